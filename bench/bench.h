@@ -0,0 +1,86 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Helpers shared by the benchmarks: timing and synthetic carriers */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+
+#define BENCH_WIDTH 4000  // Width of the synthetic carriers, the height follows the megapixels
+
+static inline double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Height of a BENCH_WIDTH wide carrier of about `megapixels` pixels */
+static inline uint32_t bench_height(double megapixels) {
+    uint32_t height = (uint32_t) (megapixels * 1e6 / BENCH_WIDTH);
+    return height ? height : 1;
+}
+
+/* Fill size bytes with a xorshift sequence, the same for every run */
+static inline void fill_random(uint8_t *data, size_t size) {
+    uint32_t seed = 0x9e3779b9;
+    for (size_t i = 0; i < size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        data[i] = (uint8_t) seed;
+    }
+}
+
+/* A width x height 24-bit carrier in memory filled with pseudo random pixels, NULL on failure */
+static inline BMP_FILE *new_synthetic(uint32_t width, uint32_t height) {
+    BMP_FILE *bmp = calloc(1, sizeof(BMP_FILE));
+    if (!bmp)
+        return NULL;
+    bmp->fileHeader.bfType      = BF_TYPE;
+    bmp->fileHeader.bfOffBits   = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    bmp->infoHeader.biSize      = sizeof(BITMAPINFOHEADER);
+    bmp->infoHeader.biWidth     = width;
+    bmp->infoHeader.biHeight    = height;
+    bmp->infoHeader.biPlanes    = 1;
+    bmp->infoHeader.biBitCount  = 24;
+    bmp->stride                 = BMP_ROW_SIZE(width, 3);
+    bmp->pixelSize              = 3;
+    bmp->channels               = 3;
+    bmp->rowsLoaded             = height;
+    bmp->infoHeader.biSizeImage = bmp->stride * height;
+    bmp->fileHeader.bfSize      = bmp->fileHeader.bfOffBits + bmp->infoHeader.biSizeImage;
+
+    bmp->data = malloc((size_t) bmp->stride * height);
+    if (!bmp->data) {
+        free(bmp);
+        return NULL;
+    }
+    fill_random(bmp->data, (size_t) bmp->stride * height);
+    return bmp;
+}
+
+/* Write a width x height synthetic carrier to filename */
+static inline int write_synthetic(const char *filename, uint32_t width, uint32_t height) {
+    BMP_FILE *bmp = new_synthetic(width, height);
+    if (!bmp)
+        return -1;
+    int result = write_bmp(filename, bmp);
+    free_bmp(bmp);
+    return result;
+}
+
+/* Create an empty temporary .bmp file, its name is stored in filename */
+static inline int temporary_carrier(char filename[32]) {
+    strcpy(filename, "/tmp/stegobmp_bench_XXXXXX.bmp");
+    int fd = mkstemps(filename, 4);
+    if (fd < 0) {
+        printerr("Could not create temporary carrier\n");
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @brief Compare the contiguous pixel plane of BMP_FILE against the former row-pointer layout,
+ * as JSON on stdout
+ *
+ * Usage: bench_bitmap [megapixels ...]   (default: 1 10 40)
+ *
+ * For every size a synthetic 24-bit carrier is written to a temporary file and then loaded,
+ * filled to capacity with LSB1 and freed using both layouts.
+ */
+#include "bench.h"
+#include "embedding.h"
+
+#define DEFAULT_SIZES {1, 10, 40}
+#define REPETITIONS 3
+
+/* The layout BMP_FILE used before: one allocation per row plus a table of row pointers */
+typedef struct
+{
+    BITMAPINFOHEADER infoHeader;
+    PIXEL          **pixels;
+} LEGACY_BMP;
+
+static LEGACY_BMP *legacy_read(const char *filename) {
+    FILE *filePtr = fopen(filename, "rb");
+    if (!filePtr)
+        return NULL;
+
+    BITMAPFILEHEADER fileHeader;
+    LEGACY_BMP      *bmp = malloc(sizeof(LEGACY_BMP));
+    if (!bmp || fread(&fileHeader, sizeof(fileHeader), 1, filePtr) != 1 ||
+        fread(&bmp->infoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr) != 1) {
+        free(bmp);
+        fclose(filePtr);
+        return NULL;
+    }
+
+    uint32_t width  = bmp->infoHeader.biWidth;
+    uint32_t height = bmp->infoHeader.biHeight;
+    bmp->pixels     = malloc(height * sizeof(PIXEL *));
+    fseek(filePtr, fileHeader.bfOffBits, SEEK_SET);
+    for (uint32_t i = 0; i < height; i++) {
+        bmp->pixels[i] = malloc(width * sizeof(PIXEL));
+        if (fread(bmp->pixels[i], sizeof(PIXEL), width, filePtr) != width) {
+            fclose(filePtr);
+            return NULL;
+        }
+        fseek(filePtr, (4 - (width * 3) % 4) % 4, SEEK_CUR);
+    }
+
+    fclose(filePtr);
+    return bmp;
+}
+
+/* lsb1_encode as it was written against the row-pointer table */
+static void legacy_lsb1(LEGACY_BMP *bmp, const unsigned char *data, size_t dataSize) {
+    size_t totalBits = dataSize * 8;
+    size_t dataIndex = 0;
+    int    bitIndex  = 7;
+    size_t bitCount  = 0;
+    uint32_t width  = bmp->infoHeader.biWidth;
+    uint32_t height = bmp->infoHeader.biHeight;
+    for (uint32_t i = 0; i < height && bitCount < totalBits; i++) {
+        for (uint32_t j = 0; j < width && bitCount < totalBits; j++) {
+            uint8_t *colors[3] = {
+                &bmp->pixels[i][j].blue, &bmp->pixels[i][j].green, &bmp->pixels[i][j].red};
+            for (int k = 0; k < 3 && bitCount < totalBits; k++) {
+                uint8_t bit = (data[dataIndex] >> bitIndex) & 0x01;
+                *colors[k]  = (*colors[k] & 0xFE) | bit;
+                if (bitIndex == 0) {
+                    bitIndex = 7;
+                    dataIndex++;
+                }
+                else {
+                    bitIndex--;
+                }
+                bitCount++;
+            }
+        }
+    }
+}
+
+static void legacy_free(LEGACY_BMP *bmp) {
+    for (uint32_t i = 0; i < (uint32_t) bmp->infoHeader.biHeight; i++)
+        free(bmp->pixels[i]);
+    free(bmp->pixels);
+    free(bmp);
+}
+
+static bool first_result = true;
+
+static int run(double megapixels) {
+    char filename[32];
+    if (temporary_carrier(filename) != 0)
+        return -1;
+
+    uint32_t width = BENCH_WIDTH, height = bench_height(megapixels);
+    if (write_synthetic(filename, width, height) != 0) {
+        printerr("Could not write synthetic carrier\n");
+        unlink(filename);
+        return -1;
+    }
+
+    size_t         dataSize = (size_t) width * height * 3 / 8;
+    unsigned char *data     = malloc(dataSize);
+    for (size_t i = 0; i < dataSize; i++)
+        data[i] = (unsigned char) (i * 31 + 7);
+
+    double legacy[3] = {1e30, 1e30, 1e30}, plane[3] = {1e30, 1e30, 1e30};
+    for (int r = 0; r < REPETITIONS; r++) {
+        double      t0  = now_ms();
+        LEGACY_BMP *old = legacy_read(filename);
+        double      t1  = now_ms();
+        legacy_lsb1(old, data, dataSize);
+        double t2 = now_ms();
+        legacy_free(old);
+        double t3 = now_ms();
+
+        double    t4  = now_ms();
+        BMP_FILE *bmp = read_bmp(filename);
+        double    t5  = now_ms();
+        lsb1_encode(bmp, data, dataSize);
+        double t6 = now_ms();
+        free_bmp(bmp);
+        double t7 = now_ms();
+
+        double l[3] = {t1 - t0, t2 - t1, t3 - t2}, p[3] = {t5 - t4, t6 - t5, t7 - t6};
+        for (int k = 0; k < 3; k++) {
+            legacy[k] = l[k] < legacy[k] ? l[k] : legacy[k];
+            plane[k]  = p[k] < plane[k] ? p[k] : plane[k];
+        }
+    }
+
+    const char *layouts[] = {"row-ptr", "plane"};
+    double     *times[]   = {legacy, plane};
+    for (int k = 0; k < 2; k++) {
+        printf("%s\n    {\"layout\": \"%s\", \"megapixels\": %.1f, \"load_ms\": %.2f, "
+               "\"embed_ms\": %.2f, \"free_ms\": %.3f}",
+               first_result ? "" : ",",
+               layouts[k],
+               width * (double) height / 1e6,
+               times[k][0],
+               times[k][1],
+               times[k][2]);
+        first_result = false;
+    }
+
+    free(data);
+    unlink(filename);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("{\n  \"benchmark\": \"bitmap\",\n  \"repetitions\": %d,\n  \"results\": [",
+           REPETITIONS);
+
+    int result = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc && result == 0; i++)
+            result = run(atof(argv[i]));
+    }
+    else {
+        double sizes[] = DEFAULT_SIZES;
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && result == 0; i++)
+            result = run(sizes[i]);
+    }
+
+    printf("\n  ]\n}\n");
+    return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+/**
+ * @brief Throughput of every stage of stegobmp, as JSON on stdout
+ *
+ * Usage: bench_stego [megapixels ...]   (default: 1 10 50 200)
+ *
+ * For every size a synthetic 24-bit carrier is written to a temporary file, then read_bmp, the
+ * LSB1, LSB4 and LSBI encoders and decoders (filled to capacity), write_bmp, analyze_bmp
+ * (chi-square, RS and SPA steganalysis) and compare_bmp (MSE, PSNR and SSIM against the mapped
+ * file) are timed. Every cipher and mode of cipher_map is timed once on a CIPHER_BYTES buffer,
+ * with the key already derived. Each figure is the best of REPETITIONS runs, on a single thread.
+ * The authenticated modes are also checked to embed the same message differently every time.
+ *
+ * Every result gives the bytes processed (the payload for the LSB methods and the ciphers, the
+ * file for read_bmp and write_bmp), MB/s (10^6 bytes) and ns per bit of those bytes.
+ */
+#include "bench.h"
+#include "embedding.h"
+#include "extraction.h"
+#include "lsb_kernels.h"
+#include "quality.h"
+#include "steganalysis.h"
+
+#define DEFAULT_SIZES {1, 10, 50, 200}
+#define REPETITIONS 3
+#define CIPHER_BYTES (4 * 1024 * 1024)  // Plaintext encrypted and decrypted by every cipher
+#define BENCH_PASSWORD "stegobmp-bench"
+#define NONCE_CHECK_BYTES 4096  // Message embedded twice by the authenticated modes
+
+typedef int (*encoder)(BMP_FILE *bmp, const unsigned char *data, size_t dataSize);
+
+static const struct
+{
+    steg    method;
+    encoder encode;
+} methods[] = {{LSB1, lsb1_encode}, {LSB4, lsb4_encode}, {LSBI, lsbi_encode}};
+
+static bool first_result = true;
+
+/* Print one result: bytes processed in the best time of ms milliseconds */
+static void print_result(const char *stage, const char *extra, size_t bytes, double ms) {
+    double seconds = ms / 1e3;
+    printf("%s\n    {\"stage\": \"%s\"%s, \"bytes\": %zu, \"ms\": %.3f, \"mb_per_s\": %.2f, "
+           "\"ns_per_bit\": %.4f}",
+           first_result ? "" : ",",
+           stage,
+           extra,
+           bytes,
+           ms,
+           seconds > 0 ? bytes / seconds / 1e6 : 0,
+           bytes ? seconds * 1e9 / (bytes * 8.0) : 0);
+    first_result = false;
+}
+
+static double min_ms(double a, double b) {
+    return a < b ? a : b;
+}
+
+/*
+ * Payload filling the capacity of a method: a size prefix announcing the rest, so that the
+ * decoders read all of it back
+ */
+static unsigned char *full_payload(size_t capacity) {
+    unsigned char *data = malloc(capacity);
+    if (!data)
+        return NULL;
+    fill_random(data, capacity);
+    uint32_t size = htonl((uint32_t) (capacity - sizeof(uint32_t)));
+    memcpy(data, &size, sizeof(size));
+    return data;
+}
+
+/* Read back the whole payload (size prefix included) as extract does, NULL on failure */
+static unsigned char *read_back(BMP_FILE *bmp, steg method) {
+    lsb_reader reader;
+    size_t     dataSize;
+    if (steg_reader(bmp, method, &reader) != 0 || decode_size(bmp, &reader, &dataSize) != 0 ||
+        bmp_load_channels(bmp, reader.channels(sizeof(uint32_t) + dataSize)) != 0)
+        return NULL;
+
+    unsigned char *data = malloc(sizeof(uint32_t) + dataSize);
+    if (data)
+        read_payload(&reader, bmp, 0, data, sizeof(uint32_t) + dataSize);
+    return data;
+}
+
+/* Time an encoder and its decoder on a carrier read from filename */
+static int run_method(const char *filename, size_t index, const char *extra) {
+    BMP_FILE *bmp = read_bmp(filename);
+    if (!bmp)
+        return -1;
+    size_t capacity = embedding_capacity(bmp, methods[index].method);
+    if (capacity > UINT32_MAX)
+        capacity = UINT32_MAX;
+    unsigned char *data = capacity > sizeof(uint32_t) ? full_payload(capacity) : NULL;
+    if (!data) {
+        free_bmp(bmp);
+        return -1;
+    }
+
+    double encode = 1e30, decode = 1e30;
+    int    result = 0;
+    for (int r = 0; r < REPETITIONS && result == 0; r++) {
+        double t0 = now_ms();
+        result    = methods[index].encode(bmp, data, capacity);
+        double t1 = now_ms();
+
+        unsigned char *decoded = result == 0 ? read_back(bmp, methods[index].method) : NULL;
+        double         t2      = now_ms();
+        if (!decoded || memcmp(decoded, data, capacity) != 0) {
+            printerr("%s payload read back does not match\n", steg_str[methods[index].method]);
+            result = -1;
+        }
+        free(decoded);
+        encode = min_ms(encode, t1 - t0);
+        decode = min_ms(decode, t2 - t1);
+    }
+
+    if (result == 0) {
+        char stage[32];
+        snprintf(stage, sizeof(stage), "%s_encode", steg_str[methods[index].method]);
+        print_result(stage, extra, capacity, encode);
+        snprintf(stage, sizeof(stage), "%s_decode", steg_str[methods[index].method]);
+        print_result(stage, extra, capacity, decode);
+    }
+    free(data);
+    free_bmp(bmp);
+    return result;
+}
+
+/* Time read_bmp, the LSB methods and write_bmp on a carrier of about `megapixels` pixels */
+static int run_carrier(double megapixels) {
+    char filename[32];
+    if (temporary_carrier(filename) != 0)
+        return -1;
+
+    uint32_t width = BENCH_WIDTH, height = bench_height(megapixels);
+    if (write_synthetic(filename, width, height) != 0) {
+        printerr("Could not write synthetic carrier\n");
+        unlink(filename);
+        return -1;
+    }
+
+    char extra[96];
+    snprintf(extra,
+             sizeof(extra),
+             ", \"megapixels\": %.1f, \"width\": %u, \"height\": %u",
+             width * (double) height / 1e6,
+             width,
+             height);
+
+    // The file was just written, reads come from the page cache
+    double    readMs = 1e30, writeMs = 1e30;
+    BMP_FILE *bmp    = NULL;
+    for (int r = 0; r < REPETITIONS; r++) {
+        if (bmp)
+            free_bmp(bmp);
+        double t0 = now_ms();
+        bmp       = read_bmp(filename);
+        readMs    = min_ms(readMs, now_ms() - t0);
+        if (!bmp) {
+            unlink(filename);
+            return -1;
+        }
+    }
+    size_t         fileSize  = bmp->fileHeader.bfSize;
+    double         analyzeMs = 1e30;
+    image_analysis analysis;
+    for (int r = 0; r < REPETITIONS; r++) {
+        double t0 = now_ms();
+        int    analyzed = analyze_bmp(bmp, &analysis);
+        analyzeMs       = min_ms(analyzeMs, now_ms() - t0);
+        if (analyzed != 0) {
+            free_bmp(bmp);
+            unlink(filename);
+            return -1;
+        }
+    }
+    double        compareMs = 1e30;
+    image_quality quality;
+    BMP_FILE     *mapped = map_bmp(filename, 0);
+    for (int r = 0; r < REPETITIONS; r++) {
+        double t0 = now_ms();
+        int    compared = mapped ? compare_bmp(bmp, mapped, &quality) : -1;
+        compareMs       = min_ms(compareMs, now_ms() - t0);
+        if (compared != 0) {
+            if (mapped)
+                free_bmp(mapped);
+            free_bmp(bmp);
+            unlink(filename);
+            return -1;
+        }
+    }
+    free_bmp(mapped);
+    for (int r = 0; r < REPETITIONS; r++) {
+        double t0 = now_ms();
+        int    written = write_bmp(filename, bmp);
+        writeMs        = min_ms(writeMs, now_ms() - t0);
+        if (written != 0) {
+            free_bmp(bmp);
+            unlink(filename);
+            return -1;
+        }
+    }
+    free_bmp(bmp);
+    print_result("read_bmp", extra, fileSize, readMs);
+
+    int result = 0;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(*methods) && result == 0; i++)
+        result = run_method(filename, i, extra);
+    print_result("write_bmp", extra, fileSize, writeMs);
+    print_result("analyze", extra, fileSize, analyzeMs);
+    print_result("compare", extra, 2 * fileSize, compareMs);
+
+    unlink(filename);
+    return result;
+}
+
+/*
+ * Embed the same message twice with the same password in an authenticated mode: the random nonce
+ * has to make the two payloads differ, a repeated one would give away both plaintexts
+ */
+static int check_nonce(encryption a, mode m, const unsigned char *plain) {
+    char filename[32];
+    if (temporary_carrier(filename) != 0)
+        return -1;
+
+    BMP_FILE *stego[2] = {NULL, NULL};
+    int       result   = write_synthetic(filename, BENCH_WIDTH, bench_height(0.1));
+    for (int i = 0; i < 2 && result == 0; i++) {
+        size_t dataSize;
+        stego[i] = read_bmp(filename);
+        result   = stego[i] ? embed_buffer(stego[i],
+                                         LSB1,
+                                         plain,
+                                         NONCE_CHECK_BYTES,
+                                         ".bin",
+                                         BENCH_PASSWORD,
+                                         a,
+                                         m,
+                                         &dataSize,
+                                         NULL)
+                            : -1;
+    }
+
+    image_quality quality;
+    if (result == 0 && (compare_bmp(stego[0], stego[1], &quality) != 0 || !quality.lsbChanged)) {
+        printerr("%s-%s embedded the same message twice the same way\n",
+                 encryption_str[a],
+                 mode_str[m]);
+        result = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (stego[i])
+            free_bmp(stego[i]);
+    }
+    unlink(filename);
+    return result;
+}
+
+/* Time encrypt_data and decrypt_data for one cipher and mode */
+static int run_cipher(encryption a, mode m, const unsigned char *plain) {
+    double encrypt = 1e30, decrypt = 1e30;
+    if (prederive_key(BENCH_PASSWORD, a, m) != 0 ||
+        (nonce_length(a, m) > 0 && check_nonce(a, m, plain) != 0))
+        return -1;
+
+    for (int r = 0; r < REPETITIONS; r++) {
+        size_t         encryptedSize, decryptedSize = 0;
+        unsigned char *decrypted = NULL;
+        double         t0        = now_ms();
+        unsigned char *encrypted =
+            encrypt_data(plain, CIPHER_BYTES, BENCH_PASSWORD, a, m, &encryptedSize);
+        double t1 = now_ms();
+        if (encrypted)
+            decrypted =
+                decrypt_data(encrypted, encryptedSize, BENCH_PASSWORD, a, m, &decryptedSize);
+        double t2 = now_ms();
+
+        bool ok = decrypted && decryptedSize == CIPHER_BYTES &&
+                  memcmp(decrypted, plain, CIPHER_BYTES) == 0;
+        free(encrypted);
+        free(decrypted);
+        if (!ok) {
+            printerr("%s-%s round trip failed\n", encryption_str[a], mode_str[m]);
+            return -1;
+        }
+        encrypt = min_ms(encrypt, t1 - t0);
+        decrypt = min_ms(decrypt, t2 - t1);
+    }
+
+    char extra[64];
+    snprintf(extra,
+             sizeof(extra),
+             ", \"cipher\": \"%s\", \"mode\": \"%s\"",
+             encryption_str[a],
+             mode_str[m]);
+    print_result("encrypt", extra, CIPHER_BYTES, encrypt);
+    print_result("decrypt", extra, CIPHER_BYTES, decrypt);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    printf("{\n  \"benchmark\": \"stego\",\n  \"kernels\": \"%s\",\n  \"openssl\": \"%s\",\n"
+           "  \"threads\": 1,\n  \"repetitions\": %d,\n  \"results\": [",
+           lsb_kernels_get()->name,
+           OpenSSL_version(OPENSSL_VERSION),
+           REPETITIONS);
+
+    int result = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc && result == 0; i++)
+            result = run_carrier(atof(argv[i]));
+    }
+    else {
+        double sizes[] = DEFAULT_SIZES;
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && result == 0; i++)
+            result = run_carrier(sizes[i]);
+    }
+
+    unsigned char *plain = malloc(CIPHER_BYTES);
+    if (!plain)
+        result = -1;
+    else
+        fill_random(plain, CIPHER_BYTES);
+    for (encryption a = AES128; a <= CHACHA20 && result == 0; a++) {
+        for (mode m = ECB; m <= POLY1305 && result == 0; m++) {
+            if (get_cipher(a, m))
+                result = run_cipher(a, m, plain);
+        }
+    }
+    free(plain);
+
+    printf("\n  ]\n}\n");
+    return result == 0 ? 0 : 1;
+}
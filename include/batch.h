@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "embedding.h"
+#include "extraction.h"
+#include "parse_args.h"
+
+typedef enum { JOB_EMBED, JOB_EXTRACT } job_action;
+
+static const char *job_action_str[] __attribute__((unused)) = {"embed", "extract"};
+
+/* One line of the manifest and its outcome */
+typedef struct batch_job
+{
+    size_t     line; /* Manifest line the job comes from */
+    job_action action;
+    char      *carrier;
+    char      *payload; /* Message to embed, unused when extracting */
+    char      *output;
+    char      *password; /* NULL for plain payloads */
+    steg       method;
+    encryption a;
+    mode       m;
+    bool       valid; /* The line was parsed, otherwise error says why */
+
+    /* Outcome */
+    int    status; /* 0 on success, -1 on failure */
+    char   error[PRINTERR_MAX];
+    size_t dataSize;
+    double seconds;
+} batch_job;
+
+typedef struct batch_manifest
+{
+    batch_job *jobs;
+    size_t     count;
+} batch_manifest;
+
+int  load_manifest(const char *manifestFile, batch_manifest *manifest);
+void free_manifest(batch_manifest *manifest);
+int  write_results(const char *resultsFile, const batch_manifest *manifest);
+int  batch(const char *manifestFile, const char *resultsFile, const steg_options *options);
+
+#endif
@@ -2,6 +2,7 @@
 #define BMP_ADT_H
 
 #include "misc.h"
+#include "stats.h"
 #include "std_libs.h"
 
 #pragma pack(push, 1)  // avoids padding bytes in structs in memory
@@ -12,6 +13,10 @@
 
 #define BF_TYPE 0x4D42
 
+#define BI_RGB 0             /* Uncompressed */
+#define BI_BITFIELDS 3       /* Uncompressed, channel masks follow the 40-byte info header */
+#define BI_ALPHABITFIELDS 6  /* Same, with an alpha mask */
+
 typedef struct /**** BMP file header structure ****/
 {
     uint16_t bfType;      /* Magic identifier: "BM" (fast way to check if is .bmp)*/
@@ -24,8 +29,8 @@ typedef struct /**** BMP file header structure ****/
 typedef struct /**** BMP file info structure ****/
 {
     uint32_t biSize;          /* Size of info header */
-    uint32_t biWidth;         /* Width of the image */
-    uint32_t biHeight;        /* Height of the image */
+    int32_t  biWidth;         /* Width of the image */
+    int32_t  biHeight;        /* Height of the image, negative when rows are stored top-down */
     uint16_t biPlanes;        /* Number of color planes */
     uint16_t biBitCount;      /* Bits per pixel */
     uint32_t biCompression;   /* Compression type */
@@ -47,14 +52,97 @@ typedef struct /**** BMP file ****/
 {
     BITMAPFILEHEADER fileHeader;
     BITMAPINFOHEADER infoHeader;
-    PIXEL          **pixels;
+    uint8_t         *extraHeader; /* Bytes between the info header and the plane (V4/V5 fields, */
+    size_t           extraSize;   /* channel masks, palette), written back as they were read */
+    uint8_t         *data;        /* Contiguous pixel plane, one allocation for every row */
+    size_t           stride;      /* Bytes between the start of two consecutive stored rows */
+    size_t           pixelSize;   /* Bytes per pixel: 3 (BGR) or 4 (BGRA or BGRX) */
+    size_t           channels;    /* Channels of a pixel carrying payload: B, G, R (and A) */
+    uint8_t         *map;    /* Whole file when it is memory mapped, NULL otherwise */
+    size_t           mapSize;
+    bool             borrowed;   /* data points into a buffer owned by the caller */
+    FILE            *file;       /* Open while rows are still to be loaded (see open_bmp) */
+    size_t           rowsLoaded; /* Rows of the plane that hold file data */
 } BMP_FILE;
 
+#pragma pack(pop)
+
+#define BMP_PLANE_ALIGN 64 /* Alignment of the pixel plane (one cache line) */
+
+/* Names of the channels of a pixel, in the order they are stored */
+static const char *bmp_channel_str[]
+    __attribute__((unused)) = {"blue", "green", "red", "alpha"};  // ignore unused warning
+
+/* Bytes of a stored row: pixelSize bytes per pixel rounded up to a multiple of 4 */
+#define BMP_ROW_SIZE(width, pixelSize) ((((size_t) (width)) * (pixelSize) + 3) & ~((size_t) 3))
+
+/*
+ * Pixel plane accessors. The plane keeps the rows in the order they are stored in the file, rows
+ * are numbered bottom-up whatever that order is: a top-down file is walked from its last stored
+ * row with a negative stride, so a payload always starts at the bottom row of the image.
+ */
+static inline size_t bmp_width(const BMP_FILE *bmp) {
+    return (size_t) bmp->infoHeader.biWidth;
+}
+
+static inline size_t bmp_height(const BMP_FILE *bmp) {
+    int64_t height = bmp->infoHeader.biHeight;
+    return (size_t) (height < 0 ? -height : height);
+}
+
+static inline bool bmp_top_down(const BMP_FILE *bmp) {
+    return bmp->infoHeader.biHeight < 0;
+}
+
+/* Bytes from a row to the row above it, negative for top-down files */
+static inline ptrdiff_t bmp_stride(const BMP_FILE *bmp) {
+    return bmp_top_down(bmp) ? -(ptrdiff_t) bmp->stride : (ptrdiff_t) bmp->stride;
+}
+
+static inline uint8_t *bmp_row(const BMP_FILE *bmp, size_t row) {
+    uint8_t *bottom = bmp_top_down(bmp) ? bmp->data + (bmp_height(bmp) - 1) * bmp->stride
+                                        : bmp->data;
+    return bottom + (ptrdiff_t) row * bmp_stride(bmp);
+}
+
+static inline uint8_t *bmp_pixel(const BMP_FILE *bmp, size_t row, size_t col) {
+    return bmp_row(bmp, row) + col * bmp->pixelSize;
+}
+
+/* Channels carrying payload in a row, and in the whole image */
+static inline size_t bmp_row_channels(const BMP_FILE *bmp) {
+    return bmp_width(bmp) * bmp->channels;
+}
+
+static inline size_t bmp_channels(const BMP_FILE *bmp) {
+    return bmp_row_channels(bmp) * bmp_height(bmp);
+}
+
+/* Run of contiguous channels [k, end) given to bmp_visit_channels callbacks */
+typedef void (*bmp_run_fn)(uint8_t *run, size_t k, size_t end, void *context);
+
 /* Function prototypes */
+BMP_FILE *open_bmp(const char *filename);
+BMP_FILE *open_bmp_stream(FILE *filePtr);
+int       bmp_load_rows(BMP_FILE *bmp, size_t rows);
 BMP_FILE *read_bmp(const char *filename);
 int       write_bmp(const char *filename, BMP_FILE *bmp);
+int       bmp_writev(int fd, BMP_FILE *bmp);
+int       bmp_parse_headers(const uint8_t *buffer, size_t size, size_t fileSize, BMP_FILE *bmp);
+int       bmp_read_headers(const char *filename, BMP_FILE *bmp);
+BMP_FILE *bmp_parse_from_memory(const uint8_t *buffer, size_t size, bool borrow);
+int       bmp_serialize_to_memory(BMP_FILE *bmp, uint8_t **buffer, size_t *size);
 void      free_bmp(BMP_FILE *bmp);
-
-#pragma pack(pop)
+BMP_FILE *map_bmp(const char *filename, int writable);
+void      bmp_use_alpha(BMP_FILE *bmp, bool alpha);
+void      bmp_visit_channels(const BMP_FILE *bmp,
+                             size_t          row,
+                             size_t          k,
+                             size_t          end,
+                             bool            store,
+                             bmp_run_fn      fn,
+                             void           *context);
+BMP_FILE *map_bmp_into(const char *carrierFile, const char *filename);
+char     *bmp_output_filename(const char *filename);
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef CAPACITY_H
+#define CAPACITY_H
+
+#include "embedding.h"
+
+#define CAPACITY_METHODS 3 /* LSB1, LSB4 and LSBI */
+#define CAPACITY_CIPHERS 5 /* AES128 to ChaCha20 */
+#define CAPACITY_MODES 6   /* ECB to Poly1305 */
+
+/* What a carrier can hold, known from its headers alone. Arrays are indexed by enum value - 1 */
+typedef struct carrier_capacity
+{
+    uint32_t width;
+    uint32_t height;
+    size_t   payload[CAPACITY_METHODS]; /* Payload bytes, size prefix included */
+    size_t   plain[CAPACITY_METHODS];   /* Room for a message and its extension, null included */
+    size_t   encrypted[CAPACITY_METHODS][CAPACITY_CIPHERS][CAPACITY_MODES]; /* 0 if unsupported */
+} carrier_capacity;
+
+bool is_carrier_name(const char *name);
+int  list_carrier_files(const char *path, char ***paths, size_t *count);
+void free_carrier_files(char **paths, size_t count);
+void carrier_capacity_of(const BMP_FILE *bmp, carrier_capacity *capacity);
+int  read_carrier_capacity(const char *filename, carrier_capacity *capacity);
+int  capacity(const char *path, const char *resultsFile, const steg_options *options);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CARRIER_INDEX_H
+#define CARRIER_INDEX_H
+
+#include <openssl/sha.h>
+
+#include "capacity.h"
+
+/* One carrier of the index */
+typedef struct carrier_entry
+{
+    char         *path;
+    uint64_t      size;  /* File size and modification time (ns) when indexed, a carrier whose */
+    int64_t       mtime; /* file no longer matches them is not used */
+    uint32_t      width;
+    uint32_t      height;
+    uint64_t      capacity[CAPACITY_METHODS]; /* Payload bytes per method, see embedding_capacity */
+    unsigned char hash[SHA256_DIGEST_LENGTH]; /* SHA-256 of the file */
+} carrier_entry;
+
+typedef struct carrier_index
+{
+    carrier_entry *entries; /* Sorted by path */
+    size_t         count;
+} carrier_index;
+
+/* Hands out the smallest unused carrier that fits a payload, each carrier at most once */
+typedef struct carrier_picker
+{
+    const carrier_index *index;
+    steg                 method;
+    size_t              *order; /* Entries by increasing capacity for the method */
+    size_t              *next;  /* Smallest unused position of order at or after each position */
+} carrier_picker;
+
+int  carrier_index_load(const char *indexFile, carrier_index *index);
+int  carrier_index_save(const char *indexFile, const carrier_index *index);
+void carrier_index_free(carrier_index *index);
+int  carrier_index_build(const char         *directory,
+                         const char         *indexFile,
+                         const steg_options *options);
+
+int                  carrier_picker_init(carrier_picker      *picker,
+                                         const carrier_index *index,
+                                         steg                 method);
+const carrier_entry *carrier_pick(carrier_picker *picker, size_t dataSize);
+void                 carrier_picker_free(carrier_picker *picker);
+
+char *auto_carrier(const char *indexFile,
+                   const char *messageFile,
+                   steg        method,
+                   const char *pass,
+                   encryption  a,
+                   mode        m);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CRACK_H
+#define CRACK_H
+
+#include "extraction.h"
+
+/* Outcome of a dictionary attack */
+typedef struct crack_result
+{
+    bool       found;
+    char      *password; /* Password found, to be released with free() */
+    steg       method;
+    encryption a;
+    mode       m;
+    size_t     dataSize;   /* Size of the hidden file */
+    uint64_t   tried;      /* Combinations of password, method, algorithm and mode tried */
+    uint64_t   decrypted;  /* Combinations that passed the first block and were decrypted */
+    double     ms;         /* Time spent trying passwords */
+} crack_result;
+
+int  crack_file(const char         *carrierFile,
+                const char         *wordlist,
+                steg                method,
+                encryption          a,
+                mode                m,
+                const char         *outputFile,
+                const steg_options *options,
+                crack_result       *result);
+void crack(const char         *carrierFile,
+           const char         *wordlist,
+           steg                method,
+           encryption          a,
+           mode                m,
+           const char         *outputFile,
+           const steg_options *options);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef DETECT_H
+#define DETECT_H
+
+#include "extraction.h"
+
+#define DETECT_METHODS 3 /* LSB1, LSB4 and LSBI */
+
+/* How plausible a payload hidden with one steganography method is */
+typedef struct detect_candidate
+{
+    steg   method;
+    int    score;     /* 0 (no payload) to 100 */
+    bool   fits;      /* The size prefix leaves the payload within the capacity */
+    bool   plain;     /* A valid extension follows the data: the payload is not encrypted */
+    size_t size;      /* Size read from the prefix */
+    size_t block;     /* Largest cipher block size (16 or 8) dividing the size, 1 for none */
+    char   extension[EXTENSION_MAX];
+} detect_candidate;
+
+int  detect_file(const char         *carrierFile,
+                 const steg_options *options,
+                 detect_candidate    candidates[DETECT_METHODS]);
+void detect(const char *carrierFile, const steg_options *options);
+
+#endif
@@ -2,19 +2,94 @@
 #define EMBEDDING_H
 
 #include "steganography.h"
+#include "thread_pool.h"
 
-void embed(const char *carrierFile,
-           const char *messageFile,
-           const char *outputFile,
-           steg        method,
-           encryption  a,
-           mode        m,
-           const char *pass);
+void embed(const char         *carrierFile,
+           const char         *messageFile,
+           const char         *outputFile,
+           steg                method,
+           encryption          a,
+           mode                m,
+           const char         *pass,
+           const steg_options *options);
+
+/* Outcome of the LSBI pattern analysis */
+typedef struct lsbi_report
+{
+    uint8_t  inversionMap;   /* Bit 3 - p set when pattern p is inverted */
+    uint64_t changes;        /* Channel LSBs changed by the payload */
+    uint64_t changesAvoided; /* Channel LSB changes saved by the inversion */
+} lsbi_report;
+
+int embed_file(const char         *carrierFile,
+               const char         *messageFile,
+               const char         *outputFile,
+               steg                method,
+               encryption          a,
+               mode                m,
+               const char         *pass,
+               const steg_options *options,
+               size_t             *dataSize,
+               lsbi_report        *report);
 
 int lsb1_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize);
 int lsb4_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize);
 int lsbi_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize);
 
+int    lsbi_encode_report(BMP_FILE            *bmp,
+                          const unsigned char *data,
+                          size_t               dataSize,
+                          lsbi_report         *report);
+void   lsbi_histogram(BMP_FILE            *bmp,
+                      size_t               offset,
+                      const unsigned char *src,
+                      size_t               count,
+                      uint64_t             changes[4],
+                      uint64_t             totals[4]);
+uint8_t lsbi_choose_map(const uint64_t changes[4], const uint64_t totals[4], lsbi_report *report);
+void    lsbi_store_map(BMP_FILE *bmp, uint8_t map);
+void    lsbi_write(
+       BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count, uint8_t map);
+void    lsbi_invert(BMP_FILE *bmp, size_t count, uint8_t map);
+size_t  lsbi_capacity(const BMP_FILE *bmp);
+
+/* Stores count payload bytes starting at payload byte offset */
+typedef void (*lsb_writer)(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count);
+
+void lsb1_write(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count);
+void lsb4_write(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count);
+void write_payload(BMP_FILE            *bmp,
+                   size_t               offset,
+                   const unsigned char *data,
+                   size_t               dataSize,
+                   lsb_writer           write,
+                   size_t               channelsPerByte);
+
+size_t embedding_capacity(const BMP_FILE *bmp, steg method);
+size_t payload_size(
+    size_t messageSize, const char *extension, const char *pass, encryption a, mode m);
+size_t payload_room(size_t capacity, bool encrypted, encryption a, mode m);
+int    message_payload_size(
+       const char *messageFile, const char *pass, encryption a, mode m, size_t *dataSize);
+int    embed_message(BMP_FILE    *bmp,
+                     steg         method,
+                     const char  *messageFile,
+                     const char  *pass,
+                     encryption   a,
+                     mode         m,
+                     size_t      *dataSize,
+                     lsbi_report *report);
+int    embed_buffer(BMP_FILE            *bmp,
+                    steg                 method,
+                    const unsigned char *message,
+                    size_t               messageSize,
+                    const char          *extension,
+                    const char          *pass,
+                    encryption           a,
+                    mode                 m,
+                    size_t              *dataSize,
+                    lsbi_report         *report);
+
 unsigned char *prepare_embedding_data(
     const char *messageFile, size_t *totalDataSize, const char *pass, encryption a, mode m);
 
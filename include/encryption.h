@@ -4,16 +4,22 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+#include "key_cache.h"
 #include "misc.h"
+#include "stats.h"
 #include "std_libs.h"
 
-typedef enum { ENC_NONE, AES128, AES192, AES256, DES3 } encryption;
-typedef enum { MODE_NONE, ECB, CBC, CFB, OFB } mode;
+#define AEAD_NONCE_LENGTH 12  // Random nonce stored before GCM and ChaCha20-Poly1305 ciphertexts
+#define AEAD_TAG_LENGTH 16    // Authentication tag stored after them
+
+typedef enum { ENC_NONE, AES128, AES192, AES256, DES3, CHACHA20 } encryption;
+typedef enum { MODE_NONE, ECB, CBC, CFB, OFB, GCM, POLY1305 } mode;
 
 static const char* encryption_str[]
-    __attribute__((unused)) = {"None", "AES128", "AES192", "AES256", "3DES"};
+    __attribute__((unused)) = {"None", "AES128", "AES192", "AES256", "3DES", "ChaCha20"};
 
-static const char* mode_str[] __attribute__((unused)) = {"None", "ECB", "CBC", "CFB", "OFB"};
+static const char* mode_str[]
+    __attribute__((unused)) = {"None", "ECB", "CBC", "CFB", "OFB", "GCM", "Poly1305"};
 
 unsigned char* encrypt_data(const unsigned char* plaintext,
                             size_t               plaintext_len,
@@ -27,5 +33,18 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
                             encryption           a,
                             mode                 m,
                             size_t*              decrypted_len);
+EVP_CIPHER_CTX*   cipher_stream_new(const char* pass, encryption a, mode m, int encrypt);
+size_t            encrypted_length(size_t plaintext_len, encryption a, mode m);
+size_t            tag_length(encryption a, mode m);
+size_t            nonce_length(encryption a, mode m);
+int               cipher_stream_new_nonce(EVP_CIPHER_CTX* ctx, unsigned char* nonce);
+int               cipher_stream_set_nonce(EVP_CIPHER_CTX* ctx, const unsigned char* nonce);
+int               cipher_stream_get_tag(EVP_CIPHER_CTX* ctx, unsigned char* tag);
+int               cipher_stream_set_tag(EVP_CIPHER_CTX* ctx, const unsigned char* tag);
+encryption        default_encryption(mode m);
+mode              default_mode(encryption a);
+int               prederive_key(const char* pass, encryption a, mode m);
+const EVP_CIPHER* get_cipher(encryption a, mode m);
+int               derive_key_material(const char* pass, unsigned char* keyIv, size_t length);
 
 #endif
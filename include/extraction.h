@@ -2,25 +2,67 @@
 #define EXTRACTION_H
 
 #include "steganography.h"
+#include "thread_pool.h"
+
+#define EXTENSION_MAX 256  // Longest extension accepted, null terminator included
 
 /* Public function that needs to be accessed by main.c */
-void extract(const char *carrierFile,
-             const char *outputFile,
-             steg        method,
-             encryption  a,
-             mode        m,
-             const char *pass);
+void extract(const char         *carrierFile,
+             const char         *outputFile,
+             steg                method,
+             encryption          a,
+             mode                m,
+             const char         *pass,
+             const steg_options *options);
+int  extract_file(const char         *carrierFile,
+                  const char         *outputFile,
+                  steg                method,
+                  encryption          a,
+                  mode                m,
+                  const char         *pass,
+                  const steg_options *options,
+                  size_t             *dataSize);
 
-/* Function used internally by extract.c */
-unsigned char *lsb1_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted);
-unsigned char *lsb4_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted);
-unsigned char *lsbi_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted);
+/* Where a steganography method keeps the payload bits, used by read_payload */
+typedef struct lsb_reader
+{
+    size_t maxDataBytes;              /* Largest payload (size prefix included) accepted */
+    size_t (*channels)(size_t bytes); /* Color channels spanned by the first `bytes` bytes */
+    void (*read)(const struct lsb_reader *reader,
+                 const BMP_FILE          *bmp,
+                 size_t                   offset,
+                 unsigned char           *dst,
+                 size_t                   count); /* Decode payload bytes [offset, offset+count) */
+    uint8_t inversionMap;                         /* LSBI pattern inversion map */
+} lsb_reader;
 
-/* Process extracted data (used internally by extract.c) */
-int process_extracted_data(const unsigned char *dataBuffer,
-                           const char          *outputFilePath,
-                           const char          *pass,
-                           encryption           a,
-                           mode                 m);
+/* Function used internally by extract.c */
+int            lsb1_reader(BMP_FILE *bmp, lsb_reader *reader);
+int            lsb4_reader(BMP_FILE *bmp, lsb_reader *reader);
+int            lsbi_reader(BMP_FILE *bmp, lsb_reader *reader);
+int            steg_reader(BMP_FILE *bmp, steg method, lsb_reader *reader);
+int            bmp_load_channels(BMP_FILE *bmp, size_t channels);
+int            decode_size(BMP_FILE *bmp, const lsb_reader *reader, size_t *dataSize);
+void           read_payload(const lsb_reader *reader,
+                            const BMP_FILE   *bmp,
+                            size_t            offset,
+                            unsigned char    *dst,
+                            size_t            count);
+int            extract_payload(BMP_FILE         *bmp,
+                               const lsb_reader *reader,
+                               const char       *outputFile,
+                               const char       *pass,
+                               encryption        a,
+                               mode              m,
+                               size_t           *dataSize);
+int            extract_payload_memory(BMP_FILE         *bmp,
+                                      const lsb_reader *reader,
+                                      size_t            dataSize,
+                                      const char       *pass,
+                                      encryption        a,
+                                      mode              m,
+                                      unsigned char   **data,
+                                      size_t           *size,
+                                      char              extension[EXTENSION_MAX]);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef KEY_CACHE_H
+#define KEY_CACHE_H
+
+#include <openssl/evp.h>
+
+#include "misc.h"
+#include "std_libs.h"
+
+#define PBKDF2_ITERATIONS 10000  // PBKDF2-HMAC-SHA256 rounds
+#define PBKDF2_SALT_LENGTH 8     // The salt is all zeros
+
+int key_cache_derive(const char          *pass,
+                     const EVP_CIPHER    *cipher,
+                     const unsigned char *salt,
+                     uint32_t             iterations,
+                     unsigned char       *keyIv,
+                     size_t               length);
+
+int      key_cache_open(const char *path);
+int      key_cache_save(void);
+void     key_cache_clear(void);
+uint64_t key_cache_avoided(void);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef LSB_KERNELS_H
+#define LSB_KERNELS_H
+
+#include "std_libs.h"
+
+/*
+ * Kernels working on a contiguous run of color channels (one row of the pixel plane, or part of
+ * it). Payload bits are stored MSB first: the first channel of a run holds bit 7 (LSB1) or the
+ * high nibble (LSB4) of the first byte. The steganalysis and image quality kernels take the
+ * values of one color instead, split out of the rows. The best implementation for the running
+ * CPU is picked once by lsb_kernels_get().
+ */
+typedef struct lsb_kernels
+{
+    const char *name;
+
+    /* Store `bytes` payload bytes in the LSBs of the 8 * bytes channels at chan */
+    void (*lsb1_embed)(uint8_t *chan, const uint8_t *src, size_t bytes);
+    /* Gather the LSBs of the 8 * bytes channels at chan into `bytes` payload bytes */
+    void (*lsb1_extract)(const uint8_t *chan, uint8_t *dst, size_t bytes);
+    /* Store `bytes` payload bytes in the low nibbles of the 2 * bytes channels at chan */
+    void (*lsb4_embed)(uint8_t *chan, const uint8_t *src, size_t bytes);
+    /* Pack the low nibbles of the 2 * bytes channels at chan into `bytes` payload bytes */
+    void (*lsb4_extract)(const uint8_t *chan, uint8_t *dst, size_t bytes);
+    /*
+     * LSBI histogram over `pixels` consecutive pixels whose blue and green channels receive the
+     * payload bits `bit`, `bit + 1`, ... of data (dataBits bits long). For every pattern (bits
+     * 1-2 of the channel) counts the channels in totals and the ones whose LSB would change in
+     * changes.
+     */
+    void (*lsbi_histogram)(const uint8_t *chan,
+                           size_t         pixels,
+                           const uint8_t *data,
+                           size_t         bit,
+                           size_t         dataBits,
+                           uint64_t       changes[4],
+                           uint64_t       totals[4]);
+    /*
+     * Sample pair classes of the count - 1 neighbours (values[i], values[i + 1]): pairs[0] counts
+     * X (the second value is even and the larger one, or odd and the smaller one), pairs[1] counts
+     * Y (the other pairs of different values) and pairs[2] the pairs equal but for the LSB.
+     */
+    void (*sample_pairs)(const uint8_t *values, size_t count, uint64_t pairs[3]);
+    /*
+     * RS classes of `groups` groups of 4 consecutive values, flipped with the mask M = (0 1 1 0)
+     * and its negative -M. counts[0..3] are R_M, S_M, R_-M and S_-M of the values as they are,
+     * counts[4..7] the same with every LSB flipped.
+     */
+    void (*rs_groups)(const uint8_t *values, size_t groups, uint64_t counts[8]);
+    /*
+     * Differences between the count values of a and of b: error[0] gets the sum of their squared
+     * differences and error[1] the number of values whose LSB differs.
+     */
+    void (*squared_error)(const uint8_t *a, const uint8_t *b, size_t count, uint64_t error[2]);
+    /*
+     * SSIM sums of `blocks` spans of 4 values: sums[0][i], sums[1][i], sums[2][i] and sums[3][i]
+     * get the sums of a, of b, of a^2 + b^2 and of a * b over values 4i to 4i + 3. Added to, so
+     * that 4 rows give the sums of 4x4 blocks.
+     */
+    void (*ssim_sums)(const uint8_t *a, const uint8_t *b, size_t blocks, uint32_t *sums[4]);
+} lsb_kernels;
+
+const lsb_kernels *lsb_kernels_get(void);
+
+/* Portable versions, also used by the vector implementations for the tails of a run */
+void lsb1_embed_scalar(uint8_t *chan, const uint8_t *src, size_t bytes);
+void lsb1_extract_scalar(const uint8_t *chan, uint8_t *dst, size_t bytes);
+void lsb4_embed_scalar(uint8_t *chan, const uint8_t *src, size_t bytes);
+void lsb4_extract_scalar(const uint8_t *chan, uint8_t *dst, size_t bytes);
+void lsbi_histogram_scalar(const uint8_t *chan,
+                           size_t         pixels,
+                           const uint8_t *data,
+                           size_t         bit,
+                           size_t         dataBits,
+                           uint64_t       changes[4],
+                           uint64_t       totals[4]);
+void sample_pairs_scalar(const uint8_t *values, size_t count, uint64_t pairs[3]);
+void rs_groups_scalar(const uint8_t *values, size_t groups, uint64_t counts[8]);
+void squared_error_scalar(const uint8_t *a, const uint8_t *b, size_t count, uint64_t error[2]);
+void ssim_sums_scalar(const uint8_t *a, const uint8_t *b, size_t blocks, uint32_t *sums[4]);
+
+/* Reverse the bit order inside every byte of a word */
+static inline uint64_t reverse_byte_bits(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    return ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+}
+
+/* Payload bits [bit, bit + 32) of data, bit j of the result is payload bit bit + j */
+static inline uint32_t load_payload_bits(const uint8_t *data, size_t bit) {
+    uint64_t word;
+    memcpy(&word, data + bit / 8, sizeof(word));
+    word = __builtin_bswap64(word) << (bit % 8);  // MSB first stream, first bit at bit 63
+    return __builtin_bswap32((uint32_t) reverse_byte_bits(word >> 32));
+}
+
+/* Implementations, lsb_kernels_get() chooses among them */
+extern const lsb_kernels lsb_kernels_scalar;
+extern const lsb_kernels lsb_kernels_bmi2;
+extern const lsb_kernels lsb_kernels_sse2;
+extern const lsb_kernels lsb_kernels_avx2;
+extern const lsb_kernels lsb_kernels_avx512;
+
+#endif
@@ -3,7 +3,13 @@
 
 #include "std_libs.h"
 
-void print_table(const char *header, int color, const char *firstAttribute, ...);
-void printerr(const char *format, ...);
+#define PRINTERR_MAX 256  // Longest error kept by printerr_first
+
+void        print_table(const char *header, int color, const char *firstAttribute, ...);
+void        print_json_string(FILE *out, const char *s);
+void        printerr(const char *format, ...);
+const char *printerr_first(void);
+void        printerr_reset(void);
+bool        printerr_quiet(bool quiet);
 
 #endif
\ No newline at end of file
@@ -8,21 +8,45 @@
 #include "std_libs.h"
 #include "steganography.h"
 
-typedef enum { NONE, EMBED, EXTRACT } action;
+typedef enum {
+    NONE,
+    EMBED,
+    EXTRACT,
+    BATCH,
+    SERVE,
+    CAPACITY,
+    INDEX,
+    CRACK,
+    DETECT,
+    ANALYZE,
+    COMPARE
+} action;
 
 typedef struct args
 {
-    action      action;
-    const char *in;
-    const char *p;
-    const char *out;
-    steg        steg;
-    encryption  a;
-    mode        m;
-    const char *pass;
+    action       action;
+    const char  *in;
+    const char  *p;
+    const char  *out;
+    steg         steg;
+    encryption   a;
+    mode         m;
+    const char  *pass;
+    const char  *manifest;
+    const char  *results;
+    const char  *socket;   /* Socket served by --serve, or of the daemon used by --connect */
+    const char  *stats;    /* File receiving the --stats summary, "-" for stdout */
+    const char  *wordlist; /* Passwords tried by --crack, one per line */
+    const char  *stego;    /* Image compared by --compare with its cover (p) */
+    bool         autoCarrier; /* Pick the carrier from options.carrierIndex */
+    bool         stripe;      /* p (and out when embedding) are comma separated lists */
+    steg_options options;
 } args;
 
 void parse_args(const int argc, const char *argv[], args *args);
+int  parse_steg(const char *name, steg *method);
+int  parse_encryption(const char *name, encryption *a);
+int  parse_mode(const char *name, mode *m);
 void print_help();
 
 #endif
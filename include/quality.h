@@ -0,0 +1,40 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include "steganography.h"
+
+#define QUALITY_CHANNELS 4    /* Blue, green, red and alpha */
+#define QUALITY_PSNR_MAX 100. /* PSNR given to identical channels, whose MSE is 0 */
+
+/* Distortion of one color channel of a stego image against its cover */
+typedef struct channel_quality
+{
+    double   mse;        /* Mean squared error */
+    double   psnr;       /* Peak signal to noise ratio in dB */
+    double   ssim;       /* Mean structural similarity of the 8x8 windows, 1 for equal channels */
+    uint64_t lsbChanged; /* Values whose LSB differs */
+} channel_quality;
+
+typedef struct image_quality
+{
+    uint32_t        width;
+    uint32_t        height;
+    size_t          channels; /* 3, or 4 when the alpha channel of 32-bit images is compared */
+    channel_quality channel[QUALITY_CHANNELS];
+    double          mse;        /* Over every value of the compared channels */
+    double          psnr;       /* From mse */
+    double          ssim;       /* Mean SSIM of the channels */
+    uint64_t        lsbChanged; /* Sum over the channels */
+} image_quality;
+
+int compare_bmp(const BMP_FILE *cover, const BMP_FILE *stego, image_quality *quality);
+int compare_files(const char    *coverFile,
+                  const char    *stegoFile,
+                  bool           alpha,
+                  image_quality *quality);
+int compare(const char         *coverFile,
+            const char         *stegoFile,
+            const char         *resultsFile,
+            const steg_options *options);
+
+#endif
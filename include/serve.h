@@ -0,0 +1,65 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "steganography.h"
+#include "stegobmp.h"
+#include "thread_pool.h"
+
+/*
+ * Protocol of stegobmp --serve, over a Unix stream socket, in host byte order. A connection may
+ * carry any number of requests, each answered before the next one is read:
+ *
+ *   request:  serve_request | password | extension | carrier | payload
+ *   response: serve_response | extension | error | data
+ *
+ * The carrier, the payload and the output may be passed as file descriptors (SCM_RIGHTS) sent
+ * with the first byte of the request, in that order, for the SERVE_FD_* flags set; their inline
+ * sizes are then 0. Input descriptors must be regular files, they are read in full when the
+ * request arrives. With an output descriptor the result (stego BMP or extracted payload) is
+ * written to it instead of following the response.
+ */
+#define SERVE_REQUEST_MAGIC 0x51524253   // "SBRQ"
+#define SERVE_RESPONSE_MAGIC 0x53524253  // "SBRS"
+#define SERVE_PASSWORD_MAX 1024          // Longest password accepted
+#define SERVE_FD_CARRIER 0x1
+#define SERVE_FD_PAYLOAD 0x2
+#define SERVE_FD_OUTPUT 0x4
+
+typedef enum { SERVE_EMBED = 1, SERVE_EXTRACT } serve_action;
+
+typedef struct serve_request
+{
+    uint32_t magic;           /* SERVE_REQUEST_MAGIC */
+    uint8_t  action;          /* serve_action */
+    uint8_t  method;          /* stegobmp_method */
+    uint8_t  cipher;          /* stegobmp_cipher */
+    uint8_t  mode;            /* stegobmp_mode */
+    uint32_t flags;           /* SERVE_FD_* */
+    uint32_t passLength;      /* 0 for plain payloads */
+    uint32_t extensionLength; /* Extension of the embedded payload, 0 for the default */
+    uint32_t reserved;
+    uint64_t carrierSize; /* Inline carrier bytes */
+    uint64_t payloadSize; /* Inline payload bytes, embedding only */
+} serve_request;
+
+typedef struct serve_response
+{
+    uint32_t magic;           /* SERVE_RESPONSE_MAGIC */
+    int32_t  status;          /* stegobmp_status */
+    uint32_t extensionLength; /* Extension of the extracted payload */
+    uint32_t errorLength;     /* Description of the failure */
+    uint64_t dataSize;        /* Inline result bytes, 0 when written to the output descriptor */
+    uint64_t nanoseconds;     /* Time spent on the request by the daemon */
+} serve_response;
+
+int serve(const char *socketPath, const steg_options *options);
+int serve_client(const char *socketPath,
+                 const char *carrierFile,
+                 const char *messageFile,
+                 const char *outputFile,
+                 steg        method,
+                 encryption  a,
+                 mode        m,
+                 const char *pass);
+
+#endif
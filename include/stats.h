@@ -0,0 +1,100 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "std_libs.h"
+
+/*
+ * Process-wide timing of the stages of embedding and extraction, and counters. Everything is
+ * off until stats_enable: a disabled span or counter costs one relaxed load and a branch.
+ * Spans of the same stage add up, also across threads (batch jobs and daemon requests run
+ * concurrently), so a stage may add up to more than the wall time.
+ */
+typedef enum {
+    STATS_READ_BMP,       /* Reading carrier headers and rows, mapping carriers */
+    STATS_PREPARE,        /* Reading the message to embed and framing the payload */
+    STATS_KEY_DERIVATION, /* generate_key_iv: PBKDF2, or a key cache lookup */
+    STATS_CIPHER,         /* Encryption and decryption */
+    STATS_LSB_EMBED,      /* Storing payload bits in the carrier */
+    STATS_LSB_EXTRACT,    /* Reading payload bits from the carrier */
+    STATS_WRITE_BMP,      /* Writing or serializing the output BMP */
+    STATS_WRITE_OUTPUT,   /* Writing extracted payloads */
+    STATS_STAGES
+} stats_stage;
+
+typedef enum {
+    STATS_BYTES_READ,        /* Carrier and message bytes read from files */
+    STATS_BYTES_WRITTEN,     /* Output BMP and extracted payload bytes written */
+    STATS_CHANNELS_MODIFIED, /* Color channels whose value the payload changed */
+    STATS_ALLOCATIONS,       /* Pixel planes and payload buffers allocated */
+    STATS_ALLOCATED_BYTES,   /* Size of those allocations */
+    STATS_KEYS_DERIVED,      /* Keys derived from passwords with PBKDF2 */
+    STATS_KEYS_REUSED,       /* PBKDF2 derivations avoided by the key cache */
+    STATS_COUNTERS
+} stats_counter;
+
+static const char *stats_stage_str[] __attribute__((unused)) = {"read_bmp",
+                                                                "prepare",
+                                                                "key_derivation",
+                                                                "cipher",
+                                                                "lsb_embed",
+                                                                "lsb_extract",
+                                                                "write_bmp",
+                                                                "write_output"};
+
+static const char *stats_counter_str[] __attribute__((unused)) = {"bytes_read",
+                                                                  "bytes_written",
+                                                                  "channels_modified",
+                                                                  "allocations",
+                                                                  "allocated_bytes",
+                                                                  "keys_derived",
+                                                                  "keys_reused"};
+
+typedef struct stats_snapshot
+{
+    uint64_t nanoseconds[STATS_STAGES]; /* Time spent in every stage */
+    uint64_t spans[STATS_STAGES];       /* Spans recorded for every stage */
+    uint64_t counters[STATS_COUNTERS];
+} stats_snapshot;
+
+extern atomic_bool stats_on;
+
+void     stats_enable(bool enable);
+void     stats_reset(void);
+void     stats_get(stats_snapshot *snapshot);
+int      stats_json(FILE *out, const stats_snapshot *snapshot);
+uint64_t stats_clock(void);
+void     stats_record(stats_stage stage, uint64_t start);
+void     stats_add(stats_counter counter, uint64_t amount);
+
+static inline bool stats_enabled(void) {
+    return atomic_load_explicit(&stats_on, memory_order_relaxed);
+}
+
+/* Start a span, 0 when disabled */
+static inline uint64_t stats_begin(void) {
+    return stats_enabled() ? stats_clock() : 0;
+}
+
+/* End a span started by stats_begin */
+static inline void stats_end(stats_stage stage, uint64_t start) {
+    if (start)
+        stats_record(stage, start);
+}
+
+static inline void stats_count(stats_counter counter, uint64_t amount) {
+    if (stats_enabled())
+        stats_add(counter, amount);
+}
+
+/* Count an allocation of size bytes */
+static inline void stats_alloc(size_t size) {
+    if (stats_enabled()) {
+        stats_add(STATS_ALLOCATIONS, 1);
+        stats_add(STATS_ALLOCATED_BYTES, size);
+    }
+}
+
+#endif
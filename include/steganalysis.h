@@ -0,0 +1,33 @@
+#ifndef STEGANALYSIS_H
+#define STEGANALYSIS_H
+
+#include "capacity.h"
+
+#define ANALYSIS_CHANNELS 4     /* Blue, green, red and alpha */
+#define ANALYSIS_SEGMENTS 64    /* Slices of rows every analysis is run on */
+#define ANALYSIS_SUSPICIOUS 0.1 /* Embedding rate from which a carrier counts as suspicious */
+
+/* Estimates for one color channel, embedding rates go from 0 (clean) to 1 (every LSB used) */
+typedef struct channel_analysis
+{
+    double chiSquare; /* Chi-square probability of an embedding in the bottom slice of rows */
+    double chiLength; /* Share of the rows whose slice the chi-square attack finds embedded */
+    double rs;        /* Embedding rate estimated by RS analysis */
+    double spa;       /* Embedding rate estimated by sample pair analysis */
+    double rate;      /* Mean of the RS and SPA estimates */
+} channel_analysis;
+
+typedef struct image_analysis
+{
+    uint32_t         width;
+    uint32_t         height;
+    size_t           channels; /* 3, or 4 when the alpha channel of a 32-bit carrier is analyzed */
+    channel_analysis channel[ANALYSIS_CHANNELS];
+    double           rate; /* Highest embedding rate of the channels */
+} image_analysis;
+
+int analyze_bmp(const BMP_FILE *bmp, image_analysis *analysis);
+int analyze_file(const char *filename, bool alpha, image_analysis *analysis);
+int analyze(const char *path, const char *resultsFile, const steg_options *options);
+
+#endif
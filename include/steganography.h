@@ -12,4 +12,14 @@ typedef enum steg { STEG_NONE, LSB1, LSB4, LSBI } steg;
 static const char *steg_str[]
     __attribute__((unused)) = {"None", "LSB1", "LSB4", "LSBI"};  // ignore unused warning
 
+/* Options shared by embed and extract */
+typedef struct steg_options
+{
+    bool        mmap;         /* Map the carrier file instead of reading it into memory */
+    bool        alpha;        /* LSB1 and LSB4 also use the 4th channel of 32-bit carriers */
+    size_t      threads;      /* Threads sharing the work, 0 for one per online CPU */
+    const char *keyCache;     /* File keeping derived keys across runs, NULL for memory only */
+    const char *carrierIndex; /* Index that carriers named "auto" are picked from */
+} steg_options;
+
 #endif
\ No newline at end of file
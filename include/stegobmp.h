@@ -0,0 +1,169 @@
+#ifndef STEGOBMP_H
+#define STEGOBMP_H
+
+/**
+ * libstegobmp: embed payloads into BMP images and extract them, over buffers in memory.
+ *
+ * Carriers are 24-bit BGR or 32-bit BGRA (or BGRX) BMP files, uncompressed (BI_RGB, or
+ * BI_BITFIELDS with BGRA masks for 32-bit files), with a BITMAPINFOHEADER up to a
+ * BITMAPV5HEADER, stored bottom-up or top-down.
+ *
+ * Nothing is printed and the process is never exited, every call returns a stegobmp_status and
+ * stegobmp_last_error describes the last failure of a context. A context holds the method and
+ * the password, it may be used by one thread at a time and separate contexts may be used
+ * concurrently. Keys derived from passwords are cached process-wide, so repeated calls with the
+ * same password do not run PBKDF2 again.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define STEGOBMP_API __attribute__((visibility("default")))
+#else
+#define STEGOBMP_API
+#endif
+
+#define STEGOBMP_EXTENSION_MAX 256 /* Longest extension, null terminator included */
+#define STEGOBMP_HEADER_SIZE 66     /* Bytes of a carrier read by stegobmp_capacity */
+#define STEGOBMP_CHANNELS 4         /* Channels of a pixel: blue, green, red and alpha */
+
+typedef enum stegobmp_status {
+    STEGOBMP_OK        = 0,
+    STEGOBMP_EINVAL    = -1, /* Invalid argument */
+    STEGOBMP_ENOMEM    = -2, /* Memory allocation failed */
+    STEGOBMP_EFORMAT   = -3, /* The carrier is not a supported BMP (24/32-bit, see above) */
+    STEGOBMP_ECAPACITY = -4, /* The payload does not fit in the carrier */
+    STEGOBMP_ENOTFOUND = -5, /* The carrier holds no payload for this method */
+    STEGOBMP_ECRYPTO   = -6, /* Encryption or decryption failed, e.g. a wrong password */
+    STEGOBMP_EIO       = -7  /* Reading or writing a file descriptor failed (stegobmp --serve) */
+} stegobmp_status;
+
+typedef enum stegobmp_method { STEGOBMP_LSB1 = 1, STEGOBMP_LSB4, STEGOBMP_LSBI } stegobmp_method;
+
+typedef enum stegobmp_cipher {
+    STEGOBMP_CIPHER_DEFAULT, /* AES128 when a password is set, ChaCha20 for STEGOBMP_POLY1305 */
+    STEGOBMP_AES128,
+    STEGOBMP_AES192,
+    STEGOBMP_AES256,
+    STEGOBMP_3DES,
+    STEGOBMP_CHACHA20
+} stegobmp_cipher;
+
+typedef enum stegobmp_mode {
+    STEGOBMP_MODE_DEFAULT, /* CBC when a password is set, Poly1305 for STEGOBMP_CHACHA20 */
+    STEGOBMP_ECB,
+    STEGOBMP_CBC,
+    STEGOBMP_CFB,
+    STEGOBMP_OFB,
+    STEGOBMP_GCM,     /* AES only, a tag follows the ciphertext */
+    STEGOBMP_POLY1305 /* ChaCha20 only, a tag follows the ciphertext */
+} stegobmp_mode;
+
+/* Stages timed while statistics are enabled, their spans add up across threads */
+typedef enum stegobmp_stage {
+    STEGOBMP_STAGE_READ_BMP,       /* Parsing carriers */
+    STEGOBMP_STAGE_PREPARE,        /* Reading messages and framing payloads (CLI) */
+    STEGOBMP_STAGE_KEY_DERIVATION, /* PBKDF2, or a lookup in the key cache */
+    STEGOBMP_STAGE_CIPHER,         /* Encryption and decryption */
+    STEGOBMP_STAGE_LSB_EMBED,      /* Storing payload bits */
+    STEGOBMP_STAGE_LSB_EXTRACT,    /* Reading payload bits */
+    STEGOBMP_STAGE_WRITE_BMP,      /* Serializing the stego image */
+    STEGOBMP_STAGE_WRITE_OUTPUT,   /* Writing extracted payloads (CLI and stegobmp --serve) */
+    STEGOBMP_STAGES
+} stegobmp_stage;
+
+typedef enum stegobmp_counter {
+    STEGOBMP_BYTES_READ,
+    STEGOBMP_BYTES_WRITTEN,
+    STEGOBMP_CHANNELS_MODIFIED, /* Color channels whose value a payload changed */
+    STEGOBMP_ALLOCATIONS,       /* Pixel planes and payload buffers allocated */
+    STEGOBMP_ALLOCATED_BYTES,
+    STEGOBMP_KEYS_DERIVED, /* Keys derived from passwords with PBKDF2 */
+    STEGOBMP_KEYS_REUSED,  /* Derivations avoided by reusing a cached key */
+    STEGOBMP_COUNTERS
+} stegobmp_counter;
+
+typedef struct stegobmp_stats
+{
+    uint64_t nanoseconds[STEGOBMP_STAGES];
+    uint64_t spans[STEGOBMP_STAGES];
+    uint64_t counters[STEGOBMP_COUNTERS];
+} stegobmp_stats;
+
+/* Distortion of one color channel of a stego image against its cover */
+typedef struct stegobmp_channel_quality
+{
+    double   mse;        /* Mean squared error */
+    double   psnr;       /* Peak signal to noise ratio in dB, 100 for identical channels */
+    double   ssim;       /* Mean structural similarity of the 8x8 windows */
+    uint64_t lsbChanged; /* Values whose LSB differs */
+} stegobmp_channel_quality;
+
+typedef struct stegobmp_quality
+{
+    uint32_t                 width;
+    uint32_t                 height;
+    size_t                   channels; /* Entries of channel in use, 3 or 4 */
+    stegobmp_channel_quality channel[STEGOBMP_CHANNELS];
+    double                   mse; /* Over every compared value */
+    double                   psnr;
+    double                   ssim; /* Mean of the channels */
+    uint64_t                 lsbChanged;
+} stegobmp_quality;
+
+typedef struct stegobmp_ctx stegobmp_ctx;
+
+STEGOBMP_API stegobmp_ctx   *stegobmp_new(stegobmp_method method);
+STEGOBMP_API void            stegobmp_destroy(stegobmp_ctx *ctx);
+STEGOBMP_API stegobmp_status stegobmp_set_method(stegobmp_ctx *ctx, stegobmp_method method);
+STEGOBMP_API stegobmp_status stegobmp_set_password(stegobmp_ctx   *ctx,
+                                                   const char     *pass,
+                                                   stegobmp_cipher cipher,
+                                                   stegobmp_mode   mode);
+STEGOBMP_API stegobmp_status stegobmp_set_alpha(stegobmp_ctx *ctx, int alpha);
+STEGOBMP_API stegobmp_status stegobmp_set_threads(size_t threads);
+
+STEGOBMP_API stegobmp_status stegobmp_embed(stegobmp_ctx  *ctx,
+                                            const uint8_t *carrier,
+                                            size_t         carrierSize,
+                                            const uint8_t *payload,
+                                            size_t         payloadSize,
+                                            const char    *extension,
+                                            uint8_t      **stego,
+                                            size_t        *stegoSize);
+STEGOBMP_API stegobmp_status stegobmp_extract(stegobmp_ctx  *ctx,
+                                              const uint8_t *stego,
+                                              size_t         stegoSize,
+                                              uint8_t      **payload,
+                                              size_t        *payloadSize,
+                                              char           extension[STEGOBMP_EXTENSION_MAX]);
+STEGOBMP_API stegobmp_status stegobmp_capacity(stegobmp_ctx  *ctx,
+                                               const uint8_t *header,
+                                               size_t         headerSize,
+                                               size_t         carrierSize,
+                                               size_t        *capacity);
+STEGOBMP_API stegobmp_status stegobmp_compare(stegobmp_ctx     *ctx,
+                                              const uint8_t    *cover,
+                                              size_t            coverSize,
+                                              const uint8_t    *stego,
+                                              size_t            stegoSize,
+                                              stegobmp_quality *quality);
+STEGOBMP_API void            stegobmp_free(void *buffer);
+
+STEGOBMP_API void stegobmp_stats_enable(int enable);
+STEGOBMP_API void stegobmp_stats_reset(void);
+STEGOBMP_API void stegobmp_stats_get(stegobmp_stats *stats);
+
+STEGOBMP_API const char *stegobmp_strerror(stegobmp_status status);
+STEGOBMP_API const char *stegobmp_last_error(const stegobmp_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
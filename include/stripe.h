@@ -0,0 +1,53 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include "embedding.h"
+#include "extraction.h"
+
+#define STRIPE_MAX 256 /* Most carriers a payload can be striped across */
+
+/*
+ * A striped payload is split in parts, one per carrier. Every carrier holds a payload of its
+ * own: size | stripe header | part, the size covering the header and the part. The header is
+ * "SBST" | index (2) | count (2) | offset (8) | total (8) | checksum (4), big-endian, where
+ * offset is the position of the part within the whole payload, total the size of the whole
+ * payload and checksum the first 4 bytes of the SHA-256 of the header before it and the part.
+ */
+#define STRIPE_HEADER_SIZE 28
+
+int  stripe_embed_files(const char *const  *carriers,
+                        const char *const  *outputs,
+                        size_t              count,
+                        const char         *messageFile,
+                        steg                method,
+                        encryption          a,
+                        mode                m,
+                        const char         *pass,
+                        const steg_options *options,
+                        size_t             *dataSize);
+int  stripe_extract_files(const char *const  *carriers,
+                          size_t              count,
+                          const char         *outputFile,
+                          steg                method,
+                          encryption          a,
+                          mode                m,
+                          const char         *pass,
+                          const steg_options *options,
+                          size_t             *dataSize);
+void stripe_embed(const char         *carriers,
+                  const char         *messageFile,
+                  const char         *outputs,
+                  steg                method,
+                  encryption          a,
+                  mode                m,
+                  const char         *pass,
+                  const steg_options *options);
+void stripe_extract(const char         *carriers,
+                    const char         *outputFile,
+                    steg                method,
+                    encryption          a,
+                    mode                m,
+                    const char         *pass,
+                    const steg_options *options);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "misc.h"
+#include "std_libs.h"
+
+/* Fewest color channels worth handing to a thread of their own */
+#define STEG_BAND_CHANNELS (256 * 1024)
+
+typedef struct thread_pool thread_pool;
+
+/* Work item: task index within [0, tasks) and the context given to thread_pool_run */
+typedef void (*thread_task)(size_t task, void *context);
+/* Band of work: [begin, end) within the range given to parallel_bands */
+typedef void (*thread_band)(size_t begin, size_t end, void *context);
+
+thread_pool *thread_pool_create(size_t threads);
+void         thread_pool_free(thread_pool *pool);
+size_t       thread_pool_threads(const thread_pool *pool);
+void thread_pool_run(thread_pool *pool, size_t tasks, thread_task task, void *context);
+
+int    steg_set_threads(size_t threads);
+size_t steg_threads(void);
+void   parallel_tasks(size_t tasks, thread_task task, void *context);
+void   parallel_bands(size_t total, size_t minBand, size_t align, thread_band band, void *context);
+
+#endif
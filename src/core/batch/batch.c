@@ -0,0 +1,434 @@
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "carrier_index.h"
+
+#define AUTO_CARRIER "auto"  // Carrier of the jobs whose carrier is picked from the index
+
+typedef struct
+{
+    batch_manifest     *manifest;
+    const steg_options *options;
+} batch_context;
+
+/* Seconds elapsed since start */
+static double elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Whether a job takes its carrier from the carrier index */
+static bool is_auto_job(const batch_job *job) {
+    return job->valid && job->action == JOB_EMBED && strcasecmp(job->carrier, AUTO_CARRIER) == 0;
+}
+
+/* Fail a job before it runs */
+static void fail_job(batch_job *job, const char *error) {
+    snprintf(job->error, sizeof(job->error), "%s", error);
+    job->valid = false;
+}
+
+static int compare_sizes(const void *a, const void *b) {
+    const batch_job *x = *(batch_job *const *) a, *y = *(batch_job *const *) b;
+    return x->dataSize < y->dataSize ? 1 : x->dataSize > y->dataSize ? -1 : 0;
+}
+
+/**
+ * @brief Give every job whose carrier is "auto" its own carrier from the carrier index
+ *
+ * A carrier holds a single payload, so packing the payloads into the indexed carriers is an
+ * assignment: the payloads go largest first to the smallest unused carrier that holds them
+ * (best fit decreasing), which places as many of them as the carriers allow and keeps the large
+ * carriers for the large payloads. Jobs left without a carrier fail.
+ *
+ * @return 0 on success, -1 if the index can not be used
+ */
+static int assign_carriers(batch_manifest *manifest, const char *indexFile) {
+    size_t      count = 0;
+    batch_job **jobs  = malloc((manifest->count ? manifest->count : 1) * sizeof(batch_job *));
+    if (!jobs) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < manifest->count; i++) {
+        batch_job *job = &manifest->jobs[i];
+        if (!is_auto_job(job))
+            continue;
+        if (!indexFile) {
+            fail_job(job, "Carrier auto requires --carrier-index.");
+            continue;
+        }
+
+        printerr_reset();
+        bool quiet = printerr_quiet(true);
+        int  sized = message_payload_size(
+            job->payload, job->password, job->a, job->m, &job->dataSize);
+        printerr_quiet(quiet);
+        if (sized != 0)
+            fail_job(job, printerr_first());
+        else
+            jobs[count++] = job;
+    }
+
+    carrier_index  index  = {0};
+    carrier_picker pickers[CAPACITY_METHODS];
+    int            result = count == 0 ? 0 : carrier_index_load(indexFile, &index);
+    for (int i = 0; i < CAPACITY_METHODS && result == 0 && count > 0; i++)
+        result = carrier_picker_init(&pickers[i], &index, (steg) (LSB1 + i));
+
+    qsort(jobs, count, sizeof(batch_job *), compare_sizes);
+    for (size_t i = 0; i < count && result == 0; i++) {
+        batch_job           *job     = jobs[i];
+        const carrier_entry *carrier = carrier_pick(&pickers[job->method - 1], job->dataSize);
+        char                *path    = carrier ? strdup(carrier->path) : NULL;
+        if (!path) {
+            fail_job(job, "No unused indexed carrier holds the payload.");
+            continue;
+        }
+        free(job->carrier);
+        job->carrier = path;
+    }
+
+    for (int i = 0; i < CAPACITY_METHODS && result == 0 && count > 0; i++)
+        carrier_picker_free(&pickers[i]);
+    carrier_index_free(&index);
+    free(jobs);
+    return result;
+}
+
+/* A file a job reads (its carrier) or writes (its output), as compared across the jobs */
+typedef struct
+{
+    char       *name; /* Path, embedding outputs with the .bmp extension */
+    struct stat st;
+    bool        exists;
+    bool        output;
+    size_t      job;
+} job_file;
+
+/* Order files by identity (inode when they exist, path otherwise), then by job */
+static int compare_files(const void *a, const void *b) {
+    const job_file *x = a, *y = b;
+    if (x->exists != y->exists)
+        return x->exists ? -1 : 1;
+    if (x->exists && x->st.st_dev != y->st.st_dev)
+        return x->st.st_dev < y->st.st_dev ? -1 : 1;
+    if (x->exists && x->st.st_ino != y->st.st_ino)
+        return x->st.st_ino < y->st.st_ino ? -1 : 1;
+    int byName = x->exists ? 0 : strcmp(x->name, y->name);
+    if (byName != 0)
+        return byName;
+    return x->job < y->job ? -1 : x->job > y->job ? 1 : 0;
+}
+
+static bool same_file(const job_file *a, const job_file *b) {
+    if (a->exists != b->exists)
+        return false;
+    if (a->exists)
+        return a->st.st_dev == b->st.st_dev && a->st.st_ino == b->st.st_ino;
+    return strcmp(a->name, b->name) == 0;
+}
+
+/**
+ * @brief Fail the jobs whose output is written by an earlier job too or is the carrier of
+ * another job, before any job runs: jobs run concurrently, so they would overwrite each other's
+ * outputs or read carriers while they are being written
+ *
+ * As for stripes, existing files are compared by inode, so other paths or links to the same
+ * file are caught, missing ones by path. Extractions are compared by their output name without
+ * the extension, which is only known once the payload is read.
+ *
+ * @return 0 on success, -1 if the check could not be run
+ */
+static int check_outputs(batch_manifest *manifest) {
+    job_file *files = calloc(2 * manifest->count + 1, sizeof(job_file));
+    if (!files) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+
+    size_t count  = 0;
+    int    result = 0;
+    for (size_t i = 0; i < manifest->count && result == 0; i++) {
+        const batch_job *job = &manifest->jobs[i];
+        if (!job->valid)
+            continue;
+
+        job_file *carrier = &files[count++];
+        carrier->name     = job->carrier;
+        carrier->job      = i;
+        carrier->exists   = stat(carrier->name, &carrier->st) == 0;
+
+        job_file *output = &files[count++];
+        output->name     = job->action == JOB_EMBED ? bmp_output_filename(job->output)
+                                                    : job->output;
+        output->job      = i;
+        output->output   = true;
+        output->exists   = output->name && stat(output->name, &output->st) == 0;
+        if (!output->name)
+            result = -1;
+    }
+
+    if (result == 0)
+        qsort(files, count, sizeof(job_file), compare_files);
+    for (size_t first = 0, end; first < count && result == 0; first = end) {
+        // Files naming the same file are adjacent, in job order
+        for (end = first + 1; end < count && same_file(&files[first], &files[end]); end++)
+            ;
+
+        const job_file *writer = NULL;
+        for (size_t i = first; i < end; i++) {
+            batch_job *job = &manifest->jobs[files[i].job];
+            if (!files[i].output || !job->valid)
+                continue;
+
+            char error[PRINTERR_MAX];
+            if (writer) {
+                snprintf(error,
+                         sizeof(error),
+                         "Output %s is also written by the job on line %zu.",
+                         job->output,
+                         manifest->jobs[writer->job].line);
+                fail_job(job, error);
+                continue;
+            }
+            writer = &files[i];
+            for (size_t j = first; j < end; j++) {
+                if (files[j].output || files[j].job == files[i].job)
+                    continue;
+                snprintf(error,
+                         sizeof(error),
+                         "Output %s is the carrier of the job on line %zu.",
+                         job->output,
+                         manifest->jobs[files[j].job].line);
+                fail_job(job, error);
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const batch_job *job = &manifest->jobs[files[i].job];
+        if (files[i].output && files[i].name != job->output)
+            free(files[i].name);
+    }
+    free(files);
+    return result;
+}
+
+/* Run one job, recording its outcome instead of exiting on errors */
+static void run_job(size_t task, void *context) {
+    batch_context  *batch = context;
+    batch_job      *job   = &batch->manifest->jobs[task];
+    struct timespec start;
+
+    if (!job->valid)
+        return;
+
+    printerr_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (job->action == JOB_EMBED)
+        job->status = embed_file(job->carrier,
+                                 job->payload,
+                                 job->output,
+                                 job->method,
+                                 job->a,
+                                 job->m,
+                                 job->password,
+                                 batch->options,
+                                 &job->dataSize,
+                                 NULL);
+    else
+        job->status = extract_file(job->carrier,
+                                   job->output,
+                                   job->method,
+                                   job->a,
+                                   job->m,
+                                   job->password,
+                                   batch->options,
+                                   &job->dataSize);
+    job->seconds = elapsed(&start);
+
+    if (job->status != 0) {
+        const char *error = printerr_first();
+        snprintf(job->error, sizeof(job->error), "%s", *error ? error : "Failed");
+    }
+}
+
+/* Write a string as a CSV field, quoted when needed */
+static void csv_string(FILE *out, const char *s) {
+    if (!s || !strpbrk(s, ",\"\r\n")) {
+        fputs(s ? s : "", out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Write the outcome of every job: JSON Lines, or CSV when the file name ends in .csv
+ *
+ * Every record holds the manifest line, the action, the carrier, the output, the method, the
+ * status (ok or failed), the error, the payload size and the time taken by the job.
+ *
+ * @param resultsFile Path to the results file
+ * @param manifest Jobs that were run
+ *
+ * @return 0 on success, -1 if the file can not be written
+ */
+int write_results(const char *resultsFile, const batch_manifest *manifest) {
+    FILE *out = fopen(resultsFile, "w");
+    if (!out) {
+        printerr("Could not open results file: %s\n", resultsFile);
+        return -1;
+    }
+
+    const char *suffix = strrchr(resultsFile, '.');
+    bool        csv    = suffix && strcasecmp(suffix, ".csv") == 0;
+    if (csv)
+        fprintf(out, "line,action,carrier,output,method,status,error,bytes,seconds\n");
+
+    for (size_t i = 0; i < manifest->count; i++) {
+        const batch_job *job    = &manifest->jobs[i];
+        const char      *status = job->status == 0 ? "ok" : "failed";
+
+        if (csv) {
+            fprintf(out, "%zu,%s,", job->line, job_action_str[job->action]);
+            csv_string(out, job->carrier);
+            fputc(',', out);
+            csv_string(out, job->output);
+            fprintf(out, ",%s,%s,", steg_str[job->method], status);
+            csv_string(out, job->error);
+            fprintf(out, ",%zu,%.6f\n", job->dataSize, job->seconds);
+            continue;
+        }
+
+        fprintf(out,
+                "{\"line\":%zu,\"action\":\"%s\",\"carrier\":",
+                job->line,
+                job_action_str[job->action]);
+        print_json_string(out, job->carrier);
+        fprintf(out, ",\"output\":");
+        print_json_string(out, job->output);
+        fprintf(out,
+                ",\"method\":\"%s\",\"status\":\"%s\",\"error\":",
+                steg_str[job->method],
+                status);
+        if (job->status == 0)
+            fprintf(out, "null");
+        else
+            print_json_string(out, job->error);
+        fprintf(out, ",\"bytes\":%zu,\"seconds\":%.6f}\n", job->dataSize, job->seconds);
+    }
+
+    if (fclose(out) != 0) {
+        printerr("Could not write results file: %s\n", resultsFile);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run every job of a manifest in this process, spread over the shared thread pool
+ *
+ * A failed job is recorded in the results file and does not stop the others. The keys of every
+ * password are derived once before the jobs start and shared through the key cache. Jobs run
+ * concurrently, so a job must not depend on the output of another job of the same manifest: jobs
+ * writing an output another job writes or reads fail before any job starts.
+ *
+ * @param manifestFile Path to the manifest, see load_manifest
+ * @param resultsFile Path to the results file, see write_results, NULL for the manifest path
+ * followed by .results.jsonl
+ * @param options Options applied to every job, threads sets how many jobs run at a time
+ *
+ * @return 0 if every job succeeded, -1 otherwise
+ */
+int batch(const char *manifestFile, const char *resultsFile, const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
+        return -1;
+
+    char *defaultResults = NULL;
+    if (!resultsFile) {
+        defaultResults = malloc(strlen(manifestFile) + sizeof(".results.jsonl"));
+        if (!defaultResults) {
+            printerr("Memory allocation failed\n");
+            return -1;
+        }
+        strcpy(defaultResults, manifestFile);
+        strcat(defaultResults, ".results.jsonl");
+        resultsFile = defaultResults;
+    }
+
+    batch_manifest manifest;
+    if (load_manifest(manifestFile, &manifest) != 0) {
+        free(defaultResults);
+        return -1;
+    }
+
+    if (assign_carriers(&manifest, options ? options->carrierIndex : NULL) != 0 ||
+        check_outputs(&manifest) != 0) {
+        free_manifest(&manifest);
+        free(defaultResults);
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Derive the keys up front, consecutive jobs usually share the password
+    for (size_t i = 0; i < manifest.count; i++) {
+        const batch_job *job  = &manifest.jobs[i];
+        const batch_job *prev = i > 0 ? &manifest.jobs[i - 1] : NULL;
+        if (job->valid && job->password &&
+            (!prev || !prev->password || strcmp(prev->password, job->password) != 0 ||
+             prev->a != job->a || prev->m != job->m))
+            prederive_key(job->password, job->a, job->m);
+    }
+
+    batch_context context = {&manifest, options};
+    parallel_tasks(manifest.count, run_job, &context);
+    double seconds = elapsed(&start);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < manifest.count; i++)
+        failed += manifest.jobs[i].status != 0;
+
+    int result = write_results(resultsFile, &manifest);
+    key_cache_save();
+
+    char jobsStr[21], okStr[21], failedStr[21], secondsStr[32], avoidedStr[21];
+    snprintf(jobsStr, sizeof(jobsStr), "%zu", manifest.count);
+    snprintf(okStr, sizeof(okStr), "%zu", manifest.count - failed);
+    snprintf(failedStr, sizeof(failedStr), "%zu", failed);
+    snprintf(secondsStr, sizeof(secondsStr), "%.3f", seconds);
+    snprintf(avoidedStr, sizeof(avoidedStr), "%" PRIu64, key_cache_avoided());
+    print_table(failed ? "Batch finished with failed jobs" : "Batch finished",
+                failed ? 0xed8796 : 0xa6da95,
+                "Jobs",
+                jobsStr,
+                "Succeeded",
+                okStr,
+                "Failed",
+                failedStr,
+                "Time (s)",
+                secondsStr,
+                "Keys reused",
+                avoidedStr,
+                "Results file",
+                resultsFile,
+                NULL);
+
+    free_manifest(&manifest);
+    free(defaultResults);
+    return result == 0 && failed == 0 ? 0 : -1;
+}
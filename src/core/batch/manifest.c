@@ -0,0 +1,371 @@
+#include "batch.h"
+
+#define MANIFEST_FIELDS 8  // action, carrier, payload, output, method, cipher, mode, password
+
+/* Manifest columns (CSV header names or JSON keys) and their accepted aliases */
+typedef enum {
+    FIELD_ACTION,
+    FIELD_CARRIER,
+    FIELD_PAYLOAD,
+    FIELD_OUTPUT,
+    FIELD_METHOD,
+    FIELD_CIPHER,
+    FIELD_MODE,
+    FIELD_PASSWORD
+} manifest_field;
+
+static const char *field_names[MANIFEST_FIELDS][2] = {{"action", "action"},
+                                                      {"carrier", "p"},
+                                                      {"payload", "in"},
+                                                      {"output", "out"},
+                                                      {"method", "steg"},
+                                                      {"cipher", "a"},
+                                                      {"mode", "m"},
+                                                      {"password", "pass"}};
+
+/* Column of a CSV header name or JSON key, -1 for unknown names */
+static int find_field(const char *name) {
+    for (int field = 0; field < MANIFEST_FIELDS; field++) {
+        if (strcasecmp(name, field_names[field][0]) == 0 ||
+            strcasecmp(name, field_names[field][1]) == 0)
+            return field;
+    }
+    return -1;
+}
+
+/* Strip the trailing newline (and carriage return) of a line */
+static void chomp(char *line) {
+    line[strcspn(line, "\r\n")] = '\0';
+}
+
+/* True for lines holding only blanks */
+static bool blank(const char *line) {
+    return line[strspn(line, " \t\r\n")] == '\0';
+}
+
+/**
+ * @brief Split a CSV line in place: fields are separated by commas, double quoted fields may hold
+ * commas and "" for a quote
+ *
+ * @return Number of fields found, -1 for an unterminated quote, -2 if the line holds more than
+ * maxFields fields
+ */
+static int split_csv(char *line, char **fields, int maxFields) {
+    int   count = 0;
+    char *src = line, *dst = line;
+
+    while (count < maxFields) {
+        fields[count++] = dst;
+        if (*src == '"') {
+            src++;
+            while (*src != '"' || src[1] == '"') {
+                if (*src == '\0')
+                    return -1;
+                if (*src == '"')
+                    src++;
+                *dst++ = *src++;
+            }
+            src++;
+        }
+        while (*src != ',' && *src != '\0')
+            *dst++ = *src++;
+
+        if (*src == '\0') {
+            *dst = '\0';
+            return count;
+        }
+        *dst++ = '\0';
+        src++;
+    }
+    // A separator after the last field: the line has fields nothing is expected for
+    return -2;
+}
+
+/* Skip blanks */
+static char *skip_blanks(char *p) {
+    return p + strspn(p, " \t\r\n");
+}
+
+/* Parse a JSON string in place (p at the opening quote), NULL on error */
+static char *json_string(char **p) {
+    char *src = *p + 1, *dst = *p + 1, *start = dst;
+
+    while (*src != '"') {
+        if (*src == '\0')
+            return NULL;
+        if (*src != '\\') {
+            *dst++ = *src++;
+            continue;
+        }
+        src++;
+        switch (*src++) {
+            case '"':
+            case '\\':
+            case '/':
+                *dst++ = src[-1];
+                break;
+            case 'n':
+                *dst++ = '\n';
+                break;
+            case 't':
+                *dst++ = '\t';
+                break;
+            case 'r':
+                *dst++ = '\r';
+                break;
+            case 'u': {  // Only code points below 0x80 are accepted
+                unsigned code;
+                if (sscanf(src, "%4x", &code) != 1 || code == 0 || code >= 0x80)
+                    return NULL;
+                *dst++ = (char) code;
+                src += 4;
+                break;
+            }
+            default:
+                return NULL;
+        }
+    }
+    *dst = '\0';
+    *p   = src + 1;
+    return start;
+}
+
+/**
+ * @brief Parse a JSON object of string (or null) values in place
+ *
+ * @return 0 on success, -1 if the line is not such an object or has an unknown key
+ */
+static int split_json(char *line, char **fields) {
+    char *p = skip_blanks(line);
+    if (*p++ != '{')
+        return -1;
+
+    p = skip_blanks(p);
+    while (*p != '}') {
+        char *key = *p == '"' ? json_string(&p) : NULL;
+        if (!key)
+            return -1;
+        p = skip_blanks(p);
+        if (*p++ != ':')
+            return -1;
+        p = skip_blanks(p);
+
+        char *value = NULL;
+        if (strncmp(p, "null", 4) == 0)
+            p += 4;
+        else if (*p != '"' || !(value = json_string(&p)))
+            return -1;
+
+        int field = find_field(key);
+        if (field < 0)
+            return -1;
+        fields[field] = value;
+
+        p = skip_blanks(p);
+        if (*p == ',')
+            p = skip_blanks(p + 1);
+        else if (*p != '}')
+            return -1;
+    }
+    return *skip_blanks(p + 1) == '\0' ? 0 : -1;
+}
+
+/* Copy of a manifest value, NULL for missing or empty ones */
+static char *field_dup(const char *value) {
+    return value && *value ? strdup(value) : NULL;
+}
+
+/* Fill in a job from the fields of a manifest line, with the same defaults as the command line */
+static void make_job(batch_job *job, char **fields) {
+    const char *action = fields[FIELD_ACTION];
+
+    job->carrier  = field_dup(fields[FIELD_CARRIER]);
+    job->payload  = field_dup(fields[FIELD_PAYLOAD]);
+    job->output   = field_dup(fields[FIELD_OUTPUT]);
+    job->password = field_dup(fields[FIELD_PASSWORD]);
+
+    // Without an action column, lines with a payload embed it and the others extract
+    if (!action || !*action)
+        job->action = job->payload ? JOB_EMBED : JOB_EXTRACT;
+    else if (strcasecmp(action, "embed") == 0)
+        job->action = JOB_EMBED;
+    else if (strcasecmp(action, "extract") == 0)
+        job->action = JOB_EXTRACT;
+    else {
+        snprintf(job->error, sizeof(job->error), "Invalid action: %s", action);
+        return;
+    }
+
+    const char *method = fields[FIELD_METHOD], *cipher = fields[FIELD_CIPHER];
+    const char *m = fields[FIELD_MODE];
+    if (!method || parse_steg(method, &job->method) != 0) {
+        snprintf(job->error, sizeof(job->error), "Invalid steg value: %s", method ? method : "");
+        return;
+    }
+    if (cipher && *cipher && parse_encryption(cipher, &job->a) != 0) {
+        snprintf(job->error, sizeof(job->error), "Invalid encryption algorithm: %s", cipher);
+        return;
+    }
+    if (m && *m && parse_mode(m, &job->m) != 0) {
+        snprintf(job->error, sizeof(job->error), "Invalid encryption mode value: %s", m);
+        return;
+    }
+
+    if (!job->password && (job->a != ENC_NONE || job->m != MODE_NONE)) {
+        snprintf(job->error, sizeof(job->error), "Encryption/decryption requires a password.");
+        return;
+    }
+    if (job->password) {
+        job->a = job->a == ENC_NONE ? default_encryption(job->m) : job->a;
+        job->m = job->m == MODE_NONE ? default_mode(job->a) : job->m;
+        if (!get_cipher(job->a, job->m)) {
+            snprintf(job->error,
+                     sizeof(job->error),
+                     "%s does not support mode %s",
+                     encryption_str[job->a],
+                     mode_str[job->m]);
+            return;
+        }
+    }
+
+    if (!job->carrier || !job->output || (job->action == JOB_EMBED && !job->payload)) {
+        snprintf(job->error,
+                 sizeof(job->error),
+                 "Missing required arguments for %s.",
+                 job->action == JOB_EMBED ? "embedding" : "extraction");
+        return;
+    }
+    job->valid = true;
+}
+
+/**
+ * @brief Read a batch manifest: one job per line, as CSV with a header line naming the columns
+ * or as JSON Lines (used when the file name ends in .jsonl or .json, or the first line is an
+ * object)
+ *
+ * Columns: action (embed or extract, inferred from the payload when missing), carrier, payload,
+ * output, method, cipher, mode and password, also accepted under the command line names (p, in,
+ * out, steg, a, m, pass). Lines that can not be parsed become invalid jobs with an error, they do
+ * not stop the batch.
+ *
+ * @param manifestFile Path to the manifest
+ * @param manifest Where to store the jobs
+ *
+ * @return 0 on success, -1 if the manifest can not be read
+ *
+ * @note The caller is responsible for freeing the manifest with free_manifest
+ */
+int load_manifest(const char *manifestFile, batch_manifest *manifest) {
+    FILE *file = fopen(manifestFile, "r");
+    if (!file) {
+        printerr("Could not open manifest file: %s\n", manifestFile);
+        return -1;
+    }
+
+    const char *suffix = strrchr(manifestFile, '.');
+    int         json   = suffix && (!strcasecmp(suffix, ".jsonl") || !strcasecmp(suffix, ".json"));
+    int         columns[MANIFEST_FIELDS];
+    int         columnCount = 0;
+    char       *line        = NULL;
+    size_t      lineSize    = 0;
+    size_t      allocated   = 0;
+    size_t      lineNumber  = 0;
+    int         result      = 0;
+
+    memset(manifest, 0, sizeof(*manifest));
+    while (result == 0 && getline(&line, &lineSize, file) != -1) {
+        lineNumber++;
+        if (blank(line))
+            continue;
+        chomp(line);
+
+        // The first line tells the format: a JSON object or the CSV header
+        if (!json && columnCount == 0) {
+            if (*skip_blanks(line) == '{') {
+                json = 1;
+            }
+            else {
+                char *names[MANIFEST_FIELDS];
+                columnCount = split_csv(line, names, MANIFEST_FIELDS);
+                if (columnCount < 0) {
+                    printerr("Invalid manifest header: %s\n",
+                             columnCount == -1 ? "unterminated quote" : "too many columns");
+                    result = -1;
+                }
+                for (int i = 0; i < columnCount && result == 0; i++) {
+                    if ((columns[i] = find_field(names[i])) < 0) {
+                        printerr("Invalid manifest header: %s\n", names[i]);
+                        result = -1;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (manifest->count == allocated) {
+            allocated       = allocated ? allocated * 2 : 64;
+            batch_job *jobs = realloc(manifest->jobs, allocated * sizeof(batch_job));
+            if (!jobs) {
+                printerr("Memory allocation failed\n");
+                result = -1;
+                break;
+            }
+            manifest->jobs = jobs;
+        }
+
+        batch_job *job = &manifest->jobs[manifest->count++];
+        memset(job, 0, sizeof(*job));
+        job->line   = lineNumber;
+        job->status = -1;
+
+        char *fields[MANIFEST_FIELDS] = {0};
+        if (json) {
+            if (split_json(line, fields) != 0) {
+                snprintf(job->error, sizeof(job->error), "Invalid JSON object");
+                continue;
+            }
+        }
+        else {
+            char *values[MANIFEST_FIELDS];
+            int   count = split_csv(line, values, columnCount);
+            if (count == -1) {
+                snprintf(job->error, sizeof(job->error), "Unterminated quote");
+                continue;
+            }
+            if (count < 0) {
+                snprintf(job->error,
+                         sizeof(job->error),
+                         "More fields than the %d columns of the header",
+                         columnCount);
+                continue;
+            }
+            for (int i = 0; i < count; i++)
+                fields[columns[i]] = values[i];
+        }
+        make_job(job, fields);
+    }
+
+    free(line);
+    fclose(file);
+    if (result != 0)
+        free_manifest(manifest);
+    return result;
+}
+
+/**
+ * @brief Free the jobs of a manifest
+ */
+void free_manifest(batch_manifest *manifest) {
+    for (size_t i = 0; i < manifest->count; i++) {
+        batch_job *job = &manifest->jobs[i];
+        free(job->carrier);
+        free(job->payload);
+        free(job->output);
+        if (job->password)
+            OPENSSL_cleanse(job->password, strlen(job->password));
+        free(job->password);
+    }
+    free(manifest->jobs);
+    manifest->jobs  = NULL;
+    manifest->count = 0;
+}
@@ -0,0 +1,272 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "capacity.h"
+
+#define SCAN_BAND 64  // Fewest carriers worth handing to a thread of their own
+
+/* One carrier of a capacity query and its outcome */
+typedef struct
+{
+    const char      *path;
+    carrier_capacity capacity;
+    int              status; /* 0 on success, -1 on failure */
+    char             error[PRINTERR_MAX];
+    double           microseconds; /* Time taken by the headers and the figures */
+} capacity_entry;
+
+/**
+ * @brief Fill the capacity figures of a carrier, only its headers are used
+ */
+void carrier_capacity_of(const BMP_FILE *bmp, carrier_capacity *capacity) {
+    capacity->width  = bmp_width(bmp);
+    capacity->height = bmp_height(bmp);
+    for (steg method = LSB1; method <= LSBI; method++) {
+        size_t payload                = embedding_capacity(bmp, method);
+        capacity->payload[method - 1] = payload;
+        capacity->plain[method - 1]   = payload_room(payload, false, ENC_NONE, MODE_NONE);
+        for (encryption a = AES128; a <= CHACHA20; a++) {
+            for (mode m = ECB; m <= POLY1305; m++)
+                capacity->encrypted[method - 1][a - 1][m - 1] = payload_room(payload, true, a, m);
+        }
+    }
+}
+
+/**
+ * @brief Capacity of a carrier file, reading its headers and nothing else
+ *
+ * @return 0 on success, -1 if the file is not a supported BMP
+ */
+int read_carrier_capacity(const char *filename, carrier_capacity *capacity) {
+    BMP_FILE bmp;
+    if (bmp_read_headers(filename, &bmp) != 0)
+        return -1;
+    carrier_capacity_of(&bmp, capacity);
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @brief Whether a directory entry name looks like a carrier: a visible .bmp file
+ */
+bool is_carrier_name(const char *name) {
+    size_t length = strlen(name);
+    return name[0] != '.' && length > 4 && strcasecmp(name + length - 4, ".bmp") == 0;
+}
+
+/**
+ * @brief List the carriers of a query: path itself, or the .bmp files of a directory (not
+ * recursive) sorted by name
+ *
+ * @return 0 on success, -1 on failure, paths are released with free_carrier_files
+ */
+int list_carrier_files(const char *path, char ***paths, size_t *count) {
+    struct stat st;
+    *paths = NULL;
+    *count = 0;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        *paths = malloc(sizeof(char *));
+        if (!*paths || !((*paths)[0] = strdup(path))) {
+            printerr("Memory allocation failed\n");
+            free(*paths);
+            return -1;
+        }
+        *count = 1;
+        return 0;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        printerr("Could not open directory: %s\n", path);
+        return -1;
+    }
+
+    size_t         allocated = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_carrier_name(entry->d_name) || entry->d_type == DT_DIR)
+            continue;
+        if (*count == allocated) {
+            allocated  = allocated ? allocated * 2 : 256;
+            char **all = realloc(*paths, allocated * sizeof(char *));
+            if (!all)
+                break;
+            *paths = all;
+        }
+
+        char *carrier = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        if (!carrier)
+            break;
+        sprintf(carrier, "%s/%s", path, entry->d_name);
+        (*paths)[(*count)++] = carrier;
+    }
+    closedir(dir);
+
+    if (entry != NULL) {
+        printerr("Memory allocation failed\n");
+        free_carrier_files(*paths, *count);
+        return -1;
+    }
+    if (*count > 0)
+        qsort(*paths, *count, sizeof(char *), compare_paths);
+    return 0;
+}
+
+void free_carrier_files(char **paths, size_t count) {
+    for (size_t i = 0; i < count && paths; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+/* Query the carriers [begin, end), recording errors instead of printing them */
+static void query_band(size_t begin, size_t end, void *context) {
+    capacity_entry *entries = context;
+    bool            quiet   = printerr_quiet(true);
+
+    for (size_t i = begin; i < end; i++) {
+        struct timespec start, stop;
+        printerr_reset();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        entries[i].status = read_carrier_capacity(entries[i].path, &entries[i].capacity);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        entries[i].microseconds =
+            (stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_nsec - start.tv_nsec) / 1e3;
+        if (entries[i].status != 0) {
+            const char *error = printerr_first();
+            snprintf(entries[i].error, sizeof(entries[i].error), "%s", *error ? error : "Failed");
+        }
+    }
+    printerr_quiet(quiet);
+}
+
+/* Write the capacity of one carrier as a JSON line */
+static void write_entry(FILE *out, const capacity_entry *entry) {
+    fprintf(out, "{\"carrier\":");
+    print_json_string(out, entry->path);
+    if (entry->status != 0) {
+        fprintf(out, ",\"error\":");
+        print_json_string(out, entry->error);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    const carrier_capacity *capacity = &entry->capacity;
+    fprintf(out,
+            ",\"width\":%u,\"height\":%u,\"us\":%.2f,\"capacity\":{",
+            capacity->width,
+            capacity->height,
+            entry->microseconds);
+    for (steg method = LSB1; method <= LSBI; method++) {
+        fprintf(out,
+                "%s\"%s\":{\"payload\":%zu,\"plain\":%zu",
+                method == LSB1 ? "" : ",",
+                steg_str[method],
+                capacity->payload[method - 1],
+                capacity->plain[method - 1]);
+        for (encryption a = AES128; a <= CHACHA20; a++) {
+            for (mode m = ECB; m <= POLY1305; m++) {
+                if (!get_cipher(a, m))
+                    continue;
+                fprintf(out,
+                        ",\"%s-%s\":%zu",
+                        encryption_str[a],
+                        mode_str[m],
+                        capacity->encrypted[method - 1][a - 1][m - 1]);
+            }
+        }
+        fputc('}', out);
+    }
+    fprintf(out, "}}\n");
+}
+
+/**
+ * @brief Report what a carrier, or every .bmp file of a directory, can hold for each method,
+ * in plain and with each cipher and mode, reading only the headers of the files
+ *
+ * Every carrier gets a JSON line: its size, the payload bytes (size prefix included) of every
+ * method and the room left for a message and its extension (null terminator included), in plain
+ * and under each cipher, whose padding or tag takes up to one block. Directories are scanned in
+ * bands over the shared thread pool.
+ *
+ * @param path BMP file or directory of BMP files
+ * @param resultsFile Where to write the JSON lines, NULL for stdout. With a file a summary is
+ * printed
+ * @param options Options, threads sets how many threads share a directory
+ *
+ * @return 0 if every carrier was read, -1 otherwise
+ */
+int capacity(const char *path, const char *resultsFile, const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+
+    char **paths;
+    size_t count;
+    if (list_carrier_files(path, &paths, &count) != 0)
+        return -1;
+
+    capacity_entry *entries = calloc(count ? count : 1, sizeof(capacity_entry));
+    if (!entries) {
+        printerr("Memory allocation failed\n");
+        free_carrier_files(paths, count);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++)
+        entries[i].path = paths[i];
+
+    FILE *out = resultsFile ? fopen(resultsFile, "w") : stdout;
+    if (!out) {
+        printerr("Could not open results file: %s\n", resultsFile);
+        free(entries);
+        free_carrier_files(paths, count);
+        return -1;
+    }
+
+    encrypted_length(0, AES128, CBC);  // Fetch the ciphers before the clock starts
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    parallel_bands(count, SCAN_BAND, 1, query_band, entries);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        write_entry(out, &entries[i]);
+        failed += entries[i].status != 0;
+    }
+
+    int result = 0;
+    if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+        printerr("Could not write results file: %s\n", resultsFile ? resultsFile : "stdout");
+        result = -1;
+    }
+    free(entries);
+    free_carrier_files(paths, count);
+
+    if (resultsFile) {
+        char carriersStr[21], failedStr[21], msStr[32], perStr[32];
+        snprintf(carriersStr, sizeof(carriersStr), "%zu", count);
+        snprintf(failedStr, sizeof(failedStr), "%zu", failed);
+        snprintf(msStr, sizeof(msStr), "%.3f", ms);
+        snprintf(perStr, sizeof(perStr), "%.2f", count ? ms * 1e3 / count : 0);
+        print_table(failed ? "Capacity query finished with unreadable carriers"
+                           : "Capacity query finished",
+                    failed ? 0xed8796 : 0xa6da95,
+                    "Carriers",
+                    carriersStr,
+                    "Unreadable",
+                    failedStr,
+                    "Time (ms)",
+                    msStr,
+                    "Per carrier (us)",
+                    perStr,
+                    "Results file",
+                    resultsFile,
+                    NULL);
+    }
+    return result == 0 && failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,571 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "carrier_index.h"
+
+#define CARRIER_INDEX_MAGIC "SBCI"
+#define CARRIER_INDEX_VERSION 1
+
+/*
+ * Index file: a header, `count` fixed size records and the paths, each one null terminated.
+ * Numbers are stored in host byte order, like the key cache.
+ */
+typedef struct
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t pathsSize;
+} index_header;
+
+typedef struct
+{
+    uint64_t      pathOffset; /* Within the paths that follow the records */
+    uint64_t      size;
+    int64_t       mtime;
+    uint32_t      width;
+    uint32_t      height;
+    uint64_t      capacity[CAPACITY_METHODS];
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+} index_record;
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const carrier_entry *) a)->path, ((const carrier_entry *) b)->path);
+}
+
+/* Modification time of a file in nanoseconds */
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* Fill the entries of an index from the contents of an index file, checked as they go */
+static int parse_index(const uint8_t *buffer, size_t size, carrier_index *index) {
+    index_header header;
+    if (size < sizeof(header))
+        return -1;
+    memcpy(&header, buffer, sizeof(header));
+
+    size_t room = (size - sizeof(header)) / sizeof(index_record);
+    if (memcmp(header.magic, CARRIER_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CARRIER_INDEX_VERSION || header.recordSize != sizeof(index_record) ||
+        header.count > room ||
+        header.pathsSize != size - sizeof(header) - header.count * sizeof(index_record))
+        return -1;
+
+    const char *paths =
+        (const char *) buffer + sizeof(header) + header.count * sizeof(index_record);
+    if (header.pathsSize > 0 && paths[header.pathsSize - 1] != '\0')
+        return -1;
+
+    index->entries = calloc(header.count ? header.count : 1, sizeof(carrier_entry));
+    if (!index->entries)
+        return -1;
+    for (size_t i = 0; i < header.count; i++) {
+        index_record record;
+        memcpy(&record, buffer + sizeof(header) + i * sizeof(index_record), sizeof(record));
+        if (record.pathOffset >= header.pathsSize)
+            return -1;
+
+        carrier_entry *entry = &index->entries[index->count];
+        if (!(entry->path = strdup(paths + record.pathOffset)))
+            return -1;
+        index->count++;
+        entry->size   = record.size;
+        entry->mtime  = record.mtime;
+        entry->width  = record.width;
+        entry->height = record.height;
+        memcpy(entry->capacity, record.capacity, sizeof(entry->capacity));
+        memcpy(entry->hash, record.hash, sizeof(entry->hash));
+    }
+    qsort(index->entries, index->count, sizeof(carrier_entry), compare_paths);
+    return 0;
+}
+
+/**
+ * @brief Load a carrier index written by carrier_index_save
+ *
+ * @param indexFile Path of the index
+ * @param index Where to store the carriers, sorted by path
+ *
+ * @return 0 on success, -1 if the index can not be read or is not valid
+ *
+ * @note The caller is responsible for freeing the index with carrier_index_free
+ */
+int carrier_index_load(const char *indexFile, carrier_index *index) {
+    index->entries = NULL;
+    index->count   = 0;
+
+    FILE *file = fopen(indexFile, "rb");
+    if (!file) {
+        printerr("Could not open carrier index %s\n", indexFile);
+        return -1;
+    }
+
+    struct stat st;
+    uint8_t    *buffer = NULL;
+    int         result = -1;
+    if (fstat(fileno(file), &st) == 0 && (buffer = malloc(st.st_size ? st.st_size : 1)) &&
+        fread(buffer, 1, st.st_size, file) == (size_t) st.st_size)
+        result = parse_index(buffer, st.st_size, index);
+    fclose(file);
+    free(buffer);
+
+    if (result != 0) {
+        printerr("Carrier index %s is not valid\n", indexFile);
+        carrier_index_free(index);
+    }
+    return result;
+}
+
+/* Write the header, the records and the paths of an index */
+static int write_index(FILE *file, const carrier_index *index) {
+    index_header header = {
+        .magic      = CARRIER_INDEX_MAGIC,
+        .version    = CARRIER_INDEX_VERSION,
+        .recordSize = sizeof(index_record),
+        .count      = index->count,
+    };
+    for (size_t i = 0; i < index->count; i++)
+        header.pathsSize += strlen(index->entries[i].path) + 1;
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return -1;
+
+    uint64_t pathOffset = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        const carrier_entry *entry = &index->entries[i];
+
+        index_record record = {
+            .pathOffset = pathOffset,
+            .size       = entry->size,
+            .mtime      = entry->mtime,
+            .width      = entry->width,
+            .height     = entry->height,
+        };
+        memcpy(record.capacity, entry->capacity, sizeof(record.capacity));
+        memcpy(record.hash, entry->hash, sizeof(record.hash));
+        if (fwrite(&record, sizeof(record), 1, file) != 1)
+            return -1;
+        pathOffset += strlen(entry->path) + 1;
+    }
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (fwrite(index->entries[i].path, strlen(index->entries[i].path) + 1, 1, file) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write a carrier index, next to the index file and renamed over it
+ *
+ * @return 0 on success, -1 on failure (the previous index is left as it was)
+ */
+int carrier_index_save(const char *indexFile, const carrier_index *index) {
+    char *temporary = malloc(strlen(indexFile) + sizeof(".tmp"));
+    if (!temporary) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    strcpy(temporary, indexFile);
+    strcat(temporary, ".tmp");
+
+    int   result = -1;
+    FILE *file   = fopen(temporary, "wb");
+    if (file) {
+        result = write_index(file, index);
+        if (fclose(file) != 0 || (result == 0 && rename(temporary, indexFile) != 0))
+            result = -1;
+        if (result != 0)
+            unlink(temporary);
+    }
+    if (result != 0)
+        printerr("Could not write carrier index %s\n", indexFile);
+    free(temporary);
+    return result;
+}
+
+void carrier_index_free(carrier_index *index) {
+    for (size_t i = 0; i < index->count; i++)
+        free(index->entries[i].path);
+    free(index->entries);
+    index->entries = NULL;
+    index->count   = 0;
+}
+
+/* Add a carrier found by the scan, only its path, size and time are known yet */
+static int add_found(carrier_index *found, size_t *allocated, char *path, const struct stat *st) {
+    if (found->count == *allocated) {
+        size_t         more    = *allocated ? *allocated * 2 : 1024;
+        carrier_entry *entries = realloc(found->entries, more * sizeof(carrier_entry));
+        if (!entries)
+            return -1;
+        found->entries = entries;
+        *allocated     = more;
+    }
+
+    carrier_entry *entry = &found->entries[found->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->path  = path;
+    entry->size  = st->st_size;
+    entry->mtime = mtime_ns(st);
+    return 0;
+}
+
+/* Collect the .bmp files under a directory, symbolic links to directories are not followed */
+static int scan_directory(const char *directory, carrier_index *found, size_t *allocated) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        printerr("Could not open directory: %s\n", directory);
+        return -1;
+    }
+
+    int            result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (entry->d_name[0] == '.' ||
+            fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+        bool subdirectory = S_ISDIR(st.st_mode);
+        if (!subdirectory && (!is_carrier_name(entry->d_name) ||
+                              (S_ISLNK(st.st_mode) && fstatat(dirfd(dir), entry->d_name, &st, 0)) ||
+                              !S_ISREG(st.st_mode)))
+            continue;
+
+        char *path = malloc(strlen(directory) + strlen(entry->d_name) + 2);
+        if (!path) {
+            result = -1;
+            break;
+        }
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        if (subdirectory) {
+            result = scan_directory(path, found, allocated);
+            free(path);
+        }
+        else if (add_found(found, allocated, path, &st) != 0) {
+            free(path);
+            result = -1;
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+/* SHA-256 of a whole file */
+static int hash_file(const char *path, unsigned char hash[SHA256_DIGEST_LENGTH]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    void       *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    SHA256(map, st.st_size, hash);
+    munmap(map, st.st_size);
+    return 0;
+}
+
+typedef struct
+{
+    carrier_index *found;
+    size_t        *pending; /* Entries of found to read, the others were reused */
+    bool          *failed;  /* Per entry of found */
+} read_context;
+
+/* Read the headers and hash the contents of a carrier the index does not know yet */
+static void read_carrier(size_t task, void *context) {
+    read_context    *read     = context;
+    size_t           i        = read->pending[task];
+    carrier_entry   *entry    = &read->found->entries[i];
+    bool             quiet    = printerr_quiet(true);
+    carrier_capacity capacity = {0};
+
+    read->failed[i] = read_carrier_capacity(entry->path, &capacity) != 0 ||
+                      hash_file(entry->path, entry->hash) != 0;
+    entry->width  = capacity.width;
+    entry->height = capacity.height;
+    for (int method = 0; method < CAPACITY_METHODS; method++)
+        entry->capacity[method] = capacity.payload[method];
+    printerr_quiet(quiet);
+}
+
+/* Indexed entry for a path, NULL if there is none */
+static const carrier_entry *find_entry(const carrier_index *index, const char *path) {
+    carrier_entry key = {.path = (char *) path};
+    if (index->count == 0)
+        return NULL;
+    return bsearch(&key, index->entries, index->count, sizeof(carrier_entry), compare_paths);
+}
+
+/**
+ * @brief Index the carriers found under a directory and its subdirectories
+ *
+ * Every .bmp file gets its size, modification time, dimensions, payload capacity per method and
+ * the SHA-256 of its contents. Files already in the index with the same size and modification
+ * time are taken from it, so updating an index only reads new and modified carriers; carriers
+ * that are gone are dropped. The others are read over the shared thread pool.
+ *
+ * @param directory Directory holding the carriers
+ * @param indexFile Index to create or update
+ * @param options Options, threads sets how many carriers are read at a time
+ *
+ * @return 0 on success, -1 on failure (the previous index is left as it was)
+ */
+int carrier_index_build(const char         *directory,
+                        const char         *indexFile,
+                        const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    carrier_index previous = {0}, found = {0};
+    if (access(indexFile, F_OK) == 0 && carrier_index_load(indexFile, &previous) != 0)
+        return -1;
+
+    size_t allocated = 0;
+    if (scan_directory(directory, &found, &allocated) != 0) {
+        printerr("Could not scan carriers under %s\n", directory);
+        carrier_index_free(&previous);
+        carrier_index_free(&found);
+        return -1;
+    }
+    if (found.count > 1)
+        qsort(found.entries, found.count, sizeof(carrier_entry), compare_paths);
+
+    size_t *pending = malloc((found.count ? found.count : 1) * sizeof(size_t));
+    bool   *failed  = calloc(found.count ? found.count : 1, sizeof(bool));
+    if (!pending || !failed) {
+        printerr("Memory allocation failed\n");
+        free(pending);
+        free(failed);
+        carrier_index_free(&previous);
+        carrier_index_free(&found);
+        return -1;
+    }
+
+    // Reuse what the index already knows of unchanged carriers, read the others
+    size_t pendingCount = 0;
+    for (size_t i = 0; i < found.count; i++) {
+        carrier_entry       *entry = &found.entries[i];
+        const carrier_entry *known = find_entry(&previous, entry->path);
+        if (known && known->size == entry->size && known->mtime == entry->mtime) {
+            char *path  = entry->path;
+            *entry      = *known;
+            entry->path = path;
+        }
+        else {
+            pending[pendingCount++] = i;
+        }
+    }
+    carrier_index_free(&previous);
+
+    read_context context = {&found, pending, failed};
+    parallel_tasks(pendingCount, read_carrier, &context);
+
+    // Unreadable files are left out of the index
+    size_t kept = 0, unreadable = 0;
+    for (size_t i = 0; i < found.count; i++) {
+        if (failed[i]) {
+            free(found.entries[i].path);
+            unreadable++;
+        }
+        else {
+            found.entries[kept++] = found.entries[i];
+        }
+    }
+    found.count = kept;
+    free(pending);
+    free(failed);
+
+    int result = carrier_index_save(indexFile, &found);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    char carriersStr[21], reusedStr[21], readStr[21], unreadableStr[21], secondsStr[32];
+    snprintf(carriersStr, sizeof(carriersStr), "%zu", found.count);
+    snprintf(reusedStr, sizeof(reusedStr), "%zu", found.count + unreadable - pendingCount);
+    snprintf(readStr, sizeof(readStr), "%zu", pendingCount - unreadable);
+    snprintf(unreadableStr, sizeof(unreadableStr), "%zu", unreadable);
+    snprintf(secondsStr,
+             sizeof(secondsStr),
+             "%.3f",
+             (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+    carrier_index_free(&found);
+    if (result != 0)
+        return -1;
+
+    print_table("Carrier index updated",
+                0xa6da95,
+                "Carriers",
+                carriersStr,
+                "Unchanged",
+                reusedStr,
+                "Read and hashed",
+                readStr,
+                "Unreadable",
+                unreadableStr,
+                "Time (s)",
+                secondsStr,
+                "Index file",
+                indexFile,
+                NULL);
+    return 0;
+}
+
+typedef struct
+{
+    uint64_t capacity;
+    size_t   entry;
+} picker_slot;
+
+static int compare_slots(const void *a, const void *b) {
+    const picker_slot *x = a, *y = b;
+    if (x->capacity != y->capacity)
+        return x->capacity < y->capacity ? -1 : 1;
+    return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
+
+/**
+ * @brief Prepare to hand out the carriers of an index for a method, smallest fitting first
+ *
+ * @return 0 on success, -1 on failure, release the picker with carrier_picker_free
+ */
+int carrier_picker_init(carrier_picker *picker, const carrier_index *index, steg method) {
+    size_t       count = index->count;
+    picker_slot *slots = malloc((count ? count : 1) * sizeof(picker_slot));
+    picker->index      = index;
+    picker->method     = method;
+    picker->order      = malloc((count ? count : 1) * sizeof(size_t));
+    picker->next       = malloc((count + 1) * sizeof(size_t));
+    if (!slots || !picker->order || !picker->next) {
+        printerr("Memory allocation failed\n");
+        free(slots);
+        carrier_picker_free(picker);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        slots[i] = (picker_slot) {index->entries[i].capacity[method - 1], i};
+    qsort(slots, count, sizeof(picker_slot), compare_slots);
+    for (size_t i = 0; i < count; i++) {
+        picker->order[i] = slots[i].entry;
+        picker->next[i]  = i;
+    }
+    picker->next[count] = count;
+    free(slots);
+    return 0;
+}
+
+/* First unused position at or after position, compressing the chain of used ones on the way */
+static size_t first_unused(size_t *next, size_t position) {
+    size_t root = position;
+    while (next[root] != root)
+        root = next[root];
+    while (next[position] != root) {
+        size_t following = next[position];
+        next[position]   = root;
+        position         = following;
+    }
+    return root;
+}
+
+/* Whether a carrier file is still the one that was indexed */
+static bool carrier_unchanged(const carrier_entry *entry) {
+    struct stat st;
+    return stat(entry->path, &st) == 0 && (uint64_t) st.st_size == entry->size &&
+           mtime_ns(&st) == entry->mtime;
+}
+
+/**
+ * @brief Hand out the smallest unused carrier whose capacity holds a payload (best fit)
+ *
+ * Carriers are handed out once. A carrier whose file changed since it was indexed is skipped.
+ * Giving the payloads of a set in decreasing size places as many of them as possible.
+ *
+ * @param picker Picker set up by carrier_picker_init
+ * @param dataSize Payload size, see payload_size
+ *
+ * @return The carrier, NULL if no unused one fits
+ */
+const carrier_entry *carrier_pick(carrier_picker *picker, size_t dataSize) {
+    const carrier_index *index = picker->index;
+    size_t               low = 0, high = index->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->entries[picker->order[middle]].capacity[picker->method - 1] < dataSize)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (size_t position = first_unused(picker->next, low); position < index->count;
+         position        = first_unused(picker->next, position)) {
+        const carrier_entry *entry = &index->entries[picker->order[position]];
+        picker->next[position]     = position + 1;
+        if (carrier_unchanged(entry))
+            return entry;
+    }
+    return NULL;
+}
+
+void carrier_picker_free(carrier_picker *picker) {
+    free(picker->order);
+    free(picker->next);
+    picker->order = NULL;
+    picker->next  = NULL;
+}
+
+/**
+ * @brief Pick from an index the smallest carrier holding a message file (for --auto-carrier)
+ *
+ * @param indexFile Carrier index, see carrier_index_build
+ * @param messageFile Message to embed, only its size and name are used
+ * @param method Steganography method to use
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ *
+ * @return Path of the carrier, NULL if none fits. The caller is responsible for freeing it
+ */
+char *auto_carrier(const char *indexFile,
+                   const char *messageFile,
+                   steg        method,
+                   const char *pass,
+                   encryption  a,
+                   mode        m) {
+    size_t dataSize;
+    if (message_payload_size(messageFile, pass, a, m, &dataSize) != 0)
+        return NULL;
+
+    carrier_index index;
+    if (carrier_index_load(indexFile, &index) != 0)
+        return NULL;
+
+    char          *carrier = NULL;
+    carrier_picker picker;
+    if (carrier_picker_init(&picker, &index, method) == 0) {
+        const carrier_entry *entry = carrier_pick(&picker, dataSize);
+        if (!entry)
+            printerr("No indexed carrier holds a %s payload of %zu bytes\n",
+                     steg_str[method],
+                     dataSize);
+        else if (!(carrier = strdup(entry->path)))
+            printerr("Memory allocation failed\n");
+        carrier_picker_free(&picker);
+    }
+    carrier_index_free(&index);
+    return carrier;
+}
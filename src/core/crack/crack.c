@@ -0,0 +1,486 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "crack.h"
+
+#define UINT32_SIZE sizeof(uint32_t)  // Size of the payload size prefix = 4 bytes
+#define EXTENSION_MIN 2               // Shortest extension: a dot and the null terminator
+#define CRACK_CHUNK 4                 // Passwords handed to a thread at a time
+#define CRACK_METHODS 3               // LSB1, LSB4 and LSBI
+#define CRACK_CIPHERS 20              // Every algorithm in every mode it supports
+
+/* Ciphertext found under a steganography method */
+typedef struct
+{
+    steg           method;
+    unsigned char *cipher;
+    size_t         size;
+} crack_payload;
+
+/* Method, algorithm and mode tried with every password */
+typedef struct
+{
+    const crack_payload *payload;
+    encryption           a;
+    mode                 m;
+    const EVP_CIPHER    *cipher;
+    size_t               block; /* Cipher block size, 1 for the unpadded CFB8, OFB and AEAD */
+    size_t               nonce; /* Random nonce before the ciphertext, 0 if none */
+    size_t               tag;   /* Authentication tag after the ciphertext, 0 if none */
+} crack_candidate;
+
+typedef struct
+{
+    char                **words;
+    size_t                count;
+    crack_candidate       candidates[CRACK_METHODS * CRACK_CIPHERS];
+    size_t                candidateCount;
+    size_t                keyLength; /* Longest key and IV of the candidates */
+    atomic_size_t         best;      /* Lowest password * candidateCount + candidate found */
+    atomic_uint_fast64_t  tried;
+    atomic_uint_fast64_t  decrypted;
+} crack_job;
+
+/**
+ * @brief Read the wordlist, one password per line
+ *
+ * @return 0 on success, -1 on failure, the words point into *buffer and both are released with
+ * free()
+ */
+static int read_wordlist(const char *wordlist, char **buffer, char ***words, size_t *count) {
+    FILE *file = fopen(wordlist, "rb");
+    if (!file) {
+        printerr("Could not open wordlist %s\n", wordlist);
+        return -1;
+    }
+
+    struct stat st;
+    *buffer = NULL;
+    *words  = NULL;
+    if (fstat(fileno(file), &st) != 0 || !(*buffer = malloc(st.st_size + 1)) ||
+        fread(*buffer, 1, st.st_size, file) != (size_t) st.st_size) {
+        printerr("Could not read wordlist %s\n", wordlist);
+        fclose(file);
+        free(*buffer);
+        return -1;
+    }
+    fclose(file);
+    (*buffer)[st.st_size] = '\0';
+
+    size_t lines = 1;
+    for (off_t i = 0; i < st.st_size; i++)
+        lines += (*buffer)[i] == '\n';
+    if (!(*words = malloc(lines * sizeof(char *)))) {
+        printerr("Memory allocation failed\n");
+        free(*buffer);
+        return -1;
+    }
+
+    *count = 0;
+    for (char *line = *buffer, *next; line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+        if (*line)
+            (*words)[(*count)++] = line;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode the ciphertext a steganography method would have hidden in the carrier
+ *
+ * @return 0 on success, -1 if the method finds no payload that could be encrypted
+ */
+static int load_payload(BMP_FILE           *bmp,
+                        steg                method,
+                        const steg_options *options,
+                        crack_payload      *payload) {
+    lsb_reader reader;
+    payload->method = method;
+    bmp_use_alpha(bmp, options && options->alpha && method != LSBI);
+    if (steg_reader(bmp, method, &reader) != 0 || decode_size(bmp, &reader, &payload->size) != 0)
+        return -1;
+    if (payload->size < UINT32_SIZE + EXTENSION_MIN ||
+        bmp_load_channels(bmp, reader.channels(UINT32_SIZE + payload->size)) != 0) {
+        printerr("No encrypted payload found\n");
+        return -1;
+    }
+
+    if (!(payload->cipher = malloc(payload->size))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    stats_alloc(payload->size);
+    read_payload(&reader, bmp, UINT32_SIZE, payload->cipher, payload->size);
+    return 0;
+}
+
+/* Add the algorithms and modes that could have produced a ciphertext of the payload's size */
+static void add_candidates(crack_job *job, const crack_payload *payload, encryption a, mode m) {
+    for (encryption alg = AES128; alg <= CHACHA20; alg++) {
+        for (mode mod = ECB; mod <= POLY1305; mod++) {
+            const EVP_CIPHER *cipher = get_cipher(alg, mod);
+            if ((a && alg != a) || (m && mod != m) || !cipher)
+                continue;
+            // Padded modes only produce whole blocks, authenticated ones add their tag
+            size_t block = EVP_CIPHER_block_size(cipher);
+            size_t nonce = nonce_length(alg, mod);
+            size_t tag   = tag_length(alg, mod);
+            if (payload->size % block != 0 ||
+                payload->size < nonce + tag + UINT32_SIZE + EXTENSION_MIN)
+                continue;
+
+            // The nonce of authenticated modes is stored in the payload, only the key is derived
+            size_t keyLength =
+                EVP_CIPHER_key_length(cipher) + (nonce > 0 ? 0 : EVP_CIPHER_iv_length(cipher));
+            if (keyLength > job->keyLength)
+                job->keyLength = keyLength;
+            job->candidates[job->candidateCount++] =
+                (crack_candidate) {payload, alg, mod, cipher, block, nonce, tag};
+        }
+    }
+}
+
+/*
+ * Initialize a decryption with the first bytes of the derived key material, and the nonce stored
+ * at the start of the payload in authenticated modes
+ */
+static bool decrypt_init(EVP_CIPHER_CTX        *ctx,
+                         const crack_candidate *candidate,
+                         const unsigned char   *keyIv,
+                         int                    padding) {
+    int                  keyLength = EVP_CIPHER_key_length(candidate->cipher);
+    const unsigned char *iv        = NULL;
+    if (candidate->nonce > 0)
+        iv = candidate->payload->cipher;
+    else if (EVP_CIPHER_iv_length(candidate->cipher) > 0)
+        iv = keyIv + keyLength;
+    return EVP_DecryptInit_ex(ctx, candidate->cipher, NULL, keyIv, iv) == 1 &&
+           EVP_CIPHER_CTX_set_padding(ctx, padding) == 1;
+}
+
+/**
+ * @brief Cheap check of a key: decrypt the first block only and see whether the inner size
+ * prefix leaves room for an extension and the padding, and no more
+ *
+ * The plaintext is size | data | extension, with 2 to EXTENSION_MAX bytes of extension and, in
+ * padded modes, 1 to block bytes of padding. Authenticated modes have their nonce before the
+ * ciphertext and their tag after it. A wrong key passes with a chance of about
+ * (EXTENSION_MAX + block) in 2^32.
+ */
+static bool first_block_fits(EVP_CIPHER_CTX        *ctx,
+                             const crack_candidate *candidate,
+                             const unsigned char   *keyIv) {
+    unsigned char        plain[EVP_MAX_BLOCK_LENGTH * 2];
+    const unsigned char *text  = candidate->payload->cipher + candidate->nonce;
+    size_t               size  = candidate->payload->size - candidate->nonce - candidate->tag;
+    size_t               first = candidate->block > 1 ? candidate->block : UINT32_SIZE;
+    int                  len;
+    if (!decrypt_init(ctx, candidate, keyIv, 0) ||
+        EVP_DecryptUpdate(ctx, plain, &len, text, (int) first) != 1 ||
+        (size_t) len < UINT32_SIZE)
+        return false;
+
+    uint32_t fileSize;
+    memcpy(&fileSize, plain, UINT32_SIZE);
+    size_t used  = UINT32_SIZE + (size_t) ntohl(fileSize);  // Size prefix and file data
+    size_t most  = candidate->block > 1 ? size - 1 : size;  // Plaintext bytes, padding removed
+    size_t least = candidate->block > 1 ? size - candidate->block : size;
+    return used + EXTENSION_MIN <= most && used + EXTENSION_MAX >= least;
+}
+
+/**
+ * @brief Decrypt the whole payload and check the extension trailing the file data, in
+ * authenticated modes only once the tag checks out
+ *
+ * @return 0 if the plaintext is size | data | extension, -1 otherwise
+ */
+static int decrypt_candidate(const crack_candidate *candidate,
+                             const unsigned char   *keyIv,
+                             unsigned char        **plain,
+                             size_t                *fileSize) {
+    EVP_CIPHER_CTX      *ctx    = EVP_CIPHER_CTX_new();
+    const unsigned char *text   = candidate->payload->cipher + candidate->nonce;
+    size_t               size   = candidate->payload->size - candidate->nonce - candidate->tag;
+    int                  result = -1;
+    int                  len, last;
+
+    *plain = ctx ? malloc(size + EVP_MAX_BLOCK_LENGTH) : NULL;
+    if (*plain && decrypt_init(ctx, candidate, keyIv, 1) &&
+        (candidate->tag == 0 || cipher_stream_set_tag(ctx, text + size)) &&
+        EVP_DecryptUpdate(ctx, *plain, &len, text, (int) size) == 1 &&
+        EVP_DecryptFinal_ex(ctx, *plain + len, &last) == 1) {
+        size_t   plainSize = (size_t) len + last;
+        uint32_t prefix;
+        memcpy(&prefix, *plain, UINT32_SIZE);
+        *fileSize = ntohl(prefix);
+
+        size_t used = UINT32_SIZE + *fileSize;
+        if (plainSize >= UINT32_SIZE && used + EXTENSION_MIN <= plainSize &&
+            plainSize - used <= EXTENSION_MAX) {
+            const char *extension = (const char *) *plain + used;
+            size_t      length    = plainSize - used;
+            if (extension[0] == '.' && strnlen(extension, length) == length - 1)
+                result = 0;
+        }
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+    if (result != 0) {
+        free(*plain);
+        *plain = NULL;
+    }
+    return result;
+}
+
+/* Keep the lowest combination found, so the outcome does not depend on the threads */
+static void record_found(crack_job *job, size_t found) {
+    size_t best = atomic_load(&job->best);
+    while (found < best && !atomic_compare_exchange_weak(&job->best, &best, found))
+        ;
+}
+
+/* Try a few passwords against every candidate, deriving each key only once */
+static void crack_task(size_t task, void *context) {
+    crack_job      *job   = context;
+    EVP_CIPHER_CTX *ctx   = EVP_CIPHER_CTX_new();
+    size_t          begin = task * CRACK_CHUNK;
+    size_t          end   = begin + CRACK_CHUNK < job->count ? begin + CRACK_CHUNK : job->count;
+    unsigned char   keyIv[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+
+    for (size_t i = begin; ctx && i < end; i++) {
+        // A password listed earlier already matched
+        if (i * job->candidateCount >= atomic_load(&job->best))
+            break;
+        if (!derive_key_material(job->words[i], keyIv, job->keyLength))
+            continue;
+
+        for (size_t c = 0; c < job->candidateCount; c++) {
+            const crack_candidate *candidate = &job->candidates[c];
+            unsigned char         *plain;
+            size_t                 fileSize;
+            atomic_fetch_add(&job->tried, 1);
+            if (!first_block_fits(ctx, candidate, keyIv))
+                continue;
+            atomic_fetch_add(&job->decrypted, 1);
+            if (decrypt_candidate(candidate, keyIv, &plain, &fileSize) == 0) {
+                free(plain);
+                record_found(job, i * job->candidateCount + c);
+                break;
+            }
+        }
+    }
+
+    OPENSSL_cleanse(keyIv, sizeof(keyIv));
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+/* Write the file data of the plaintext to the output file followed by its extension */
+static int write_output(const char *outputFile, const unsigned char *plain, size_t fileSize) {
+    const char *extension = (const char *) plain + UINT32_SIZE + fileSize;
+    char       *path      = malloc(strlen(outputFile) + strlen(extension) + 1);
+    if (!path) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    strcpy(path, outputFile);
+    strcat(path, extension);
+
+    int   result = 0;
+    FILE *out    = fopen(path, "wb");
+    if (!out) {
+        printerr("Failed to open output file %s\n", path);
+        result = -1;
+    }
+    else if (fwrite(plain + UINT32_SIZE, 1, fileSize, out) != fileSize || fclose(out) != 0) {
+        printerr("Failed to write all data to output file\n");
+        remove(path);
+        result = -1;
+    }
+    else {
+        stats_count(STATS_BYTES_WRITTEN, fileSize);
+    }
+    free(path);
+    return result;
+}
+
+/* Decrypt the payload with the combination found and fill in the result */
+static int use_found(crack_job *job, const char *outputFile, crack_result *result) {
+    size_t                 best      = atomic_load(&job->best);
+    const char            *password  = job->words[best / job->candidateCount];
+    const crack_candidate *candidate = &job->candidates[best % job->candidateCount];
+    unsigned char          keyIv[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+    unsigned char         *plain = NULL;
+
+    int status = -1;
+    if (derive_key_material(password, keyIv, job->keyLength))
+        status = decrypt_candidate(candidate, keyIv, &plain, &result->dataSize);
+    OPENSSL_cleanse(keyIv, sizeof(keyIv));
+    if (status == 0 && outputFile)
+        status = write_output(outputFile, plain, result->dataSize);
+    free(plain);
+    if (status != 0)
+        return -1;
+
+    if (!(result->password = strdup(password))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    result->found  = true;
+    result->method = candidate->payload->method;
+    result->a      = candidate->a;
+    result->m      = candidate->m;
+    return 0;
+}
+
+/**
+ * @brief Look for the password, algorithm and mode of an encrypted payload among the words of a
+ * wordlist, without printing the outcome or exiting on errors
+ *
+ * The ciphertext of every candidate method is decoded once. Passwords are then handed to the
+ * threads of the shared pool a few at a time: each one derives its key material once, as long as
+ * the longest key and IV, and every algorithm and mode takes its key and IV from it. A key is
+ * rejected after decrypting its first block when the inner size prefix leaves no room for the
+ * extension, only the rare keys that pass are used to decrypt the whole payload and check its
+ * extension.
+ *
+ * @param carrierFile Path to the BMP file holding the encrypted payload
+ * @param wordlist Path to the list of passwords to try, one per line
+ * @param method Steganography method, STEG_NONE to try all of them
+ * @param a Encryption algorithm, ENC_NONE to try all of them
+ * @param m Encryption mode, MODE_NONE to try all of them
+ * @param outputFile Where to extract the payload once found, without the extension, may be NULL
+ * @param options Options, with mmap set the carrier is mapped and alpha applies to LSB1 and LSB4
+ * @param result Where to store the outcome, result->password is released with free()
+ *
+ * @return 0 when the attack ran (result->found tells whether it succeeded), -1 on failure
+ */
+int crack_file(const char         *carrierFile,
+               const char         *wordlist,
+               steg                method,
+               encryption          a,
+               mode                m,
+               const char         *outputFile,
+               const steg_options *options,
+               crack_result       *result) {
+    memset(result, 0, sizeof(*result));
+    BMP_FILE *bmp = options && options->mmap ? map_bmp(carrierFile, 0) : open_bmp(carrierFile);
+    if (!bmp) {
+        printerr("Could not read BMP file: %s\n", carrierFile);
+        return -1;
+    }
+
+    // Methods that were not asked for are only tried quietly
+    crack_payload payloads[CRACK_METHODS] = {0};
+    crack_job     job                     = {.best = SIZE_MAX};
+    for (steg candidate = LSB1; candidate <= LSBI; candidate++) {
+        if (method && candidate != method)
+            continue;
+        bool quiet = printerr_quiet(!method);
+        if (load_payload(bmp, candidate, options, &payloads[candidate - 1]) == 0)
+            add_candidates(&job, &payloads[candidate - 1], a, m);
+        printerr_quiet(quiet);
+    }
+    free_bmp(bmp);
+
+    char *buffer = NULL;
+    int   status = -1;
+    if (job.candidateCount == 0)
+        printerr("No encrypted payload found in %s\n", carrierFile);
+    else if (read_wordlist(wordlist, &buffer, &job.words, &job.count) == 0)
+        status = 0;
+
+    if (status == 0) {
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        parallel_tasks((job.count + CRACK_CHUNK - 1) / CRACK_CHUNK, crack_task, &job);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        result->ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+        result->tried     = atomic_load(&job.tried);
+        result->decrypted = atomic_load(&job.decrypted);
+        if (atomic_load(&job.best) != SIZE_MAX)
+            status = use_found(&job, outputFile, result);
+    }
+
+    for (size_t i = 0; i < CRACK_METHODS; i++)
+        free(payloads[i].cipher);
+    free(job.words);
+    free(buffer);
+    return status;
+}
+
+/**
+ * @brief Run a dictionary attack on the encrypted payload of a BMP file and print the outcome
+ *
+ * @param carrierFile Path to the BMP file holding the encrypted payload
+ * @param wordlist Path to the list of passwords to try, one per line
+ * @param method Steganography method, STEG_NONE to try all of them
+ * @param a Encryption algorithm, ENC_NONE to try all of them
+ * @param m Encryption mode, MODE_NONE to try all of them
+ * @param outputFile Where to extract the payload once found, without the extension, may be NULL
+ * @param options Options, threads sets how many passwords are tried at a time
+ */
+void crack(const char         *carrierFile,
+           const char         *wordlist,
+           steg                method,
+           encryption          a,
+           mode                m,
+           const char         *outputFile,
+           const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(EXIT_FAILURE);
+
+    crack_result result;
+    if (crack_file(carrierFile, wordlist, method, a, m, outputFile, options, &result) != 0)
+        exit(EXIT_FAILURE);
+
+    char triedStr[21], decryptedStr[21], msStr[32], rateStr[32], dataSizeStr[21];
+    snprintf(triedStr, sizeof(triedStr), "%" PRIu64, result.tried);
+    snprintf(decryptedStr, sizeof(decryptedStr), "%" PRIu64, result.decrypted);
+    snprintf(msStr, sizeof(msStr), "%.3f", result.ms);
+    snprintf(rateStr, sizeof(rateStr), "%.0f", result.ms > 0 ? result.tried * 1e3 / result.ms : 0);
+    snprintf(dataSizeStr, sizeof(dataSizeStr), "%zu", result.dataSize);
+
+    if (!result.found) {
+        print_table("Password not found in the wordlist",
+                    0xed8796,
+                    "Combinations tried",
+                    triedStr,
+                    "Fully decrypted",
+                    decryptedStr,
+                    "Time (ms)",
+                    msStr,
+                    "Combinations per s",
+                    rateStr,
+                    NULL);
+        exit(EXIT_FAILURE);
+    }
+
+    print_table("Password found",
+                0xa6da95,
+                "Password",
+                result.password,
+                "Steganography method",
+                steg_str[result.method],
+                "Encryption Algorithm",
+                encryption_str[result.a],
+                "Encryption Mode",
+                mode_str[result.m],
+                "Size (bytes)",
+                dataSizeStr,
+                "Output file",
+                outputFile ? outputFile : "None",
+                "Combinations tried",
+                triedStr,
+                "Fully decrypted",
+                decryptedStr,
+                "Time (ms)",
+                msStr,
+                "Combinations per s",
+                rateStr,
+                NULL);
+    free(result.password);
+}
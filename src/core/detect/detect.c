@@ -0,0 +1,217 @@
+#include <ctype.h>
+#include <time.h>
+
+#include "detect.h"
+
+#define UINT32_SIZE sizeof(uint32_t)  // Size of the payload size prefix = 4 bytes
+#define EXTENSION_MIN 2               // Shortest extension: a dot and the null terminator
+#define SCORE_PLAIN 95                // Size prefix and extension both check out
+#define SCORE_BLOCK16 60              // Ciphertext of whole AES (or 3DES) blocks
+#define SCORE_BLOCK8 50               // Ciphertext of whole 3DES blocks
+#define SCORE_STREAM 35               // Only CFB, OFB, GCM or Poly1305 produce this length
+#define SCORE_TINY 5                  // Too small for a payload, the prefix is likely noise
+
+typedef struct
+{
+    const BMP_FILE     *bmp;
+    const steg_options *options;
+    detect_candidate   *candidates;
+} detect_job;
+
+/**
+ * @brief Read what follows the data of a payload and keep it if it is an extension: a dot,
+ * printable characters and a null terminator
+ *
+ * @return true if the payload is a plain one
+ */
+static bool read_extension(const BMP_FILE   *bmp,
+                           const lsb_reader *reader,
+                           detect_candidate *candidate) {
+    size_t start = UINT32_SIZE + candidate->size;
+    size_t count = reader->maxDataBytes - start < EXTENSION_MAX ? reader->maxDataBytes - start
+                                                                : EXTENSION_MAX;
+    if (count < EXTENSION_MIN)
+        return false;
+
+    char extension[EXTENSION_MAX];
+    reader->read(reader, bmp, start, (unsigned char *) extension, count);
+    size_t length = strnlen(extension, count);
+    if (length == count || extension[0] != '.')
+        return false;
+    for (size_t i = 1; i < length; i++) {
+        if (!isgraph((unsigned char) extension[i]) || extension[i] == '/')
+            return false;
+    }
+    memcpy(candidate->extension, extension, length + 1);
+    return true;
+}
+
+/**
+ * @brief Score a candidate from 0 to 100
+ *
+ * A size prefix followed by a valid extension is a plain payload. Otherwise the payload may be a
+ * ciphertext, more likely when its length is a whole number of blocks. The size prefix read from
+ * untouched pixels is noise that fits the capacity by chance (capacity / 2^32), so large carriers
+ * lower the score of encrypted candidates.
+ */
+static int score_candidate(const detect_candidate *candidate, size_t capacity) {
+    if (!candidate->fits)
+        return 0;
+    if (candidate->plain)
+        return SCORE_PLAIN;
+    if (candidate->size < UINT32_SIZE + EXTENSION_MIN)
+        return SCORE_TINY;
+
+    int    score  = candidate->block == 16  ? SCORE_BLOCK16
+                    : candidate->block == 8 ? SCORE_BLOCK8
+                                            : SCORE_STREAM;
+    double chance = (double) capacity / 4294967296.0;
+    return (int) (score * (1 - (chance < 1 ? chance : 1)) + 0.5);
+}
+
+/* Decode the size prefix of one method and check what follows the data */
+static void detect_task(size_t task, void *context) {
+    detect_job       *job       = context;
+    detect_candidate *candidate = &job->candidates[task];
+    BMP_FILE          view      = *job->bmp;  // Own channel layout, the mapped pixels are shared
+    bool              quiet     = printerr_quiet(true);
+    lsb_reader        reader    = {0};
+
+    memset(candidate, 0, sizeof(*candidate));
+    candidate->method = (steg) (LSB1 + task);
+    candidate->block  = 1;
+    bmp_use_alpha(&view, job->options && job->options->alpha && candidate->method != LSBI);
+    if (steg_reader(&view, candidate->method, &reader) == 0 &&
+        decode_size(&view, &reader, &candidate->size) == 0) {
+        candidate->fits  = true;
+        candidate->block = candidate->size == 0        ? 1
+                           : candidate->size % 16 == 0 ? 16
+                           : candidate->size % 8 == 0  ? 8
+                                                       : 1;
+        candidate->plain = read_extension(&view, &reader, candidate);
+    }
+    candidate->score = score_candidate(candidate, reader.maxDataBytes);
+    printerr_quiet(quiet);
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const detect_candidate *first = a, *second = b;
+    if (first->score != second->score)
+        return second->score - first->score;
+    return (int) first->method - (int) second->method;
+}
+
+/**
+ * @brief Find which steganography method most likely hid a payload in a carrier, and whether the
+ * payload is encrypted
+ *
+ * The carrier is mapped once, the size prefix of every method is decoded on a task of the shared
+ * pool and only the pages holding the prefixes and the bytes after the data are read, so the
+ * time does not depend on the size of the image.
+ *
+ * @param carrierFile Path to the BMP file
+ * @param options Options, alpha applies to LSB1 and LSB4
+ * @param candidates Where to store the candidates, the most plausible first
+ *
+ * @return 0 on success, -1 if the carrier can not be read
+ */
+int detect_file(const char         *carrierFile,
+                const steg_options *options,
+                detect_candidate    candidates[DETECT_METHODS]) {
+    BMP_FILE *bmp = map_bmp(carrierFile, 0);
+    if (!bmp) {
+        printerr("Could not read BMP file: %s\n", carrierFile);
+        return -1;
+    }
+
+    detect_job job = {bmp, options, candidates};
+    parallel_tasks(DETECT_METHODS, detect_task, &job);
+    free_bmp(bmp);
+
+    qsort(candidates, DETECT_METHODS, sizeof(detect_candidate), compare_candidates);
+    return 0;
+}
+
+/* Describe a candidate in a few words */
+static void describe(const detect_candidate *candidate, char *text, size_t size) {
+    if (!candidate->fits)
+        snprintf(text, size, "%d: size over capacity", candidate->score);
+    else if (candidate->plain)
+        snprintf(text, size, "%d: plain, %.16s", candidate->score, candidate->extension);
+    else if (candidate->block > 1)
+        snprintf(text, size, "%d: encrypted, %zu-B blocks", candidate->score, candidate->block);
+    else
+        snprintf(text, size, "%d: encrypted, stream/AEAD", candidate->score);
+}
+
+/**
+ * @brief Detect the steganography method and encryption of a carrier and print the candidates
+ * ranked by plausibility
+ *
+ * @param carrierFile Path to the BMP file
+ * @param options Options, threads sets how many methods are checked at a time
+ */
+void detect(const char *carrierFile, const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(EXIT_FAILURE);
+
+    struct timespec  start, stop;
+    detect_candidate candidates[DETECT_METHODS];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (detect_file(carrierFile, options, candidates) != 0)
+        exit(EXIT_FAILURE);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double us = (stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_nsec - start.tv_nsec) / 1e3;
+
+    const detect_candidate *best = &candidates[0];
+    char                    sizeStr[21], scoreStr[12], usStr[32], detail[EXTENSION_MAX + 32];
+    snprintf(sizeStr, sizeof(sizeStr), "%zu", best->size);
+    snprintf(scoreStr, sizeof(scoreStr), "%d", best->score);
+    snprintf(usStr, sizeof(usStr), "%.1f", us);
+    if (best->plain)
+        snprintf(detail, sizeof(detail), "%s", best->extension);
+    else if (best->block == 16)
+        snprintf(detail, sizeof(detail), "AES/3DES, or CFB/OFB/AEAD");
+    else if (best->block == 8)
+        snprintf(detail, sizeof(detail), "3DES, or CFB/OFB/AEAD");
+    else
+        snprintf(detail, sizeof(detail), "CFB, OFB, GCM or Poly1305");
+
+    if (best->score == 0) {
+        print_table("No payload detected", 0xed8796, "Time (us)", usStr, NULL);
+    }
+    else {
+        print_table("Payload detected",
+                    0xa6da95,
+                    "Likely method",
+                    steg_str[best->method],
+                    "Encrypted",
+                    best->plain ? "No" : "Yes",
+                    "Size (bytes)",
+                    sizeStr,
+                    best->plain ? "Extension" : "Possible ciphers",
+                    detail,
+                    "Score",
+                    scoreStr,
+                    "Time (us)",
+                    usStr,
+                    NULL);
+    }
+
+    char ranks[DETECT_METHODS][24], texts[DETECT_METHODS][48];
+    for (int i = 0; i < DETECT_METHODS; i++) {
+        snprintf(ranks[i], sizeof(ranks[i]), "%d. %s", i + 1, steg_str[candidates[i].method]);
+        describe(&candidates[i], texts[i], sizeof(texts[i]));
+    }
+    print_table("Methods by plausibility",
+                best->score ? 0xa6da95 : 0xed8796,
+                ranks[0],
+                texts[0],
+                ranks[1],
+                texts[1],
+                ranks[2],
+                texts[2],
+                NULL);
+    if (best->score == 0)
+        exit(EXIT_FAILURE);
+}
@@ -1,7 +1,86 @@
+#include <inttypes.h>
+
 #include "embedding.h"
+#include "extraction.h"
+
+/* Remove a partially written output file */
+static void remove_output(const char *outputFile) {
+    char *filename = bmp_output_filename(outputFile);
+    if (filename) {
+        remove(filename);
+        if (filename != outputFile)
+            free(filename);
+    }
+}
+
+typedef struct
+{
+    BMP_FILE            *bmp;
+    size_t               offset;
+    const unsigned char *data;
+    lsb_writer           write;
+    bool                 counting; /* Count the channels changed, reading them through reader */
+    lsb_reader           reader;
+} write_context;
+
+/* Count the channels a band is about to change: LSB1 bits or LSB4 nibbles that differ */
+static void count_changes(const write_context *band, size_t begin, size_t end) {
+    unsigned char *previous = malloc(end - begin);
+    if (!previous)
+        return;
+    band->reader.read(&band->reader, band->bmp, band->offset + begin, previous, end - begin);
+
+    uint64_t changed = 0;
+    for (size_t i = begin; i < end; i++) {
+        uint8_t diff = previous[i - begin] ^ band->data[i];
+        if (band->write == lsb1_write)
+            changed += __builtin_popcount(diff);
+        else
+            changed += ((diff & 0xF0) != 0) + ((diff & 0x0F) != 0);
+    }
+    free(previous);
+    stats_add(STATS_CHANNELS_MODIFIED, changed);
+}
+
+static void write_band(size_t begin, size_t end, void *context) {
+    write_context *band = context;
+    if (band->counting)
+        count_changes(band, begin, end);
+    band->write(band->bmp, band->offset + begin, band->data + begin, end - begin);
+}
 
 /**
- * @brief Embed a message into a BMP file using the specified steganography method
+ * @brief Store the payload with a byte oriented method, split in bands across the shared pool
+ *
+ * Every payload byte owns its channels, so bands never share a channel and the result is the
+ * same whatever the number of threads.
+ *
+ * @param bmp BMP file structure to embed the data into
+ * @param offset Offset of the first byte within the payload
+ * @param data Data to embed
+ * @param dataSize Size of the data to embed
+ * @param write Function storing a range of payload bytes
+ * @param channelsPerByte Color channels taken by each payload byte
+ */
+void write_payload(BMP_FILE            *bmp,
+                   size_t               offset,
+                   const unsigned char *data,
+                   size_t               dataSize,
+                   lsb_writer           write,
+                   size_t               channelsPerByte) {
+    write_context context = {bmp, offset, data, write, false, {0}};
+    uint64_t      span    = stats_begin();
+    if (span && write == lsb1_write)
+        context.counting = lsb1_reader(bmp, &context.reader) == 0;
+    else if (span && write == lsb4_write)
+        context.counting = lsb4_reader(bmp, &context.reader) == 0;
+    parallel_bands(dataSize, STEG_BAND_CHANNELS / channelsPerByte, 1, write_band, &context);
+    stats_end(STATS_LSB_EMBED, span);
+}
+
+/**
+ * @brief Embed a message file into a BMP file and write the output file, without printing the
+ * outcome or exiting on errors
  *
  * @param carrierFile Path to the BMP file to embed the message into
  * @param messageFile Path to the file containing the message to embed
@@ -9,65 +88,105 @@
  * @param method Steganography method to use
  * @param a Encryption algorithm to use
  * @param m Encryption mode to use
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param options Embedding options, with mmap set the carrier is copied to the output file and
+ * only the pages that receive payload bits are touched
+ * @param dataSize Pointer to store the size of the embedded payload
+ * @param report Where to store the LSBI inversion map and change counts, may be NULL
  *
- * @note To ensure encryption a password must be provided
+ * @return 0 on success, -1 on failure (no output file is left behind)
  */
-void embed(const char *carrierFile,
-           const char *messageFile,
-           const char *outputFile,
-           steg        method,
-           encryption  a,
-           mode        m,
-           const char *pass) {
-    BMP_FILE *bmp = read_bmp(carrierFile);
+int embed_file(const char         *carrierFile,
+               const char         *messageFile,
+               const char         *outputFile,
+               steg                method,
+               encryption          a,
+               mode                m,
+               const char         *pass,
+               const steg_options *options,
+               size_t             *dataSize,
+               lsbi_report        *report) {
+    int       mapped = options && options->mmap;
+    BMP_FILE *bmp    = mapped ? map_bmp_into(carrierFile, outputFile) : read_bmp(carrierFile);
     if (!bmp) {
         printerr("Could not read BMP file %s\n", carrierFile);
-        exit(1);
+        return -1;
     }
+    bmp_use_alpha(bmp, options && options->alpha && method != LSBI);
 
-    /* dataSize | (embeddigData[data] | embeddingData[extension]) */
-    size_t         dataSize;
-    unsigned char *embeddingData = prepare_embedding_data(messageFile, &dataSize, pass, a, m);
-
-    int result = 0;
-    /* Select the steganography method and embed the message into bmp*/
-    switch (method) {
-        case LSB1:
-            result = lsb1_encode(bmp, embeddingData, dataSize);
-            break;
-        case LSB4:
-            result = lsb4_encode(bmp, embeddingData, dataSize);
-            break;
-        case LSBI:
-            result = lsbi_encode(bmp, embeddingData, dataSize);
-            break;
-        default:
-            printerr("Invalid steganography method\n");
-            free_bmp(bmp);
-            free(embeddingData);
-            exit(1);
-    }
+    /* The message is read, encrypted and embedded in chunks: dataSize | data | extension */
+    int result = -1;
+    *dataSize  = 0;
+    if (method == LSB1 || method == LSB4 || method == LSBI)
+        result = embed_message(bmp, method, messageFile, pass, a, m, dataSize, report);
+    else
+        printerr("Invalid steganography method\n");
 
     if (result == -1) {
         printerr("Error embedding data\n");
         free_bmp(bmp);
-        free(embeddingData);
-        exit(1);
+        if (mapped)
+            remove_output(outputFile);
+        return -1;
     }
-    /* Write the new bmp to outputfile*/
-    if (write_bmp(outputFile, bmp) != 0) {
+    /* Write the new bmp to outputfile, a mapped output already holds it */
+    if (!mapped && write_bmp(outputFile, bmp) != 0) {
         printerr("Could not write BMP file %s\n", outputFile);
         free_bmp(bmp);
-        free(embeddingData);
-        exit(1);
+        return -1;
     }
 
     free_bmp(bmp);
-    free(embeddingData);
+    return 0;
+}
+
+/**
+ * @brief Embed a message into a BMP file using the specified steganography method
+ *
+ * @param carrierFile Path to the BMP file to embed the message into
+ * @param messageFile Path to the file containing the message to embed
+ * @param outputFile Path to the output BMP file
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param options Embedding options, with mmap set the carrier is copied to the output file and
+ * only the pages that receive payload bits are touched, threads sets how many threads share the
+ * embedding and keyCache names a file keeping derived keys across runs
+ *
+ * @note To ensure encryption a password must be provided
+ */
+void embed(const char         *carrierFile,
+           const char         *messageFile,
+           const char         *outputFile,
+           steg                method,
+           encryption          a,
+           mode                m,
+           const char         *pass,
+           const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(1);
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
+        exit(1);
+
+    size_t      dataSize;
+    lsbi_report report = {0};
+    if (embed_file(carrierFile,
+                   messageFile,
+                   outputFile,
+                   method,
+                   a,
+                   m,
+                   pass,
+                   options,
+                   &dataSize,
+                   &report) != 0)
+        exit(1);
+    key_cache_save();
 
     /*******************************************************************/
     char dataSizeStr[20];
     snprintf(dataSizeStr, sizeof(dataSizeStr), "%zu", dataSize);
+    const char *cached = key_cache_avoided() ? "Yes" : "No";
     print_table("Successfully embedded data into BMP file",
                 0xa6da95,
                 "Output file",
@@ -82,5 +201,25 @@ void embed(const char *carrierFile,
                 mode_str[m],
                 "Password",
                 pass,
+                options && options->keyCache ? "Key from cache" : NULL,
+                cached,
                 NULL);
+
+    if (method == LSBI) {
+        char mapStr[5], changesStr[21], avoidedStr[21];
+        for (int pattern = 0; pattern < 4; pattern++)
+            mapStr[pattern] = (report.inversionMap >> (3 - pattern)) & 1 ? '1' : '0';
+        mapStr[4] = '\0';
+        snprintf(changesStr, sizeof(changesStr), "%" PRIu64, report.changes);
+        snprintf(avoidedStr, sizeof(avoidedStr), "%" PRIu64, report.changesAvoided);
+        print_table("LSBI inversion map",
+                    0xa6da95,
+                    "Inverted patterns",
+                    mapStr,
+                    "LSBs changed",
+                    changesStr,
+                    "Changes avoided",
+                    avoidedStr,
+                    NULL);
+    }
 }
@@ -0,0 +1,402 @@
+#include <sys/stat.h>
+
+#include "embedding.h"
+
+#define UINT32_SIZE sizeof(uint32_t)  // Size of the payload size prefix = 4 bytes
+#define STREAM_CHUNK (1024 * 1024)    // Message bytes read and embedded at a time
+#define DEFAULT_EXTENSION ".txt"      // Default extension if none is found
+#define EXTENSION_SEPARATOR '.'       // Magic string for file extension separator
+
+/* Where the payload goes: the carrier, through the selected steganography method */
+typedef struct
+{
+    BMP_FILE       *bmp;
+    steg            method;
+    EVP_CIPHER_CTX *cipher;      // NULL for plain payloads
+    size_t          tagLength;   // Authentication tag embedded after the ciphertext, 0 if none
+    unsigned char  *cipherOut;   // Ciphertext of the chunk being embedded
+    size_t          offset;      // Payload bytes embedded so far
+    uint64_t        changes[4];  // LSBI histogram of the embedded bytes
+    uint64_t        totals[4];
+} payload_stream;
+
+/**
+ * @brief Largest payload (size prefix included) a steganography method can embed into a BMP file
+ *
+ * @param bmp BMP file structure, only the headers are used
+ * @param method Steganography method
+ *
+ * @return Capacity in bytes, 0 for an invalid method
+ */
+size_t embedding_capacity(const BMP_FILE *bmp, steg method) {
+    size_t channels = bmp_channels(bmp);
+
+    switch (method) {
+        case LSB1:
+            return channels / 8;
+        case LSB4:
+            return channels / 2;
+        case LSBI:
+            return lsbi_capacity(bmp);
+        default:
+            return 0;
+    }
+}
+
+/* Store payload bytes [offset, offset + count) in the carrier */
+static void stream_store(payload_stream      *stream,
+                         size_t               offset,
+                         const unsigned char *src,
+                         size_t               count) {
+    uint64_t span;
+    switch (stream->method) {
+        case LSB1:
+            write_payload(stream->bmp, offset, src, count, lsb1_write, 8);
+            break;
+        case LSB4:
+            write_payload(stream->bmp, offset, src, count, lsb4_write, 2);
+            break;
+        case LSBI:
+            // The map is only known at the end: count now, store as is, invert at the end
+            span = stats_begin();
+            lsbi_histogram(stream->bmp, offset, src, count, stream->changes, stream->totals);
+            lsbi_write(stream->bmp, offset, src, count, 0);
+            stats_end(STATS_LSB_EMBED, span);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Draw the random nonce of authenticated modes and embed it right after the size prefix */
+static int stream_nonce(payload_stream *stream) {
+    if (!stream->cipher || stream->tagLength == 0)
+        return 0;
+    if (cipher_stream_new_nonce(stream->cipher, stream->cipherOut) != 1) {
+        printerr("Error generating the nonce\n");
+        return -1;
+    }
+    stream_store(stream, stream->offset, stream->cipherOut, AEAD_NONCE_LENGTH);
+    stream->offset += AEAD_NONCE_LENGTH;
+    return 0;
+}
+
+/* Encrypt if needed and embed the next plaintext bytes of the payload */
+static int stream_feed(payload_stream *stream, const unsigned char *src, size_t count) {
+    if (!stream->cipher) {
+        stream_store(stream, stream->offset, src, count);
+        stream->offset += count;
+        return 0;
+    }
+
+    int      len;
+    uint64_t span = stats_begin();
+    if (EVP_EncryptUpdate(stream->cipher, stream->cipherOut, &len, src, (int) count) != 1) {
+        printerr("Error during encryption\n");
+        return -1;
+    }
+    stats_end(STATS_CIPHER, span);
+    stream_store(stream, stream->offset, stream->cipherOut, len);
+    stream->offset += len;
+    return 0;
+}
+
+/* Flush the cipher, append the tag of authenticated modes and fill in the size prefix */
+static int stream_finish(payload_stream *stream, lsbi_report *report) {
+    if (stream->cipher) {
+        int      len;
+        uint64_t span = stats_begin();
+        if (EVP_EncryptFinal_ex(stream->cipher, stream->cipherOut, &len) != 1) {
+            printerr("Error during final encryption\n");
+            return -1;
+        }
+        stream_store(stream, stream->offset, stream->cipherOut, len);
+        stream->offset += len;
+        if (stream->tagLength > 0) {
+            if (cipher_stream_get_tag(stream->cipher, stream->cipherOut) != 1) {
+                printerr("Error getting the authentication tag\n");
+                return -1;
+            }
+            stream_store(stream, stream->offset, stream->cipherOut, stream->tagLength);
+            stream->offset += stream->tagLength;
+        }
+        stats_end(STATS_CIPHER, span);
+
+        uint32_t encryptedSize = htonl((uint32_t) (stream->offset - UINT32_SIZE));
+        stream_store(stream, 0, (const unsigned char *) &encryptedSize, UINT32_SIZE);
+    }
+
+    if (stream->method == LSBI) {
+        lsbi_report chosen;
+        uint64_t    span = stats_begin();
+        uint8_t     map  = lsbi_choose_map(stream->changes, stream->totals, &chosen);
+        lsbi_store_map(stream->bmp, map);
+        lsbi_invert(stream->bmp, stream->offset, map);
+        stats_end(STATS_LSB_EMBED, span);
+        stats_count(STATS_CHANNELS_MODIFIED, chosen.changes);
+        if (report)
+            *report = chosen;
+    }
+    return 0;
+}
+
+/* Feed size | data | extension through the stream, one chunk of the message at a time */
+static int stream_message(payload_stream      *stream,
+                          FILE                *file,
+                          const unsigned char *message,
+                          size_t               messageSize,
+                          const char          *extension,
+                          unsigned char       *chunk,
+                          lsbi_report         *report) {
+    uint32_t size = htonl((uint32_t) messageSize);
+    if (stream_feed(stream, (const unsigned char *) &size, UINT32_SIZE) != 0)
+        return -1;
+
+    // A message already in memory is fed as is, a message file is read one chunk at a time
+    for (size_t done = 0; done < messageSize;) {
+        size_t               count = messageSize - done < STREAM_CHUNK ? messageSize - done
+                                                                           : STREAM_CHUNK;
+        const unsigned char *src   = message ? message + done : chunk;
+        if (!message) {
+            uint64_t span = stats_begin();
+            if ((count = fread(chunk, 1, count, file)) == 0) {
+                printerr("Could not read the message file\n");
+                return -1;
+            }
+            stats_count(STATS_BYTES_READ, count);
+            stats_end(STATS_PREPARE, span);
+        }
+        if (stream_feed(stream, src, count) != 0)
+            return -1;
+        done += count;
+    }
+
+    if (stream_feed(stream, (const unsigned char *) extension, strlen(extension) + 1) != 0)
+        return -1;
+    return stream_finish(stream, report);
+}
+
+/**
+ * @brief Size of the payload embedded for a message: size | data | extension, encrypted payloads
+ * are size | ciphertext(size | data | extension), GCM and Poly1305 ones size | nonce |
+ * ciphertext(size | data | extension) | tag
+ *
+ * @param messageSize Size of the message
+ * @param extension Extension stored after the message, null terminator excluded
+ * @param pass Password to encrypt the data, NULL for plain payloads
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ *
+ * @return Payload size in bytes
+ */
+size_t payload_size(
+    size_t messageSize, const char *extension, const char *pass, encryption a, mode m) {
+    size_t plainSize = UINT32_SIZE + messageSize + strlen(extension) + 1;
+    return pass ? UINT32_SIZE + encrypted_length(plainSize, a, m) : plainSize;
+}
+
+/* Extension stored for a message file: from its name, or the default if it has none */
+static const char *message_extension(const char *messageFile) {
+    const char *extension = strrchr(messageFile, EXTENSION_SEPARATOR);
+    return extension ? extension : DEFAULT_EXTENSION;
+}
+
+/**
+ * @brief Size of the payload embed_message would embed for a message file, without reading it
+ *
+ * @param messageFile Path to the message file
+ * @param pass Password to encrypt the data, NULL for plain payloads
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param dataSize Where to store the payload size
+ *
+ * @return 0 on success, -1 if the file can not be used as a message
+ */
+int message_payload_size(
+    const char *messageFile, const char *pass, encryption a, mode m, size_t *dataSize) {
+    struct stat st;
+    if (stat(messageFile, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > UINT32_MAX) {
+        printerr("Could not read message file: %s\n", messageFile);
+        return -1;
+    }
+    *dataSize = payload_size(st.st_size, message_extension(messageFile), pass, a, m);
+    return 0;
+}
+
+/**
+ * @brief Room left for a message and its extension (null terminator included) by a payload of
+ * at most capacity bytes, the inverse of payload_size
+ *
+ * @param capacity Payload bytes the carrier holds, see embedding_capacity
+ * @param encrypted Whether the payload is encrypted with a and m, which adds a size prefix and
+ * the padding or authentication tag of the cipher
+ *
+ * @return Largest messageSize + strlen(extension) + 1 that fits
+ */
+size_t payload_room(size_t capacity, bool encrypted, encryption a, mode m) {
+    if (capacity < UINT32_SIZE)
+        return 0;
+    size_t room = capacity - UINT32_SIZE;
+    if (!encrypted)
+        return room;
+
+    // The padding or tag is at most one block, the first plaintext whose ciphertext fits is close
+    size_t ciphertext = room;
+    while (room > 0 && encrypted_length(room, a, m) > ciphertext)
+        room--;
+    return room < UINT32_SIZE || encrypted_length(room, a, m) == 0 ? 0 : room - UINT32_SIZE;
+}
+
+/* Check the capacity, then stream the message (from a file or from memory) into the carrier */
+static int embed_stream(BMP_FILE            *bmp,
+                        steg                 method,
+                        FILE                *file,
+                        const unsigned char *message,
+                        size_t               messageSize,
+                        const char          *extension,
+                        const char          *pass,
+                        encryption           a,
+                        mode                 m,
+                        size_t              *dataSize,
+                        lsbi_report         *report) {
+    *dataSize       = payload_size(messageSize, extension, pass, a, m);
+    size_t capacity = embedding_capacity(bmp, method);
+    if (*dataSize > capacity) {
+        printerr(
+            "Data size exceeds the maximum embedding capacity. You are trying to embed %zu bytes, "
+            "but the maximum capacity is %zu bytes.\n",
+            *dataSize,
+            capacity);
+        return -1;
+    }
+
+    payload_stream stream = {.bmp = bmp, .method = method};
+    unsigned char *chunk  = message ? NULL : malloc(STREAM_CHUNK);
+    if (pass) {
+        stream.cipher    = cipher_stream_new(pass, a, m, 1);
+        stream.tagLength = tag_length(a, m);
+        stream.cipherOut = malloc(STREAM_CHUNK + EVP_MAX_BLOCK_LENGTH);
+        stream.offset    = UINT32_SIZE;  // The size prefix is stored last
+    }
+
+    stats_alloc(chunk ? STREAM_CHUNK : 0);
+    stats_alloc(stream.cipherOut ? STREAM_CHUNK + EVP_MAX_BLOCK_LENGTH : 0);
+
+    int result = -1;
+    if (pass && !stream.cipher) {
+        printerr("Error encrypting data\n");
+    }
+    else if ((!message && !chunk) || (pass && !stream.cipherOut)) {
+        printerr("Memory allocation failed\n");
+    }
+    else if (stream_nonce(&stream) == 0) {
+        result = stream_message(&stream, file, message, messageSize, extension, chunk, report);
+    }
+    *dataSize = stream.offset;
+
+    free(chunk);
+    free(stream.cipherOut);
+    EVP_CIPHER_CTX_free(stream.cipher);
+    return result;
+}
+
+/**
+ * @brief Embed a message file into a BMP file, reading, encrypting and embedding it in chunks
+ *
+ * The payload has the same layout as the one built by prepare_embedding_data, but only one chunk
+ * of the message is held in memory at a time: every chunk goes through EVP_EncryptUpdate and its
+ * ciphertext is embedded right away at its offset. The size prefix of encrypted payloads is
+ * embedded once the cipher has been flushed, after the tag of the authenticated modes.
+ *
+ * @param bmp BMP file structure to embed the message into
+ * @param method Steganography method to use
+ * @param messageFile Path to the message file
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param dataSize Pointer to store the size of the embedded payload
+ * @param report Where to store the LSBI inversion map and change counts, may be NULL
+ *
+ * @return 0 on success, -1 on failure
+ */
+int embed_message(BMP_FILE    *bmp,
+                  steg         method,
+                  const char  *messageFile,
+                  const char  *pass,
+                  encryption   a,
+                  mode         m,
+                  size_t      *dataSize,
+                  lsbi_report *report) {
+    FILE *file = fopen(messageFile, "rb");
+    if (!file) {
+        printerr("Could not open message file: %s\n", messageFile);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+    if (fileSize < 0 || (unsigned long) fileSize > UINT32_MAX) {
+        printerr("Could not read message file: %s\n", messageFile);
+        fclose(file);
+        return -1;
+    }
+
+    int result = embed_stream(bmp,
+                              method,
+                              file,
+                              NULL,
+                              (size_t) fileSize,
+                              message_extension(messageFile),
+                              pass,
+                              a,
+                              m,
+                              dataSize,
+                              report);
+    fclose(file);
+    return result;
+}
+
+/**
+ * @brief Embed a message held in memory into a BMP file, with the same payload layout as
+ * embed_message
+ *
+ * @param bmp BMP file structure to embed the message into
+ * @param method Steganography method to use
+ * @param message Message to embed
+ * @param messageSize Size of the message, at most UINT32_MAX
+ * @param extension Extension stored after the message (".txt" when NULL)
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param dataSize Pointer to store the size of the embedded payload
+ * @param report Where to store the LSBI inversion map and change counts, may be NULL
+ *
+ * @return 0 on success, -1 on failure
+ */
+int embed_buffer(BMP_FILE            *bmp,
+                 steg                 method,
+                 const unsigned char *message,
+                 size_t               messageSize,
+                 const char          *extension,
+                 const char          *pass,
+                 encryption           a,
+                 mode                 m,
+                 size_t              *dataSize,
+                 lsbi_report         *report) {
+    if (messageSize > UINT32_MAX) {
+        printerr("Message too large: %zu bytes\n", messageSize);
+        return -1;
+    }
+    return embed_stream(bmp,
+                        method,
+                        NULL,
+                        message ? message : (const unsigned char *) "",
+                        messageSize,
+                        extension ? extension : DEFAULT_EXTENSION,
+                        pass,
+                        a,
+                        m,
+                        dataSize,
+                        report);
+}
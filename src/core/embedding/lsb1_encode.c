@@ -1,4 +1,63 @@
 #include "embedding.h"
+#include "lsb_kernels.h"
+
+/* Store a single payload bit (bit `bit` of src, MSB first) in the LSB of a channel */
+static inline void put_bit(uint8_t *channel, const unsigned char *src, size_t bit) {
+    *channel = (*channel & 0xFE) | ((src[bit / 8] >> (7 - bit % 8)) & 0x01);
+}
+
+/* Payload bits stored into the runs of channels of a row */
+typedef struct
+{
+    const lsb_kernels   *kernels;
+    const unsigned char *src;
+    size_t               bit;  // Next bit of src to embed
+} store_run_context;
+
+/* Store payload bits into channels [k, end) of a run */
+static void store_run(uint8_t *colors, size_t k, size_t end, void *context) {
+    store_run_context   *run = context;
+    const unsigned char *src = run->src;
+
+    // Finish the byte started in the previous run
+    for (; k < end && run->bit % 8 != 0; k++, run->bit++)
+        put_bit(&colors[k], src, run->bit);
+
+    size_t bytes = (end - k) / 8;
+    run->kernels->lsb1_embed(colors + k, src + run->bit / 8, bytes);
+    k += bytes * 8;
+    run->bit += bytes * 8;
+
+    // Start the byte that continues in the next run
+    for (; k < end; k++, run->bit++)
+        put_bit(&colors[k], src, run->bit);
+}
+
+/**
+ * @brief Store payload bytes with LSB1 starting at the given payload offset
+ *
+ * Byte aligned runs of each row go through the vector kernels, only the bits of a byte split
+ * between two runs are stored one at a time.
+ *
+ * @param bmp BMP file structure to embed the bytes into
+ * @param offset Offset of the first byte within the payload
+ * @param src Bytes to embed
+ * @param count Number of bytes to embed
+ */
+void lsb1_write(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count) {
+    store_run_context run         = {.kernels = lsb_kernels_get(), .src = src, .bit = 0};
+    size_t            rowChannels = bmp_row_channels(bmp);
+    size_t            channel     = offset * 8;
+    size_t            row         = channel / rowChannels;
+    size_t            k           = channel % rowChannels;  // Channel within the current row
+    size_t            totalBits   = count * 8;
+
+    for (; run.bit < totalBits; row++, k = 0) {
+        size_t remaining = totalBits - run.bit;
+        size_t end       = rowChannels - k < remaining ? rowChannels : k + remaining;
+        bmp_visit_channels(bmp, row, k, end, true, store_run, &run);
+    }
+}
 
 /**
  * @brief Embed a message into a BMP file using the LSB1 steganography method
@@ -11,8 +70,8 @@
  */
 int lsb1_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
     size_t totalBits = dataSize * 8;  // Total bits to embed
-    // there are 3 effective bits per pixel (1 per channel)
-    size_t maxBits = bmp->infoHeader.biHeight * bmp->infoHeader.biWidth * 3;
+    // there is 1 effective bit per channel carrying payload (3 or 4 per pixel)
+    size_t maxBits = bmp_channels(bmp);
 
     if (totalBits > maxBits) {
         printerr(
@@ -23,43 +82,6 @@ int lsb1_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
         return -1;
     }
 
-    size_t   dataIndex = 0;  // Index into the data array
-    int      bitIndex  = 7;  // Bit index within the current byte (start from MSB)
-    size_t   bitCount  = 0;  // Counter for total bits embedded
-    uint32_t i, j;           // Loop counters
-
-    // Embed the message into the BMP file pixel by pixel, color channel by color channel
-    for (i = 0; i < bmp->infoHeader.biHeight && bitCount < totalBits; i++) {
-        for (j = 0; j < bmp->infoHeader.biWidth && bitCount < totalBits; j++) {
-            // get the color channels of the current pixel
-            uint8_t *colors[3] = {
-                &bmp->pixels[i][j].blue, &bmp->pixels[i][j].green, &bmp->pixels[i][j].red};
-
-            for (int k = 0; k < 3 && bitCount < totalBits; k++) {
-                // Get the current bit to embed from the data buffer
-                uint8_t bit = (data[dataIndex] >> bitIndex) & 0x01;
-
-                // Embed the bit into the least significant bit of the color channel
-                *colors[k] = (*colors[k] & 0xFE) | bit;
-
-                if (bitIndex == 0) {
-                    bitIndex = 7;
-                    dataIndex++;
-                }
-                else {
-                    bitIndex--;
-                }
-
-                bitCount++;
-            }
-        }
-    }
-
-    // Check if all data was embedded
-    if (bitCount < totalBits) {
-        printerr("Not all data was embedded\n");
-        return -1;
-    }
-
+    write_payload(bmp, 0, data, dataSize, lsb1_write, 8);
     return 0;
 }
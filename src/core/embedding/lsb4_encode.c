@@ -1,4 +1,63 @@
 #include "embedding.h"
+#include "lsb_kernels.h"
+
+/* Store a single payload nibble (high nibble of a byte first) in the low nibble of a channel */
+static inline void put_nibble(uint8_t *channel, const unsigned char *src, size_t nibble) {
+    *channel = (*channel & 0xF0) | ((src[nibble / 2] >> (nibble % 2 ? 0 : 4)) & 0x0F);
+}
+
+/* Payload nibbles stored into the runs of channels of a row */
+typedef struct
+{
+    const lsb_kernels   *kernels;
+    const unsigned char *src;
+    size_t               nibble;  // Next nibble of src to embed
+} store_run_context;
+
+/* Store payload nibbles into channels [k, end) of a run */
+static void store_run(uint8_t *colors, size_t k, size_t end, void *context) {
+    store_run_context   *run = context;
+    const unsigned char *src = run->src;
+
+    // Finish the byte started in the previous run
+    if (k < end && run->nibble % 2 != 0)
+        put_nibble(&colors[k++], src, run->nibble++);
+
+    size_t bytes = (end - k) / 2;
+    run->kernels->lsb4_embed(colors + k, src + run->nibble / 2, bytes);
+    k += bytes * 2;
+    run->nibble += bytes * 2;
+
+    // Start the byte that continues in the next run
+    if (k < end)
+        put_nibble(&colors[k++], src, run->nibble++);
+}
+
+/**
+ * @brief Store payload bytes with LSB4 starting at the given payload offset
+ *
+ * Byte aligned runs of each row go through the vector kernels, only a byte split between two
+ * runs (runs with an odd number of channels) is stored one nibble at a time.
+ *
+ * @param bmp BMP file structure to embed the bytes into
+ * @param offset Offset of the first byte within the payload
+ * @param src Bytes to embed
+ * @param count Number of bytes to embed
+ */
+void lsb4_write(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count) {
+    store_run_context run          = {.kernels = lsb_kernels_get(), .src = src, .nibble = 0};
+    size_t            rowChannels  = bmp_row_channels(bmp);
+    size_t            channel      = offset * 2;
+    size_t            row          = channel / rowChannels;
+    size_t            k            = channel % rowChannels;  // Channel within the current row
+    size_t            totalNibbles = count * 2;
+
+    for (; run.nibble < totalNibbles; row++, k = 0) {
+        size_t remaining = totalNibbles - run.nibble;
+        size_t end       = rowChannels - k < remaining ? rowChannels : k + remaining;
+        bmp_visit_channels(bmp, row, k, end, true, store_run, &run);
+    }
+}
 
 /**
  * @brief Embed a message into a BMP file using the LSB4 steganography method
@@ -10,9 +69,8 @@
  * @return 0 on success, -1 on failure
  */
 int lsb4_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
-    size_t totalNibbles = dataSize * 2;  // total bytes * 2 nibbles per byte to embed
-    // there are 3 effective nibbles per pixel (1 per channel) so 12 bits per pixel
-    size_t maxBits   = bmp->infoHeader.biHeight * bmp->infoHeader.biWidth * 3 * 4;
+    // there is 1 effective nibble per channel carrying payload (3 or 4 per pixel)
+    size_t maxBits   = bmp_channels(bmp) * 4;
     size_t totalBits = dataSize * 8;  // Total bits to embed
 
     // Check if the BMP has enough capacity to hold the data
@@ -25,43 +83,6 @@ int lsb4_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
         return -1;
     }
 
-    size_t dataIndex   = 0;  // Index into the data array
-    int    nibbleIndex = 1;  // nibble index for curr byte
-    size_t nibbleCount = 0;  // Counter for total nibbles embedded
-
-    // Iterate over each pixel in the BMP image
-    for (uint32_t i = 0; i < bmp->infoHeader.biHeight && nibbleCount < totalNibbles; i++) {
-        for (uint32_t j = 0; j < bmp->infoHeader.biWidth && nibbleCount < totalNibbles; j++) {
-            uint8_t *colors[3] = {
-                &bmp->pixels[i][j].blue, &bmp->pixels[i][j].green, &bmp->pixels[i][j].red};
-
-            // Similar if not same as lsb1
-            for (int k = 0; k < 3 && nibbleCount < totalNibbles; k++) {
-                // Get the current nibble to embed from the data buffer
-                uint8_t nibble = (data[dataIndex] >> (nibbleIndex * 4)) & 0x0F;
-
-                // Embed the nibble into the least significant 4 bits of the color channel
-                *colors[k] = (*colors[k] & 0xF0) | nibble;
-
-                // Move to the next nibble
-                if (nibbleIndex == 0) {
-                    nibbleIndex = 1;
-                    dataIndex++;
-                }
-                else {
-                    nibbleIndex = 0;
-                }
-
-                nibbleCount++;
-            }
-        }
-    }
-
-    // Check if all data was embedded
-    if (nibbleCount < totalNibbles) {
-        printerr("Not all data was embedded\n");
-        return -1;
-    }
-
+    write_payload(bmp, 0, data, dataSize, lsb4_write, 2);
     return 0;
 }
@@ -1,116 +1,373 @@
+#include <pthread.h>
+
 #include "embedding.h"
+#include "lsb_kernels.h"
 
-/**
- * @brief Embed a message into a BMP file using the LSBI steganography method
- *
- * @param bmp BMP file structure to embed the message into
- * @param data Data to embed
- * @param dataSize Size of the data to embed
- *
- * @return 0 on success, -1 on failure
+/*
+ * The first 4 color channels hold the inversion map (LSB1), data bits follow from the green
+ * channel of the second pixel on, skipping every red channel. Counting the blue and green
+ * channels only (slots), data bit k is stored in slot k + 3: pixel (k + 3) / 2, blue if even.
  */
-int lsbi_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
-    uint32_t i, j, k;
-    size_t   width            = bmp->infoHeader.biWidth;
-    size_t   height           = bmp->infoHeader.biHeight;
-    size_t   total_pixels     = width * height;
-    size_t   total_components = width * height * 3;
-    size_t   max_data_bits    = (total_pixels - 2) * 2 + 1;  // Only green and blue channels used
-    size_t   max_data_bytes   = max_data_bits / 8;
+#define LSBI_MAP_CHANNELS 4
+#define LSBI_FIRST_SLOT 3
+#define TILE_PIXELS 512  // Pixels of 32-bit rows repacked at a time for the histogram kernels
 
-    // Check if the BMP has enough capacity to hold the data
+/* What to do with the blue/green channels that receive payload bits */
+typedef struct lsbi_visitor
+{
+    /* `pixels` whole pixels from chan on, receiving payload bits bit, bit + 1, ... */
+    void (*pixels)(uint8_t *chan, size_t pixels, size_t bit, void *context);
+    /* A single channel receiving payload bit `bit` */
+    void (*channel)(uint8_t *channel, size_t bit, void *context);
+} lsbi_visitor;
 
-    if (dataSize > max_data_bytes) {
-        printerr(
-            "Data size exceeds the maximum embedding capacity. You are trying to embed %zu bytes, "
-            "but the maximum capacity is %zu bytes.\n",
-            dataSize,
-            max_data_bytes);
-        return -1;
+typedef struct
+{
+    const lsb_kernels   *kernels;
+    const unsigned char *data;
+    size_t               first;  // Payload bit held by the MSB of data[0]
+    size_t               dataBits;
+    size_t               pixelSize;
+    uint64_t             changes[4];
+    uint64_t             totals[4];
+} histogram_context;
+
+typedef struct
+{
+    BMP_FILE            *bmp;
+    const unsigned char *data;
+    size_t               first;    // Payload bit held by the MSB of data[0]
+    uint8_t              flip[4];  // 1 for the inverted patterns
+} store_context;
+
+/* Per band histograms are added up into the shared one */
+typedef struct
+{
+    BMP_FILE          *bmp;
+    histogram_context *histogram;
+    pthread_mutex_t    lock;
+} histogram_bands;
+
+/* Payload bit `bit` of data, MSB first */
+static inline uint8_t payload_bit(const unsigned char *data, size_t bit) {
+    return (data[bit / 8] >> (7 - bit % 8)) & 0x01;
+}
+
+/* Visit the channels receiving payload bits [bit, endBit) row by row */
+static void visit_slots(BMP_FILE           *bmp,
+                        size_t              bit,
+                        size_t              endBit,
+                        const lsbi_visitor *visitor,
+                        void               *context) {
+    size_t width = bmp_width(bmp);
+
+    while (bit < endBit) {
+        size_t   slot   = LSBI_FIRST_SLOT + bit;
+        size_t   pixel  = slot / 2;
+        uint8_t *colors = bmp_pixel(bmp, pixel / width, pixel % width);
+
+        // A green channel without its blue one, or a last blue channel without its green one
+        if (slot % 2 == 1 || endBit - bit < 2) {
+            visitor->channel(colors + slot % 2, bit, context);
+            bit++;
+            continue;
+        }
+
+        // The rest of the row, or up to the last whole pixel
+        size_t pixels = width - pixel % width;
+        if (pixels > (endBit - bit) / 2)
+            pixels = (endBit - bit) / 2;
+        visitor->pixels(colors, pixels, bit, context);
+        bit += pixels * 2;
     }
+}
 
-    // Buffer to store inversion map
-    uint8_t map_bits     = 0;
-    int     bits_written = 0;
+static void histogram_pixels(uint8_t *chan, size_t pixels, size_t bit, void *context) {
+    histogram_context *histogram = context;
+    if (histogram->pixelSize == 3) {
+        histogram->kernels->lsbi_histogram(chan,
+                                           pixels,
+                                           histogram->data,
+                                           bit - histogram->first,
+                                           histogram->dataBits,
+                                           histogram->changes,
+                                           histogram->totals);
+        return;
+    }
 
-    // Embed the 4-bit pattern map into the first 4 color components using LSB1
-    size_t idx = 0;
-    for (bits_written = 0; bits_written < 4 && idx < total_components; idx++) {
-        i = idx / (width * 3);
-        j = (idx % (width * 3)) / 3;
-        k = idx % 3;
+    // The kernels take 3-byte pixels, 32-bit ones are repacked a tile at a time
+    uint8_t tile[TILE_PIXELS * 3];
+    while (pixels > 0) {
+        size_t count = pixels < TILE_PIXELS ? pixels : TILE_PIXELS;
+        for (size_t i = 0; i < count; i++, chan += histogram->pixelSize)
+            memcpy(tile + i * 3, chan, 3);
+        histogram->kernels->lsbi_histogram(tile,
+                                           count,
+                                           histogram->data,
+                                           bit - histogram->first,
+                                           histogram->dataBits,
+                                           histogram->changes,
+                                           histogram->totals);
+        pixels -= count;
+        bit += count * 2;
+    }
+}
 
-        if (i >= height || j >= width)
-            break;
+static void histogram_channel(uint8_t *channel, size_t bit, void *context) {
+    histogram_context *histogram = context;
+    uint8_t            pattern   = (*channel >> 1) & 0x03;
+    uint8_t            payload   = payload_bit(histogram->data, bit - histogram->first);
+    histogram->changes[pattern] += (*channel & 0x01) != payload;
+    histogram->totals[pattern]++;
+}
 
-        PIXEL  *pixel     = &bmp->pixels[i][j];
-        uint8_t colors[3] = {pixel->blue, pixel->green, pixel->red};
+static void store_channel(uint8_t *channel, size_t bit, void *context) {
+    store_context *store   = context;
+    uint8_t        pattern = (*channel >> 1) & 0x03;
+    uint8_t        payload = payload_bit(store->data, bit - store->first);
+    *channel               = (*channel & 0xFE) | (payload ^ store->flip[pattern]);
+}
 
-        uint8_t bit = (map_bits >> (3 - bits_written)) & 1;
-        colors[k]   = (colors[k] & 0xFE) | bit;
+static void store_pixels(uint8_t *chan, size_t pixels, size_t bit, void *context) {
+    size_t pixelSize = ((store_context *) context)->bmp->pixelSize;
+    for (size_t i = 0; i < pixels; i++, chan += pixelSize, bit += 2) {
+        store_channel(chan, bit, context);
+        store_channel(chan + 1, bit + 1, context);
+    }
+}
 
-        pixel->blue  = colors[0];
-        pixel->green = colors[1];
-        pixel->red   = colors[2];
+static void invert_channel(uint8_t *channel, size_t bit, void *context) {
+    store_context *store = context;
+    (void) bit;
+    *channel ^= store->flip[(*channel >> 1) & 0x03];
+}
 
-        bits_written++;
+static void invert_pixels(uint8_t *chan, size_t pixels, size_t bit, void *context) {
+    size_t pixelSize = ((store_context *) context)->bmp->pixelSize;
+    for (size_t i = 0; i < pixels; i++, chan += pixelSize) {
+        invert_channel(chan, bit, context);
+        invert_channel(chan + 1, bit, context);
     }
+}
 
-    // Step 2: Embed the data using LSBI and inversion pattern
-    size_t dataIndex    = 0;
-    int    bitIndex     = 0;
-    size_t twoBitsCount = 0;
-    int    stop         = 0;
+static const lsbi_visitor histogram_visitor = {histogram_pixels, histogram_channel};
+static const lsbi_visitor store_visitor     = {store_pixels, store_channel};
+static const lsbi_visitor invert_visitor    = {invert_pixels, invert_channel};
 
-    for (; idx < total_components && !stop; idx++) {
-        // Skip the red channel (k == 2)
-        if ((idx % 3) == 2)
-            continue;
+static void histogram_band(size_t begin, size_t end, void *context) {
+    histogram_bands  *bands = context;
+    histogram_context band  = {
+        .kernels   = bands->histogram->kernels,
+        .data      = bands->histogram->data,
+        .first     = bands->histogram->first,
+        .dataBits  = bands->histogram->dataBits,
+        .pixelSize = bands->histogram->pixelSize,
+    };
 
-        i = idx / (width * 3);
-        j = (idx % (width * 3)) / 3;
-        k = idx % 3;
+    visit_slots(bands->bmp, band.first + begin, band.first + end, &histogram_visitor, &band);
 
-        if (i >= height || j >= width)
-            break;
+    pthread_mutex_lock(&bands->lock);
+    for (int pattern = 0; pattern < 4; pattern++) {
+        bands->histogram->changes[pattern] += band.changes[pattern];
+        bands->histogram->totals[pattern] += band.totals[pattern];
+    }
+    pthread_mutex_unlock(&bands->lock);
+}
 
-        PIXEL  *pixel       = &bmp->pixels[i][j];
-        uint8_t colors[3]   = {pixel->blue, pixel->green, pixel->red};
-        uint8_t color_value = colors[k];
+static void store_band(size_t begin, size_t end, void *context) {
+    store_context *store = context;
+    visit_slots(store->bmp, store->first + begin, store->first + end, &store_visitor, store);
+}
 
-        // Get the next bit to embed from the data buffer
-        uint8_t pattern  = (color_value >> 1) & 0x3;
-        uint8_t inverted = (map_bits >> (3 - pattern)) & 1;
+static void invert_band(size_t begin, size_t end, void *context) {
+    store_context *store = context;
+    visit_slots(store->bmp, begin, end, &invert_visitor, store);
+}
 
-        uint8_t bit = (data[dataIndex] >> (7 - bitIndex)) & 1;
-        if (inverted)
-            bit ^= 1;
+/* Inversion flag of each pattern */
+static void map_flips(uint8_t map, uint8_t flip[4]) {
+    for (int pattern = 0; pattern < 4; pattern++)
+        flip[pattern] = (map >> (3 - pattern)) & 1;
+}
 
-        // Embed the bit into the color channel
-        colors[k]    = (colors[k] & 0xFE) | bit;
-        pixel->blue  = colors[0];
-        pixel->green = colors[1];
-        pixel->red   = colors[2];
+/**
+ * @brief Count, for each of the 4 patterns (bits 1-2 of the channel), how many of the channels
+ * receiving a range of the payload would change their LSB and how many there are in total
+ *
+ * The count is a read-only pass over the channels done by the vector kernels, split in bands of
+ * whole pixels across the shared pool. It must run before the range is stored.
+ *
+ * @param bmp BMP file structure the data is going to be embedded into
+ * @param offset Offset of the first byte within the payload
+ * @param src Bytes to embed
+ * @param count Number of bytes to embed
+ * @param changes Per pattern count of channels whose LSB differs from its payload bit, added to
+ * @param totals Per pattern count of channels receiving a payload bit, added to
+ */
+void lsbi_histogram(BMP_FILE            *bmp,
+                    size_t               offset,
+                    const unsigned char *src,
+                    size_t               count,
+                    uint64_t             changes[4],
+                    uint64_t             totals[4]) {
+    histogram_context histogram = {
+        .kernels   = lsb_kernels_get(),
+        .data      = src,
+        .first     = offset * 8,
+        .dataBits  = count * 8,
+        .pixelSize = bmp->pixelSize,
+    };
+    histogram_bands bands = {.bmp = bmp, .histogram = &histogram};
 
-        bitIndex++;
-        if (bitIndex == 8) {
-            dataIndex++;
-            bitIndex = 0;
+    pthread_mutex_init(&bands.lock, NULL);
+    parallel_bands(count * 8, STEG_BAND_CHANNELS, 2, histogram_band, &bands);
+    pthread_mutex_destroy(&bands.lock);
+    for (int pattern = 0; pattern < 4; pattern++) {
+        changes[pattern] += histogram.changes[pattern];
+        totals[pattern] += histogram.totals[pattern];
+    }
+}
+
+/**
+ * @brief Choose the inversion map: a pattern is inverted when more of its channels would change
+ * than stay the same
+ *
+ * @return Inversion map, bit 3 - p set when pattern p is inverted
+ */
+uint8_t lsbi_choose_map(const uint64_t changes[4], const uint64_t totals[4], lsbi_report *report) {
+    uint8_t  map     = 0;
+    uint64_t changed = 0, avoided = 0;
 
-            // Stop if we've embedded all the data
-            if (dataIndex >= dataSize) {
-                stop = 1;
-            }
+    for (int pattern = 0; pattern < 4; pattern++) {
+        uint64_t unchanged = totals[pattern] - changes[pattern];
+        if (changes[pattern] > unchanged) {
+            map |= 1 << (3 - pattern);
+            changed += unchanged;
+            avoided += changes[pattern] - unchanged;
         }
+        else {
+            changed += changes[pattern];
+        }
+    }
 
-        twoBitsCount++;
+    if (report) {
+        report->inversionMap   = map;
+        report->changes        = changed;
+        report->changesAvoided = avoided;
+    }
+    return map;
+}
+
+/**
+ * @brief Store the inversion map in the first 4 color channels (B, G and R of the first pixel,
+ * B of the second one) using LSB1
+ *
+ * @param bmp BMP file structure to embed the map into
+ * @param map Inversion map, bit 3 - p set when pattern p is inverted
+ */
+void lsbi_store_map(BMP_FILE *bmp, uint8_t map) {
+    size_t width = bmp_width(bmp);
+    for (int bits_written = 0; bits_written < LSBI_MAP_CHANNELS; bits_written++) {
+        size_t   pixel = bits_written / 3;
+        uint8_t *color = bmp_pixel(bmp, pixel / width, pixel % width) + bits_written % 3;
+        *color         = (*color & 0xFE) | ((map >> (3 - bits_written)) & 1);
     }
+}
+
+/**
+ * @brief Store payload bytes with LSBI starting at the given payload offset
+ *
+ * @param bmp BMP file structure to embed the bytes into
+ * @param offset Offset of the first byte within the payload
+ * @param src Bytes to embed
+ * @param count Number of bytes to embed
+ * @param map Inversion map, the LSB of the channels whose pattern is inverted is stored inverted
+ */
+void lsbi_write(BMP_FILE *bmp, size_t offset, const unsigned char *src, size_t count, uint8_t map) {
+    store_context store = {.bmp = bmp, .data = src, .first = offset * 8};
+    map_flips(map, store.flip);
+    parallel_bands(count * 8, STEG_BAND_CHANNELS, 2, store_band, &store);
+}
 
-    // Check if all data was embedded
-    if (twoBitsCount < dataSize * 8) {
-        printerr("Not all data was embedded\n");
+/**
+ * @brief Invert the LSB of the channels holding the first bytes of the payload whose pattern is
+ * inverted by the map, for payloads stored with an empty map before the map was known
+ *
+ * @param bmp BMP file structure holding the payload
+ * @param count Number of payload bytes stored
+ * @param map Inversion map
+ */
+void lsbi_invert(BMP_FILE *bmp, size_t count, uint8_t map) {
+    store_context store = {.bmp = bmp};
+    map_flips(map, store.flip);
+    if (map != 0)
+        parallel_bands(count * 8, STEG_BAND_CHANNELS, 2, invert_band, &store);
+}
+
+/**
+ * @brief Largest payload (size prefix included) LSBI can embed into a BMP file
+ */
+size_t lsbi_capacity(const BMP_FILE *bmp) {
+    size_t total_pixels  = bmp_width(bmp) * bmp_height(bmp);
+    size_t max_data_bits = total_pixels < 2 ? 0 : (total_pixels - 2) * 2 + 1;  // Green and blue
+    return max_data_bits / 8;
+}
+
+/**
+ * @brief Embed a message into a BMP file using the LSBI steganography method and report the
+ * chosen inversion map
+ *
+ * @param bmp BMP file structure to embed the message into
+ * @param data Data to embed
+ * @param dataSize Size of the data to embed
+ * @param report Where to store the inversion map and the change counts, may be NULL
+ *
+ * @return 0 on success, -1 on failure
+ */
+int lsbi_encode_report(BMP_FILE            *bmp,
+                       const unsigned char *data,
+                       size_t               dataSize,
+                       lsbi_report         *report) {
+    size_t max_data_bytes = lsbi_capacity(bmp);
+
+    // Check if the BMP has enough capacity to hold the data
+    if (dataSize > max_data_bytes) {
+        printerr(
+            "Data size exceeds the maximum embedding capacity. You are trying to embed %zu bytes, "
+            "but the maximum capacity is %zu bytes.\n",
+            dataSize,
+            max_data_bytes);
         return -1;
     }
 
+    // Step 1: Count how many LSBs each pattern would change and choose what to invert
+    uint64_t    span       = stats_begin();
+    uint64_t    changes[4] = {0}, totals[4] = {0};
+    lsbi_report chosen;
+    lsbi_histogram(bmp, 0, data, dataSize, changes, totals);
+    uint8_t map_bits = lsbi_choose_map(changes, totals, &chosen);
+    if (report)
+        *report = chosen;
+
+    // Step 2: Embed the 4-bit pattern map into the first 4 color components using LSB1
+    lsbi_store_map(bmp, map_bits);
+
+    // Step 3: Embed the data, inverting the LSB of the channels whose pattern is inverted
+    lsbi_write(bmp, 0, data, dataSize, map_bits);
+    stats_count(STATS_CHANNELS_MODIFIED, chosen.changes);
+    stats_end(STATS_LSB_EMBED, span);
     return 0;
 }
+
+/**
+ * @brief Embed a message into a BMP file using the LSBI steganography method
+ *
+ * @param bmp BMP file structure to embed the message into
+ * @param data Data to embed
+ * @param dataSize Size of the data to embed
+ *
+ * @return 0 on success, -1 on failure
+ */
+int lsbi_encode(BMP_FILE *bmp, const unsigned char *data, size_t dataSize) {
+    return lsbi_encode_report(bmp, data, dataSize, NULL);
+}
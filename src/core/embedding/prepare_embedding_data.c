@@ -27,6 +27,8 @@ unsigned char *prepare_embedding_data(const char *message_file,
                                       const char *password,
                                       encryption  encryption_type,
                                       mode        mode_type) {
+    uint64_t span = stats_begin();
+
     // Open file and handle error if unable to open
     FILE *file = fopen(message_file, "rb");
     if (!file) {
@@ -48,7 +50,7 @@ unsigned char *prepare_embedding_data(const char *message_file,
     }
 
     // Read file data in one go
-    fread(file_data, 1, file_size, file);
+    stats_count(STATS_BYTES_READ, fread(file_data, 1, file_size, file));
     fclose(file);
 
     // Get the file extension, or use the default if none is found
@@ -76,6 +78,8 @@ unsigned char *prepare_embedding_data(const char *message_file,
         embedding_data + UINT32_SIZE + file_size, extension, extension_length);  // Copy extension
 
     free(file_data);  // Free the original file data since it's already copied
+    stats_alloc(file_size + embedding_data_size);
+    stats_end(STATS_PREPARE, span);
 
     // Handle encryption if necessary
     if (password != NULL) {
@@ -1,5 +1,8 @@
 #include "encryption.h"
 
+#include <openssl/rand.h>
+#include <pthread.h>
+
 typedef const EVP_CIPHER* (*CipherFunction)();
 
 typedef struct
@@ -24,34 +27,71 @@ CipherMap cipher_map[] = {{AES128, ECB, EVP_aes_128_ecb},
                           {DES3, ECB, EVP_des_ede3_ecb},
                           {DES3, CBC, EVP_des_ede3_cbc},
                           {DES3, CFB, EVP_des_ede3_cfb8},
-                          {DES3, OFB, EVP_des_ede3_ofb}};
+                          {DES3, OFB, EVP_des_ede3_ofb},
+                          {AES128, GCM, EVP_aes_128_gcm},  // Authenticated, the tag follows
+                          {AES192, GCM, EVP_aes_192_gcm},
+                          {AES256, GCM, EVP_aes_256_gcm},
+                          {CHACHA20, POLY1305, EVP_chacha20_poly1305}};
+
+#define CIPHER_COUNT (sizeof(cipher_map) / sizeof(CipherMap))
+
+/* Ciphers of cipher_map fetched from the provider once, so that initializing a context does
+ * not look the implementation up again every time */
+static const EVP_CIPHER* fetched_ciphers[CIPHER_COUNT];
+static pthread_once_t    fetch_once = PTHREAD_ONCE_INIT;
+
+static void fetch_ciphers(void) {
+    for (size_t i = 0; i < CIPHER_COUNT; i++) {
+        const EVP_CIPHER* legacy = cipher_map[i].cipher_func();
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        const EVP_CIPHER* fetched = EVP_CIPHER_fetch(NULL, EVP_CIPHER_get0_name(legacy), NULL);
+        fetched_ciphers[i]        = fetched ? fetched : legacy;
+#else
+        fetched_ciphers[i] = legacy;
+#endif
+    }
+}
 
 const EVP_CIPHER* get_cipher(encryption alg, mode mod) {
-    int map_size = sizeof(cipher_map) / sizeof(CipherMap);
-    for (int i = 0; i < map_size; i++) {
+    pthread_once(&fetch_once, fetch_ciphers);
+    for (size_t i = 0; i < CIPHER_COUNT; i++) {
         if (cipher_map[i].alg == alg && cipher_map[i].mod == mod) {
-            return cipher_map[i].cipher_func();
+            return fetched_ciphers[i];
         }
     }
     return NULL;
 }
 
-int generate_key_iv(
-    const char* pass, unsigned char* key, unsigned char* iv, int key_len, int iv_len) {
-    const unsigned char salt[8]   = {0};
-    int                 total_len = key_len + iv_len;
-    unsigned char*      key_iv    = malloc(total_len);
+/*
+ * IV derived from the password along with the key. Authenticated modes take none: their nonce
+ * is random, a fixed one would repeat under every message encrypted with the same password.
+ */
+static int derived_iv_length(const EVP_CIPHER* cipher) {
+    return EVP_CIPHER_flags(cipher) & EVP_CIPH_FLAG_AEAD_CIPHER ? 0 : EVP_CIPHER_iv_length(cipher);
+}
 
-    if (!key_iv) {
-        printerr("Memory allocation failed while generating key/IV\n");
-        return 0;
-    }
+/**
+ * @brief Derive the key and IV of a cipher from the password using PBKDF2 with SHA-256, through
+ * the process-wide key cache
+ *
+ * @return 1 on success, 0 on failure
+ */
+int generate_key_iv(const char*       pass,
+                    const EVP_CIPHER* cipher,
+                    unsigned char*    key,
+                    unsigned char*    iv,
+                    int               key_len,
+                    int               iv_len) {
+    const unsigned char salt[PBKDF2_SALT_LENGTH] = {0};
+    unsigned char       key_iv[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+    int                 total_len = key_len + iv_len;
 
     /* Derive key and IV from password using PBKDF2 with SHA-256 */
-    if (PKCS5_PBKDF2_HMAC(
-            pass, strlen(pass), salt, sizeof(salt), 10000, EVP_sha256(), total_len, key_iv) != 1) {
+    uint64_t span    = stats_begin();
+    int      derived = key_cache_derive(pass, cipher, salt, PBKDF2_ITERATIONS, key_iv, total_len);
+    stats_end(STATS_KEY_DERIVATION, span);
+    if (!derived) {
         printerr("Error deriving key and IV from password using PBKDF2 with SHA-256\n");
-        free(key_iv);
         return 0;
     }
 
@@ -61,10 +101,67 @@ int generate_key_iv(
         memcpy(iv, key_iv + key_len, iv_len);
     }
 
-    free(key_iv);
+    OPENSSL_cleanse(key_iv, sizeof(key_iv));
     return 1;
 }
 
+/**
+ * @brief Derive key material from a password the way generate_key_iv does, bypassing the key
+ * cache
+ *
+ * Every 32 bytes of PBKDF2 output are computed on their own, so the key and IV of a cipher are
+ * the first bytes of any longer derivation: one derivation as long as the longest key and IV
+ * serves every algorithm and mode.
+ *
+ * @param pass The password
+ * @param keyIv Where to store the derived bytes
+ * @param length Bytes to derive, at most EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH
+ *
+ * @return 1 on success, 0 on failure
+ */
+int derive_key_material(const char* pass, unsigned char* keyIv, size_t length) {
+    const unsigned char salt[PBKDF2_SALT_LENGTH] = {0};
+
+    uint64_t span    = stats_begin();
+    int      derived = PKCS5_PBKDF2_HMAC(pass,
+                                    strlen(pass),
+                                    salt,
+                                    PBKDF2_SALT_LENGTH,
+                                    PBKDF2_ITERATIONS,
+                                    EVP_sha256(),
+                                    length,
+                                    keyIv);
+    stats_end(STATS_KEY_DERIVATION, span);
+    return derived == 1;
+}
+
+/**
+ * @brief Derive the key and IV of an algorithm and mode ahead of time, so that the runs of a
+ * batch sharing the password get them from the key cache
+ *
+ * @param pass The password
+ * @param a The encryption algorithm
+ * @param m The encryption mode
+ *
+ * @return 0 on success, -1 on failure
+ */
+int prederive_key(const char* pass, encryption a, mode m) {
+    const EVP_CIPHER* cipher_type = get_cipher(a, m);
+    if (!cipher_type) {
+        printerr("Invalid encryption algorithm or mode\n");
+        return -1;
+    }
+
+    unsigned char key[EVP_MAX_KEY_LENGTH];
+    unsigned char iv[EVP_MAX_IV_LENGTH];
+    int           key_len = EVP_CIPHER_key_length(cipher_type);
+    int           iv_len  = derived_iv_length(cipher_type);
+    int           result  = generate_key_iv(pass, cipher_type, key, iv, key_len, iv_len);
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return result ? 0 : -1;
+}
+
 /**
  * @brief Encrypt data using the specified algorithm and mode
  *
@@ -99,7 +196,7 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
     }
 
     int key_len = EVP_CIPHER_key_length(cipher_type);
-    int iv_len  = EVP_CIPHER_iv_length(cipher_type);
+    int iv_len  = derived_iv_length(cipher_type);
 
     unsigned char* key = malloc(key_len);
     unsigned char* iv  = NULL;
@@ -113,7 +210,7 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
         }
     }
 
-    if (!generate_key_iv(pass, key, iv, key_len, iv_len)) {
+    if (!generate_key_iv(pass, cipher_type, key, iv, key_len, iv_len)) {
         printerr("Error generating key/IV\n");
         EVP_CIPHER_CTX_free(ctx);
         free(key);
@@ -131,8 +228,11 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
         return NULL;
     }
 
-    // Encryption
-    size_t         ciphertext_len = plaintext_len + EVP_CIPHER_block_size(cipher_type);
+    // Encryption, authenticated modes store a random nonce first and their tag last
+    size_t         nonce_len      = nonce_length(a, m);
+    size_t         tag_len        = tag_length(a, m);
+    size_t         block_len      = EVP_CIPHER_block_size(cipher_type);
+    size_t         ciphertext_len = nonce_len + plaintext_len + block_len + tag_len;
     unsigned char* ciphertext     = malloc(ciphertext_len);
     if (!ciphertext) {
         printerr("Memory allocation failed for ciphertext\n");
@@ -142,9 +242,21 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
             free(iv);
         return NULL;
     }
+    stats_alloc(ciphertext_len);
 
-    int len;
-    if (EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len) != 1) {
+    if (nonce_len > 0 && cipher_stream_new_nonce(ctx, ciphertext) != 1) {
+        printerr("Error generating the nonce\n");
+        free(ciphertext);
+        EVP_CIPHER_CTX_free(ctx);
+        free(key);
+        if (iv)
+            free(iv);
+        return NULL;
+    }
+
+    int      len;
+    uint64_t span = stats_begin();
+    if (EVP_EncryptUpdate(ctx, ciphertext + nonce_len, &len, plaintext, plaintext_len) != 1) {
         printerr("Error during encryption\n");
         free(ciphertext);
         EVP_CIPHER_CTX_free(ctx);
@@ -153,9 +265,9 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
             free(iv);
         return NULL;
     }
-    *encrypted_len = len;
+    *encrypted_len = nonce_len + len;
 
-    if (EVP_EncryptFinal_ex(ctx, ciphertext + len, &len) != 1) {
+    if (EVP_EncryptFinal_ex(ctx, ciphertext + *encrypted_len, &len) != 1) {
         printerr("Error during final encryption\n");
         free(ciphertext);
         EVP_CIPHER_CTX_free(ctx);
@@ -166,6 +278,18 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
     }
     *encrypted_len += len;
 
+    if (tag_len > 0 && cipher_stream_get_tag(ctx, ciphertext + *encrypted_len) != 1) {
+        printerr("Error getting the authentication tag\n");
+        free(ciphertext);
+        EVP_CIPHER_CTX_free(ctx);
+        free(key);
+        if (iv)
+            free(iv);
+        return NULL;
+    }
+    *encrypted_len += tag_len;
+    stats_end(STATS_CIPHER, span);
+
     EVP_CIPHER_CTX_free(ctx);
     free(key);
     if (iv)
@@ -184,7 +308,8 @@ unsigned char* encrypt_data(const unsigned char* plaintext,
  * @param m The encryption mode to use
  * @param decrypted_len The length of the decrypted data to be returned
  *
- * @return The decrypted data
+ * @return The decrypted data, NULL on failure. Authenticated modes (GCM, ChaCha20-Poly1305) also
+ * fail when the tag following the ciphertext does not match: wrong password or corrupted data.
  *
  * @note The caller is responsible for freeing the returned pointer
  */
@@ -207,8 +332,20 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
         return NULL;
     }
 
+    // Authenticated modes: nonce | ciphertext | tag
+    size_t nonce_len = nonce_length(a, m);
+    size_t tag_len   = tag_length(a, m);
+    if (ciphertext_len < nonce_len + tag_len) {
+        printerr("Authentication failed: wrong password or corrupted data\n");
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+    const unsigned char* nonce = ciphertext;
+    ciphertext += nonce_len;
+    ciphertext_len -= nonce_len + tag_len;
+
     int key_len = EVP_CIPHER_key_length(cipher_type);
-    int iv_len  = EVP_CIPHER_iv_length(cipher_type);
+    int iv_len  = derived_iv_length(cipher_type);
 
     unsigned char* key = malloc(key_len);
     unsigned char* iv  = NULL;
@@ -222,7 +359,7 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
         }
     }
 
-    if (!generate_key_iv(pass, key, iv, key_len, iv_len)) {
+    if (!generate_key_iv(pass, cipher_type, key, iv, key_len, iv_len)) {
         printerr("Error generating key/IV\n");
         EVP_CIPHER_CTX_free(ctx);
         free(key);
@@ -231,7 +368,9 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
         return NULL;
     }
 
-    if (EVP_DecryptInit_ex(ctx, cipher_type, NULL, key, iv) != 1) {
+    if (EVP_DecryptInit_ex(ctx, cipher_type, NULL, key, iv) != 1 ||
+        (nonce_len > 0 && cipher_stream_set_nonce(ctx, nonce) != 1) ||
+        (tag_len > 0 && cipher_stream_set_tag(ctx, ciphertext + ciphertext_len) != 1)) {
         printerr("Error initializing decryption\n");
         EVP_CIPHER_CTX_free(ctx);
         free(key);
@@ -250,8 +389,10 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
             free(iv);
         return NULL;
     }
+    stats_alloc(ciphertext_len + EVP_CIPHER_block_size(cipher_type));
 
-    int len;
+    int      len;
+    uint64_t span = stats_begin();
     if (EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len) != 1) {
         printerr("Error during decryption\n");
         free(plaintext);  // Free the allocated plaintext on failure
@@ -265,7 +406,10 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
     *decrypted_len = len;
 
     if (EVP_DecryptFinal_ex(ctx, plaintext + len, &len) != 1) {
-        printerr("Error during final decryption\n");
+        if (tag_len > 0)
+            printerr("Authentication failed: wrong password or corrupted data\n");
+        else
+            printerr("Error during final decryption\n");
         free(plaintext);  // Free plaintext on failure
         EVP_CIPHER_CTX_free(ctx);
         free(key);
@@ -274,6 +418,7 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
         return NULL;
     }
     *decrypted_len += len;
+    stats_end(STATS_CIPHER, span);
 
     // Clean up the resources
     EVP_CIPHER_CTX_free(ctx);
@@ -283,3 +428,159 @@ unsigned char* decrypt_data(const unsigned char* ciphertext,
 
     return plaintext;  // Return the successfully decrypted plaintext
 }
+
+/**
+ * @brief Create a cipher context keyed from the password, ready for EVP_EncryptUpdate or
+ * EVP_DecryptUpdate, so that data can be processed in chunks
+ *
+ * @param pass The password to derive the key and IV from
+ * @param a The encryption algorithm to use
+ * @param m The encryption mode to use
+ * @param encrypt 1 to encrypt, 0 to decrypt
+ *
+ * @return The cipher context, NULL on failure
+ *
+ * @note The caller is responsible for freeing the context with EVP_CIPHER_CTX_free. The
+ * authenticated modes still need their nonce, see cipher_stream_new_nonce and
+ * cipher_stream_set_nonce
+ */
+EVP_CIPHER_CTX* cipher_stream_new(const char* pass, encryption a, mode m, int encrypt) {
+    const EVP_CIPHER* cipher_type = get_cipher(a, m);
+    if (!cipher_type) {
+        printerr("Invalid encryption algorithm or mode\n");
+        return NULL;
+    }
+
+    unsigned char key[EVP_MAX_KEY_LENGTH];
+    unsigned char iv[EVP_MAX_IV_LENGTH];
+    int           key_len = EVP_CIPHER_key_length(cipher_type);
+    int           iv_len  = derived_iv_length(cipher_type);
+
+    if (!generate_key_iv(pass, cipher_type, key, iv, key_len, iv_len)) {
+        printerr("Error generating key/IV\n");
+        return NULL;
+    }
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        printerr("Error creating %s context\n", encrypt ? "encryption" : "decryption");
+        OPENSSL_cleanse(key, sizeof(key));
+        return NULL;
+    }
+
+    if (EVP_CipherInit_ex(ctx, cipher_type, NULL, key, iv_len > 0 ? iv : NULL, encrypt) != 1) {
+        printerr("Error initializing %s\n", encrypt ? "encryption" : "decryption");
+        EVP_CIPHER_CTX_free(ctx);
+        ctx = NULL;
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    return ctx;
+}
+
+/**
+ * @brief Length of the ciphertext of a plaintext: block ciphers in ECB and CBC modes add PKCS#7
+ * padding, the stream modes (CFB, OFB) keep the length and the authenticated ones (GCM,
+ * ChaCha20-Poly1305) add their nonce and tag
+ *
+ * @param plaintext_len The length of the data to encrypt
+ * @param a The encryption algorithm to use
+ * @param m The encryption mode to use
+ *
+ * @return The length of the ciphertext, 0 for an invalid algorithm or mode
+ */
+size_t encrypted_length(size_t plaintext_len, encryption a, mode m) {
+    const EVP_CIPHER* cipher_type = get_cipher(a, m);
+    if (!cipher_type)
+        return 0;
+
+    size_t block_size = EVP_CIPHER_block_size(cipher_type);
+    if (block_size <= 1)
+        return nonce_length(a, m) + plaintext_len + tag_length(a, m);
+    return (plaintext_len / block_size + 1) * block_size;
+}
+
+/**
+ * @brief Length of the authentication tag stored after the ciphertext
+ *
+ * @return AEAD_TAG_LENGTH for GCM and ChaCha20-Poly1305, 0 for the other modes
+ */
+size_t tag_length(encryption a, mode m) {
+    const EVP_CIPHER* cipher_type = get_cipher(a, m);
+    if (!cipher_type || !(EVP_CIPHER_flags(cipher_type) & EVP_CIPH_FLAG_AEAD_CIPHER))
+        return 0;
+    return AEAD_TAG_LENGTH;
+}
+
+/**
+ * @brief Length of the random nonce stored before the ciphertext
+ *
+ * @return AEAD_NONCE_LENGTH for GCM and ChaCha20-Poly1305, 0 for the other modes
+ */
+size_t nonce_length(encryption a, mode m) {
+    return tag_length(a, m) > 0 ? AEAD_NONCE_LENGTH : 0;
+}
+
+/**
+ * @brief Draw a random nonce for an authenticated encryption and start it with it, before the
+ * first EVP_EncryptUpdate
+ *
+ * @param ctx Context from cipher_stream_new
+ * @param nonce Where to store the AEAD_NONCE_LENGTH bytes of the nonce
+ *
+ * @return 1 on success, 0 on failure
+ */
+int cipher_stream_new_nonce(EVP_CIPHER_CTX* ctx, unsigned char* nonce) {
+    return RAND_bytes(nonce, AEAD_NONCE_LENGTH) == 1 && cipher_stream_set_nonce(ctx, nonce);
+}
+
+/**
+ * @brief Start an authenticated decryption with the nonce stored before the ciphertext, before
+ * the first EVP_DecryptUpdate
+ *
+ * @param ctx Context from cipher_stream_new
+ * @param nonce The AEAD_NONCE_LENGTH bytes of the nonce
+ *
+ * @return 1 on success, 0 on failure
+ */
+int cipher_stream_set_nonce(EVP_CIPHER_CTX* ctx, const unsigned char* nonce) {
+    return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, -1) == 1;
+}
+
+/**
+ * @brief Get the tag of an authenticated encryption once EVP_EncryptFinal_ex has been called
+ *
+ * @param ctx Context from cipher_stream_new
+ * @param tag Where to store the AEAD_TAG_LENGTH bytes of the tag
+ *
+ * @return 1 on success, 0 on failure
+ */
+int cipher_stream_get_tag(EVP_CIPHER_CTX* ctx, unsigned char* tag) {
+    return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_LENGTH, tag) == 1;
+}
+
+/**
+ * @brief Set the tag an authenticated decryption is checked against, before EVP_DecryptFinal_ex,
+ * which then fails for a wrong key or modified ciphertext
+ *
+ * @param ctx Context from cipher_stream_new
+ * @param tag The AEAD_TAG_LENGTH bytes of the tag
+ *
+ * @return 1 on success, 0 on failure
+ */
+int cipher_stream_set_tag(EVP_CIPHER_CTX* ctx, const unsigned char* tag) {
+    return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_LENGTH, (void*) tag) == 1;
+}
+
+/**
+ * @brief Algorithm used when only the mode is given: ChaCha20 for Poly1305, AES128 otherwise
+ */
+encryption default_encryption(mode m) {
+    return m == POLY1305 ? CHACHA20 : AES128;
+}
+
+/**
+ * @brief Mode used when only the algorithm is given: Poly1305 for ChaCha20, CBC otherwise
+ */
+mode default_mode(encryption a) {
+    return a == CHACHA20 ? POLY1305 : CBC;
+}
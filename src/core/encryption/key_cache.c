@@ -0,0 +1,417 @@
+#include "key_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+#define KEY_CACHE_MAGIC "SBKC"
+#define KEY_CACHE_VERSION 2
+#define KEY_CACHE_MAX 1024             // Entries kept, the oldest ones are replaced first
+#define KEY_CACHE_SECRET_SUFFIX ".key"  // Secret file next to the cache file
+
+/* One derivation: the password is only kept as an HMAC-SHA256 keyed with the cache secret */
+typedef struct
+{
+    unsigned char passMac[SHA256_DIGEST_LENGTH];
+    int32_t       cipher;  // OpenSSL NID of the cipher
+    unsigned char salt[PBKDF2_SALT_LENGTH];
+    uint32_t      iterations;
+    uint32_t      length;
+    unsigned char keyIv[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+} key_cache_entry;
+
+/* Header of the on-disk cache, followed by `count` entries */
+typedef struct
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t entrySize;
+    uint32_t count;
+} key_cache_header;
+
+/* Process-wide cache */
+static struct
+{
+    key_cache_entry *entries;
+    size_t           count;
+    size_t           next;  // Entry replaced once the cache is full
+    uint64_t         avoided;
+    char            *path;  // On-disk copy, NULL if the cache only lives in memory
+    bool             dirty;
+    unsigned char    secret[SHA256_DIGEST_LENGTH];  // Random key of the password MACs
+    bool             hasSecret;
+    bool             secretSaved;  // The secret file next to path holds secret
+    pthread_mutex_t  lock;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* Generate the secret keying the password MACs if there is none yet, called with the lock held */
+static int ensure_secret(void) {
+    if (!cache.hasSecret) {
+        if (RAND_bytes(cache.secret, sizeof(cache.secret)) != 1)
+            return -1;
+        cache.hasSecret   = true;
+        cache.secretSaved = false;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill in the lookup fields of an entry, called with the lock held
+ *
+ * The password is looked up by its HMAC under a random secret that is not stored in the cache
+ * file, so the file alone does not allow testing password guesses faster than PBKDF2 does.
+ *
+ * @return 0 on success, -1 if there is no secret and none can be generated
+ */
+static int entry_key(key_cache_entry     *entry,
+                     const char          *pass,
+                     const EVP_CIPHER    *cipher,
+                     const unsigned char *salt,
+                     uint32_t             iterations,
+                     size_t               length) {
+    memset(entry, 0, sizeof(*entry));
+    if (ensure_secret() != 0)
+        return -1;
+    if (!HMAC(EVP_sha256(),
+              cache.secret,
+              sizeof(cache.secret),
+              (const unsigned char *) pass,
+              strlen(pass),
+              entry->passMac,
+              NULL))
+        return -1;
+    entry->cipher     = EVP_CIPHER_nid(cipher);
+    entry->iterations = iterations;
+    entry->length     = length;
+    memcpy(entry->salt, salt, PBKDF2_SALT_LENGTH);
+    return 0;
+}
+
+/* Cached entry with the same lookup fields, called with the lock held */
+static const key_cache_entry *find_entry(const key_cache_entry *key) {
+    for (size_t i = 0; i < cache.count; i++) {
+        const key_cache_entry *entry = &cache.entries[i];
+        if (entry->cipher == key->cipher && entry->iterations == key->iterations &&
+            entry->length == key->length && !memcmp(entry->salt, key->salt, sizeof(key->salt)) &&
+            !memcmp(entry->passMac, key->passMac, sizeof(key->passMac)))
+            return entry;
+    }
+    return NULL;
+}
+
+/* Add an entry, replacing the oldest one when the cache is full, called with the lock held */
+static void add_entry(const key_cache_entry *entry) {
+    if (!cache.entries) {
+        cache.entries = calloc(KEY_CACHE_MAX, sizeof(key_cache_entry));
+        if (!cache.entries)
+            return;
+    }
+
+    if (cache.count < KEY_CACHE_MAX) {
+        cache.entries[cache.count++] = *entry;
+    }
+    else {
+        cache.entries[cache.next] = *entry;
+        cache.next                = (cache.next + 1) % KEY_CACHE_MAX;
+    }
+    cache.dirty = true;
+}
+
+/**
+ * @brief Derive key and IV bytes from a password with PBKDF2-HMAC-SHA256, reusing a previous
+ * derivation of the same password, cipher, salt and iterations when there is one
+ *
+ * @param pass The password
+ * @param cipher The cipher the key and IV are for
+ * @param salt PBKDF2_SALT_LENGTH bytes of salt
+ * @param iterations PBKDF2 rounds
+ * @param keyIv Where to store the key followed by the IV
+ * @param length Key length + IV length of the cipher
+ *
+ * @return 1 on success, 0 on failure
+ */
+int key_cache_derive(const char          *pass,
+                     const EVP_CIPHER    *cipher,
+                     const unsigned char *salt,
+                     uint32_t             iterations,
+                     unsigned char       *keyIv,
+                     size_t               length) {
+    key_cache_entry entry;
+    if (length > sizeof(entry.keyIv))
+        return 0;
+
+    pthread_mutex_lock(&cache.lock);
+    int                    keyed  = entry_key(&entry, pass, cipher, salt, iterations, length);
+    const key_cache_entry *cached = keyed == 0 ? find_entry(&entry) : NULL;
+    if (cached) {
+        memcpy(keyIv, cached->keyIv, length);
+        cache.avoided++;
+        stats_count(STATS_KEYS_REUSED, 1);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    if (cached)
+        return 1;
+
+    if (PKCS5_PBKDF2_HMAC(pass,
+                          strlen(pass),
+                          salt,
+                          PBKDF2_SALT_LENGTH,
+                          iterations,
+                          EVP_sha256(),
+                          length,
+                          keyIv) != 1) {
+        OPENSSL_cleanse(&entry, sizeof(entry));
+        return 0;
+    }
+    memcpy(entry.keyIv, keyIv, length);
+
+    stats_count(STATS_KEYS_DERIVED, 1);
+
+    pthread_mutex_lock(&cache.lock);
+    if (keyed == 0 && !find_entry(&entry))
+        add_entry(&entry);
+    pthread_mutex_unlock(&cache.lock);
+
+    OPENSSL_cleanse(&entry, sizeof(entry));
+    return 1;
+}
+
+/* Path of the file with the given suffix next to the cache file, release it with free() */
+static char *sibling_path(const char *path, const char *suffix) {
+    char *sibling = malloc(strlen(path) + strlen(suffix) + 1);
+    if (sibling) {
+        strcpy(sibling, path);
+        strcat(sibling, suffix);
+    }
+    return sibling;
+}
+
+/**
+ * @brief Open a cache file for reading, only if it is a regular file owned by the user and not
+ * accessible by anyone else (mode 600)
+ *
+ * @return File descriptor, -1 if the file is missing (errno is ENOENT) or can not be used
+ */
+static int open_private(const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            printerr("Could not open key cache %s\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        printerr("Key cache %s must be a regular file only its owner can access\n", path);
+        close(fd);
+        errno = EACCES;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Write a cache file with mode 600 next to it and rename it over the old one
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int write_private(const char *path,
+                         const void *head,
+                         size_t      headSize,
+                         const void *data,
+                         size_t      dataSize) {
+    int   result    = -1;
+    char *temporary = sibling_path(path, ".tmp");
+    if (!temporary)
+        return -1;
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if (fd >= 0) {
+        if (fchmod(fd, S_IRUSR | S_IWUSR) == 0 && write(fd, head, headSize) == (ssize_t) headSize &&
+            (dataSize == 0 || write(fd, data, dataSize) == (ssize_t) dataSize))
+            result = 0;
+        if (close(fd) != 0 || (result == 0 && rename(temporary, path) != 0))
+            result = -1;
+        if (result != 0)
+            unlink(temporary);
+    }
+    free(temporary);
+    return result;
+}
+
+/* Wipe the cached entries, called with the lock held */
+static void drop_entries(void) {
+    if (cache.entries)
+        OPENSSL_cleanse(cache.entries, KEY_CACHE_MAX * sizeof(key_cache_entry));
+    cache.count = 0;
+    cache.next  = 0;
+}
+
+/**
+ * @brief Back the cache with a file: its entries are loaded now and key_cache_save writes the
+ * cache back to it
+ *
+ * The file holds derived keys, so it is only used when it is a regular file owned by the user
+ * and not accessible by anyone else (mode 600). The secret keying the password MACs is kept
+ * apart, in the same kind of file with ".key" appended to the path. A missing file is created
+ * by key_cache_save, and a cache whose secret is missing is started over.
+ *
+ * @param path Path of the cache file
+ *
+ * @return 0 on success, -1 if the file exists but can not be used
+ */
+int key_cache_open(const char *path) {
+    char *secretPath = sibling_path(path, KEY_CACHE_SECRET_SUFFIX);
+    if (!secretPath) {
+        printerr("Could not open key cache %s\n", path);
+        return -1;
+    }
+
+    unsigned char    secret[SHA256_DIGEST_LENGTH];
+    key_cache_header header;
+    bool             hasSecret = false;
+    int              result    = 0;
+    int              secretFd  = open_private(secretPath);
+    if (secretFd >= 0) {
+        hasSecret = read(secretFd, secret, sizeof(secret)) == sizeof(secret);
+        if (!hasSecret) {
+            printerr("Key cache %s is not valid\n", secretPath);
+            result = -1;
+        }
+        close(secretFd);
+    }
+    else if (errno != ENOENT) {
+        result = -1;
+    }
+
+    int fd = result == 0 ? open_private(path) : -1;
+    if (fd < 0 && result == 0 && errno != ENOENT) {
+        result = -1;
+    }
+    else if (fd >= 0 && (read(fd, &header, sizeof(header)) != sizeof(header) ||
+                         memcmp(header.magic, KEY_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+                         header.version != KEY_CACHE_VERSION ||
+                         header.entrySize != sizeof(key_cache_entry) ||
+                         header.count > KEY_CACHE_MAX)) {
+        printerr("Key cache %s is not valid\n", path);
+        result = -1;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    if (result == 0 && hasSecret) {
+        // Entries derived so far are keyed with another secret and could not be found anymore
+        if (cache.hasSecret && memcmp(cache.secret, secret, sizeof(secret)) != 0)
+            drop_entries();
+        memcpy(cache.secret, secret, sizeof(secret));
+        cache.hasSecret = true;
+    }
+
+    // Without their secret the entries in the file can not be looked up, so they are skipped
+    for (uint32_t i = 0; fd >= 0 && hasSecret && result == 0 && i < header.count; i++) {
+        key_cache_entry entry;
+        if (read(fd, &entry, sizeof(entry)) != sizeof(entry)) {
+            printerr("Key cache %s is not valid\n", path);
+            result = -1;
+        }
+        else if (!find_entry(&entry)) {
+            add_entry(&entry);
+        }
+        OPENSSL_cleanse(&entry, sizeof(entry));
+    }
+
+    if (result == 0) {
+        free(cache.path);
+        cache.path        = strdup(path);
+        cache.dirty       = fd < 0 || !hasSecret;
+        cache.secretSaved = hasSecret;
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    OPENSSL_cleanse(secret, sizeof(secret));
+    if (fd >= 0)
+        close(fd);
+    free(secretPath);
+    return result;
+}
+
+/**
+ * @brief Write the cache to the file given to key_cache_open, if anything was derived since
+ *
+ * The secret file is written first when it does not hold the current secret yet. Both are
+ * written with mode 600 next to their final path and renamed over it.
+ *
+ * @return 0 on success or when there is nothing to save, -1 on failure
+ */
+int key_cache_save(void) {
+    pthread_mutex_lock(&cache.lock);
+    if (!cache.path || !cache.dirty) {
+        pthread_mutex_unlock(&cache.lock);
+        return 0;
+    }
+
+    int result = 0;
+    if (!cache.secretSaved) {
+        char *secretPath = sibling_path(cache.path, KEY_CACHE_SECRET_SUFFIX);
+        result           = -1;
+        if (secretPath && ensure_secret() == 0)
+            result = write_private(secretPath, cache.secret, sizeof(cache.secret), NULL, 0);
+        cache.secretSaved = result == 0;
+        free(secretPath);
+    }
+
+    if (result == 0) {
+        key_cache_header header = {
+            .magic     = KEY_CACHE_MAGIC,
+            .version   = KEY_CACHE_VERSION,
+            .entrySize = sizeof(key_cache_entry),
+            .count     = cache.count,
+        };
+        result = write_private(cache.path,
+                               &header,
+                               sizeof(header),
+                               cache.entries,
+                               cache.count * sizeof(key_cache_entry));
+    }
+
+    if (result == 0)
+        cache.dirty = false;
+    else
+        printerr("Could not write key cache %s\n", cache.path);
+    pthread_mutex_unlock(&cache.lock);
+    return result;
+}
+
+/**
+ * @brief Wipe every cached key and the secret from memory and detach the cache from its file
+ */
+void key_cache_clear(void) {
+    pthread_mutex_lock(&cache.lock);
+    drop_entries();
+    free(cache.entries);
+    free(cache.path);
+    OPENSSL_cleanse(cache.secret, sizeof(cache.secret));
+    cache.entries     = NULL;
+    cache.path        = NULL;
+    cache.dirty       = false;
+    cache.hasSecret   = false;
+    cache.secretSaved = false;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief Number of PBKDF2 derivations avoided by reusing a cached key
+ */
+uint64_t key_cache_avoided(void) {
+    pthread_mutex_lock(&cache.lock);
+    uint64_t avoided = cache.avoided;
+    pthread_mutex_unlock(&cache.lock);
+    return avoided;
+}
@@ -0,0 +1,88 @@
+#include "extraction.h"
+
+#define UINT32_SIZE sizeof(uint32_t)  // Size of the payload size prefix = 4 bytes
+
+/**
+ * @brief Make sure the rows holding the first color channels of the image are loaded
+ *
+ * @param bmp BMP file structure, possibly opened lazily with open_bmp
+ * @param channels Number of channels carrying payload (rows bottom-up) that have to be available
+ *
+ * @return 0 on success, -1 if the image has fewer channels or the rows could not be read
+ */
+int bmp_load_channels(BMP_FILE *bmp, size_t channels) {
+    size_t rowChannels = bmp_row_channels(bmp);
+
+    if (rowChannels == 0 || channels > rowChannels * bmp_height(bmp))
+        return -1;
+    return bmp_load_rows(bmp, (channels + rowChannels - 1) / rowChannels);
+}
+
+typedef struct
+{
+    const lsb_reader *reader;
+    const BMP_FILE   *bmp;
+    size_t            offset;
+    unsigned char    *dst;
+} read_context;
+
+static void read_band(size_t begin, size_t end, void *context) {
+    read_context *band = context;
+    const lsb_reader *reader = band->reader;
+    reader->read(reader, band->bmp, band->offset + begin, band->dst + begin, end - begin);
+}
+
+/**
+ * @brief Read a range of payload bytes, split in bands across the shared pool
+ *
+ * Every band writes its own bytes of dst, so the result is the same whatever the number of
+ * threads.
+ */
+void read_payload(const lsb_reader *reader,
+                  const BMP_FILE   *bmp,
+                  size_t            offset,
+                  unsigned char    *dst,
+                  size_t            count) {
+    read_context context         = {reader, bmp, offset, dst};
+    size_t       channelsPerByte = reader->channels(64) / 64;
+    uint64_t     span            = stats_begin();
+
+    parallel_bands(count,
+                   STEG_BAND_CHANNELS / (channelsPerByte ? channelsPerByte : 1),
+                   1,
+                   read_band,
+                   &context);
+    stats_end(STATS_LSB_EXTRACT, span);
+}
+
+/**
+ * @brief Decode the 4-byte size prefix of the payload and check it against the capacity
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Bit layout of the steganography method
+ * @param dataSize Pointer to store the size read from the size prefix
+ *
+ * @return 0 on success, -1 if the prefix can not be read or announces more than fits
+ */
+int decode_size(BMP_FILE *bmp, const lsb_reader *reader, size_t *dataSize) {
+    unsigned char sizePrefix[UINT32_SIZE];
+
+    // The first 4 bytes represent the size of the hidden data
+    if (reader->maxDataBytes < UINT32_SIZE ||
+        bmp_load_channels(bmp, reader->channels(UINT32_SIZE)) != 0) {
+        printerr("End of image data reached before completing extraction\n");
+        return -1;
+    }
+    reader->read(reader, bmp, 0, sizePrefix, UINT32_SIZE);
+
+    uint32_t size;
+    memcpy(&size, sizePrefix, UINT32_SIZE);
+    *dataSize = ntohl(size);  // Convert from network byte order
+
+    // Ensure the reported size fits within the maximum capacity
+    if (UINT32_SIZE + *dataSize > reader->maxDataBytes) {
+        printerr("Size mismatch: read size too large\n");
+        return -1;
+    }
+    return 0;
+}
@@ -1,7 +1,31 @@
 #include "extraction.h"
 
 /**
- * @brief Extract hidden data from a BMP file using the specified steganography method
+ * @brief Get the bit layout of a steganography method for a BMP file
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param method Steganography method
+ * @param reader Where to store the bit layout
+ *
+ * @return 0 on success, -1 for an invalid method or if the layout can not be read
+ */
+int steg_reader(BMP_FILE *bmp, steg method, lsb_reader *reader) {
+    switch (method) {
+        case LSB1:
+            return lsb1_reader(bmp, reader);
+        case LSB4:
+            return lsb4_reader(bmp, reader);
+        case LSBI:
+            return lsbi_reader(bmp, reader);
+        default:
+            printerr("Invalid steganography method\n");
+            return -1;
+    }
+}
+
+/**
+ * @brief Extract hidden data from a BMP file into an output file, without printing the outcome
+ * or exiting on errors
  *
  * @param carrierFile Path to the BMP file to extract data from
  * @param outputFile Path to the output file to store the extracted data
@@ -9,67 +33,84 @@
  * @param a Encryption algorithm to use
  * @param m Encryption mode to use
  * @param pass Password to decrypt the data
+ * @param options Extraction options, with mmap set the carrier is mapped read-only and only the
+ * pages holding the payload are read
+ * @param dataSize Pointer to store the size of the extracted payload
  *
- * @note To ensure decryption a password must be provided
- *
+ * @return 0 on success, -1 on failure
  */
-void extract(const char *carrierFile,
-             const char *outputFile,
-             steg        method,
-             encryption  a,
-             mode        m,
-             const char *pass) {
-    BMP_FILE *bmp = read_bmp(carrierFile);
+int extract_file(const char         *carrierFile,
+                 const char         *outputFile,
+                 steg                method,
+                 encryption          a,
+                 mode                m,
+                 const char         *pass,
+                 const steg_options *options,
+                 size_t             *dataSize) {
+    // Only the headers are read here, the decoders load the rows holding the payload
+    BMP_FILE *bmp = options && options->mmap ? map_bmp(carrierFile, 0) : open_bmp(carrierFile);
 
     // Ensure BMP file was read correctly
     if (!bmp) {
         printerr("Could not read BMP file: %s\n", carrierFile);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    bmp_use_alpha(bmp, options && options->alpha && method != LSBI);
 
-    // Determine if encryption is being used based on password presence
-    int            encrypted     = pass != NULL;
-    unsigned char *extractedData = NULL;
-    size_t         dataSize      = 0;
+    // Bit layout of the selected steganography method
+    lsb_reader reader;
+    int        result = steg_reader(bmp, method, &reader);
 
-    // Steganography extraction based on the selected method
-    switch (method) {
-        case LSB1:
-            extractedData = lsb1_decode(bmp, &dataSize, encrypted);
-            break;
-        case LSB4:
-            extractedData = lsb4_decode(bmp, &dataSize, encrypted);
-            break;
-        case LSBI:
-            extractedData = lsbi_decode(bmp, &dataSize, encrypted);
-            break;
-        default:
-            printerr("Invalid steganography method\n");
-            free_bmp(bmp);
-            exit(EXIT_FAILURE);
-    }
+    // Decode, decrypt if needed and write the payload to the output file in chunks
+    *dataSize = 0;
+    if (result == 0)
+        result = extract_payload(bmp, &reader, outputFile, pass, a, m, dataSize);
 
     // Free BMP resources after extraction
     free_bmp(bmp);
 
-    if (!extractedData) {
+    if (result != 0)
         printerr("Error extracting data\n");
-        exit(EXIT_FAILURE);
-    }
+    return result;
+}
 
-    // Process the extracted data with decryption if needed
-    if (process_extracted_data(extractedData, outputFile, pass, a, m) != 0) {
-        printerr("Error processing extracted data\n");
-        free(extractedData);
+/**
+ * @brief Extract hidden data from a BMP file using the specified steganography method
+ *
+ * @param carrierFile Path to the BMP file to extract data from
+ * @param outputFile Path to the output file to store the extracted data
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param pass Password to decrypt the data
+ * @param options Extraction options, with mmap set the carrier is mapped read-only and only the
+ * pages holding the payload are read, threads sets how many threads share the extraction and
+ * keyCache names a file keeping derived keys across runs
+ *
+ * @note To ensure decryption a password must be provided
+ *
+ */
+void extract(const char         *carrierFile,
+             const char         *outputFile,
+             steg                method,
+             encryption          a,
+             mode                m,
+             const char         *pass,
+             const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(EXIT_FAILURE);
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
         exit(EXIT_FAILURE);
-    }
 
-    // Free the memory allocated for the extracted data
-    free(extractedData);
+    size_t dataSize;
+    if (extract_file(carrierFile, outputFile, method, a, m, pass, options, &dataSize) != 0)
+        exit(EXIT_FAILURE);
+    key_cache_save();
 
     // Output extraction details
     char dataSizeStr[20];
     snprintf(dataSizeStr, sizeof(dataSizeStr), "%zu", dataSize);
+    const char *cached = key_cache_avoided() ? "Yes" : "No";
 
     print_table("Successfully extracted hidden data from BMP file",
                 0xa6da95,
@@ -85,5 +126,7 @@ void extract(const char *carrierFile,
                 mode_str[m],
                 "Password",
                 pass ? pass : "None",
+                options && options->keyCache && pass ? "Key from cache" : NULL,
+                cached,
                 NULL);
 }
@@ -0,0 +1,420 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "extraction.h"
+
+#define UINT32_SIZE sizeof(uint32_t)  // Size of the payload size prefix = 4 bytes
+#define STREAM_CHUNK (1024 * 1024)    // Payload bytes decoded and written at a time
+
+/* Consumer of the plaintext: size prefix, file data written out, then the extension */
+typedef struct
+{
+    FILE          *out;
+    unsigned char *memory;  // Where the file data goes instead of out, room for all the plaintext
+    unsigned char  prefix[UINT32_SIZE];
+    size_t         prefixLength;
+    size_t         fileSize;  // Read from the prefix
+    size_t         written;   // File data bytes written so far
+    char           extension[EXTENSION_MAX];
+    size_t         extensionLength;
+} plain_stream;
+
+/* Output path: the output file name followed by the extension */
+static char *output_path(const char *outputFile, const char *extension) {
+    char *path = malloc(strlen(outputFile) + strlen(extension) + 1);
+    if (!path) {
+        printerr("Memory allocation failed\n");
+        return NULL;
+    }
+    strcpy(path, outputFile);
+    strcat(path, extension);
+    return path;
+}
+
+/* Create a temporary file next to the output file, with the permissions a new file would get */
+static FILE *open_temporary(const char *outputFile, char **path) {
+    for (unsigned attempt = 0; attempt < 100; attempt++) {
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".partial-%ld-%u", (long) getpid(), attempt);
+        if (!(*path = output_path(outputFile, suffix)))
+            return NULL;
+
+        int fd = open(*path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0)
+            return fdopen(fd, "wb");
+        free(*path);
+        *path = NULL;
+        if (errno != EEXIST)
+            break;
+    }
+    printerr("Failed to open output file %s\n", outputFile);
+    return NULL;
+}
+
+/* Take the next plaintext bytes: fill the size prefix, write the file data, keep the extension */
+static int plain_consume(plain_stream *plain, const unsigned char *src, size_t count) {
+    while (count > 0) {
+        size_t take;
+        if (plain->prefixLength < UINT32_SIZE) {
+            take = UINT32_SIZE - plain->prefixLength < count ? UINT32_SIZE - plain->prefixLength
+                                                             : count;
+            memcpy(plain->prefix + plain->prefixLength, src, take);
+            plain->prefixLength += take;
+            if (plain->prefixLength == UINT32_SIZE) {
+                uint32_t size;
+                memcpy(&size, plain->prefix, UINT32_SIZE);
+                plain->fileSize = ntohl(size);
+            }
+        }
+        else if (plain->written < plain->fileSize) {
+            take = plain->fileSize - plain->written < count ? plain->fileSize - plain->written
+                                                             : count;
+            uint64_t span = stats_begin();
+            if (plain->memory)
+                memcpy(plain->memory + plain->written, src, take);
+            else if (fwrite(src, 1, take, plain->out) != take) {
+                printerr("Failed to write all data to output file\n");
+                return -1;
+            }
+            else
+                stats_count(STATS_BYTES_WRITTEN, take);
+            stats_end(STATS_WRITE_OUTPUT, span);
+            plain->written += take;
+        }
+        else {
+            take = EXTENSION_MAX - plain->extensionLength < count
+                       ? EXTENSION_MAX - plain->extensionLength
+                       : count;
+            if (take == 0) {
+                printerr("File extension is not null-terminated\n");
+                return -1;
+            }
+            memcpy(plain->extension + plain->extensionLength, src, take);
+            plain->extensionLength += take;
+        }
+        src += take;
+        count -= take;
+    }
+    return 0;
+}
+
+/* Check the extension left in the plaintext once it has all been consumed */
+static int plain_extension(const plain_stream *plain) {
+    if (plain->written < plain->fileSize || plain->extensionLength == 0 ||
+        plain->extension[0] != '.') {
+        printerr("File extension is not valid\n");
+        return -1;
+    }
+    if (!memchr(plain->extension, '\0', plain->extensionLength)) {
+        printerr("File extension is not null-terminated\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Decode the ciphertext in chunks, decrypt it and write the file data as it is produced. The
+ * authenticated modes start from the nonce preceding the ciphertext and their plaintext is held
+ * back until the tag following it checks out, a wrong password or a corrupted carrier is
+ * rejected before any of it is consumed.
+ */
+static int decrypt_stream(BMP_FILE         *bmp,
+                          const lsb_reader *reader,
+                          size_t            cipherSize,
+                          size_t            tagLength,
+                          EVP_CIPHER_CTX   *cipher,
+                          plain_stream     *plain) {
+    size_t         nonceSize = tagLength > 0 ? AEAD_NONCE_LENGTH : 0;
+    size_t         overhead  = nonceSize + tagLength;
+    size_t         textSize  = cipherSize < overhead ? 0 : cipherSize - overhead;
+    size_t         heldSize  = tagLength > 0 ? textSize : STREAM_CHUNK;
+    unsigned char *chunk     = malloc(STREAM_CHUNK);
+    unsigned char *plaintext = malloc(heldSize + EVP_MAX_BLOCK_LENGTH);
+    size_t         held      = 0;  // Plaintext bytes held back so far
+    int            result    = -1;
+    int            len;
+
+    stats_alloc(STREAM_CHUNK);
+    stats_alloc(heldSize + EVP_MAX_BLOCK_LENGTH);
+    if (!chunk || !plaintext) {
+        printerr("Memory allocation failed\n");
+    }
+    else if (bmp_load_channels(bmp, reader->channels(UINT32_SIZE + cipherSize)) != 0) {
+        printerr("End of image data reached before completing extraction\n");
+    }
+    else if (cipherSize < overhead) {
+        printerr("Authentication failed: wrong password or corrupted carrier\n");
+    }
+    else {
+        result = 0;
+        if (tagLength > 0) {
+            unsigned char nonce[AEAD_NONCE_LENGTH], tag[AEAD_TAG_LENGTH];
+            read_payload(reader, bmp, UINT32_SIZE, nonce, nonceSize);
+            read_payload(reader, bmp, UINT32_SIZE + nonceSize + textSize, tag, tagLength);
+            if (cipher_stream_set_nonce(cipher, nonce) != 1 ||
+                cipher_stream_set_tag(cipher, tag) != 1) {
+                printerr("Error during decryption\n");
+                result = -1;
+            }
+        }
+        for (size_t offset = 0; result == 0 && offset < textSize; offset += STREAM_CHUNK) {
+            size_t count = textSize - offset < STREAM_CHUNK ? textSize - offset : STREAM_CHUNK;
+            read_payload(reader, bmp, UINT32_SIZE + nonceSize + offset, chunk, count);
+            uint64_t span      = stats_begin();
+            int      decrypted =
+                EVP_DecryptUpdate(cipher, plaintext + held, &len, chunk, (int) count);
+            stats_end(STATS_CIPHER, span);
+            if (decrypted != 1) {
+                printerr("Error during decryption\n");
+                result = -1;
+            }
+            else if (tagLength > 0) {
+                held += len;
+            }
+            else {
+                result = plain_consume(plain, plaintext, len);
+            }
+        }
+        uint64_t span = stats_begin();
+        if (result == 0 && EVP_DecryptFinal_ex(cipher, plaintext + held, &len) != 1) {
+            if (tagLength > 0)
+                printerr("Authentication failed: wrong password or corrupted carrier\n");
+            else
+                printerr("Error during final decryption\n");
+            result = -1;
+        }
+        stats_end(STATS_CIPHER, span);
+        if (result == 0)
+            result = plain_consume(plain, plaintext, held + len);
+    }
+
+    free(chunk);
+    free(plaintext);
+    return result;
+}
+
+/* Decrypt the payload into a temporary file, renamed once the trailing extension is known */
+static int extract_encrypted(BMP_FILE         *bmp,
+                             const lsb_reader *reader,
+                             size_t            cipherSize,
+                             size_t            tagLength,
+                             const char       *outputFile,
+                             EVP_CIPHER_CTX   *cipher) {
+    plain_stream plain = {0};
+    char        *temporary;
+
+    if (!(plain.out = open_temporary(outputFile, &temporary)))
+        return -1;
+
+    int result = decrypt_stream(bmp, reader, cipherSize, tagLength, cipher, &plain);
+    if (result != 0)
+        printerr("Error decrypting data\n");
+    else
+        result = plain_extension(&plain);
+
+    if (fclose(plain.out) != 0 && result == 0) {
+        printerr("Failed to write all data to output file\n");
+        result = -1;
+    }
+
+    char *path = result == 0 ? output_path(outputFile, plain.extension) : NULL;
+    if (path && rename(temporary, path) != 0) {
+        printerr("Failed to open output file %s\n", path);
+        free(path);
+        path = NULL;
+    }
+    if (!path) {
+        remove(temporary);
+        result = -1;
+    }
+
+    free(path);
+    free(temporary);
+    return result;
+}
+
+/* Read the extension that follows the file data of a plain payload, one byte at a time */
+static int read_extension(BMP_FILE         *bmp,
+                          const lsb_reader *reader,
+                          size_t            fileSize,
+                          plain_stream     *plain) {
+    size_t length = UINT32_SIZE + fileSize;
+
+    while (plain->extensionLength == 0 ||
+           plain->extension[plain->extensionLength - 1] != '\0') {
+        if (length >= reader->maxDataBytes ||
+            bmp_load_channels(bmp, reader->channels(length + 1)) != 0) {
+            printerr("End of image data reached before completing extraction\n");
+            return -1;
+        }
+        if (plain->extensionLength == EXTENSION_MAX) {
+            printerr("File extension is not null-terminated\n");
+            return -1;
+        }
+
+        unsigned char c;
+        reader->read(reader, bmp, length++, &c, 1);
+        plain->extension[plain->extensionLength++] = c;
+        if (plain->extension[0] != '.') {
+            printerr("File extension is not valid\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Read the extension first, then decode the file data in chunks straight into the output */
+static int extract_plain(BMP_FILE         *bmp,
+                         const lsb_reader *reader,
+                         size_t            fileSize,
+                         const char       *outputFile) {
+    plain_stream plain = {.fileSize = fileSize};
+    if (read_extension(bmp, reader, fileSize, &plain) != 0)
+        return -1;
+
+    char *path = output_path(outputFile, plain.extension);
+    if (!path)
+        return -1;
+    if (!(plain.out = fopen(path, "wb"))) {
+        printerr("Failed to open output file %s\n", path);
+        free(path);
+        return -1;
+    }
+
+    size_t         chunkSize = fileSize < STREAM_CHUNK ? fileSize + 1 : STREAM_CHUNK;
+    unsigned char *chunk     = malloc(chunkSize);
+    int            result    = chunk ? 0 : -1;
+    if (!chunk)
+        printerr("Memory allocation failed\n");
+    stats_alloc(chunkSize);
+
+    for (size_t offset = 0; result == 0 && offset < fileSize; offset += STREAM_CHUNK) {
+        size_t count = fileSize - offset < STREAM_CHUNK ? fileSize - offset : STREAM_CHUNK;
+        read_payload(reader, bmp, UINT32_SIZE + offset, chunk, count);
+        uint64_t span = stats_begin();
+        if (fwrite(chunk, 1, count, plain.out) != count) {
+            printerr("Failed to write all data to output file\n");
+            result = -1;
+        }
+        stats_count(STATS_BYTES_WRITTEN, count);
+        stats_end(STATS_WRITE_OUTPUT, span);
+    }
+
+    if (fclose(plain.out) != 0 && result == 0) {
+        printerr("Failed to write all data to output file\n");
+        result = -1;
+    }
+    if (result != 0)
+        remove(path);
+
+    free(chunk);
+    free(path);
+    return result;
+}
+
+/**
+ * @brief Extract the hidden payload straight into the output file, one chunk at a time
+ *
+ * Encrypted payloads are decoded in chunks that go through EVP_DecryptUpdate, the plaintext file
+ * data is written as soon as it is produced. The extension trailing the plaintext is only known
+ * at the end, so the data goes to a temporary file next to the output that is then renamed.
+ * Authenticated modes (GCM, ChaCha20-Poly1305) write nothing until their tag checks out.
+ * Plain payloads have their extension at a known offset: it is read first and the file data is
+ * then decoded in chunks straight into the output file.
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Bit layout of the steganography method
+ * @param outputFile Path of the output file, without the extension
+ * @param pass Password to decrypt the data, NULL for plain payloads
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param dataSize Pointer to store the size read from the size prefix
+ *
+ * @return 0 on success, -1 on failure (no output file is left behind)
+ */
+int extract_payload(BMP_FILE         *bmp,
+                    const lsb_reader *reader,
+                    const char       *outputFile,
+                    const char       *pass,
+                    encryption        a,
+                    mode              m,
+                    size_t           *dataSize) {
+    if (decode_size(bmp, reader, dataSize) != 0)
+        return -1;
+
+    if (!pass)
+        return extract_plain(bmp, reader, *dataSize, outputFile);
+
+    EVP_CIPHER_CTX *cipher = cipher_stream_new(pass, a, m, 0);
+    if (!cipher) {
+        printerr("Error decrypting data\n");
+        return -1;
+    }
+    int result = extract_encrypted(bmp, reader, *dataSize, tag_length(a, m), outputFile, cipher);
+    EVP_CIPHER_CTX_free(cipher);
+    return result;
+}
+
+/**
+ * @brief Extract the hidden payload into memory instead of an output file
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Bit layout of the steganography method
+ * @param dataSize Size read from the size prefix with decode_size
+ * @param pass Password to decrypt the data, NULL for plain payloads
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param data Where to store the file data, to be released with free()
+ * @param size Where to store the size of the file data
+ * @param extension Where to store the extension, null terminated
+ *
+ * @return 0 on success, -1 on failure (nothing is stored)
+ */
+int extract_payload_memory(BMP_FILE         *bmp,
+                           const lsb_reader *reader,
+                           size_t            dataSize,
+                           const char       *pass,
+                           encryption        a,
+                           mode              m,
+                           unsigned char   **data,
+                           size_t           *size,
+                           char              extension[EXTENSION_MAX]) {
+    // Plain payloads hold dataSize bytes of file data, encrypted ones at most as much plaintext
+    plain_stream plain = {.fileSize = pass ? 0 : dataSize};
+    size_t       room  = dataSize + (pass ? EVP_MAX_BLOCK_LENGTH : 0) + 1;
+    plain.memory       = malloc(room);
+    if (!plain.memory) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    stats_alloc(room);
+
+    int result = -1;
+    if (!pass) {
+        result = read_extension(bmp, reader, dataSize, &plain);
+        if (result == 0)
+            read_payload(reader, bmp, UINT32_SIZE, plain.memory, dataSize);
+        plain.written = dataSize;
+    }
+    else {
+        EVP_CIPHER_CTX *cipher    = cipher_stream_new(pass, a, m, 0);
+        size_t          tagLength = tag_length(a, m);
+        if (!cipher)
+            printerr("Error decrypting data\n");
+        else if ((result = decrypt_stream(bmp, reader, dataSize, tagLength, cipher, &plain)) != 0)
+            printerr("Error decrypting data\n");
+        else
+            result = plain_extension(&plain);
+        EVP_CIPHER_CTX_free(cipher);
+    }
+
+    if (result != 0) {
+        free(plain.memory);
+        return -1;
+    }
+    *data = plain.memory;
+    *size = plain.written;
+    memcpy(extension, plain.extension, plain.extensionLength);
+    return 0;
+}
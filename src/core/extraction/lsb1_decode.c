@@ -1,98 +1,83 @@
-#include <ctype.h>
-
 #include "extraction.h"
-/**
- * @brief Extract hidden data from a BMP file using the LSB1 steganography method
- *
- * @param bmp BMP file structure to extract data from
- * @param dataSize Pointer to store the size of the extracted data
- * @param encrypted Flag to indicate if the data is encrypted
- *
- * @return Pointer to the extracted data buffer
- *
- * @note The caller is responsible for freeing the returned buffer
- */
-unsigned char *lsb1_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted) {
-    size_t width        = bmp->infoHeader.biWidth;
-    size_t height       = bmp->infoHeader.biHeight;
-    size_t maxDataBytes = (width * height * 3) / 8;  // Each pixel has 3 color components
-
-    // Allocate memory for the extracted data buffer
-    unsigned char *dataBuffer = malloc(maxDataBytes);
-    if (!dataBuffer) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return NULL;
-    }
+#include "lsb_kernels.h"
 
-    size_t  dataBufferIndex    = 0;  // Index for writing bytes into the data buffer
-    uint8_t currentByte        = 0;  // Byte currently being constructed from bits
-    int     bitIndex           = 0;  // Tracks position within the current byte (0-7)
-    int     extractionComplete = 0;  // Flag to stop extraction when done
-    int     extensionFound     = 0;  // Flag to indicate if the file extension start has been found
+/* Every payload bit is stored in the LSB of one color channel */
+static size_t lsb1_channels(size_t bytes) {
+    return bytes * 8;
+}
 
-    // Iterate over each pixel in the BMP image
-    for (size_t i = 0; i < height && !extractionComplete; ++i) {
-        for (size_t j = 0; j < width && !extractionComplete; ++j) {
-            PIXEL   pixel     = bmp->pixels[i][j];
-            uint8_t colors[3] = {pixel.blue, pixel.green, pixel.red};
+/* Take a single payload bit (bit `bit` of dst, MSB first) from the LSB of a channel */
+static inline void get_bit(uint8_t channel, unsigned char *dst, size_t bit) {
+    if (bit % 8 == 0)
+        dst[bit / 8] = 0;
+    dst[bit / 8] |= (channel & 1) << (7 - bit % 8);
+}
 
-            // Extract the LSB from each color component
-            for (int k = 0; k < 3 && !extractionComplete; ++k) {
-                uint8_t bit = colors[k] & 1;
-                currentByte = (currentByte << 1) | bit;
-                ++bitIndex;
+/* Payload bits decoded from the runs of channels of a row */
+typedef struct
+{
+    const lsb_kernels *kernels;
+    unsigned char     *dst;
+    size_t             bit;  // Next bit of dst to decode
+} read_run_context;
 
-                // If we have a full byte, store it in the data buffer
-                if (bitIndex == 8) {
-                    dataBuffer[dataBufferIndex++] = currentByte;
-                    currentByte                   = 0;
-                    bitIndex                      = 0;
+/* Decode payload bits from channels [k, end) of a run */
+static void read_run(uint8_t *colors, size_t k, size_t end, void *context) {
+    read_run_context *run = context;
+    unsigned char    *dst = run->dst;
 
-                    // The first 4 bytes represent the size of the hidden data
-                    if (dataBufferIndex == 4) {
-                        uint32_t size;
-                        memcpy(&size, dataBuffer, 4);
-                        size      = ntohl(size);  // Convert from network byte order
-                        *dataSize = size;
+    // Finish the byte started in the previous run
+    for (; k < end && run->bit % 8 != 0; k++, run->bit++)
+        get_bit(colors[k], dst, run->bit);
 
-                        // Ensure the reported size fits within the maximum capacity
-                        if (4 + *dataSize > maxDataBytes) {
-                            fprintf(stderr, "Size mismatch: read size too large\n");
-                            free(dataBuffer);
-                            return NULL;
-                        }
-                    }
+    size_t bytes = (end - k) / 8;
+    run->kernels->lsb1_extract(colors + k, dst + run->bit / 8, bytes);
+    k += bytes * 8;
+    run->bit += bytes * 8;
 
-                    // Check if extraction should be stopped
-                    if (dataBufferIndex >= 4 + *dataSize) {
-                        if (!encrypted) {
-                            if (!extensionFound && dataBuffer[dataBufferIndex - 1] == '.') {
-                                extensionFound = 1;
-                            }
-                            else if (extensionFound && dataBuffer[dataBufferIndex - 1] == '\0') {
-                                extractionComplete = 1;
-                            }
-                        }
-                        else {
-                            extractionComplete = 1;
-                        }
-                    }
+    // Start the byte that continues in the next run
+    for (; k < end; k++, run->bit++)
+        get_bit(colors[k], dst, run->bit);
+}
 
-                    // Prevent buffer overflow
-                    if (dataBufferIndex >= maxDataBytes) {
-                        extractionComplete = 1;
-                    }
-                }
-            }
-        }
-    }
+/*
+ * Decode payload bytes [offset, offset+count), MSB first, from the channel LSBs. Byte aligned
+ * runs of each row go through the vector kernels, only the bits of a byte split between two
+ * runs are taken one at a time.
+ */
+static void lsb1_read(const lsb_reader *reader,
+                      const BMP_FILE   *bmp,
+                      size_t            offset,
+                      unsigned char    *dst,
+                      size_t            count) {
+    (void) reader;
+    read_run_context run         = {.kernels = lsb_kernels_get(), .dst = dst, .bit = 0};
+    size_t           rowChannels = bmp_row_channels(bmp);
+    size_t           channel     = offset * 8;
+    size_t           row         = channel / rowChannels;
+    size_t           k           = channel % rowChannels;  // Channel within the current row
+    size_t           totalBits   = count * 8;
 
-    // If the loop ended without extracting all data, report an error
-    if (!extractionComplete) {
-        fprintf(stderr, "End of image data reached before completing extraction\n");
-        free(dataBuffer);
-        return NULL;
+    for (; run.bit < totalBits; row++, k = 0) {
+        size_t remaining = totalBits - run.bit;
+        size_t end       = rowChannels - k < remaining ? rowChannels : k + remaining;
+        bmp_visit_channels(bmp, row, k, end, false, read_run, &run);
     }
+}
 
-    return dataBuffer;
-}
\ No newline at end of file
+/**
+ * @brief Bit layout of the LSB1 steganography method
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Reader to fill in
+ *
+ * @return 0 on success
+ */
+int lsb1_reader(BMP_FILE *bmp, lsb_reader *reader) {
+    *reader = (lsb_reader) {
+        .maxDataBytes = bmp_channels(bmp) / 8,  // 3 color components, or 4 with alpha
+        .channels     = lsb1_channels,
+        .read         = lsb1_read,
+    };
+    return 0;
+}
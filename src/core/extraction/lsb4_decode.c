@@ -1,97 +1,84 @@
 #include "extraction.h"
+#include "lsb_kernels.h"
 
-/**
- * @brief Extract hidden data from a BMP file using the LSB4 steganography method
- *
- * @param bmp BMP file structure to extract data from
- * @param dataSize Pointer to store the size of the extracted data
- * @param encrypted Flag to indicate if the data is encrypted
- *
- * @return Pointer to the extracted data buffer
- *
- * @note The caller is responsible for freeing the returned buffer
- */
-unsigned char *lsb4_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted) {
-    size_t width        = bmp->infoHeader.biWidth;
-    size_t height       = bmp->infoHeader.biHeight;
-    size_t maxDataBytes = (width * height * 3) / 2;  // Each pixel has 3 color components
-
-    // Allocate memory for the extracted data buffer
-    unsigned char *dataBuffer = malloc(maxDataBytes);
-    if (!dataBuffer) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return NULL;
-    }
-
-    size_t  dataBufferIndex    = 0;  // Index for writing bytes into the data buffer
-    uint8_t currentByte        = 0;  // Byte currently being constructed from nibbles
-    int     nibbleIndex        = 0;  // Tracks position within the current byte (0 or 1)
-    int     extractionComplete = 0;  // Flag to stop extraction when done
-    int     extensionFound     = 0;  // Flag to indicate if the file extension start has been found
+/* Every payload byte is stored in the low nibbles of two color channels */
+static size_t lsb4_channels(size_t bytes) {
+    return bytes * 2;
+}
 
-    // Iterate over each pixel in the BMP image
-    for (size_t i = 0; i < height && !extractionComplete; ++i) {
-        for (size_t j = 0; j < width && !extractionComplete; ++j) {
-            PIXEL   pixel     = bmp->pixels[i][j];
-            uint8_t colors[3] = {pixel.blue, pixel.green, pixel.red};
+/* Take a single payload nibble (high nibble of a byte first) from the low nibble of a channel */
+static inline void get_nibble(uint8_t channel, unsigned char *dst, size_t nibble) {
+    if (nibble % 2 == 0)
+        dst[nibble / 2] = (channel & 0x0F) << 4;
+    else
+        dst[nibble / 2] |= channel & 0x0F;
+}
 
-            // Extract the LSB nibble from each color component
-            for (int k = 0; k < 3 && !extractionComplete; ++k) {
-                uint8_t nibble = colors[k] & 0x0F;
-                currentByte    = (currentByte << 4) | nibble;
-                ++nibbleIndex;
+/* Payload nibbles decoded from the runs of channels of a row */
+typedef struct
+{
+    const lsb_kernels *kernels;
+    unsigned char     *dst;
+    size_t             nibble;  // Next nibble of dst to decode
+} read_run_context;
 
-                // If we have two nibbles (one byte), store it in the data buffer
-                if (nibbleIndex == 2) {
-                    dataBuffer[dataBufferIndex++] = currentByte;
-                    currentByte                   = 0;
-                    nibbleIndex                   = 0;
+/* Decode payload nibbles from channels [k, end) of a run */
+static void read_run(uint8_t *colors, size_t k, size_t end, void *context) {
+    read_run_context *run = context;
+    unsigned char    *dst = run->dst;
 
-                    // The first 4 bytes represent the size of the hidden data
-                    if (dataBufferIndex == 4) {
-                        uint32_t size;
-                        memcpy(&size, dataBuffer, 4);
-                        size      = ntohl(size);  // Convert from network byte order
-                        *dataSize = size;
+    // Finish the byte started in the previous run
+    if (k < end && run->nibble % 2 != 0)
+        get_nibble(colors[k++], dst, run->nibble++);
 
-                        // Ensure the reported size fits within the maximum capacity
-                        if (4 + *dataSize > maxDataBytes) {
-                            fprintf(stderr, "Size mismatch: read size too large\n");
-                            free(dataBuffer);
-                            return NULL;
-                        }
-                    }
+    size_t bytes = (end - k) / 2;
+    run->kernels->lsb4_extract(colors + k, dst + run->nibble / 2, bytes);
+    k += bytes * 2;
+    run->nibble += bytes * 2;
 
-                    // Check if extraction should be stopped
-                    if (dataBufferIndex >= 4 + *dataSize) {
-                        if (!encrypted) {
-                            if (!extensionFound && dataBuffer[dataBufferIndex - 1] == '.') {
-                                extensionFound = 1;
-                            }
-                            else if (extensionFound && dataBuffer[dataBufferIndex - 1] == '\0') {
-                                extractionComplete = 1;
-                            }
-                        }
-                        else {
-                            extractionComplete = 1;
-                        }
+    // Start the byte that continues in the next run
+    if (k < end)
+        get_nibble(colors[k++], dst, run->nibble++);
+}
 
-                        // Prevent buffer overflow
-                        if (dataBufferIndex >= maxDataBytes) {
-                            extractionComplete = 1;
-                        }
-                    }
-                }
-            }
-        }
-    }
+/*
+ * Decode payload bytes [offset, offset+count), high nibble first, from the channel nibbles.
+ * Byte aligned runs of each row go through the vector kernels, only a byte split between two
+ * runs (runs with an odd number of channels) is taken one nibble at a time.
+ */
+static void lsb4_read(const lsb_reader *reader,
+                      const BMP_FILE   *bmp,
+                      size_t            offset,
+                      unsigned char    *dst,
+                      size_t            count) {
+    (void) reader;
+    read_run_context run          = {.kernels = lsb_kernels_get(), .dst = dst, .nibble = 0};
+    size_t           rowChannels  = bmp_row_channels(bmp);
+    size_t           channel      = offset * 2;
+    size_t           row          = channel / rowChannels;
+    size_t           k            = channel % rowChannels;  // Channel within the current row
+    size_t           totalNibbles = count * 2;
 
-    // If the loop ended without extracting all data, report an error
-    if (!extractionComplete) {
-        fprintf(stderr, "End of image data reached before completing extraction\n");
-        free(dataBuffer);
-        return NULL;
+    for (; run.nibble < totalNibbles; row++, k = 0) {
+        size_t remaining = totalNibbles - run.nibble;
+        size_t end       = rowChannels - k < remaining ? rowChannels : k + remaining;
+        bmp_visit_channels(bmp, row, k, end, false, read_run, &run);
     }
+}
 
-    return dataBuffer;
+/**
+ * @brief Bit layout of the LSB4 steganography method
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Reader to fill in
+ *
+ * @return 0 on success
+ */
+int lsb4_reader(BMP_FILE *bmp, lsb_reader *reader) {
+    *reader = (lsb_reader) {
+        .maxDataBytes = bmp_channels(bmp) / 2,  // 3 color components, or 4 with alpha
+        .channels     = lsb4_channels,
+        .read         = lsb4_read,
+    };
+    return 0;
 }
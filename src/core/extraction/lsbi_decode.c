@@ -1,150 +1,94 @@
 #include "extraction.h"
 
-/**
- * @brief Extract hidden data from a BMP file using the LSBI steganography method
- *
- * @param bmp BMP file structure to extract data from
- * @param dataSize Pointer to store the size of the extracted data
- * @param encrypted Flag to indicate if the data is encrypted
- *
- * @return Pointer to the extracted data buffer
- *
- * @note The caller is responsible for freeing the returned buffer
+/*
+ * The first 4 color channels hold the inversion map, data bits follow from the green channel
+ * of the second pixel on, skipping every red channel. Counting the blue and green channels
+ * only, data bit k is therefore the (k + 3)-th one: pixel (k + 3) / 2, blue if even.
  */
-
-unsigned char *lsbi_decode(BMP_FILE *bmp, size_t *dataSize, int encrypted) {
-    size_t width  = bmp->infoHeader.biWidth;
-    size_t height = bmp->infoHeader.biHeight;
-
-    size_t totalComponents = width * height * 3;  // Total color components (R, G, B)
-    size_t maxDataBits     = width * height * 2;  // Only green and blue channels are used
-    size_t maxDataBytes    = maxDataBits / 8;     // Maximum bytes that can be extracted
-
-    // Allocate memory for the extracted data buffer
-    unsigned char *dataBuffer = malloc(maxDataBytes);
-    if (!dataBuffer) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return NULL;
-    }
-
-    // Step 1: Read the 4-bit inversion map from the first 4 color components
-    uint8_t inversionMap = 0;
-    int     bitsRead     = 0;
-    size_t  idx          = 0;  // Index of the current color component
-
-    while (bitsRead < 4 && idx < totalComponents) {
-        size_t i    = idx / (width * 3);
-        size_t temp = idx % (width * 3);
-        size_t j    = temp / 3;
-        size_t k    = temp % 3;
-
-        if (i >= height || j >= width)
-            break;
-
-        PIXEL   pixel     = bmp->pixels[i][j];
-        uint8_t colors[3] = {pixel.blue, pixel.green, pixel.red};
-
-        uint8_t bit = colors[k] & 1;
-        inversionMap |= bit << (3 - bitsRead);  // Build the inversion map
-        bitsRead++;
-        idx++;
-    }
-
-    if (bitsRead < 4) {
-        fprintf(stderr, "Failed to read inversion map bits\n");
-        free(dataBuffer);
-        return NULL;
-    }
-
-    // Step 2: Decode the hidden data using the inversion map
-    size_t  dataBufferIndex    = 0;
-    uint8_t currentByte        = 0;
-    int     bitIndex           = 0;
-    int     extractionComplete = 0;
-    int     extensionFound     = 0;
-
-    while (idx < totalComponents && !extractionComplete) {
-        // Skip the red channel (k == 2)
-        if ((idx % 3) == 2) {
-            idx++;
-            continue;
-        }
-
-        size_t i    = idx / (width * 3);
-        size_t temp = idx % (width * 3);
-        size_t j    = temp / 3;
-        size_t k    = temp % 3;
-
-        if (i >= height || j >= width)
-            break;
-
-        PIXEL   pixel      = bmp->pixels[i][j];
-        uint8_t colors[3]  = {pixel.blue, pixel.green, pixel.red};
-        uint8_t colorValue = colors[k];
-
-        // Extract the pattern from the 2nd and 3rd least significant bits (LSBs)
-        uint8_t pattern  = (colorValue >> 1) & 0x03;             // 2nd and 3rd LSBs
-        uint8_t inverted = (inversionMap >> (3 - pattern)) & 1;  // Determine if the bit is inverted
-
-        // Extract the LSB and invert if necessary
-        uint8_t bit = colorValue & 1;
-        if (inverted)
-            bit ^= 1;
-
-        // Collect bits to form bytes
-        currentByte = (currentByte << 1) | bit;
-        bitIndex++;
-
-        if (bitIndex == 8) {
-            dataBuffer[dataBufferIndex++] = currentByte;
-            currentByte                   = 0;
-            bitIndex                      = 0;
-
-            // The first 4 bytes represent the size of the hidden data
-            if (dataBufferIndex == 4) {
-                uint32_t size;
-                memcpy(&size, dataBuffer, 4);
-                size      = ntohl(size);  // Convert from network byte order
-                *dataSize = size;
-
-                // Ensure the reported size fits within the maximum capacity
-                if (4 + *dataSize > maxDataBytes) {
-                    fprintf(stderr, "Size mismatch: hidden data is too large for this image\n");
-                    free(dataBuffer);
-                    return NULL;
-                }
-            }
-
-            // Check if extraction should be stopped
-            if (dataBufferIndex >= 4 + *dataSize) {
-                if (!encrypted) {
-                    if (!extensionFound && dataBuffer[dataBufferIndex - 1] == '.') {
-                        extensionFound = 1;
-                    }
-                    else if (extensionFound && dataBuffer[dataBufferIndex - 1] == '\0') {
-                        extractionComplete = 1;
-                    }
+#define LSBI_MAP_CHANNELS 4
+#define LSBI_FIRST_SLOT 3
+
+/* Color channels spanned by the inversion map and the first `bytes` bytes */
+static size_t lsbi_channels(size_t bytes) {
+    if (bytes == 0)
+        return LSBI_MAP_CHANNELS;
+
+    size_t slot = LSBI_FIRST_SLOT + bytes * 8 - 1;  // Blue/green channel of the last bit
+    return (slot / 2) * 3 + slot % 2 + 1;
+}
+
+/* Decode payload bytes [offset, offset+count) undoing the inversion of each pattern */
+static void lsbi_read(const lsb_reader *reader,
+                      const BMP_FILE   *bmp,
+                      size_t            offset,
+                      unsigned char    *dst,
+                      size_t            count) {
+    size_t width = bmp_width(bmp);
+    size_t slot  = LSBI_FIRST_SLOT + offset * 8;
+    size_t pixel = slot / 2;
+    size_t row   = pixel / width;
+    size_t col   = pixel % width;
+    int    k     = slot % 2;  // 0 = blue, 1 = green
+
+    const uint8_t *colors = bmp_pixel(bmp, row, col);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t currentByte = 0;
+        for (int bitIndex = 0; bitIndex < 8; bitIndex++) {
+            uint8_t colorValue = colors[k];
+
+            // The pattern is given by the 2nd and 3rd least significant bits
+            uint8_t pattern  = (colorValue >> 1) & 0x03;
+            uint8_t inverted = (reader->inversionMap >> (3 - pattern)) & 1;
+
+            currentByte = (currentByte << 1) | ((colorValue & 1) ^ inverted);
+
+            // Move to the next blue/green channel
+            if (k == 1) {
+                k = 0;
+                if (++col == width) {
+                    col = 0;
+                    row++;
+                    colors = bmp_row(bmp, row);
                 }
                 else {
-                    extractionComplete = 1;
-                }
-
-                // Prevent buffer overflow
-                if (dataBufferIndex >= maxDataBytes) {
-                    extractionComplete = 1;
+                    colors += bmp->pixelSize;
                 }
             }
+            else {
+                k = 1;
+            }
         }
-
-        idx++;
+        dst[i] = currentByte;
     }
+}
 
-    // Check if extraction was successful
-    if (!extractionComplete) {
-        fprintf(stderr, "End of image data reached before completing extraction\n");
-        free(dataBuffer);
-        return NULL;
+/**
+ * @brief Bit layout of the LSBI steganography method, with the inversion map read from the
+ * first 4 color components
+ *
+ * @param bmp BMP file structure to extract data from
+ * @param reader Reader to fill in
+ *
+ * @return 0 on success, -1 if the inversion map can not be read
+ */
+int lsbi_reader(BMP_FILE *bmp, lsb_reader *reader) {
+    *reader = (lsb_reader) {
+        .maxDataBytes = (bmp_width(bmp) * bmp_height(bmp) * 2) / 8,  // Only green and blue used
+        .channels     = lsbi_channels,
+        .read         = lsbi_read,
+        .inversionMap = 0,
+    };
+
+    // Read the 4-bit inversion map from the first 4 color components
+    if (bmp_load_channels(bmp, LSBI_MAP_CHANNELS) != 0) {
+        printerr("Failed to read inversion map bits\n");
+        return -1;
     }
-
-    return dataBuffer;
-}
\ No newline at end of file
+    for (int bitsRead = 0; bitsRead < LSBI_MAP_CHANNELS; bitsRead++) {
+        size_t         pixel = bitsRead / 3;
+        const uint8_t *color =
+            bmp_pixel(bmp, pixel / bmp_width(bmp), pixel % bmp_width(bmp)) + bitsRead % 3;
+        reader->inversionMap |= (*color & 1) << (3 - bitsRead);
+    }
+    return 0;
+}
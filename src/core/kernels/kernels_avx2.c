@@ -0,0 +1,348 @@
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/* 32 channels (4 payload bytes) per iteration */
+__attribute__((target("avx2"))) static void lsb1_embed_avx2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    const __m256i bitMask   = _mm256_set1_epi64x((long long) 0x0102040810204080ULL);
+    const __m256i lsb       = _mm256_set1_epi8(1);
+    const __m256i broadcast = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,  //
+                                               1, 1, 1, 1, 1, 1, 1, 1,  //
+                                               2, 2, 2, 2, 2, 2, 2, 2,  //
+                                               3, 3, 3, 3, 3, 3, 3, 3);
+    size_t        i         = 0;
+
+    for (; i + 4 <= bytes; i += 4, chan += 32) {
+        // Every 128-bit lane holds the 4 payload bytes, the shuffle spreads each over 8 lanes
+        uint32_t word;
+        memcpy(&word, src + i, sizeof(word));
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int) word), broadcast);
+        v         = _mm256_cmpeq_epi8(_mm256_and_si256(v, bitMask), bitMask);
+
+        __m256i colors = _mm256_loadu_si256((const __m256i *) chan);
+        colors = _mm256_or_si256(_mm256_andnot_si256(lsb, colors), _mm256_and_si256(v, lsb));
+        _mm256_storeu_si256((__m256i *) chan, colors);
+    }
+    lsb1_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* 32 channels (4 payload bytes) per iteration */
+__attribute__((target("avx2"))) static void lsb1_extract_avx2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 4 <= bytes; i += 4, chan += 32) {
+        // Move every LSB to the sign bit and collect them, channel j ends up in bit j
+        __m256i  colors = _mm256_loadu_si256((const __m256i *) chan);
+        uint32_t bits   = (uint32_t) _mm256_movemask_epi8(_mm256_slli_epi16(colors, 7));
+        bits            = (uint32_t) reverse_byte_bits(bits);
+        memcpy(dst + i, &bits, sizeof(bits));
+    }
+    lsb1_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/* 64 channels (32 payload bytes) per iteration */
+__attribute__((target("avx2"))) static void lsb4_embed_avx2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    size_t        i         = 0;
+
+    for (; i + 32 <= bytes; i += 32, chan += 64) {
+        // Split every byte in its nibbles and interleave them, high nibble first. The unpacks
+        // work inside 128-bit lanes, so the lanes are put back in order afterwards.
+        __m256i payload = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i high    = _mm256_and_si256(_mm256_srli_epi16(payload, 4), lowNibble);
+        __m256i low     = _mm256_and_si256(payload, lowNibble);
+        __m256i first   = _mm256_unpacklo_epi8(high, low);
+        __m256i second  = _mm256_unpackhi_epi8(high, low);
+
+        __m256i colors0 = _mm256_loadu_si256((const __m256i *) chan);
+        __m256i colors1 = _mm256_loadu_si256((const __m256i *) (chan + 32));
+        colors0         = _mm256_or_si256(_mm256_andnot_si256(lowNibble, colors0),
+                                  _mm256_permute2x128_si256(first, second, 0x20));
+        colors1         = _mm256_or_si256(_mm256_andnot_si256(lowNibble, colors1),
+                                  _mm256_permute2x128_si256(first, second, 0x31));
+        _mm256_storeu_si256((__m256i *) chan, colors0);
+        _mm256_storeu_si256((__m256i *) (chan + 32), colors1);
+    }
+    lsb4_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* Every 16-bit lane holds the channels of one byte, build it in the low half of the lane */
+__attribute__((target("avx2"))) static inline __m256i pack_nibbles_avx2(__m256i colors) {
+    const __m256i lowNibble = _mm256_set1_epi16(0x0F);
+    __m256i       high      = _mm256_slli_epi16(_mm256_and_si256(colors, lowNibble), 4);
+    __m256i       low       = _mm256_and_si256(_mm256_srli_epi16(colors, 8), lowNibble);
+    return _mm256_or_si256(high, low);
+}
+
+/* 64 channels (32 payload bytes) per iteration */
+__attribute__((target("avx2"))) static void lsb4_extract_avx2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32, chan += 64) {
+        __m256i bytes0 = pack_nibbles_avx2(_mm256_loadu_si256((const __m256i *) chan));
+        __m256i bytes1 = pack_nibbles_avx2(_mm256_loadu_si256((const __m256i *) (chan + 32)));
+        // The pack interleaves the 128-bit lanes of both inputs, restore their order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes0, bytes1), 0xD8);
+        _mm256_storeu_si256((__m256i *) (dst + i), packed);
+    }
+    lsb4_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/*
+ * LSBI histogram, 16 pixels (48 channels, 32 payload bits) per iteration. The LSB and pattern
+ * bits of the channels are turned into 48-bit masks, the payload bits are deposited on the
+ * blue/green positions with pdep and everything else is counted with popcount.
+ */
+#define BLUE_GREEN_48 0x6DB6DB6DB6DBULL  // Channel i is blue or green when i % 3 != 2
+
+__attribute__((target("avx2,bmi2,popcnt"))) static inline void count_patterns(
+    uint64_t lsb,
+    uint64_t bit1,
+    uint64_t bit2,
+    uint32_t payload,
+    uint64_t changes[4],
+    uint64_t totals[4]) {
+    uint64_t changed     = (lsb ^ _pdep_u64(payload, BLUE_GREEN_48)) & BLUE_GREEN_48;
+    uint64_t patterns[4] = {~bit1 & ~bit2, bit1 & ~bit2, ~bit1 & bit2, bit1 & bit2};
+
+    for (int p = 0; p < 4; p++) {
+        uint64_t members = patterns[p] & BLUE_GREEN_48;
+        changes[p] += __builtin_popcountll(changed & members);
+        totals[p] += __builtin_popcountll(members);
+    }
+}
+
+/* Mask with bit i set when bit `shift` of channel i is set, for 48 channels */
+__attribute__((target("avx2"))) static inline uint64_t channel_bits(__m256i low,
+                                                                    __m128i high,
+                                                                    int     shift) {
+    uint32_t lowBits  = (uint32_t) _mm256_movemask_epi8(_mm256_slli_epi16(low, 7 - shift));
+    uint32_t highBits = (uint32_t) _mm_movemask_epi8(_mm_slli_epi16(high, 7 - shift));
+    return lowBits | ((uint64_t) highBits << 32);
+}
+
+__attribute__((target("avx2,bmi2,popcnt"))) static void lsbi_histogram_avx2(
+    const uint8_t *chan,
+    size_t         pixels,
+    const uint8_t *data,
+    size_t         bit,
+    size_t         dataBits,
+    uint64_t       changes[4],
+    uint64_t       totals[4]) {
+    size_t dataBytes = (dataBits + 7) / 8;
+    size_t i         = 0;
+
+    for (; i + 16 <= pixels && bit / 8 + 8 <= dataBytes; i += 16, chan += 48, bit += 32) {
+        __m256i low  = _mm256_loadu_si256((const __m256i *) chan);
+        __m128i high = _mm_loadu_si128((const __m128i *) (chan + 32));
+        count_patterns(channel_bits(low, high, 0),
+                       channel_bits(low, high, 1),
+                       channel_bits(low, high, 2),
+                       load_payload_bits(data, bit),
+                       changes,
+                       totals);
+    }
+    lsbi_histogram_scalar(chan, pixels - i, data, bit, dataBits, changes, totals);
+}
+
+/* 32 pairs per iteration, every class becomes a 32-bit mask that is counted */
+__attribute__((target("avx2,popcnt"))) static void sample_pairs_avx2(const uint8_t *values,
+                                                                     size_t         count,
+                                                                     uint64_t       pairs[3]) {
+    const __m256i zero     = _mm256_setzero_si256();
+    const __m256i highBits = _mm256_set1_epi8((char) 0xFE);
+    size_t        i        = 0;
+
+    for (; i + 33 <= count; i += 32) {
+        __m256i  r       = _mm256_loadu_si256((const __m256i *) (values + i));
+        __m256i  s       = _mm256_loadu_si256((const __m256i *) (values + i + 1));
+        __m256i  low     = _mm256_min_epu8(r, s);
+        __m256i  pair    = _mm256_and_si256(_mm256_xor_si256(r, s), highBits);
+        uint32_t equal   = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(r, s));
+        uint32_t smaller = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, r));
+        uint32_t odd     = (uint32_t) _mm256_movemask_epi8(_mm256_slli_epi16(s, 7));
+        uint32_t close   = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(pair, zero));
+
+        uint32_t x = ~equal & (smaller ^ odd);
+        pairs[0] += __builtin_popcount(x);
+        pairs[1] += 32 - __builtin_popcount(equal) - __builtin_popcount(x);
+        pairs[2] += __builtin_popcount(close);
+    }
+    sample_pairs_scalar(values + i, count - i, pairs);
+}
+
+/*
+ * Every 16-bit lane holds a value, 4 lanes a group. Shifts move lanes within 128-bit halves only,
+ * which hold 2 whole groups each. The variation of a group ends up in its first lane, so only
+ * lanes 0, 4, 8 and 12 (bits 0, 8, 16 and 24 of a byte mask) are classified.
+ */
+#define RS_LEADS_AVX2 0x01010101U
+
+__attribute__((target("avx2"))) static inline __m256i variation_avx2(__m256i v) {
+    const __m256i inner = _mm256_set1_epi64x(0x0000FFFFFFFFFFFFLL);  // Lane 3 has no neighbour
+    __m256i       d     = _mm256_abs_epi16(_mm256_sub_epi16(v, _mm256_srli_si256(v, 2)));
+    d                   = _mm256_and_si256(d, inner);
+    return _mm256_add_epi16(d,
+                            _mm256_add_epi16(_mm256_srli_si256(d, 2), _mm256_srli_si256(d, 4)));
+}
+
+__attribute__((target("avx2,popcnt"))) static inline int count_leads_avx2(__m256i greater) {
+    return __builtin_popcount((uint32_t) _mm256_movemask_epi8(greater) & RS_LEADS_AVX2);
+}
+
+/* R_M, S_M, R_-M and S_-M of the 4 groups of v */
+__attribute__((target("avx2,popcnt"))) static inline void rs_classes_avx2(__m256i  v,
+                                                                          uint64_t classes[4]) {
+    const __m256i middle   = _mm256_set1_epi64x(0x0000000100010000LL);
+    __m256i       f        = variation_avx2(v);
+    __m256i       positive = variation_avx2(_mm256_xor_si256(v, middle));
+    __m256i       negative = variation_avx2(
+        _mm256_sub_epi16(_mm256_xor_si256(_mm256_add_epi16(v, middle), middle), middle));
+
+    classes[0] += count_leads_avx2(_mm256_cmpgt_epi16(positive, f));
+    classes[1] += count_leads_avx2(_mm256_cmpgt_epi16(f, positive));
+    classes[2] += count_leads_avx2(_mm256_cmpgt_epi16(negative, f));
+    classes[3] += count_leads_avx2(_mm256_cmpgt_epi16(f, negative));
+}
+
+/* 8 groups (32 values) per iteration */
+__attribute__((target("avx2,popcnt"))) static void rs_groups_avx2(const uint8_t *values,
+                                                                  size_t         groups,
+                                                                  uint64_t       counts[8]) {
+    const __m256i lsb = _mm256_set1_epi16(0x01);
+    size_t        g   = 0;
+
+    for (; g + 8 <= groups; g += 8, values += 32) {
+        __m256i low  = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) values));
+        __m256i high = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (values + 16)));
+        rs_classes_avx2(low, counts);
+        rs_classes_avx2(high, counts);
+        rs_classes_avx2(_mm256_xor_si256(low, lsb), counts + 4);
+        rs_classes_avx2(_mm256_xor_si256(high, lsb), counts + 4);
+    }
+    rs_groups_scalar(values, groups - g, counts);
+}
+
+/* 32 values per iteration, the 32-bit lanes are moved to 64-bit ones as in squared_error_sse2 */
+__attribute__((target("avx2"))) static void squared_error_avx2(const uint8_t *a,
+                                                               const uint8_t *b,
+                                                               size_t         count,
+                                                               uint64_t       error[2]) {
+    const __m256i lsb     = _mm256_set1_epi8(0x01);
+    const __m256i zero    = _mm256_setzero_si256();
+    __m256i       squares = zero, lsbs = zero;
+    size_t        i       = 0;
+
+    while (i + 32 <= count) {
+        __m256i lanes = zero;
+        for (size_t n = 0; n < 4096 && i + 32 <= count; n++, i += 32) {
+            __m256i x       = _mm256_loadu_si256((const __m256i *) (a + i));
+            __m256i y       = _mm256_loadu_si256((const __m256i *) (b + i));
+            __m256i low     = _mm256_sub_epi16(_mm256_unpacklo_epi8(x, zero),
+                                               _mm256_unpacklo_epi8(y, zero));
+            __m256i high    = _mm256_sub_epi16(_mm256_unpackhi_epi8(x, zero),
+                                               _mm256_unpackhi_epi8(y, zero));
+            __m256i changed = _mm256_and_si256(_mm256_xor_si256(x, y), lsb);
+            lanes           = _mm256_add_epi32(lanes, _mm256_madd_epi16(low, low));
+            lanes           = _mm256_add_epi32(lanes, _mm256_madd_epi16(high, high));
+            lsbs            = _mm256_add_epi64(lsbs, _mm256_sad_epu8(changed, zero));
+        }
+        squares = _mm256_add_epi64(squares, _mm256_unpacklo_epi32(lanes, zero));
+        squares = _mm256_add_epi64(squares, _mm256_unpackhi_epi32(lanes, zero));
+    }
+
+    uint64_t sums[8];
+    _mm256_storeu_si256((__m256i *) sums, squares);
+    _mm256_storeu_si256((__m256i *) (sums + 4), lsbs);
+    error[0] += sums[0] + sums[1] + sums[2] + sums[3];
+    error[1] += sums[4] + sums[5] + sums[6] + sums[7];
+    squared_error_scalar(a + i, b + i, count - i, error);
+}
+
+/*
+ * Add the 32-bit lanes of low (values 0-15) and high (values 16-31) in pairs. hadd works within
+ * 128-bit halves and leaves the blocks ordered 0 1 4 5 2 3 6 7.
+ */
+__attribute__((target("avx2"))) static inline __m256i pair_lanes_avx2(__m256i low, __m256i high) {
+    return _mm256_permute4x64_epi64(_mm256_hadd_epi32(low, high), 0xD8);
+}
+
+__attribute__((target("avx2"))) static inline void add_sums_avx2(uint32_t *sums, __m256i v) {
+    _mm256_storeu_si256((__m256i *) sums,
+                        _mm256_add_epi32(_mm256_loadu_si256((__m256i *) sums), v));
+}
+
+/* 8 blocks (32 values) per iteration */
+__attribute__((target("avx2"))) static void ssim_sums_avx2(const uint8_t *a,
+                                                           const uint8_t *b,
+                                                           size_t         blocks,
+                                                           uint32_t      *sums[4]) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    size_t        i    = 0;
+
+    for (; i + 8 <= blocks; i += 8) {
+        const __m128i *x     = (const __m128i *) (a + 4 * i);
+        const __m128i *y     = (const __m128i *) (b + 4 * i);
+        __m256i        xLow  = _mm256_cvtepu8_epi16(_mm_loadu_si128(x));
+        __m256i        xHigh = _mm256_cvtepu8_epi16(_mm_loadu_si128(x + 1));
+        __m256i        yLow  = _mm256_cvtepu8_epi16(_mm_loadu_si128(y));
+        __m256i        yHigh = _mm256_cvtepu8_epi16(_mm_loadu_si128(y + 1));
+
+        add_sums_avx2(sums[0] + i,
+                      pair_lanes_avx2(_mm256_madd_epi16(xLow, ones),
+                                      _mm256_madd_epi16(xHigh, ones)));
+        add_sums_avx2(sums[1] + i,
+                      pair_lanes_avx2(_mm256_madd_epi16(yLow, ones),
+                                      _mm256_madd_epi16(yHigh, ones)));
+        add_sums_avx2(sums[2] + i,
+                      pair_lanes_avx2(_mm256_add_epi32(_mm256_madd_epi16(xLow, xLow),
+                                                       _mm256_madd_epi16(yLow, yLow)),
+                                      _mm256_add_epi32(_mm256_madd_epi16(xHigh, xHigh),
+                                                       _mm256_madd_epi16(yHigh, yHigh))));
+        add_sums_avx2(sums[3] + i,
+                      pair_lanes_avx2(_mm256_madd_epi16(xLow, yLow),
+                                      _mm256_madd_epi16(xHigh, yHigh)));
+    }
+    uint32_t *tail[4] = {sums[0] + i, sums[1] + i, sums[2] + i, sums[3] + i};
+    ssim_sums_scalar(a + 4 * i, b + 4 * i, blocks - i, tail);
+}
+
+const lsb_kernels lsb_kernels_avx2 = {
+    .name           = "avx2",
+    .lsb1_embed     = lsb1_embed_avx2,
+    .lsb1_extract   = lsb1_extract_avx2,
+    .lsb4_embed     = lsb4_embed_avx2,
+    .lsb4_extract   = lsb4_extract_avx2,
+    .lsbi_histogram = lsbi_histogram_avx2,
+    .sample_pairs   = sample_pairs_avx2,
+    .rs_groups      = rs_groups_avx2,
+    .squared_error  = squared_error_avx2,
+    .ssim_sums      = ssim_sums_avx2,
+};
+
+#else
+
+const lsb_kernels lsb_kernels_avx2 = {
+    .name           = "avx2",
+    .lsb1_embed     = lsb1_embed_scalar,
+    .lsb1_extract   = lsb1_extract_scalar,
+    .lsb4_embed     = lsb4_embed_scalar,
+    .lsb4_extract   = lsb4_extract_scalar,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
+
+#endif
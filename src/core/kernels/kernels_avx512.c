@@ -0,0 +1,332 @@
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+/*
+ * With AVX-512BW a mask register holds one bit per channel of a 64 channel vector, so 8 payload
+ * bytes become a mask once the bit order inside each byte is reversed (and the other way round).
+ */
+
+/* 64 channels (8 payload bytes) per iteration */
+__attribute__((target("avx512f,avx512bw"))) static void lsb1_embed_avx512(uint8_t       *chan,
+                                                                          const uint8_t *src,
+                                                                          size_t bytes) {
+    const __m512i lsb = _mm512_set1_epi8(1);
+    size_t        i   = 0;
+
+    for (; i + 8 <= bytes; i += 8, chan += 64) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        __mmask64 bits = reverse_byte_bits(word);
+
+        __m512i colors = _mm512_andnot_si512(lsb, _mm512_loadu_si512(chan));
+        colors         = _mm512_or_si512(colors, _mm512_maskz_mov_epi8(bits, lsb));
+        _mm512_storeu_si512(chan, colors);
+    }
+    lsb1_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* 64 channels (8 payload bytes) per iteration */
+__attribute__((target("avx512f,avx512bw"))) static void lsb1_extract_avx512(const uint8_t *chan,
+                                                                            uint8_t       *dst,
+                                                                            size_t bytes) {
+    const __m512i lsb = _mm512_set1_epi8(1);
+    size_t        i   = 0;
+
+    for (; i + 8 <= bytes; i += 8, chan += 64) {
+        uint64_t bits = _mm512_test_epi8_mask(_mm512_loadu_si512(chan), lsb);
+        bits          = reverse_byte_bits(bits);
+        memcpy(dst + i, &bits, sizeof(bits));
+    }
+    lsb1_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/* 128 channels (64 payload bytes) per iteration */
+__attribute__((target("avx512f,avx512bw"))) static void lsb4_embed_avx512(uint8_t       *chan,
+                                                                          const uint8_t *src,
+                                                                          size_t bytes) {
+    const __m512i lowNibble = _mm512_set1_epi8(0x0F);
+    const __m512i order0    = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i order1    = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    size_t        i         = 0;
+
+    for (; i + 64 <= bytes; i += 64, chan += 128) {
+        // Split every byte in its nibbles and interleave them, high nibble first. The unpacks
+        // work inside 128-bit lanes, so the lanes are put back in order afterwards.
+        __m512i payload = _mm512_loadu_si512(src + i);
+        __m512i high    = _mm512_and_si512(_mm512_srli_epi16(payload, 4), lowNibble);
+        __m512i low     = _mm512_and_si512(payload, lowNibble);
+        __m512i first   = _mm512_unpacklo_epi8(high, low);
+        __m512i second  = _mm512_unpackhi_epi8(high, low);
+
+        __m512i colors0 = _mm512_andnot_si512(lowNibble, _mm512_loadu_si512(chan));
+        __m512i colors1 = _mm512_andnot_si512(lowNibble, _mm512_loadu_si512(chan + 64));
+        colors0 = _mm512_or_si512(colors0, _mm512_permutex2var_epi64(first, order0, second));
+        colors1 = _mm512_or_si512(colors1, _mm512_permutex2var_epi64(first, order1, second));
+        _mm512_storeu_si512(chan, colors0);
+        _mm512_storeu_si512(chan + 64, colors1);
+    }
+    lsb4_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* Every 16-bit lane holds the channels of one byte, build it in the low half of the lane */
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i pack_nibbles_avx512(
+    __m512i colors) {
+    const __m512i lowNibble = _mm512_set1_epi16(0x0F);
+    __m512i       high      = _mm512_slli_epi16(_mm512_and_si512(colors, lowNibble), 4);
+    __m512i       low       = _mm512_and_si512(_mm512_srli_epi16(colors, 8), lowNibble);
+    return _mm512_or_si512(high, low);
+}
+
+/* 128 channels (64 payload bytes) per iteration */
+__attribute__((target("avx512f,avx512bw"))) static void lsb4_extract_avx512(const uint8_t *chan,
+                                                                            uint8_t       *dst,
+                                                                            size_t bytes) {
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    size_t        i     = 0;
+
+    for (; i + 64 <= bytes; i += 64, chan += 128) {
+        __m512i bytes0 = pack_nibbles_avx512(_mm512_loadu_si512(chan));
+        __m512i bytes1 = pack_nibbles_avx512(_mm512_loadu_si512(chan + 64));
+        // The pack interleaves the 128-bit lanes of both inputs, restore their order
+        __m512i packed = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(bytes0, bytes1));
+        _mm512_storeu_si512(dst + i, packed);
+    }
+    lsb4_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/*
+ * LSBI histogram, 16 pixels (48 channels, 32 payload bits) per iteration. The LSB and pattern
+ * bits of the channels are turned into 48-bit masks, the payload bits are deposited on the
+ * blue/green positions with pdep and everything else is counted with popcount.
+ */
+#define BLUE_GREEN_48 0x6DB6DB6DB6DBULL  // Channel i is blue or green when i % 3 != 2
+
+__attribute__((target("avx512f,avx512bw,bmi2,popcnt"))) static inline void count_patterns(
+    uint64_t lsb,
+    uint64_t bit1,
+    uint64_t bit2,
+    uint32_t payload,
+    uint64_t changes[4],
+    uint64_t totals[4]) {
+    uint64_t changed     = (lsb ^ _pdep_u64(payload, BLUE_GREEN_48)) & BLUE_GREEN_48;
+    uint64_t patterns[4] = {~bit1 & ~bit2, bit1 & ~bit2, ~bit1 & bit2, bit1 & bit2};
+
+    for (int p = 0; p < 4; p++) {
+        uint64_t members = patterns[p] & BLUE_GREEN_48;
+        changes[p] += __builtin_popcountll(changed & members);
+        totals[p] += __builtin_popcountll(members);
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2,popcnt"))) static void lsbi_histogram_avx512(
+    const uint8_t *chan,
+    size_t         pixels,
+    const uint8_t *data,
+    size_t         bit,
+    size_t         dataBits,
+    uint64_t       changes[4],
+    uint64_t       totals[4]) {
+    size_t dataBytes = (dataBits + 7) / 8;
+    size_t i         = 0;
+
+    for (; i + 16 <= pixels && bit / 8 + 8 <= dataBytes; i += 16, chan += 48, bit += 32) {
+        __m512i colors = _mm512_maskz_loadu_epi8(0xFFFFFFFFFFFFULL, chan);
+        count_patterns(_mm512_test_epi8_mask(colors, _mm512_set1_epi8(1)),
+                       _mm512_test_epi8_mask(colors, _mm512_set1_epi8(2)),
+                       _mm512_test_epi8_mask(colors, _mm512_set1_epi8(4)),
+                       load_payload_bits(data, bit),
+                       changes,
+                       totals);
+    }
+    lsbi_histogram_scalar(chan, pixels - i, data, bit, dataBits, changes, totals);
+}
+
+/* 64 pairs per iteration, the comparisons give the class masks directly */
+__attribute__((target("avx512f,avx512bw,popcnt"))) static void sample_pairs_avx512(
+    const uint8_t *values,
+    size_t         count,
+    uint64_t       pairs[3]) {
+    const __m512i lsb      = _mm512_set1_epi8(0x01);
+    const __m512i highBits = _mm512_set1_epi8((char) 0xFE);
+    size_t        i        = 0;
+
+    for (; i + 65 <= count; i += 64) {
+        __m512i   r       = _mm512_loadu_si512(values + i);
+        __m512i   s       = _mm512_loadu_si512(values + i + 1);
+        __mmask64 equal   = _mm512_cmpeq_epu8_mask(r, s);
+        __mmask64 smaller = _mm512_cmplt_epu8_mask(r, s);
+        __mmask64 odd     = _mm512_test_epi8_mask(s, lsb);
+        __mmask64 close   = _mm512_testn_epi8_mask(_mm512_xor_si512(r, s), highBits);
+
+        uint64_t x = ~equal & (smaller ^ odd);
+        pairs[0] += __builtin_popcountll(x);
+        pairs[1] += 64 - __builtin_popcountll(equal) - __builtin_popcountll(x);
+        pairs[2] += __builtin_popcountll(close);
+    }
+    sample_pairs_scalar(values + i, count - i, pairs);
+}
+
+/*
+ * Every 16-bit lane holds a value, 4 lanes a group, so a vector holds 8 groups. The variation of
+ * a group ends up in its first lane, the comparisons keep every fourth bit of their mask.
+ */
+#define RS_LEADS_AVX512 0x11111111U
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i variation_avx512(__m512i v) {
+    const __m512i inner = _mm512_set1_epi64(0x0000FFFFFFFFFFFFLL);  // Lane 3 has no neighbour
+    __m512i       d     = _mm512_abs_epi16(_mm512_sub_epi16(v, _mm512_bsrli_epi128(v, 2)));
+    d                   = _mm512_and_si512(d, inner);
+    return _mm512_add_epi16(d,
+                            _mm512_add_epi16(_mm512_bsrli_epi128(d, 2), _mm512_bsrli_epi128(d, 4)));
+}
+
+/* R_M, S_M, R_-M and S_-M of the 8 groups of v */
+__attribute__((target("avx512f,avx512bw,popcnt"))) static inline void rs_classes_avx512(
+    __m512i  v,
+    uint64_t classes[4]) {
+    const __m512i middle   = _mm512_set1_epi64(0x0000000100010000LL);
+    __m512i       f        = variation_avx512(v);
+    __m512i       positive = variation_avx512(_mm512_xor_si512(v, middle));
+    __m512i       negative = variation_avx512(
+        _mm512_sub_epi16(_mm512_xor_si512(_mm512_add_epi16(v, middle), middle), middle));
+
+    classes[0] += __builtin_popcount(_mm512_cmpgt_epi16_mask(positive, f) & RS_LEADS_AVX512);
+    classes[1] += __builtin_popcount(_mm512_cmpgt_epi16_mask(f, positive) & RS_LEADS_AVX512);
+    classes[2] += __builtin_popcount(_mm512_cmpgt_epi16_mask(negative, f) & RS_LEADS_AVX512);
+    classes[3] += __builtin_popcount(_mm512_cmpgt_epi16_mask(f, negative) & RS_LEADS_AVX512);
+}
+
+/* 16 groups (64 values) per iteration */
+__attribute__((target("avx512f,avx512bw,popcnt"))) static void rs_groups_avx512(
+    const uint8_t *values,
+    size_t         groups,
+    uint64_t       counts[8]) {
+    const __m512i lsb = _mm512_set1_epi16(0x01);
+    size_t        g   = 0;
+
+    for (; g + 16 <= groups; g += 16, values += 64) {
+        __m512i low  = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) values));
+        __m512i high = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (values + 32)));
+        rs_classes_avx512(low, counts);
+        rs_classes_avx512(high, counts);
+        rs_classes_avx512(_mm512_xor_si512(low, lsb), counts + 4);
+        rs_classes_avx512(_mm512_xor_si512(high, lsb), counts + 4);
+    }
+    rs_groups_scalar(values, groups - g, counts);
+}
+
+/* 64 values per iteration, the 32-bit lanes are moved to 64-bit ones as in squared_error_sse2 */
+__attribute__((target("avx512f,avx512bw"))) static void squared_error_avx512(const uint8_t *a,
+                                                                             const uint8_t *b,
+                                                                             size_t   count,
+                                                                             uint64_t error[2]) {
+    const __m512i lsb     = _mm512_set1_epi8(0x01);
+    const __m512i zero    = _mm512_setzero_si512();
+    __m512i       squares = zero, lsbs = zero;
+    size_t        i       = 0;
+
+    while (i + 64 <= count) {
+        __m512i lanes = zero;
+        for (size_t n = 0; n < 4096 && i + 64 <= count; n++, i += 64) {
+            __m512i x       = _mm512_loadu_si512((const void *) (a + i));
+            __m512i y       = _mm512_loadu_si512((const void *) (b + i));
+            __m512i low     = _mm512_sub_epi16(_mm512_unpacklo_epi8(x, zero),
+                                               _mm512_unpacklo_epi8(y, zero));
+            __m512i high    = _mm512_sub_epi16(_mm512_unpackhi_epi8(x, zero),
+                                               _mm512_unpackhi_epi8(y, zero));
+            __m512i changed = _mm512_and_si512(_mm512_xor_si512(x, y), lsb);
+            lanes           = _mm512_add_epi32(lanes, _mm512_madd_epi16(low, low));
+            lanes           = _mm512_add_epi32(lanes, _mm512_madd_epi16(high, high));
+            lsbs            = _mm512_add_epi64(lsbs, _mm512_sad_epu8(changed, zero));
+        }
+        squares = _mm512_add_epi64(squares, _mm512_unpacklo_epi32(lanes, zero));
+        squares = _mm512_add_epi64(squares, _mm512_unpackhi_epi32(lanes, zero));
+    }
+
+    error[0] += (uint64_t) _mm512_reduce_add_epi64(squares);
+    error[1] += (uint64_t) _mm512_reduce_add_epi64(lsbs);
+    squared_error_scalar(a + i, b + i, count - i, error);
+}
+
+/* Add the 32-bit lanes of low (values 0-31) and high (values 32-63) in pairs */
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i pair_lanes_avx512(__m512i low,
+                                                                                    __m512i high) {
+    const __m512i even =
+        _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+    return _mm512_add_epi32(_mm512_permutex2var_epi32(low, even, high),
+                            _mm512_permutex2var_epi32(low, odd, high));
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline void add_sums_avx512(uint32_t *sums,
+                                                                              __m512i   v) {
+    _mm512_storeu_si512((void *) sums, _mm512_add_epi32(_mm512_loadu_si512((void *) sums), v));
+}
+
+/* 16 blocks (64 values) per iteration */
+__attribute__((target("avx512f,avx512bw"))) static void ssim_sums_avx512(const uint8_t *a,
+                                                                         const uint8_t *b,
+                                                                         size_t         blocks,
+                                                                         uint32_t      *sums[4]) {
+    const __m512i ones = _mm512_set1_epi16(1);
+    size_t        i    = 0;
+
+    for (; i + 16 <= blocks; i += 16) {
+        const __m256i *x     = (const __m256i *) (a + 4 * i);
+        const __m256i *y     = (const __m256i *) (b + 4 * i);
+        __m512i        xLow  = _mm512_cvtepu8_epi16(_mm256_loadu_si256(x));
+        __m512i        xHigh = _mm512_cvtepu8_epi16(_mm256_loadu_si256(x + 1));
+        __m512i        yLow  = _mm512_cvtepu8_epi16(_mm256_loadu_si256(y));
+        __m512i        yHigh = _mm512_cvtepu8_epi16(_mm256_loadu_si256(y + 1));
+
+        add_sums_avx512(sums[0] + i,
+                        pair_lanes_avx512(_mm512_madd_epi16(xLow, ones),
+                                          _mm512_madd_epi16(xHigh, ones)));
+        add_sums_avx512(sums[1] + i,
+                        pair_lanes_avx512(_mm512_madd_epi16(yLow, ones),
+                                          _mm512_madd_epi16(yHigh, ones)));
+        add_sums_avx512(sums[2] + i,
+                        pair_lanes_avx512(_mm512_add_epi32(_mm512_madd_epi16(xLow, xLow),
+                                                           _mm512_madd_epi16(yLow, yLow)),
+                                          _mm512_add_epi32(_mm512_madd_epi16(xHigh, xHigh),
+                                                           _mm512_madd_epi16(yHigh, yHigh))));
+        add_sums_avx512(sums[3] + i,
+                        pair_lanes_avx512(_mm512_madd_epi16(xLow, yLow),
+                                          _mm512_madd_epi16(xHigh, yHigh)));
+    }
+    uint32_t *tail[4] = {sums[0] + i, sums[1] + i, sums[2] + i, sums[3] + i};
+    ssim_sums_scalar(a + 4 * i, b + 4 * i, blocks - i, tail);
+}
+
+const lsb_kernels lsb_kernels_avx512 = {
+    .name           = "avx512",
+    .lsb1_embed     = lsb1_embed_avx512,
+    .lsb1_extract   = lsb1_extract_avx512,
+    .lsb4_embed     = lsb4_embed_avx512,
+    .lsb4_extract   = lsb4_extract_avx512,
+    .lsbi_histogram = lsbi_histogram_avx512,
+    .sample_pairs   = sample_pairs_avx512,
+    .rs_groups      = rs_groups_avx512,
+    .squared_error  = squared_error_avx512,
+    .ssim_sums      = ssim_sums_avx512,
+};
+
+#else
+
+const lsb_kernels lsb_kernels_avx512 = {
+    .name           = "avx512",
+    .lsb1_embed     = lsb1_embed_scalar,
+    .lsb1_extract   = lsb1_extract_scalar,
+    .lsb4_embed     = lsb4_embed_scalar,
+    .lsb4_extract   = lsb4_extract_scalar,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define ONES 0x0101010101010101ULL
+#define LOW_NIBBLES 0x0F0F0F0F0F0F0F0FULL
+
+/*
+ * pdep/pext move the bits between a byte and the LSBs of a word in one instruction, the byte
+ * swap puts the MSB of the payload in the first channel.
+ */
+__attribute__((target("bmi2"))) static void lsb1_embed_bmi2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 8) {
+        uint64_t word;
+        memcpy(&word, chan, sizeof(word));
+        word = (word & ~ONES) | __builtin_bswap64(_pdep_u64(src[i], ONES));
+        memcpy(chan, &word, sizeof(word));
+    }
+}
+
+__attribute__((target("bmi2"))) static void lsb1_extract_bmi2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 8) {
+        uint64_t word;
+        memcpy(&word, chan, sizeof(word));
+        dst[i] = (uint8_t) _pext_u64(__builtin_bswap64(word), ONES);
+    }
+}
+
+/* Swap the two nibbles of every byte */
+static inline uint64_t swap_nibbles(uint64_t x) {
+    return ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+}
+
+/* 8 channels (4 payload bytes) per iteration, nibble j of the swapped bytes goes to channel j */
+__attribute__((target("bmi2"))) static void lsb4_embed_bmi2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 4 <= bytes; i += 4, chan += 8) {
+        uint32_t payload;
+        uint64_t word;
+        memcpy(&payload, src + i, sizeof(payload));
+        memcpy(&word, chan, sizeof(word));
+        word = (word & ~LOW_NIBBLES) | _pdep_u64(swap_nibbles(payload), LOW_NIBBLES);
+        memcpy(chan, &word, sizeof(word));
+    }
+    lsb4_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* 8 channels (4 payload bytes) per iteration */
+__attribute__((target("bmi2"))) static void lsb4_extract_bmi2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 4 <= bytes; i += 4, chan += 8) {
+        uint64_t word;
+        memcpy(&word, chan, sizeof(word));
+        uint32_t payload = (uint32_t) swap_nibbles(_pext_u64(word, LOW_NIBBLES));
+        memcpy(dst + i, &payload, sizeof(payload));
+    }
+    lsb4_extract_scalar(chan, dst + i, bytes - i);
+}
+
+const lsb_kernels lsb_kernels_bmi2 = {
+    .name           = "bmi2",
+    .lsb1_embed     = lsb1_embed_bmi2,
+    .lsb1_extract   = lsb1_extract_bmi2,
+    .lsb4_embed     = lsb4_embed_bmi2,
+    .lsb4_extract   = lsb4_extract_bmi2,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
+
+#else
+
+const lsb_kernels lsb_kernels_bmi2 = {
+    .name           = "bmi2",
+    .lsb1_embed     = lsb1_embed_scalar,
+    .lsb1_extract   = lsb1_extract_scalar,
+    .lsb4_embed     = lsb4_embed_scalar,
+    .lsb4_extract   = lsb4_extract_scalar,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
+
+#endif
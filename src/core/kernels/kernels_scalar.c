@@ -0,0 +1,144 @@
+#include "lsb_kernels.h"
+
+#define ONES 0x0101010101010101ULL
+#define BIT_PER_BYTE 0x0102040810204080ULL  // Byte i selects bit 7 - i (little endian)
+#define GATHER_LSBS 0x8040201008040201ULL   // Moves the LSB of byte i to bit 63 - i
+
+/*
+ * Channels are handled 8 at a time as one little endian word, so channel i is byte i of the
+ * word and holds bit 7 - i of the payload byte.
+ */
+static inline uint64_t load_word(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline void store_word(uint8_t *p, uint64_t word) {
+    memcpy(p, &word, sizeof(word));
+}
+
+/* Spread the 8 bits of a byte into the LSBs of the 8 bytes of a word, MSB first */
+static inline uint64_t spread_bits(uint8_t byte) {
+    uint64_t selected = (byte * ONES) & BIT_PER_BYTE;
+    return ((selected + 0x7F7F7F7F7F7F7F7FULL) >> 7) & ONES;
+}
+
+/* Inverse of spread_bits */
+static inline uint8_t gather_bits(uint64_t word) {
+    return (uint8_t) (((word & ONES) * GATHER_LSBS) >> 56);
+}
+
+void lsb1_embed_scalar(uint8_t *chan, const uint8_t *src, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 8)
+        store_word(chan, (load_word(chan) & ~ONES) | spread_bits(src[i]));
+}
+
+void lsb1_extract_scalar(const uint8_t *chan, uint8_t *dst, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 8)
+        dst[i] = gather_bits(load_word(chan));
+}
+
+void lsb4_embed_scalar(uint8_t *chan, const uint8_t *src, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 2) {
+        chan[0] = (chan[0] & 0xF0) | (src[i] >> 4);
+        chan[1] = (chan[1] & 0xF0) | (src[i] & 0x0F);
+    }
+}
+
+void lsb4_extract_scalar(const uint8_t *chan, uint8_t *dst, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++, chan += 2)
+        dst[i] = (uint8_t) ((chan[0] << 4) | (chan[1] & 0x0F));
+}
+
+void lsbi_histogram_scalar(const uint8_t *chan,
+                           size_t         pixels,
+                           const uint8_t *data,
+                           size_t         bit,
+                           size_t         dataBits,
+                           uint64_t       changes[4],
+                           uint64_t       totals[4]) {
+    (void) dataBits;
+    for (size_t i = 0; i < pixels * 3; i++) {
+        if (i % 3 == 2)  // Red channels hold no payload
+            continue;
+
+        uint8_t pattern = (chan[i] >> 1) & 0x03;
+        uint8_t payload = (data[bit / 8] >> (7 - bit % 8)) & 0x01;
+        changes[pattern] += (chan[i] & 0x01) != payload;
+        totals[pattern]++;
+        bit++;
+    }
+}
+
+void sample_pairs_scalar(const uint8_t *values, size_t count, uint64_t pairs[3]) {
+    for (size_t i = 0; i + 1 < count; i++) {
+        uint8_t r = values[i], s = values[i + 1];
+        if (r != s)
+            pairs[(r < s) == (s & 0x01)]++;  // X when s is even and larger or odd and smaller
+        pairs[2] += (r >> 1) == (s >> 1);
+    }
+}
+
+/* Sum of the differences between neighbours, the smoother the group the lower */
+static inline int variation(int a, int b, int c, int d) {
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* F-1 swaps 2n - 1 and 2n, so 0 becomes -1 and 255 becomes 256 */
+static inline int flip_negative(int x) {
+    return ((x + 1) ^ 0x01) - 1;
+}
+
+void rs_groups_scalar(const uint8_t *values, size_t groups, uint64_t counts[8]) {
+    for (size_t g = 0; g < groups; g++, values += 4) {
+        for (int lsb = 0; lsb < 2; lsb++) {
+            int a = values[0] ^ lsb, b = values[1] ^ lsb, c = values[2] ^ lsb, d = values[3] ^ lsb;
+            int f        = variation(a, b, c, d);
+            int positive = variation(a, b ^ 0x01, c ^ 0x01, d);
+            int negative = variation(a, flip_negative(b), flip_negative(c), d);
+
+            uint64_t *classes = counts + 4 * lsb;
+            classes[0] += positive > f;
+            classes[1] += positive < f;
+            classes[2] += negative > f;
+            classes[3] += negative < f;
+        }
+    }
+}
+
+void squared_error_scalar(const uint8_t *a, const uint8_t *b, size_t count, uint64_t error[2]) {
+    uint64_t squares = 0, lsbs = 0;
+    for (size_t i = 0; i < count; i++) {
+        int difference = a[i] - b[i];
+        squares += (uint64_t) (difference * difference);
+        lsbs += (a[i] ^ b[i]) & 0x01;
+    }
+    error[0] += squares;
+    error[1] += lsbs;
+}
+
+void ssim_sums_scalar(const uint8_t *a, const uint8_t *b, size_t blocks, uint32_t *sums[4]) {
+    for (size_t i = 0; i < blocks; i++, a += 4, b += 4) {
+        for (int k = 0; k < 4; k++) {
+            uint32_t x = a[k], y = b[k];
+            sums[0][i] += x;
+            sums[1][i] += y;
+            sums[2][i] += x * x + y * y;
+            sums[3][i] += x * y;
+        }
+    }
+}
+
+const lsb_kernels lsb_kernels_scalar = {
+    .name           = "scalar",
+    .lsb1_embed     = lsb1_embed_scalar,
+    .lsb1_extract   = lsb1_extract_scalar,
+    .lsb4_embed     = lsb4_embed_scalar,
+    .lsb4_extract   = lsb4_extract_scalar,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
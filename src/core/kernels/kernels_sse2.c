@@ -0,0 +1,293 @@
+#include "lsb_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/* 16 channels (2 payload bytes) per iteration */
+__attribute__((target("sse2"))) static void lsb1_embed_sse2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    const __m128i bitMask = _mm_set1_epi64x((long long) 0x0102040810204080ULL);
+    const __m128i lsb     = _mm_set1_epi8(1);
+    size_t        i       = 0;
+
+    for (; i + 2 <= bytes; i += 2, chan += 16) {
+        // Broadcast each payload byte over 8 lanes, then keep bit 7 - lane of it
+        __m128i v = _mm_cvtsi32_si128(src[i] | (src[i + 1] << 8));
+        v         = _mm_unpacklo_epi8(v, v);
+        v         = _mm_unpacklo_epi16(v, v);
+        v         = _mm_unpacklo_epi32(v, v);
+        v         = _mm_cmpeq_epi8(_mm_and_si128(v, bitMask), bitMask);
+
+        __m128i colors = _mm_loadu_si128((const __m128i *) chan);
+        colors         = _mm_or_si128(_mm_andnot_si128(lsb, colors), _mm_and_si128(v, lsb));
+        _mm_storeu_si128((__m128i *) chan, colors);
+    }
+    lsb1_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* 16 channels (2 payload bytes) per iteration */
+__attribute__((target("sse2"))) static void lsb1_extract_sse2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 2 <= bytes; i += 2, chan += 16) {
+        // Move every LSB to the sign bit and collect them, channel j ends up in bit j
+        __m128i  colors = _mm_loadu_si128((const __m128i *) chan);
+        uint64_t bits   = (uint64_t) _mm_movemask_epi8(_mm_slli_epi16(colors, 7));
+        bits            = reverse_byte_bits(bits);
+        dst[i]          = (uint8_t) bits;
+        dst[i + 1]      = (uint8_t) (bits >> 8);
+    }
+    lsb1_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/* 32 channels (16 payload bytes) per iteration */
+__attribute__((target("sse2"))) static void lsb4_embed_sse2(uint8_t       *chan,
+                                                            const uint8_t *src,
+                                                            size_t         bytes) {
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+    size_t        i         = 0;
+
+    for (; i + 16 <= bytes; i += 16, chan += 32) {
+        // Split every byte in its nibbles and interleave them, high nibble first
+        __m128i payload = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i high    = _mm_and_si128(_mm_srli_epi16(payload, 4), lowNibble);
+        __m128i low     = _mm_and_si128(payload, lowNibble);
+
+        __m128i colors0 = _mm_loadu_si128((const __m128i *) chan);
+        __m128i colors1 = _mm_loadu_si128((const __m128i *) (chan + 16));
+        colors0 = _mm_or_si128(_mm_andnot_si128(lowNibble, colors0), _mm_unpacklo_epi8(high, low));
+        colors1 = _mm_or_si128(_mm_andnot_si128(lowNibble, colors1), _mm_unpackhi_epi8(high, low));
+        _mm_storeu_si128((__m128i *) chan, colors0);
+        _mm_storeu_si128((__m128i *) (chan + 16), colors1);
+    }
+    lsb4_embed_scalar(chan, src + i, bytes - i);
+}
+
+/* Every 16-bit lane holds the channels of one byte, build it in the low half of the lane */
+__attribute__((target("sse2"))) static inline __m128i pack_nibbles_sse2(__m128i colors) {
+    const __m128i lowNibble = _mm_set1_epi16(0x0F);
+    __m128i       high      = _mm_slli_epi16(_mm_and_si128(colors, lowNibble), 4);
+    __m128i       low       = _mm_and_si128(_mm_srli_epi16(colors, 8), lowNibble);
+    return _mm_or_si128(high, low);
+}
+
+/* 32 channels (16 payload bytes) per iteration */
+__attribute__((target("sse2"))) static void lsb4_extract_sse2(const uint8_t *chan,
+                                                              uint8_t       *dst,
+                                                              size_t         bytes) {
+    size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16, chan += 32) {
+        __m128i bytes0 = pack_nibbles_sse2(_mm_loadu_si128((const __m128i *) chan));
+        __m128i bytes1 = pack_nibbles_sse2(_mm_loadu_si128((const __m128i *) (chan + 16)));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(bytes0, bytes1));
+    }
+    lsb4_extract_scalar(chan, dst + i, bytes - i);
+}
+
+/* Sum of the 16 bytes of v */
+__attribute__((target("sse2"))) static inline uint32_t sum_bytes_sse2(__m128i v) {
+    __m128i sums = _mm_sad_epu8(v, _mm_setzero_si128());
+    return (uint32_t) (_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+}
+
+/*
+ * 16 pairs per iteration. Without popcount the classes are counted in byte lanes, emptied every
+ * 255 iterations before they wrap.
+ */
+__attribute__((target("sse2"))) static void sample_pairs_sse2(const uint8_t *values,
+                                                              size_t         count,
+                                                              uint64_t       pairs[3]) {
+    const __m128i lsb      = _mm_set1_epi8(0x01);
+    const __m128i highBits = _mm_set1_epi8((char) 0xFE);
+    size_t        i        = 0;
+
+    while (i + 17 <= count) {
+        __m128i xs = _mm_setzero_si128(), equals = xs, closes = xs;
+        size_t  n  = 0;
+        for (; n < 255 && i + 17 <= count; n++, i += 16) {
+            __m128i r       = _mm_loadu_si128((const __m128i *) (values + i));
+            __m128i s       = _mm_loadu_si128((const __m128i *) (values + i + 1));
+            __m128i equal   = _mm_cmpeq_epi8(r, s);
+            __m128i smaller = _mm_cmpeq_epi8(_mm_min_epu8(r, s), r);
+            __m128i odd     = _mm_cmpeq_epi8(_mm_and_si128(s, lsb), lsb);
+            __m128i pair    = _mm_and_si128(_mm_xor_si128(r, s), highBits);
+
+            xs     = _mm_sub_epi8(xs, _mm_andnot_si128(equal, _mm_xor_si128(smaller, odd)));
+            equals = _mm_sub_epi8(equals, equal);
+            closes = _mm_sub_epi8(closes, _mm_cmpeq_epi8(pair, _mm_setzero_si128()));
+        }
+
+        uint32_t x = sum_bytes_sse2(xs);
+        pairs[0] += x;
+        pairs[1] += 16 * n - sum_bytes_sse2(equals) - x;
+        pairs[2] += sum_bytes_sse2(closes);
+    }
+    sample_pairs_scalar(values + i, count - i, pairs);
+}
+
+/*
+ * Every 16-bit lane holds a value, 4 lanes a group. The variation of a group ends up in its first
+ * lane, so only lanes 0 and 4 (bits 0 and 8 of a byte mask) are classified.
+ */
+__attribute__((target("sse2"))) static inline __m128i variation_sse2(__m128i v) {
+    const __m128i inner = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);  // Lane 3 has no neighbour
+    __m128i       d     = _mm_sub_epi16(v, _mm_srli_si128(v, 2));
+    d = _mm_and_si128(_mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d)), inner);
+    return _mm_add_epi16(d, _mm_add_epi16(_mm_srli_si128(d, 2), _mm_srli_si128(d, 4)));
+}
+
+__attribute__((target("sse2"))) static inline int count_leads_sse2(__m128i greater) {
+    int mask = _mm_movemask_epi8(greater);
+    return (mask & 0x01) + ((mask >> 8) & 0x01);
+}
+
+/* R_M, S_M, R_-M and S_-M of the 2 groups of v */
+__attribute__((target("sse2"))) static inline void rs_classes_sse2(__m128i v, uint64_t classes[4]) {
+    const __m128i middle   = _mm_set_epi16(0, 1, 1, 0, 0, 1, 1, 0);
+    __m128i       f        = variation_sse2(v);
+    __m128i       positive = variation_sse2(_mm_xor_si128(v, middle));
+    __m128i       negative = variation_sse2(
+        _mm_sub_epi16(_mm_xor_si128(_mm_add_epi16(v, middle), middle), middle));
+
+    classes[0] += count_leads_sse2(_mm_cmpgt_epi16(positive, f));
+    classes[1] += count_leads_sse2(_mm_cmpgt_epi16(f, positive));
+    classes[2] += count_leads_sse2(_mm_cmpgt_epi16(negative, f));
+    classes[3] += count_leads_sse2(_mm_cmpgt_epi16(f, negative));
+}
+
+/* 4 groups (16 values) per iteration */
+__attribute__((target("sse2"))) static void rs_groups_sse2(const uint8_t *values,
+                                                           size_t         groups,
+                                                           uint64_t       counts[8]) {
+    const __m128i lsb = _mm_set1_epi16(0x01);
+    size_t        g   = 0;
+
+    for (; g + 4 <= groups; g += 4, values += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) values);
+        __m128i low   = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+        __m128i high  = _mm_unpackhi_epi8(bytes, _mm_setzero_si128());
+        rs_classes_sse2(low, counts);
+        rs_classes_sse2(high, counts);
+        rs_classes_sse2(_mm_xor_si128(low, lsb), counts + 4);
+        rs_classes_sse2(_mm_xor_si128(high, lsb), counts + 4);
+    }
+    rs_groups_scalar(values, groups - g, counts);
+}
+
+/* Squared differences of 16 values, added in 32-bit lanes */
+__attribute__((target("sse2"))) static inline __m128i squares_sse2(__m128i a, __m128i b) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       low  = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i       high = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    return _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+}
+
+/*
+ * 16 values per iteration. A 32-bit lane gains at most 4 * 255^2 per iteration, the lanes are
+ * moved to 64-bit ones every 4096 iterations before they overflow.
+ */
+__attribute__((target("sse2"))) static void squared_error_sse2(const uint8_t *a,
+                                                               const uint8_t *b,
+                                                               size_t         count,
+                                                               uint64_t       error[2]) {
+    const __m128i lsb     = _mm_set1_epi8(0x01);
+    const __m128i zero    = _mm_setzero_si128();
+    __m128i       squares = zero, lsbs = zero;
+    size_t        i       = 0;
+
+    while (i + 16 <= count) {
+        __m128i lanes = zero;
+        for (size_t n = 0; n < 4096 && i + 16 <= count; n++, i += 16) {
+            __m128i x       = _mm_loadu_si128((const __m128i *) (a + i));
+            __m128i y       = _mm_loadu_si128((const __m128i *) (b + i));
+            __m128i changed = _mm_and_si128(_mm_xor_si128(x, y), lsb);
+            lanes           = _mm_add_epi32(lanes, squares_sse2(x, y));
+            lsbs            = _mm_add_epi64(lsbs, _mm_sad_epu8(changed, zero));
+        }
+        squares = _mm_add_epi64(squares, _mm_unpacklo_epi32(lanes, zero));
+        squares = _mm_add_epi64(squares, _mm_unpackhi_epi32(lanes, zero));
+    }
+
+    uint64_t sums[4];
+    _mm_storeu_si128((__m128i *) sums, squares);
+    _mm_storeu_si128((__m128i *) (sums + 2), lsbs);
+    error[0] += sums[0] + sums[1];
+    error[1] += sums[2] + sums[3];
+    squared_error_scalar(a + i, b + i, count - i, error);
+}
+
+/* Add the 32-bit lanes of low and high in pairs: the sums of 4 values from sums of 2 */
+__attribute__((target("sse2"))) static inline __m128i pair_lanes_sse2(__m128i low, __m128i high) {
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), 0x88);
+    __m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), 0xDD);
+    return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+__attribute__((target("sse2"))) static inline void add_sums_sse2(uint32_t *sums, __m128i v) {
+    _mm_storeu_si128((__m128i *) sums, _mm_add_epi32(_mm_loadu_si128((__m128i *) sums), v));
+}
+
+/* 4 blocks (16 values) per iteration */
+__attribute__((target("sse2"))) static void ssim_sums_sse2(const uint8_t *a,
+                                                           const uint8_t *b,
+                                                           size_t         blocks,
+                                                           uint32_t      *sums[4]) {
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    size_t        i    = 0;
+
+    for (; i + 4 <= blocks; i += 4) {
+        __m128i x           = _mm_loadu_si128((const __m128i *) (a + 4 * i));
+        __m128i y           = _mm_loadu_si128((const __m128i *) (b + 4 * i));
+        __m128i xLow        = _mm_unpacklo_epi8(x, zero), xHigh = _mm_unpackhi_epi8(x, zero);
+        __m128i yLow        = _mm_unpacklo_epi8(y, zero), yHigh = _mm_unpackhi_epi8(y, zero);
+        __m128i squaresLow  = _mm_add_epi32(_mm_madd_epi16(xLow, xLow), _mm_madd_epi16(yLow, yLow));
+        __m128i squaresHigh = _mm_add_epi32(_mm_madd_epi16(xHigh, xHigh),
+                                            _mm_madd_epi16(yHigh, yHigh));
+
+        add_sums_sse2(sums[0] + i,
+                      pair_lanes_sse2(_mm_madd_epi16(xLow, ones), _mm_madd_epi16(xHigh, ones)));
+        add_sums_sse2(sums[1] + i,
+                      pair_lanes_sse2(_mm_madd_epi16(yLow, ones), _mm_madd_epi16(yHigh, ones)));
+        add_sums_sse2(sums[2] + i, pair_lanes_sse2(squaresLow, squaresHigh));
+        add_sums_sse2(sums[3] + i,
+                      pair_lanes_sse2(_mm_madd_epi16(xLow, yLow), _mm_madd_epi16(xHigh, yHigh)));
+    }
+    uint32_t *tail[4] = {sums[0] + i, sums[1] + i, sums[2] + i, sums[3] + i};
+    ssim_sums_scalar(a + 4 * i, b + 4 * i, blocks - i, tail);
+}
+
+const lsb_kernels lsb_kernels_sse2 = {
+    .name           = "sse2",
+    .lsb1_embed     = lsb1_embed_sse2,
+    .lsb1_extract   = lsb1_extract_sse2,
+    .lsb4_embed     = lsb4_embed_sse2,
+    .lsb4_extract   = lsb4_extract_sse2,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_sse2,
+    .rs_groups      = rs_groups_sse2,
+    .squared_error  = squared_error_sse2,
+    .ssim_sums      = ssim_sums_sse2,
+};
+
+#else
+
+const lsb_kernels lsb_kernels_sse2 = {
+    .name           = "sse2",
+    .lsb1_embed     = lsb1_embed_scalar,
+    .lsb1_extract   = lsb1_extract_scalar,
+    .lsb4_embed     = lsb4_embed_scalar,
+    .lsb4_extract   = lsb4_extract_scalar,
+    .lsbi_histogram = lsbi_histogram_scalar,
+    .sample_pairs   = sample_pairs_scalar,
+    .rs_groups      = rs_groups_scalar,
+    .squared_error  = squared_error_scalar,
+    .ssim_sums      = ssim_sums_scalar,
+};
+
+#endif
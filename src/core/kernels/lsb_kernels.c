@@ -0,0 +1,59 @@
+#include "lsb_kernels.h"
+
+#include <pthread.h>
+#include <strings.h>
+
+#define KERNEL_ENV "STEGOBMP_KERNELS"  // Forces an implementation, e.g. STEGOBMP_KERNELS=scalar
+
+static const lsb_kernels *selected = &lsb_kernels_scalar;
+static pthread_once_t     selectOnce = PTHREAD_ONCE_INIT;
+
+/* Whether the running CPU can execute the given implementation */
+static int supported(const lsb_kernels *kernels) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    // The LSBI histogram of the vector implementations relies on pdep and popcount as well
+    if (kernels == &lsb_kernels_avx512)
+        return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2") &&
+               __builtin_cpu_supports("popcnt");
+    if (kernels == &lsb_kernels_avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") &&
+               __builtin_cpu_supports("popcnt");
+    if (kernels == &lsb_kernels_bmi2)
+        return __builtin_cpu_supports("bmi2");
+    if (kernels == &lsb_kernels_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return kernels == &lsb_kernels_scalar;
+}
+
+static void select_kernels(void) {
+    /* Fastest first */
+    const lsb_kernels *candidates[] = {&lsb_kernels_avx512,
+                                       &lsb_kernels_avx2,
+                                       &lsb_kernels_sse2,
+                                       &lsb_kernels_bmi2,
+                                       &lsb_kernels_scalar};
+    size_t             count        = sizeof(candidates) / sizeof(candidates[0]);
+    const char        *forced       = getenv(KERNEL_ENV);
+
+    for (size_t i = 0; i < count; i++) {
+        if (forced && strcasecmp(forced, candidates[i]->name) != 0)
+            continue;
+        if (supported(candidates[i])) {
+            selected = candidates[i];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Get the kernels to use on this CPU
+ *
+ * @return The fastest supported implementation, or the one named by STEGOBMP_KERNELS if the CPU
+ * supports it
+ */
+const lsb_kernels *lsb_kernels_get(void) {
+    pthread_once(&selectOnce, select_kernels);
+    return selected;
+}
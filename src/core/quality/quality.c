@@ -0,0 +1,355 @@
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lsb_kernels.h"
+#include "quality.h"
+#include "thread_pool.h"
+
+#define SSIM_C1 6.5025   // (0.01 * 255)^2, keeps the luminance term stable on dark windows
+#define SSIM_C2 58.5225  // (0.03 * 255)^2, same for the contrast and structure term
+#define SSIM_WINDOW 64   // Values of a window: 2x2 blocks of 4x4 values
+
+typedef struct
+{
+    const BMP_FILE *cover;
+    const BMP_FILE *stego;
+    size_t          channels;
+    bool            windows; /* The image holds at least one 8x8 window */
+    uint64_t        error[QUALITY_CHANNELS][2]; /* See squared_error */
+    double          ssim[QUALITY_CHANNELS];     /* Sum over the windows */
+    int             status;                     /* 0 on success, -1 on failure */
+    pthread_mutex_t lock;
+} quality_job;
+
+/* Split a row into one run of values per color */
+static void split_row(const uint8_t *pixel,
+                      size_t         width,
+                      size_t         pixelSize,
+                      size_t         channels,
+                      uint8_t       *planes) {
+    if (channels == 3) {
+        uint8_t *blue = planes, *green = planes + width, *red = planes + 2 * width;
+        for (size_t x = 0; x < width; x++, pixel += pixelSize) {
+            blue[x]  = pixel[0];
+            green[x] = pixel[1];
+            red[x]   = pixel[2];
+        }
+        return;
+    }
+    for (size_t x = 0; x < width; x++, pixel += pixelSize) {
+        for (size_t c = 0; c < channels; c++)
+            planes[c * width + x] = pixel[c];
+    }
+}
+
+/* SSIM of count values from their sums: of a, of b, of a^2 + b^2 and of a * b */
+static double ssim_of(double a, double b, double squares, double products, double count) {
+    double meanA      = a / count, meanB = b / count;
+    double variances  = squares / count - meanA * meanA - meanB * meanB;
+    double covariance = products / count - meanA * meanB;
+    return (2 * meanA * meanB + SSIM_C1) * (2 * covariance + SSIM_C2) /
+           ((meanA * meanA + meanB * meanB + SSIM_C1) * (variances + SSIM_C2));
+}
+
+/* Sum of the SSIM of the windows spanning two consecutive rows of 4x4 blocks */
+static double ssim_windows(uint32_t *const top[4], uint32_t *const bottom[4], size_t blocks) {
+    double sum = 0;
+    for (size_t j = 0; j + 1 < blocks; j++) {
+        double window[4];
+        for (int k = 0; k < 4; k++)
+            window[k] = (double) top[k][j] + top[k][j + 1] + bottom[k][j] + bottom[k][j + 1];
+        sum += ssim_of(window[0], window[1], window[2], window[3], SSIM_WINDOW);
+    }
+    return sum;
+}
+
+/**
+ * @brief Compare the rows [4 * begin, 4 * end) of both images
+ *
+ * Windows of 8x8 values overlap by half in both directions (as in x264): they are made of 2x2
+ * blocks of 4x4 values, whose sums are kept for the previous and the current row of blocks. A
+ * band also sums the row of blocks following it, for the windows crossing into the next band.
+ */
+static void compare_band(size_t begin, size_t end, void *context) {
+    quality_job       *job       = context;
+    const lsb_kernels *kernels   = lsb_kernels_get();
+    size_t             width     = bmp_width(job->cover), height = bmp_height(job->cover);
+    size_t             channels  = job->channels, blocks = width / 4, blockRows = height / 4;
+    size_t             errorEnd  = 4 * end < height ? 4 * end : height;
+    size_t             sumsEnd   = job->windows ? 4 * (end < blockRows ? end + 1 : blockRows) : 0;
+    uint64_t           error[QUALITY_CHANNELS][2] = {{0}};
+    double             ssim[QUALITY_CHANNELS]     = {0};
+    uint8_t           *planes                     = malloc(2 * width * channels);
+    uint32_t          *sums = calloc(2 * channels * 4 * blocks + 1, sizeof(uint32_t));
+    uint32_t          *blockRow[2][QUALITY_CHANNELS][4];
+    int                current = 0;
+
+    if (!planes || !sums) {
+        free(planes);
+        free(sums);
+        pthread_mutex_lock(&job->lock);
+        job->status = -1;
+        pthread_mutex_unlock(&job->lock);
+        return;
+    }
+    for (int r = 0; r < 2; r++) {
+        for (size_t c = 0; c < channels; c++) {
+            for (int k = 0; k < 4; k++)
+                blockRow[r][c][k] = sums + ((r * channels + c) * 4 + k) * blocks;
+        }
+    }
+
+    for (size_t row = 4 * begin; row < (errorEnd > sumsEnd ? errorEnd : sumsEnd); row++) {
+        uint8_t *coverPlanes = planes, *stegoPlanes = planes + width * channels;
+        split_row(bmp_row(job->cover, row), width, job->cover->pixelSize, channels, coverPlanes);
+        split_row(bmp_row(job->stego, row), width, job->stego->pixelSize, channels, stegoPlanes);
+        for (size_t c = 0; c < channels; c++) {
+            const uint8_t *a = coverPlanes + c * width, *b = stegoPlanes + c * width;
+            if (row < errorEnd)
+                kernels->squared_error(a, b, width, error[c]);
+            if (row < sumsEnd)
+                kernels->ssim_sums(a, b, blocks, blockRow[current][c]);
+        }
+
+        if (row < sumsEnd && row % 4 == 3) {
+            for (size_t c = 0; c < channels && row / 4 > begin; c++)
+                ssim[c] += ssim_windows(blockRow[current ^ 1][c], blockRow[current][c], blocks);
+            current ^= 1;
+            memset(blockRow[current][0][0], 0, channels * 4 * blocks * sizeof(uint32_t));
+        }
+    }
+    free(planes);
+    free(sums);
+
+    pthread_mutex_lock(&job->lock);
+    for (size_t c = 0; c < channels; c++) {
+        job->error[c][0] += error[c][0];
+        job->error[c][1] += error[c][1];
+        job->ssim[c] += ssim[c];
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* SSIM of a whole channel taken as one window, for images too small to hold an 8x8 one */
+static double channel_ssim(const BMP_FILE *cover, const BMP_FILE *stego, size_t c) {
+    size_t width = bmp_width(cover), height = bmp_height(cover);
+    double sums[4] = {0};
+    for (size_t row = 0; row < height; row++) {
+        for (size_t x = 0; x < width; x++) {
+            double a = bmp_pixel(cover, row, x)[c], b = bmp_pixel(stego, row, x)[c];
+            sums[0] += a;
+            sums[1] += b;
+            sums[2] += a * a + b * b;
+            sums[3] += a * b;
+        }
+    }
+    return ssim_of(sums[0], sums[1], sums[2], sums[3], (double) width * height);
+}
+
+static double psnr_of(double mse) {
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : QUALITY_PSNR_MAX;
+}
+
+/**
+ * @brief Measure how much a stego image differs from its cover: MSE, PSNR, SSIM and the count of
+ * changed LSBs of every color channel
+ *
+ * The rows are split in bands compared on the shared thread pool, each row split into one run of
+ * values per color for the vector kernels. SSIM is the mean over windows of 8x8 values
+ * overlapping by half, with the constants of Wang et al. for 8-bit values.
+ *
+ * @param cover Original image
+ * @param stego Image compared with it, of the same size and channels (see bmp_use_alpha)
+ * @param quality Where to store the measures
+ *
+ * @return 0 on success, -1 on failure
+ */
+int compare_bmp(const BMP_FILE *cover, const BMP_FILE *stego, image_quality *quality) {
+    memset(quality, 0, sizeof(*quality));
+    if (bmp_width(cover) != bmp_width(stego) || bmp_height(cover) != bmp_height(stego)) {
+        printerr("The images differ in size: %zux%zu and %zux%zu\n",
+                 bmp_width(cover),
+                 bmp_height(cover),
+                 bmp_width(stego),
+                 bmp_height(stego));
+        return -1;
+    }
+    if (cover->channels != stego->channels) {
+        printerr("Only one of the images has its alpha channel compared\n");
+        return -1;
+    }
+
+    size_t width = bmp_width(cover), height = bmp_height(cover);
+    quality->width    = width;
+    quality->height   = height;
+    quality->channels = cover->channels < QUALITY_CHANNELS ? cover->channels : QUALITY_CHANNELS;
+
+    quality_job job = {.cover    = cover,
+                       .stego    = stego,
+                       .channels = quality->channels,
+                       .windows  = width >= 8 && height >= 8};
+    size_t      groupChannels = 4 * width * job.channels;  // Channels of a row of blocks
+    size_t      minBand       = groupChannels && groupChannels < STEG_BAND_CHANNELS
+                                    ? STEG_BAND_CHANNELS / groupChannels
+                                    : 1;
+    pthread_mutex_init(&job.lock, NULL);
+    parallel_bands((height + 3) / 4, minBand, 1, compare_band, &job);
+    pthread_mutex_destroy(&job.lock);
+    if (job.status != 0) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+
+    double   values  = (double) width * height;
+    double   windows = (double) (width / 4 - 1) * (height / 4 - 1);
+    uint64_t squares = 0;
+    for (size_t c = 0; c < quality->channels; c++) {
+        channel_quality *channel = &quality->channel[c];
+        channel->mse             = values ? job.error[c][0] / values : 0;
+        channel->psnr            = psnr_of(channel->mse);
+        channel->ssim            = job.windows ? job.ssim[c] / windows : 0;
+        channel->lsbChanged      = job.error[c][1];
+        if (!job.windows)
+            channel->ssim = channel_ssim(cover, stego, c);
+
+        squares += job.error[c][0];
+        quality->ssim += channel->ssim / quality->channels;
+        quality->lsbChanged += channel->lsbChanged;
+    }
+    quality->mse  = values ? squares / (values * quality->channels) : 0;
+    quality->psnr = psnr_of(quality->mse);
+    return 0;
+}
+
+/**
+ * @brief Compare two BMP files, mapped rather than read
+ *
+ * @param alpha Compare the alpha (or unused X) channel of 32-bit images as well
+ *
+ * @return 0 on success, -1 on failure
+ */
+int compare_files(const char    *coverFile,
+                  const char    *stegoFile,
+                  bool           alpha,
+                  image_quality *quality) {
+    BMP_FILE *cover = map_bmp(coverFile, 0);
+    if (!cover) {
+        printerr("Could not read BMP file: %s\n", coverFile);
+        return -1;
+    }
+    BMP_FILE *stego = map_bmp(stegoFile, 0);
+    if (!stego) {
+        printerr("Could not read BMP file: %s\n", stegoFile);
+        free_bmp(cover);
+        return -1;
+    }
+
+    bmp_use_alpha(cover, alpha);
+    bmp_use_alpha(stego, alpha);
+    int result = compare_bmp(cover, stego, quality);
+    free_bmp(stego);
+    free_bmp(cover);
+    return result;
+}
+
+/* Write the measures of a comparison as a JSON line */
+static void write_quality(FILE                *out,
+                          const char          *coverFile,
+                          const char          *stegoFile,
+                          const image_quality *quality,
+                          double               us) {
+    fprintf(out, "{\"cover\":");
+    print_json_string(out, coverFile);
+    fprintf(out, ",\"stego\":");
+    print_json_string(out, stegoFile);
+    fprintf(out,
+            ",\"width\":%u,\"height\":%u,\"us\":%.2f,\"mse\":%.6f,\"psnr\":%.4f,\"ssim\":%.6f,"
+            "\"lsb_changed\":%" PRIu64 ",\"channels\":{",
+            quality->width,
+            quality->height,
+            us,
+            quality->mse,
+            quality->psnr,
+            quality->ssim,
+            quality->lsbChanged);
+    for (size_t c = 0; c < quality->channels; c++) {
+        const channel_quality *channel = &quality->channel[c];
+        fprintf(out,
+                "%s\"%s\":{\"mse\":%.6f,\"psnr\":%.4f,\"ssim\":%.6f,\"lsb_changed\":%" PRIu64 "}",
+                c == 0 ? "" : ",",
+                bmp_channel_str[c],
+                channel->mse,
+                channel->psnr,
+                channel->ssim,
+                channel->lsbChanged);
+    }
+    fprintf(out, "}}\n");
+}
+
+/**
+ * @brief Measure the distortion a stego image carries against its cover and print it as a JSON
+ * line: MSE, PSNR (QUALITY_PSNR_MAX for identical images), SSIM and the count of changed LSBs,
+ * for the whole image and each color channel
+ *
+ * @param coverFile Original BMP file
+ * @param stegoFile BMP file compared with it
+ * @param resultsFile Where to write the JSON line, NULL for stdout. With a file a summary is
+ * printed
+ * @param options Options, threads sets how many bands are compared at a time and alpha adds the
+ * alpha channel of 32-bit images
+ *
+ * @return 0 on success, -1 on failure
+ */
+int compare(const char         *coverFile,
+            const char         *stegoFile,
+            const char         *resultsFile,
+            const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+
+    struct timespec start, stop;
+    image_quality   quality;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (compare_files(coverFile, stegoFile, options && options->alpha, &quality) != 0)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double us = (stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_nsec - start.tv_nsec) / 1e3;
+
+    FILE *out = resultsFile ? fopen(resultsFile, "w") : stdout;
+    if (!out) {
+        printerr("Could not open results file: %s\n", resultsFile);
+        return -1;
+    }
+    write_quality(out, coverFile, stegoFile, &quality, us);
+    if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+        printerr("Could not write results file: %s\n", resultsFile ? resultsFile : "stdout");
+        return -1;
+    }
+
+    if (resultsFile) {
+        char psnrStr[32], ssimStr[32], mseStr[32], lsbStr[21], usStr[32];
+        snprintf(psnrStr, sizeof(psnrStr), "%.4f", quality.psnr);
+        snprintf(ssimStr, sizeof(ssimStr), "%.6f", quality.ssim);
+        snprintf(mseStr, sizeof(mseStr), "%.6f", quality.mse);
+        snprintf(lsbStr, sizeof(lsbStr), "%" PRIu64, quality.lsbChanged);
+        snprintf(usStr, sizeof(usStr), "%.1f", us);
+        print_table("Images compared",
+                    0xa6da95,
+                    "PSNR (dB)",
+                    psnrStr,
+                    "SSIM",
+                    ssimStr,
+                    "MSE",
+                    mseStr,
+                    "LSBs changed",
+                    lsbStr,
+                    "Time (us)",
+                    usStr,
+                    "Results file",
+                    resultsFile,
+                    NULL);
+    }
+    return 0;
+}
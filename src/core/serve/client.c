@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+#define EXTENSION_SEPARATOR '.'  // Separator of the extension sent with the message
+
+/* Read exactly size bytes, -1 on error or end of stream */
+static int recv_full(int fd, void *buffer, size_t size) {
+    uint8_t *dst = buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, dst, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        dst += got;
+        size -= got;
+    }
+    return 0;
+}
+
+/* Send the fixed part of a request with its descriptors, then the variable part */
+static int send_request(int                  conn,
+                        const serve_request *request,
+                        const int           *fds,
+                        size_t               fdCount,
+                        const char          *pass,
+                        const char          *extension) {
+    union {
+        char           buffer[CMSG_SPACE(sizeof(int) * 3)];
+        struct cmsghdr align;
+    } control;
+    struct iovec  iov[3]  = {{(void *) request, sizeof(*request)},
+                             {(void *) pass, request->passLength},
+                             {(void *) extension, request->extensionLength}};
+    struct msghdr message = {0};
+    message.msg_iov        = iov;
+    message.msg_iovlen     = 3;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level     = SOL_SOCKET;
+    cmsg->cmsg_type      = SCM_RIGHTS;
+    cmsg->cmsg_len       = CMSG_LEN(sizeof(int) * fdCount);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+
+    size_t  total = sizeof(*request) + request->passLength + request->extensionLength;
+    ssize_t sent;
+    do
+        sent = sendmsg(conn, &message, MSG_NOSIGNAL);
+    while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t) total ? 0 : -1;
+}
+
+/* Connect to the daemon */
+static int connect_socket(const char *socketPath) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        printerr("Socket path too long: %s\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0)
+        return fd;
+    printerr("Could not connect to %s: %s\n", socketPath, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/* Temporary output of an extraction, renamed once the extension is known */
+static char *temporary_path(const char *outputFile) {
+    char   suffix[32];
+    size_t length = snprintf(suffix, sizeof(suffix), ".partial-%ld", (long) getpid());
+    char  *path   = malloc(strlen(outputFile) + length + 1);
+    if (!path) {
+        printerr("Memory allocation failed\n");
+        return NULL;
+    }
+    strcpy(path, outputFile);
+    strcat(path, suffix);
+    return path;
+}
+
+/**
+ * @brief Open the stego BMP written by the daemon, without truncating it before it is known not
+ * to be one of the inputs, which the daemon has yet to read
+ *
+ * @param path Output path
+ * @param inputs Descriptors of the carrier and the message
+ * @param inputCount Number of inputs
+ * @param created Set to whether the output was created by this call
+ *
+ * @return Descriptor of the empty output, -1 on failure
+ */
+static int open_output(const char *path, const int *inputs, int inputCount, bool *created) {
+    *created = false;
+    int fd   = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd >= 0)
+        *created = true;
+    else if (errno == EEXIST)
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printerr("Could not open output file: %s\n", path);
+        return -1;
+    }
+
+    struct stat output, input;
+    int         result = fstat(fd, &output);
+    for (int i = 0; result == 0 && i < inputCount; i++) {
+        if (fstat(inputs[i], &input) != 0)
+            result = -1;
+        else if (input.st_dev == output.st_dev && input.st_ino == output.st_ino) {
+            printerr("The output file %s is also an input\n", path);
+            result = -1;
+        }
+    }
+    if (result == 0 && !*created && ftruncate(fd, 0) != 0) {
+        printerr("Could not open output file: %s\n", path);
+        result = -1;
+    }
+    if (result != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Embed or extract through a running stegobmp --serve daemon
+ *
+ * The files are opened here and passed to the daemon as descriptors, it reads the inputs and
+ * writes the output directly. Outputs are named as stegobmp --embed and --extract name them.
+ * An output that is one of the inputs is refused, and only an output created here is removed on
+ * failure.
+ *
+ * @param socketPath Socket of the daemon
+ * @param carrierFile Carrier to embed into or to extract from
+ * @param messageFile Message to embed, NULL to extract
+ * @param outputFile Output BMP file, or output file name without extension when extracting
+ * @param method Steganography method
+ * @param a Encryption algorithm
+ * @param m Encryption mode
+ * @param pass Password, NULL for plain payloads
+ *
+ * @return 0 on success, -1 on failure (no output file is left behind)
+ */
+int serve_client(const char *socketPath,
+                 const char *carrierFile,
+                 const char *messageFile,
+                 const char *outputFile,
+                 steg        method,
+                 encryption  a,
+                 mode        m,
+                 const char *pass) {
+    const char *extension = NULL;
+    if (messageFile) {
+        extension = strrchr(messageFile, EXTENSION_SEPARATOR);
+        if (extension && strlen(extension) >= STEGOBMP_EXTENSION_MAX) {
+            printerr("File extension is too long: %s\n", extension);
+            return -1;
+        }
+    }
+    if (pass && strlen(pass) > SERVE_PASSWORD_MAX) {
+        printerr("Password is too long, the limit is %d bytes\n", SERVE_PASSWORD_MAX);
+        return -1;
+    }
+
+    // Embedding writes the BMP in place, extraction a temporary file named after its extension
+    char *outputPath = messageFile ? bmp_output_filename(outputFile) : temporary_path(outputFile);
+    if (!outputPath)
+        return -1;
+
+    int fds[3]  = {open(carrierFile, O_RDONLY | O_CLOEXEC), -1, -1};
+    int fdCount = 1;
+    if (fds[0] < 0)
+        printerr("Could not open carrier file: %s\n", carrierFile);
+    if (fds[0] >= 0 && messageFile) {
+        fds[fdCount] = open(messageFile, O_RDONLY | O_CLOEXEC);
+        if (fds[fdCount++] < 0)
+            printerr("Could not open message file: %s\n", messageFile);
+    }
+    bool opened  = fds[0] >= 0 && (!messageFile || fds[1] >= 0);
+    bool created = false;
+    if (opened && messageFile) {
+        fds[fdCount] = open_output(outputPath, fds, fdCount, &created);
+        opened       = fds[fdCount++] >= 0;
+    }
+    else if (opened) {
+        fds[fdCount] = open(outputPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        opened       = fds[fdCount++] >= 0;
+        created      = opened;
+        if (!opened)
+            printerr("Could not open output file: %s\n", outputPath);
+    }
+
+    uint32_t flags = SERVE_FD_CARRIER | SERVE_FD_OUTPUT;
+    if (messageFile)
+        flags |= SERVE_FD_PAYLOAD;
+    serve_request request = {
+        .magic           = SERVE_REQUEST_MAGIC,
+        .action          = messageFile ? SERVE_EMBED : SERVE_EXTRACT,
+        .method          = method,
+        .cipher          = a,
+        .mode            = m,
+        .flags           = flags,
+        .passLength      = pass ? strlen(pass) : 0,
+        .extensionLength = extension ? strlen(extension) : 0,
+    };
+    serve_response response                                = {0};
+    char           resultExtension[STEGOBMP_EXTENSION_MAX] = "";
+    char           error[PRINTERR_MAX]                     = "";
+    int            result                                  = -1;
+    int            conn = opened ? connect_socket(socketPath) : -1;
+    if (conn >= 0) {
+        if (send_request(conn, &request, fds, fdCount, pass, extension) != 0 ||
+            recv_full(conn, &response, sizeof(response)) != 0 ||
+            response.magic != SERVE_RESPONSE_MAGIC ||
+            response.extensionLength >= STEGOBMP_EXTENSION_MAX ||
+            recv_full(conn, resultExtension, response.extensionLength) != 0 ||
+            recv_full(conn,
+                      error,
+                      response.errorLength < sizeof(error) ? response.errorLength
+                                                           : sizeof(error) - 1) != 0)
+            printerr("Invalid response from the daemon\n");
+        else if (response.status != STEGOBMP_OK)
+            printerr("%s\n", error[0] ? error : stegobmp_strerror(response.status));
+        else
+            result = 0;
+        close(conn);
+    }
+    for (int i = 0; i < fdCount; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    // Name the extracted file after its extension, or remove a failed output
+    char *finalPath = outputPath;
+    if (result == 0 && !messageFile) {
+        finalPath = malloc(strlen(outputFile) + strlen(resultExtension) + 1);
+        if (finalPath) {
+            strcpy(finalPath, outputFile);
+            strcat(finalPath, resultExtension);
+        }
+        if (!finalPath || rename(outputPath, finalPath) != 0) {
+            printerr("Could not write output file: %s\n", outputFile);
+            result = -1;
+        }
+    }
+    if (result != 0 && created)
+        unlink(outputPath);
+
+    if (result == 0) {
+        char timeStr[32];
+        snprintf(timeStr, sizeof(timeStr), "%.3f ms", response.nanoseconds / 1e6);
+        print_table(messageFile ? "Embedded by daemon" : "Extracted by daemon",
+                    0xa6da95,
+                    "Output",
+                    finalPath,
+                    "Daemon time",
+                    timeStr,
+                    NULL);
+    }
+    if (finalPath != outputPath)
+        free(finalPath);
+    if (outputPath != outputFile)
+        free(outputPath);
+    return result;
+}
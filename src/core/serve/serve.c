@@ -0,0 +1,471 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+#define SERVE_BACKLOG 128                      // Pending connections queued by the kernel
+#define SERVE_INLINE_MAX ((uint64_t) 1 << 32)  // Largest inline carrier or payload
+#define SERVE_FDS 3                            // Carrier, payload and output descriptors
+#define SERVE_IO_TIMEOUT_MS 5000               // Longest stall of a client within a request
+#define SERVE_IDLE_TIMEOUT_MS 5000             // Longest wait for the next request of a client
+
+typedef struct
+{
+    int                  listenFd;
+    atomic_uint_fast64_t requests; /* Requests answered */
+    atomic_uint_fast64_t failures; /* Requests answered with an error */
+} server;
+
+/* Written to by the signal handler, every worker polls the read end */
+static int stop_pipe[2] = {-1, -1};
+
+static void on_signal(int signal) {
+    (void) signal;
+    int saved = errno;
+    if (write(stop_pipe[1], "", 1) < 0) {
+        // Nothing to do, the pipe already holds a byte
+    }
+    errno = saved;
+}
+
+/**
+ * @brief Wait until fd is ready for the given poll events
+ *
+ * @param timeout Milliseconds to wait at most, -1 for no limit
+ * @param stoppable Give up as soon as the daemon is stopping
+ *
+ * @return 0 once ready, -1 on timeout, on error or when stopping
+ */
+static int wait_ready(int fd, short events, int timeout, bool stoppable) {
+    struct pollfd fds[2] = {{fd, events, 0}, {stop_pipe[0], stoppable ? POLLIN : 0, 0}};
+    for (;;) {
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0 || fds[1].revents)
+            return -1;
+        if (fds[0].revents)
+            return 0;
+    }
+}
+
+/* Read exactly size bytes, -1 on error, end of stream, timeout or when stopping */
+static int read_full(int fd, void *buffer, size_t size) {
+    uint8_t *dst = buffer;
+    while (size > 0) {
+        ssize_t got = read(fd, dst, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && errno == EAGAIN) {
+            if (wait_ready(fd, POLLIN, SERVE_IO_TIMEOUT_MS, true) != 0)
+                return -1;
+            continue;
+        }
+        if (got <= 0)
+            return -1;
+        dst += got;
+        size -= got;
+    }
+    return 0;
+}
+
+/* Write exactly size bytes, -1 on error or timeout */
+static int write_full(int fd, const void *buffer, size_t size) {
+    const uint8_t *src = buffer;
+    while (size > 0) {
+        ssize_t put = write(fd, src, size);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put < 0 && errno == EAGAIN) {
+            if (wait_ready(fd, POLLOUT, SERVE_IO_TIMEOUT_MS, false) != 0)
+                return -1;
+            continue;
+        }
+        if (put <= 0)
+            return -1;
+        src += put;
+        size -= put;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receive the fixed part of a request and the descriptors sent with it
+ *
+ * @return 0 on success, 1 if the client closed the connection, -1 on error
+ */
+static int recv_request(int conn, serve_request *request, int fds[SERVE_FDS], size_t *fdCount) {
+    union {
+        char           buffer[CMSG_SPACE(sizeof(int) * SERVE_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec  iov     = {request, sizeof(*request)};
+    struct msghdr message = {0};
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t got;
+    do
+        got = recvmsg(conn, &message, MSG_CMSG_CLOEXEC);
+    while ((got < 0 && errno == EINTR) ||
+           (got < 0 && errno == EAGAIN &&
+            wait_ready(conn, POLLIN, SERVE_IO_TIMEOUT_MS, true) == 0));
+    if (got <= 0)
+        return got == 0 ? 1 : -1;
+
+    *fdCount = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (*fdCount < SERVE_FDS)
+                fds[(*fdCount)++] = fd;
+            else
+                close(fd);
+        }
+    }
+    if (message.msg_flags & MSG_CTRUNC)
+        return -1;
+
+    // The rest of the fixed part may come in later segments
+    return read_full(conn, (uint8_t *) request + got, sizeof(*request) - got);
+}
+
+/* An input of the request, read inline from the connection or from a descriptor */
+typedef struct
+{
+    uint8_t *data;
+    size_t   size;
+} serve_input;
+
+/* Read an inline input, -1 if it can not be read */
+static int read_input(int conn, uint64_t size, serve_input *input) {
+    input->data = malloc(size ? size : 1);
+    input->size = size;
+    return input->data ? read_full(conn, input->data, size) : -1;
+}
+
+/* Whether fd is a regular file, or no descriptor at all (-1) */
+static bool regular_input(int fd) {
+    struct stat st;
+    return fd < 0 || (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+}
+
+/**
+ * @brief Read an input passed as a descriptor
+ *
+ * The file belongs to the client, which may still be changing it, so it is copied with pread
+ * rather than mapped: a file truncated meanwhile fails the request instead of raising SIGBUS.
+ *
+ * @return 0 on success, -1 if it can not be read in full
+ */
+static int read_fd_input(int fd, serve_input *input) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size > SERVE_INLINE_MAX)
+        return -1;
+
+    input->size = st.st_size;
+    input->data = malloc(input->size ? input->size : 1);
+    if (!input->data)
+        return -1;
+    for (size_t done = 0; done < input->size;) {
+        ssize_t got = pread(fd, input->data + done, input->size - done, done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return -1;
+        done += got;
+    }
+    return 0;
+}
+
+static void free_input(serve_input *input) {
+    free(input->data);
+}
+
+/* Nanoseconds elapsed since start */
+static uint64_t elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000u + now.tv_nsec - start->tv_nsec;
+}
+
+/* Run a request whose inputs are all available */
+static stegobmp_status run_request(stegobmp_ctx        *ctx,
+                                   const serve_request *request,
+                                   const char          *pass,
+                                   const char          *extension,
+                                   const serve_input   *carrier,
+                                   const serve_input   *payload,
+                                   uint8_t            **result,
+                                   size_t              *resultSize,
+                                   char                 resultExtension[STEGOBMP_EXTENSION_MAX]) {
+    stegobmp_status status = stegobmp_set_method(ctx, request->method);
+    if (status == STEGOBMP_OK)
+        status = stegobmp_set_password(ctx, pass, request->cipher, request->mode);
+    if (status != STEGOBMP_OK)
+        return status;
+
+    if (request->action == SERVE_EMBED)
+        return stegobmp_embed(ctx,
+                              carrier->data,
+                              carrier->size,
+                              payload->data,
+                              payload->size,
+                              extension,
+                              result,
+                              resultSize);
+    if (request->action == SERVE_EXTRACT)
+        return stegobmp_extract(
+            ctx, carrier->data, carrier->size, result, resultSize, resultExtension);
+    return STEGOBMP_EINVAL;
+}
+
+/**
+ * @brief Read, run and answer one request of a connection
+ *
+ * @return 0 to keep serving the connection, -1 to close it
+ */
+static int handle_request(server *srv, stegobmp_ctx *ctx, int conn) {
+    serve_request request;
+    int           fds[SERVE_FDS];
+    size_t        fdCount = 0;
+    int           result  = recv_request(conn, &request, fds, &fdCount);
+    if (result != 0 || request.magic != SERVE_REQUEST_MAGIC ||
+        request.passLength > SERVE_PASSWORD_MAX ||
+        request.extensionLength >= STEGOBMP_EXTENSION_MAX ||
+        request.carrierSize > SERVE_INLINE_MAX || request.payloadSize > SERVE_INLINE_MAX) {
+        for (size_t i = 0; i < fdCount; i++)
+            close(fds[i]);
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Descriptors come in the order of their flags
+    int    carrierFd = -1, payloadFd = -1, outputFd = -1;
+    size_t next      = 0;
+    if ((request.flags & SERVE_FD_CARRIER) && next < fdCount)
+        carrierFd = fds[next++];
+    if ((request.flags & SERVE_FD_PAYLOAD) && next < fdCount)
+        payloadFd = fds[next++];
+    if ((request.flags & SERVE_FD_OUTPUT) && next < fdCount)
+        outputFd = fds[next++];
+    for (size_t i = next; i < fdCount; i++)
+        close(fds[i]);
+
+    char        pass[SERVE_PASSWORD_MAX + 1]      = {0};
+    char        extension[STEGOBMP_EXTENSION_MAX] = {0};
+    serve_input carrier = {0}, payload = {0};
+    if (read_full(conn, pass, request.passLength) != 0 ||
+        read_full(conn, extension, request.extensionLength) != 0 ||
+        (carrierFd < 0 && read_input(conn, request.carrierSize, &carrier) != 0) ||
+        (payloadFd < 0 && read_input(conn, request.payloadSize, &payload) != 0))
+        result = -1;
+
+    // The request has been read in full, from here on failures are answered
+    stegobmp_status status                                  = STEGOBMP_OK;
+    const char     *error                                   = NULL;
+    uint8_t        *output                                  = NULL;
+    size_t          outputSize                              = 0;
+    char            outputExtension[STEGOBMP_EXTENSION_MAX] = "";
+    if (result != 0) {
+        status = STEGOBMP_EIO;
+    }
+    else if (next != fdCount || (request.flags & SERVE_FD_CARRIER && carrierFd < 0) ||
+             (request.flags & SERVE_FD_PAYLOAD && payloadFd < 0) ||
+             (request.flags & SERVE_FD_OUTPUT && outputFd < 0)) {
+        status = STEGOBMP_EINVAL;
+        error  = "The descriptors sent do not match the request flags";
+    }
+    else if (!regular_input(carrierFd) || !regular_input(payloadFd)) {
+        status = STEGOBMP_EINVAL;
+        error  = "Input descriptors must be regular files";
+    }
+    else if ((carrierFd >= 0 && read_fd_input(carrierFd, &carrier) != 0) ||
+             (payloadFd >= 0 && read_fd_input(payloadFd, &payload) != 0)) {
+        status = STEGOBMP_EIO;
+        error  = "Could not read an input descriptor";
+    }
+    else {
+        status = run_request(ctx,
+                             &request,
+                             request.passLength ? pass : NULL,
+                             request.extensionLength ? extension : NULL,
+                             &carrier,
+                             &payload,
+                             &output,
+                             &outputSize,
+                             outputExtension);
+        if (status == STEGOBMP_OK && outputFd >= 0 &&
+            write_full(outputFd, output, outputSize) != 0) {
+            status = STEGOBMP_EIO;
+            error  = "Could not write the output descriptor";
+        }
+    }
+    OPENSSL_cleanse(pass, sizeof(pass));
+    if (status != STEGOBMP_OK && !error)
+        error = stegobmp_last_error(ctx);
+
+    // Answer: the result follows unless it went to the output descriptor
+    serve_response response = {SERVE_RESPONSE_MAGIC, status, 0, 0, 0, 0};
+    response.extensionLength = status == STEGOBMP_OK ? strlen(outputExtension) : 0;
+    response.errorLength     = error ? strlen(error) : 0;
+    response.dataSize        = status == STEGOBMP_OK && outputFd < 0 ? outputSize : 0;
+    response.nanoseconds     = elapsed(&start);
+    if (result == 0 && (write_full(conn, &response, sizeof(response)) != 0 ||
+                        write_full(conn, outputExtension, response.extensionLength) != 0 ||
+                        write_full(conn, error, response.errorLength) != 0 ||
+                        write_full(conn, output, response.dataSize) != 0))
+        result = -1;
+
+    atomic_fetch_add(&srv->requests, 1);
+    if (status != STEGOBMP_OK)
+        atomic_fetch_add(&srv->failures, 1);
+
+    stegobmp_free(output);
+    free_input(&carrier);
+    free_input(&payload);
+    if (carrierFd >= 0)
+        close(carrierFd);
+    if (payloadFd >= 0)
+        close(payloadFd);
+    if (outputFd >= 0)
+        close(outputFd);
+    return result;
+}
+
+/* Worker: accept connections and serve their requests until the daemon stops */
+static void serve_worker(size_t task, void *context) {
+    server       *srv = context;
+    stegobmp_ctx *ctx = stegobmp_new(STEGOBMP_LSB1);
+    (void) task;
+
+    while (ctx && wait_ready(srv->listenFd, POLLIN, -1, true) == 0) {
+        // Every worker is woken up, the ones that lose the race get EAGAIN
+        int conn = accept4(srv->listenFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (conn < 0)
+            continue;
+        // Idle connections are closed, so they do not keep the worker from accepting others
+        while (wait_ready(conn, POLLIN, SERVE_IDLE_TIMEOUT_MS, true) == 0 &&
+               handle_request(srv, ctx, conn) == 0)
+            ;
+        close(conn);
+    }
+    stegobmp_destroy(ctx);
+}
+
+/* Create the listening socket, readable and writable by the owner only */
+static int listen_socket(const char *socketPath) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        printerr("Socket path too long: %s\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    // A socket left behind by a previous daemon is replaced, any other file is kept
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        printerr("Could not create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    mode_t mask   = umask(077);
+    int    result = bind(fd, (struct sockaddr *) &address, sizeof(address));
+    umask(mask);
+    if (result != 0 || listen(fd, SERVE_BACKLOG) != 0) {
+        printerr("Could not listen on %s: %s\n", socketPath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Serve embed and extract requests on a Unix socket until SIGINT or SIGTERM
+ *
+ * Requests run on the shared thread pool, one connection per thread at a time. Every thread
+ * keeps its library context, and the ciphers and the keys derived from passwords stay cached
+ * across requests, so a small payload costs the embedding and no process start-up or PBKDF2.
+ * Connections are non-blocking so no client can hold a worker: one idle for
+ * SERVE_IDLE_TIMEOUT_MS between requests, or stalled for SERVE_IO_TIMEOUT_MS within one, is
+ * closed, and reads end as soon as the daemon is stopping. The protocol is described in serve.h.
+ *
+ * @param socketPath Path of the socket to create
+ * @param options threads sets how many requests are served at a time, keyCache names a file
+ * keeping derived keys across runs of the daemon
+ *
+ * @return 0 once stopped, -1 if the daemon could not start
+ */
+int serve(const char *socketPath, const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
+        return -1;
+
+    if (pipe2(stop_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        printerr("Could not create pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    server srv = {.listenFd = listen_socket(socketPath)};
+    if (srv.listenFd < 0) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        return -1;
+    }
+
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);  // A client going away only fails its own request
+
+    char threadsStr[21];
+    snprintf(threadsStr, sizeof(threadsStr), "%zu", steg_threads());
+    print_table("Serving requests", 0xa6da95, "Socket", socketPath, "Workers", threadsStr, NULL);
+    fflush(stdout);
+
+    parallel_tasks(steg_threads(), serve_worker, &srv);
+
+    close(srv.listenFd);
+    unlink(socketPath);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    key_cache_save();
+
+    char requestsStr[21], failuresStr[21], reusedStr[21];
+    snprintf(requestsStr, sizeof(requestsStr), "%" PRIuFAST64, atomic_load(&srv.requests));
+    snprintf(failuresStr, sizeof(failuresStr), "%" PRIuFAST64, atomic_load(&srv.failures));
+    snprintf(reusedStr, sizeof(reusedStr), "%" PRIu64, key_cache_avoided());
+    // The daemon held the keys of every client, they are not left in memory once it stops
+    key_cache_clear();
+    print_table("Daemon stopped",
+                0xa6da95,
+                "Requests",
+                requestsStr,
+                "Failed",
+                failuresStr,
+                "Keys reused",
+                reusedStr,
+                NULL);
+    return 0;
+}
@@ -0,0 +1,439 @@
+#include <math.h>
+#include <time.h>
+
+#include "lsb_kernels.h"
+#include "steganalysis.h"
+
+#define CHI_MIN_EXPECTED 5  // Pairs of values seen less often are left out of the chi-square test
+#define CHI_EMBEDDED 0.5    // Probability from which a slice of rows counts as embedded
+#define SCAN_CHUNK 1024     // Carriers analyzed before their JSON lines are written
+
+/* Counts of a slice of rows, every analysis only needs their sums */
+typedef struct
+{
+    uint64_t histogram[ANALYSIS_CHANNELS][256];
+    uint64_t pairs[ANALYSIS_CHANNELS][3];  /* Sample pair classes, see sample_pairs */
+    uint64_t groups[ANALYSIS_CHANNELS][8]; /* RS classes, see rs_groups */
+    int      status;                       /* 0 on success, -1 on failure */
+} segment_counts;
+
+typedef struct
+{
+    const BMP_FILE *bmp;
+    size_t          channels;
+    size_t          segments;
+    segment_counts *counts;
+} analysis_job;
+
+/* One carrier of a scan and its outcome */
+typedef struct
+{
+    const char    *path;
+    image_analysis analysis;
+    int            status; /* 0 on success, -1 on failure */
+    char           error[PRINTERR_MAX];
+    double         microseconds; /* Time taken to read and analyze the carrier */
+} analysis_entry;
+
+typedef struct
+{
+    analysis_entry *entries;
+    bool            alpha;
+} scan_job;
+
+/* First row of a slice, slices split the rows as evenly as possible */
+static size_t segment_row(const analysis_job *job, size_t segment) {
+    return segment * bmp_height(job->bmp) / job->segments;
+}
+
+/* Split a row into one run of values per color, counting the values on the way */
+static void split_row(const uint8_t  *pixel,
+                      size_t          width,
+                      size_t          pixelSize,
+                      size_t          channels,
+                      uint8_t        *planes,
+                      segment_counts *counts) {
+    if (channels == 3) {
+        uint8_t *blue = planes, *green = planes + width, *red = planes + 2 * width;
+        for (size_t x = 0; x < width; x++, pixel += pixelSize) {
+            blue[x]  = pixel[0];
+            green[x] = pixel[1];
+            red[x]   = pixel[2];
+            counts->histogram[0][pixel[0]]++;
+            counts->histogram[1][pixel[1]]++;
+            counts->histogram[2][pixel[2]]++;
+        }
+        return;
+    }
+    for (size_t x = 0; x < width; x++, pixel += pixelSize) {
+        for (size_t c = 0; c < channels; c++) {
+            planes[c * width + x] = pixel[c];
+            counts->histogram[c][pixel[c]]++;
+        }
+    }
+}
+
+/* Count the values, pairs of neighbours and groups of every color of a slice of rows */
+static void count_segment(size_t segment, void *context) {
+    analysis_job      *job     = context;
+    const BMP_FILE    *bmp     = job->bmp;
+    const lsb_kernels *kernels = lsb_kernels_get();
+    segment_counts    *counts  = &job->counts[segment];
+    size_t             width   = bmp_width(bmp);
+    uint8_t           *planes  = malloc(width * job->channels);
+
+    if (!planes) {
+        counts->status = -1;
+        return;
+    }
+    for (size_t row = segment_row(job, segment); row < segment_row(job, segment + 1); row++) {
+        split_row(bmp_row(bmp, row), width, bmp->pixelSize, job->channels, planes, counts);
+        for (size_t c = 0; c < job->channels; c++) {
+            kernels->sample_pairs(planes + c * width, width, counts->pairs[c]);
+            kernels->rs_groups(planes + c * width, width / 4, counts->groups[c]);
+        }
+    }
+    free(planes);
+}
+
+/* ln(Gamma(a)) for a whole or half a > 0, the only ones a chi-square test needs */
+static double log_gamma_half(double a) {
+    bool   whole  = fmod(a, 1) == 0;
+    double result = whole ? 0 : 0.5 * log(M_PI);
+    for (double x = whole ? 1 : 0.5; x < a; x++)
+        result += log(x);
+    return result;
+}
+
+/* Regularized upper incomplete gamma function Q(a, x), by its series or continued fraction */
+static double upper_gamma(double a, double x) {
+    if (x <= 0)
+        return 1;
+
+    double prefix = exp(a * log(x) - x - log_gamma_half(a));
+    if (x < a + 1) {
+        double term = 1 / a, sum = term;
+        for (int n = 1; n < 1000 && term > sum * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+        return 1 - prefix * sum;
+    }
+
+    // Modified Lentz
+    double b = x + 1 - a, c = 1e300, d = 1 / b, h = d;
+    for (int n = 1; n < 1000; n++) {
+        double an = -n * (n - a);
+        b += 2;
+        d = an * d + b;
+        c = b + an / c;
+        d = 1 / (fabs(d) < 1e-300 ? 1e-300 : d);
+        c = fabs(c) < 1e-300 ? 1e-300 : c;
+        h *= d * c;
+        if (fabs(d * c - 1) < 1e-15)
+            break;
+    }
+    return prefix * h;
+}
+
+/**
+ * @brief Chi-square attack (Westfeld and Pfitzmann): an LSB embedding makes the values 2n and
+ * 2n + 1 equally frequent, the p-value of that hypothesis is the probability of an embedding
+ */
+static double chi_square_probability(const uint64_t histogram[256]) {
+    double chi        = 0;
+    int    categories = 0;
+    for (int v = 0; v < 256; v += 2) {
+        double expected = (histogram[v] + histogram[v + 1]) / 2.0;
+        if (expected < CHI_MIN_EXPECTED)
+            continue;
+        double deviation = histogram[v] - expected;
+        chi += deviation * deviation / expected;
+        categories++;
+    }
+    return categories < 2 ? 0 : upper_gamma((categories - 1) / 2.0, chi / 2);
+}
+
+/* Root of a x^2 + b x + c = 0 closest to zero, the vertex when there is no real root */
+static double smallest_root(double a, double b, double c) {
+    if (a == 0)
+        return b != 0 ? -c / b : 0;
+
+    double discriminant = b * b - 4 * a * c;
+    double root         = sqrt(discriminant > 0 ? discriminant : 0);
+    double first = (-b + root) / (2 * a), second = (-b - root) / (2 * a);
+    return fabs(first) < fabs(second) ? first : second;
+}
+
+/* Clamp an estimate to [0, 1], NaN (no estimate) becomes 0 */
+static double clamp_rate(double rate) {
+    return rate > 0 ? (rate < 1 ? rate : 1) : 0;
+}
+
+/* Clamp the estimate of a slice to [-1, 1], the noise of clean slices around 0 averages out */
+static double bound_slice(double rate) {
+    return isnan(rate) ? 0 : rate > -1 ? (rate < 1 ? rate : 1) : -1;
+}
+
+/**
+ * @brief RS analysis (Fridrich, Goljan and Du): the regular and singular groups under M and -M
+ * drift apart as LSBs are randomized, with every LSB flipped as well they fit a quadratic whose
+ * root gives the embedding rate
+ */
+static double rs_rate(const uint64_t groups[8]) {
+    double d0 = (double) groups[0] - groups[1], n0 = (double) groups[2] - groups[3];
+    double d1 = (double) groups[4] - groups[5], n1 = (double) groups[6] - groups[7];
+    double z  = smallest_root(2 * (d1 + d0), n0 - n1 - d1 - 3 * d0, d0 - n0);
+    return z / (z - 0.5);
+}
+
+/**
+ * @brief Sample pair analysis (Dumitrescu, Wu and Wang): the rate p solves
+ * (K / 2) p^2 + (2 X - P) p + Y - X = 0 over the P pairs of neighbours
+ */
+static double spa_rate(const uint64_t pairs[3], uint64_t total) {
+    double x = (double) pairs[0], y = (double) pairs[1], k = (double) pairs[2];
+    return smallest_root(k / 2, 2 * x - (double) total, y - x);
+}
+
+/**
+ * @brief Estimate how much of every color channel of an image carries an LSB payload
+ *
+ * The rows are split in slices counted on tasks of the shared thread pool: the histogram of
+ * every color, the classes of its pairs of horizontal neighbours and of its groups of 4. Every
+ * analysis runs on each slice: payloads fill the channels from the bottom row and RS and SPA are
+ * not linear in the rate, so a half-used carrier is estimated as the mean of full and clean
+ * slices rather than from counts mixing both.
+ *
+ * @param bmp Image, its alpha channel is analyzed if it carries payload (see bmp_use_alpha)
+ * @param analysis Where to store the estimates
+ *
+ * @return 0 on success, -1 on failure
+ */
+int analyze_bmp(const BMP_FILE *bmp, image_analysis *analysis) {
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->width    = bmp_width(bmp);
+    analysis->height   = bmp_height(bmp);
+    analysis->channels = bmp->channels < ANALYSIS_CHANNELS ? bmp->channels : ANALYSIS_CHANNELS;
+
+    size_t       height = bmp_height(bmp);
+    analysis_job job    = {bmp,
+                           analysis->channels,
+                           height < ANALYSIS_SEGMENTS ? height : ANALYSIS_SEGMENTS,
+                           NULL};
+    if (job.segments == 0)
+        return 0;
+    if (!(job.counts = calloc(job.segments, sizeof(segment_counts)))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    parallel_tasks(job.segments, count_segment, &job);
+
+    for (size_t s = 0; s < job.segments; s++) {
+        if (job.counts[s].status != 0) {
+            printerr("Memory allocation failed\n");
+            free(job.counts);
+            return -1;
+        }
+    }
+
+    size_t width = analysis->width;
+    for (size_t c = 0; c < analysis->channels; c++) {
+        channel_analysis *channel = &analysis->channel[c];
+        size_t            rows    = 0;
+        double            rs = 0, spa = 0;
+
+        for (size_t s = 0; s < job.segments; s++) {
+            const segment_counts *counts = &job.counts[s];
+            size_t                slice  = segment_row(&job, s + 1) - segment_row(&job, s);
+            uint64_t              pairs  = width > 1 ? (uint64_t) (width - 1) * slice : 0;
+            double probability           = chi_square_probability(counts->histogram[c]);
+
+            if (s == 0)
+                channel->chiSquare = probability;
+            if (probability >= CHI_EMBEDDED)
+                rows += slice;
+            rs += slice * bound_slice(rs_rate(counts->groups[c]));
+            spa += slice * bound_slice(spa_rate(counts->pairs[c], pairs));
+        }
+        channel->chiLength = (double) rows / height;
+        channel->rs        = clamp_rate(rs / height);
+        channel->spa       = clamp_rate(spa / height);
+        channel->rate      = (channel->rs + channel->spa) / 2;
+        if (channel->rate > analysis->rate)
+            analysis->rate = channel->rate;
+    }
+    free(job.counts);
+    return 0;
+}
+
+/**
+ * @brief Analyze a BMP file, mapped rather than read
+ *
+ * @param alpha Analyze the alpha (or unused X) channel of 32-bit carriers as well
+ *
+ * @return 0 on success, -1 on failure
+ */
+int analyze_file(const char *filename, bool alpha, image_analysis *analysis) {
+    BMP_FILE *bmp = map_bmp(filename, 0);
+    if (!bmp) {
+        printerr("Could not read BMP file: %s\n", filename);
+        return -1;
+    }
+    bmp_use_alpha(bmp, alpha);
+    int result = analyze_bmp(bmp, analysis);
+    free_bmp(bmp);
+    return result;
+}
+
+/* Analyze one carrier, recording errors instead of printing them */
+static void analyze_task(size_t task, void *context) {
+    scan_job       *job   = context;
+    analysis_entry *entry = &job->entries[task];
+    bool            quiet = printerr_quiet(true);
+    struct timespec start, stop;
+
+    printerr_reset();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    entry->status = analyze_file(entry->path, job->alpha, &entry->analysis);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    entry->microseconds = (stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_nsec - start.tv_nsec) / 1e3;
+    if (entry->status != 0) {
+        const char *error = printerr_first();
+        snprintf(entry->error, sizeof(entry->error), "%s", *error ? error : "Failed");
+    }
+    printerr_quiet(quiet);
+}
+
+/* Write the estimates of one carrier as a JSON line */
+static void write_entry(FILE *out, const analysis_entry *entry) {
+    fprintf(out, "{\"carrier\":");
+    print_json_string(out, entry->path);
+    if (entry->status != 0) {
+        fprintf(out, ",\"error\":");
+        print_json_string(out, entry->error);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    const image_analysis *analysis = &entry->analysis;
+    fprintf(out,
+            ",\"width\":%u,\"height\":%u,\"us\":%.2f,\"rate\":%.4f,\"channels\":{",
+            analysis->width,
+            analysis->height,
+            entry->microseconds,
+            analysis->rate);
+    for (size_t c = 0; c < analysis->channels; c++) {
+        const channel_analysis *channel = &analysis->channel[c];
+        fprintf(out,
+                "%s\"%s\":{\"chi_square\":%.4f,\"chi_length\":%.4f,\"rs\":%.4f,\"spa\":%.4f,"
+                "\"rate\":%.4f}",
+                c == 0 ? "" : ",",
+                bmp_channel_str[c],
+                channel->chiSquare,
+                channel->chiLength,
+                channel->rs,
+                channel->spa,
+                channel->rate);
+    }
+    fprintf(out, "}}\n");
+}
+
+/**
+ * @brief Screen a carrier, or every .bmp file of a directory, for LSB payloads with the
+ * chi-square attack, RS analysis and sample pair analysis
+ *
+ * Every carrier gets a JSON line with the estimates of each color channel: the chi-square
+ * probability of an embedding and the share of the rows it covers, the RS and SPA embedding
+ * rates and their mean, and the highest mean of the carrier. A directory is analyzed a chunk of
+ * carriers at a time, one carrier per thread of the shared pool, a single carrier is split in
+ * slices of rows instead.
+ *
+ * @param path BMP file or directory of BMP files
+ * @param resultsFile Where to write the JSON lines, NULL for stdout. With a file a summary is
+ * printed
+ * @param options Options, threads sets how many carriers are analyzed at a time and alpha adds
+ * the alpha channel of 32-bit carriers
+ *
+ * @return 0 if every carrier was analyzed, -1 otherwise
+ */
+int analyze(const char *path, const char *resultsFile, const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        return -1;
+
+    char **paths;
+    size_t count;
+    if (list_carrier_files(path, &paths, &count) != 0)
+        return -1;
+
+    scan_job job = {calloc(count < SCAN_CHUNK ? (count ? count : 1) : SCAN_CHUNK,
+                           sizeof(analysis_entry)),
+                    options && options->alpha};
+    if (!job.entries) {
+        printerr("Memory allocation failed\n");
+        free_carrier_files(paths, count);
+        return -1;
+    }
+
+    FILE *out = resultsFile ? fopen(resultsFile, "w") : stdout;
+    if (!out) {
+        printerr("Could not open results file: %s\n", resultsFile);
+        free(job.entries);
+        free_carrier_files(paths, count);
+        return -1;
+    }
+
+    struct timespec start, stop;
+    size_t          failed = 0, suspicious = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t first = 0; first < count; first += SCAN_CHUNK) {
+        size_t chunk = count - first < SCAN_CHUNK ? count - first : SCAN_CHUNK;
+        for (size_t i = 0; i < chunk; i++) {
+            memset(&job.entries[i], 0, sizeof(analysis_entry));
+            job.entries[i].path = paths[first + i];
+        }
+        parallel_tasks(chunk, analyze_task, &job);
+
+        for (size_t i = 0; i < chunk; i++) {
+            write_entry(out, &job.entries[i]);
+            failed += job.entries[i].status != 0;
+            suspicious += job.entries[i].status == 0 &&
+                          job.entries[i].analysis.rate >= ANALYSIS_SUSPICIOUS;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+
+    int result = 0;
+    if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+        printerr("Could not write results file: %s\n", resultsFile ? resultsFile : "stdout");
+        result = -1;
+    }
+    free(job.entries);
+    free_carrier_files(paths, count);
+
+    if (resultsFile) {
+        char carriersStr[21], failedStr[21], suspiciousStr[21], msStr[32], perStr[32];
+        snprintf(carriersStr, sizeof(carriersStr), "%zu", count);
+        snprintf(failedStr, sizeof(failedStr), "%zu", failed);
+        snprintf(suspiciousStr, sizeof(suspiciousStr), "%zu", suspicious);
+        snprintf(msStr, sizeof(msStr), "%.3f", ms);
+        snprintf(perStr, sizeof(perStr), "%.2f", count ? ms * 1e3 / count : 0);
+        print_table(failed ? "Analysis finished with unreadable carriers" : "Analysis finished",
+                    failed ? 0xed8796 : 0xa6da95,
+                    "Carriers",
+                    carriersStr,
+                    "Unreadable",
+                    failedStr,
+                    "Suspicious",
+                    suspiciousStr,
+                    "Time (ms)",
+                    msStr,
+                    "Per carrier (us)",
+                    perStr,
+                    "Results file",
+                    resultsFile,
+                    NULL);
+    }
+    return result == 0 && failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,965 @@
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stripe.h"
+
+#define UINT32_SIZE sizeof(uint32_t)                      // Size of the payload size prefix
+#define STRIPE_MAGIC "SBST"                               // First bytes of every stripe header
+#define STRIPE_FRAME (UINT32_SIZE + STRIPE_HEADER_SIZE)   // Payload bytes ahead of every part
+#define STRIPE_SUMMED (STRIPE_HEADER_SIZE - UINT32_SIZE)  // Header bytes the checksum covers
+#define STREAM_CHUNK (1024 * 1024)                        // Part bytes decoded at a time
+
+/* Fields of a stripe header */
+typedef struct
+{
+    uint16_t index;
+    uint16_t count;
+    uint64_t offset; /* Position of the part within the whole payload */
+    uint64_t total;  /* Size of the whole payload */
+    uint32_t checksum;
+} stripe_header;
+
+/* One carrier of a striped payload and the outcome of its task */
+typedef struct
+{
+    const char   *carrier;
+    struct stat   carrierStat; /* Device and inode, no output may be the carrier */
+    const char   *output;      /* Stego file written by the embedding */
+    BMP_FILE     *bmp;    /* Carrier being extracted, rows of the whole stripe loaded */
+    lsb_reader    reader;
+    stripe_header header;
+    size_t        room;   /* Part bytes the carrier can take */
+    size_t        length; /* Part bytes */
+    int           status; /* 0 on success, -1 on failure */
+    char          error[PRINTERR_MAX];
+} stripe_entry;
+
+/* What the tasks of an embedding or an extraction share */
+typedef struct
+{
+    stripe_entry        *entries;
+    size_t               count;
+    steg                 method;
+    const steg_options  *options;
+    const unsigned char *payload; /* Whole payload being embedded */
+    unsigned char       *buffer;  /* Whole encrypted payload being extracted */
+    int                  fd;      /* Output of a plain extraction */
+    size_t               fileSize;
+} stripe_job;
+
+static void put_be(unsigned char *dst, uint64_t value, size_t bytes) {
+    for (size_t i = bytes; i > 0; i--, value >>= 8)
+        dst[i - 1] = (unsigned char) value;
+}
+
+static uint64_t get_be(const unsigned char *src, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+        value = value << 8 | src[i];
+    return value;
+}
+
+/* Serialize a header, the checksum included as it is */
+static void pack_header(const stripe_header *header, unsigned char dst[STRIPE_HEADER_SIZE]) {
+    memcpy(dst, STRIPE_MAGIC, 4);
+    put_be(dst + 4, header->index, 2);
+    put_be(dst + 6, header->count, 2);
+    put_be(dst + 8, header->offset, 8);
+    put_be(dst + 16, header->total, 8);
+    put_be(dst + STRIPE_SUMMED, header->checksum, UINT32_SIZE);
+}
+
+/**
+ * @brief Parse a stripe header
+ *
+ * @return 0 on success, -1 if the bytes are not a stripe header
+ */
+static int unpack_header(const unsigned char src[STRIPE_HEADER_SIZE], stripe_header *header) {
+    if (memcmp(src, STRIPE_MAGIC, 4) != 0)
+        return -1;
+    header->index    = (uint16_t) get_be(src + 4, 2);
+    header->count    = (uint16_t) get_be(src + 6, 2);
+    header->offset   = get_be(src + 8, 8);
+    header->total    = get_be(src + 16, 8);
+    header->checksum = (uint32_t) get_be(src + STRIPE_SUMMED, UINT32_SIZE);
+    return 0;
+}
+
+/* Start the checksum of a stripe with its header, the part is added with EVP_DigestUpdate */
+static EVP_MD_CTX *checksum_begin(const stripe_header *header) {
+    unsigned char packed[STRIPE_HEADER_SIZE];
+    EVP_MD_CTX   *digest = EVP_MD_CTX_new();
+    pack_header(header, packed);
+    if (digest && (EVP_DigestInit_ex(digest, EVP_sha256(), NULL) != 1 ||
+                   EVP_DigestUpdate(digest, packed, STRIPE_SUMMED) != 1)) {
+        EVP_MD_CTX_free(digest);
+        digest = NULL;
+    }
+    if (!digest)
+        printerr("Error computing the stripe checksum\n");
+    return digest;
+}
+
+/**
+ * @brief Finish and release a checksum started with checksum_begin
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int checksum_end(EVP_MD_CTX *digest, uint32_t *checksum) {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    int           result = EVP_DigestFinal_ex(digest, hash, NULL) == 1 ? 0 : -1;
+    EVP_MD_CTX_free(digest);
+    if (result != 0)
+        printerr("Error computing the stripe checksum\n");
+    else
+        *checksum = (uint32_t) get_be(hash, UINT32_SIZE);
+    return result;
+}
+
+/* Split a comma separated list in place, NULL if it is empty or names too many files */
+static const char **split_list(char *list, size_t *count) {
+    const char **items = calloc(STRIPE_MAX + 1, sizeof(*items));
+    if (!items) {
+        printerr("Memory allocation failed\n");
+        return NULL;
+    }
+
+    *count = 0;
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        if (*count == STRIPE_MAX) {
+            printerr("A payload can be striped across at most %d carriers\n", STRIPE_MAX);
+            free(items);
+            return NULL;
+        }
+        items[(*count)++] = item;
+    }
+    if (*count == 0) {
+        printerr("No carriers given\n");
+        free(items);
+        return NULL;
+    }
+    return items;
+}
+
+/* Record the first error of a task, or clear the status on success */
+static void task_status(stripe_entry *entry, int result) {
+    entry->status = result;
+    if (result != 0) {
+        const char *error = printerr_first();
+        snprintf(entry->error, sizeof(entry->error), "%s", *error ? error : "Failed");
+    }
+}
+
+/* Print the errors recorded by the tasks */
+static int report_failures(const stripe_job *job) {
+    int result = 0;
+    for (size_t i = 0; i < job->count; i++) {
+        if (job->entries[i].status != 0) {
+            printerr("%s: %s\n", job->entries[i].carrier, job->entries[i].error);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* An output of an embedding, as checked against the other outputs and the carriers */
+typedef struct
+{
+    char       *name; /* Output path with the .bmp extension */
+    struct stat st;
+    bool        exists;
+} output_file;
+
+static bool same_inode(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/* Whether an existing file is one of the carriers, other links to it included */
+static bool is_carrier(const stripe_job *job, const struct stat *st) {
+    for (size_t i = 0; i < job->count; i++) {
+        if (same_inode(st, &job->entries[i].carrierStat))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Check, before any output is opened, that every output of an embedding is a file of its
+ * own: outputs are truncated when written, so two stripes sharing one would overwrite each
+ * other and an output that is a carrier would destroy it
+ *
+ * Existing files are compared by inode, so other paths or links to the same file are caught,
+ * missing ones by path.
+ *
+ * @return 0 on success, -1 if an output is given twice or is one of the carriers
+ */
+static int check_outputs(const stripe_job *job) {
+    output_file *files  = calloc(job->count, sizeof(output_file));
+    int          result = 0;
+    if (!files) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+
+    for (size_t i = 0; result == 0 && i < job->count; i++) {
+        output_file *file = &files[i];
+        if (!(file->name = bmp_output_filename(job->entries[i].output))) {
+            result = -1;
+            break;
+        }
+        file->exists = stat(file->name, &file->st) == 0;
+
+        for (size_t j = 0; result == 0 && j < i; j++) {
+            if (file->exists && files[j].exists ? same_inode(&file->st, &files[j].st)
+                                                : strcmp(file->name, files[j].name) == 0) {
+                printerr("Output file %s is given more than once\n", file->name);
+                result = -1;
+            }
+        }
+        if (result == 0 && file->exists && is_carrier(job, &file->st)) {
+            printerr("Output file %s is one of the carriers\n", file->name);
+            result = -1;
+        }
+    }
+
+    for (size_t i = 0; i < job->count; i++) {
+        if (files[i].name != job->entries[i].output)
+            free(files[i].name);
+    }
+    free(files);
+    return result;
+}
+
+/* Remove the stego files written so far */
+static void remove_outputs(const stripe_job *job) {
+    for (size_t i = 0; i < job->count; i++) {
+        char *filename = bmp_output_filename(job->entries[i].output);
+        if (filename) {
+            remove(filename);
+            if (filename != job->entries[i].output)
+                free(filename);
+        }
+    }
+}
+
+/**
+ * @brief Split the payload in parts proportional to the room of every carrier
+ *
+ * @return 0 on success, -1 if the carriers can not hold the whole payload
+ */
+static int plan_parts(stripe_job *job, size_t total) {
+    size_t room = 0;
+    for (size_t i = 0; i < job->count; i++)
+        room += job->entries[i].room;
+    if (total > room) {
+        printerr(
+            "Data size exceeds the combined capacity of the carriers. You are trying to embed %zu "
+            "bytes, but the carriers can take %zu bytes.\n",
+            total,
+            room);
+        return -1;
+    }
+
+    size_t left = total;
+    for (size_t i = 0; i < job->count; i++) {
+        stripe_entry *entry = &job->entries[i];
+        size_t        share = (size_t) ((double) total * entry->room / room);
+        if (share > entry->room)
+            share = entry->room;
+        if (share > left)
+            share = left;
+        entry->length = share;
+        left -= share;
+    }
+    // Rounding leaves a few bytes, they go to the first carriers with room to spare
+    for (size_t i = 0; left > 0 && i < job->count; i++) {
+        stripe_entry *entry = &job->entries[i];
+        size_t        more  = entry->room - entry->length;
+        if (more > left)
+            more = left;
+        entry->length += more;
+        left -= more;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < job->count; i++) {
+        stripe_entry *entry  = &job->entries[i];
+        entry->header.index  = (uint16_t) i;
+        entry->header.count  = (uint16_t) job->count;
+        entry->header.offset = offset;
+        entry->header.total  = total;
+        offset += entry->length;
+    }
+    return 0;
+}
+
+/* Store the frame and the part of a stripe in its carrier */
+static int store_stripe(stripe_job *job, stripe_entry *entry, BMP_FILE *bmp) {
+    const unsigned char *part   = job->payload + entry->header.offset;
+    EVP_MD_CTX          *digest = checksum_begin(&entry->header);
+    if (!digest)
+        return -1;
+    if (EVP_DigestUpdate(digest, part, entry->length) != 1) {
+        EVP_MD_CTX_free(digest);
+        printerr("Error computing the stripe checksum\n");
+        return -1;
+    }
+    if (checksum_end(digest, &entry->header.checksum) != 0)
+        return -1;
+
+    unsigned char frame[STRIPE_FRAME];
+    put_be(frame, STRIPE_HEADER_SIZE + entry->length, UINT32_SIZE);
+    pack_header(&entry->header, frame + UINT32_SIZE);
+
+    if (job->method != LSBI) {
+        lsb_writer write = job->method == LSB1 ? lsb1_write : lsb4_write;
+        size_t     per   = job->method == LSB1 ? 8 : 2;
+        write_payload(bmp, 0, frame, STRIPE_FRAME, write, per);
+        write_payload(bmp, STRIPE_FRAME, part, entry->length, write, per);
+        return 0;
+    }
+
+    // LSBI chooses its inversion map from the whole stripe before storing any of it
+    uint64_t    span       = stats_begin();
+    uint64_t    changes[4] = {0}, totals[4] = {0};
+    lsbi_report chosen;
+    lsbi_histogram(bmp, 0, frame, STRIPE_FRAME, changes, totals);
+    lsbi_histogram(bmp, STRIPE_FRAME, part, entry->length, changes, totals);
+    uint8_t map = lsbi_choose_map(changes, totals, &chosen);
+    lsbi_store_map(bmp, map);
+    lsbi_write(bmp, 0, frame, STRIPE_FRAME, map);
+    lsbi_write(bmp, STRIPE_FRAME, part, entry->length, map);
+    stats_count(STATS_CHANNELS_MODIFIED, chosen.changes);
+    stats_end(STATS_LSB_EMBED, span);
+    return 0;
+}
+
+/* Embed one stripe and write its stego file, on a thread of its own */
+static void embed_task(size_t task, void *context) {
+    stripe_job   *job    = context;
+    stripe_entry *entry  = &job->entries[task];
+    bool          quiet  = printerr_quiet(true);
+    bool          mapped = job->options && job->options->mmap;
+    int           result = -1;
+    printerr_reset();
+
+    BMP_FILE *bmp = mapped ? map_bmp_into(entry->carrier, entry->output) : read_bmp(entry->carrier);
+    if (!bmp) {
+        printerr("Could not read BMP file %s\n", entry->carrier);
+    }
+    else {
+        bmp_use_alpha(bmp, job->options && job->options->alpha && job->method != LSBI);
+        result = store_stripe(job, entry, bmp);
+        if (result == 0 && !mapped && write_bmp(entry->output, bmp) != 0) {
+            printerr("Could not write BMP file %s\n", entry->output);
+            result = -1;
+        }
+        free_bmp(bmp);
+    }
+
+    task_status(entry, result);
+    printerr_quiet(quiet);
+}
+
+/**
+ * @brief Split the payload of a message file across several carriers and embed every part
+ * concurrently, without printing the outcome or exiting on errors
+ *
+ * The payload is prepared once, as for a single carrier, and split in parts proportional to
+ * the room of every carrier, read from their headers. Every carrier is read, embedded and
+ * written on a thread of the shared pool, so the stripes move through the disks in parallel.
+ *
+ * @param carriers Paths of the BMP files to embed the message into, at most STRIPE_MAX
+ * @param outputs Paths of the output BMP files, one per carrier
+ * @param count Number of carriers
+ * @param messageFile Path to the file containing the message to embed
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param options Embedding options, as for embed_file
+ * @param dataSize Pointer to store the size of the whole payload
+ *
+ * @return 0 on success, -1 on failure (no output file is left behind)
+ */
+int stripe_embed_files(const char *const  *carriers,
+                       const char *const  *outputs,
+                       size_t              count,
+                       const char         *messageFile,
+                       steg                method,
+                       encryption          a,
+                       mode                m,
+                       const char         *pass,
+                       const steg_options *options,
+                       size_t             *dataSize) {
+    if (method != LSB1 && method != LSB4 && method != LSBI) {
+        printerr("Invalid steganography method\n");
+        return -1;
+    }
+    if (count == 0 || count > STRIPE_MAX) {
+        printerr("A payload can be striped across 1 to %d carriers\n", STRIPE_MAX);
+        return -1;
+    }
+
+    stripe_job job = {.count = count, .method = method, .options = options, .fd = -1};
+    if (!(job.entries = calloc(count, sizeof(stripe_entry)))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; result == 0 && i < count; i++) {
+        stripe_entry *entry = &job.entries[i];
+        BMP_FILE      bmp;
+        entry->carrier = carriers[i];
+        entry->output  = outputs[i];
+        if (stat(carriers[i], &entry->carrierStat) != 0 ||
+            bmp_read_headers(carriers[i], &bmp) != 0) {
+            printerr("Could not read BMP file %s\n", carriers[i]);
+            result = -1;
+            continue;
+        }
+        bmp_use_alpha(&bmp, options && options->alpha && method != LSBI);
+        size_t capacity = embedding_capacity(&bmp, method);
+        if (capacity < STRIPE_FRAME) {
+            printerr("Carrier %s is too small to hold a stripe\n", carriers[i]);
+            result = -1;
+            continue;
+        }
+        entry->room = capacity - STRIPE_FRAME;
+    }
+
+    unsigned char *payload = NULL;
+    *dataSize              = 0;
+    if (result == 0)
+        result = check_outputs(&job);
+    if (result == 0 && !(payload = prepare_embedding_data(messageFile, dataSize, pass, a, m)))
+        result = -1;
+    if (result == 0)
+        result = plan_parts(&job, *dataSize);
+
+    if (result == 0) {
+        job.payload = payload;
+        parallel_tasks(count, embed_task, &job);
+        if ((result = report_failures(&job)) != 0)
+            remove_outputs(&job);
+    }
+    if (result != 0)
+        printerr("Error embedding data\n");
+
+    free(payload);
+    free(job.entries);
+    return result;
+}
+
+/* Open a carrier and read its stripe header, on a thread of its own */
+static void open_task(size_t task, void *context) {
+    stripe_job   *job    = context;
+    stripe_entry *entry  = &job->entries[task];
+    bool          quiet  = printerr_quiet(true);
+    int           result = -1;
+    size_t        size;
+    printerr_reset();
+
+    entry->bmp = job->options && job->options->mmap ? map_bmp(entry->carrier, 0)
+                                                    : open_bmp(entry->carrier);
+    if (!entry->bmp) {
+        printerr("Could not read BMP file: %s\n", entry->carrier);
+    }
+    else {
+        bmp_use_alpha(entry->bmp, job->options && job->options->alpha && job->method != LSBI);
+        result = steg_reader(entry->bmp, job->method, &entry->reader);
+        if (result == 0)
+            result = decode_size(entry->bmp, &entry->reader, &size);
+        // The rows of the whole stripe are loaded here, while the other carriers load theirs
+        if (result == 0 &&
+            (size < STRIPE_HEADER_SIZE ||
+             bmp_load_channels(entry->bmp, entry->reader.channels(UINT32_SIZE + size)) != 0)) {
+            printerr("No stripe found\n");
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        unsigned char packed[STRIPE_HEADER_SIZE];
+        entry->reader.read(&entry->reader, entry->bmp, UINT32_SIZE, packed, STRIPE_HEADER_SIZE);
+        entry->length = size - STRIPE_HEADER_SIZE;
+        if ((result = unpack_header(packed, &entry->header)) != 0)
+            printerr("No stripe found\n");
+    }
+
+    task_status(entry, result);
+    printerr_quiet(quiet);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const stripe_entry *first = a, *second = b;
+    return (first->header.index > second->header.index) -
+           (first->header.index < second->header.index);
+}
+
+/**
+ * @brief Put the stripes in order and check that they make up one whole payload
+ *
+ * @return 0 on success, -1 if a stripe is missing, repeated or belongs to another payload
+ */
+static int check_stripes(stripe_job *job) {
+    qsort(job->entries, job->count, sizeof(stripe_entry), compare_entries);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < job->count; i++) {
+        const stripe_header *header = &job->entries[i].header;
+        if (header->count != job->count) {
+            printerr("Expected %u stripes, %zu were given\n", header->count, job->count);
+            return -1;
+        }
+        if (header->index != i) {
+            printerr("Stripe %zu is missing, another one was given twice\n", i);
+            return -1;
+        }
+        if (header->total != job->entries[0].header.total || header->offset != offset) {
+            printerr("Stripes of different payloads were given\n");
+            return -1;
+        }
+        offset += job->entries[i].length;
+    }
+    if (offset != job->entries[0].header.total || offset < UINT32_SIZE) {
+        printerr("Stripes of different payloads were given\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Read payload bytes [offset, offset + count) from the stripes that hold them */
+static void read_span(const stripe_job *job, size_t offset, unsigned char *dst, size_t count) {
+    for (size_t i = 0; i < job->count; i++) {
+        const stripe_entry *entry = &job->entries[i];
+        size_t              begin = entry->header.offset > offset ? entry->header.offset : offset;
+        size_t              end   = entry->header.offset + entry->length;
+        if (end > offset + count)
+            end = offset + count;
+        if (begin < end)
+            read_payload(&entry->reader,
+                         entry->bmp,
+                         STRIPE_FRAME + begin - entry->header.offset,
+                         dst + begin - offset,
+                         end - begin);
+    }
+}
+
+/* Check the extension stored after the file data: a dot, then text up to the only null */
+static int check_extension(const char *extension, size_t length) {
+    if (length == 0 || length > EXTENSION_MAX || extension[0] != '.') {
+        printerr("File extension is not valid\n");
+        return -1;
+    }
+    if (strnlen(extension, length) != length - 1) {
+        printerr("File extension is not null-terminated\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode a part in chunks, checking its checksum. Plain payloads have the file data of
+ * every chunk written at its place in the output, encrypted ones are gathered in job->buffer
+ */
+static int read_part(const stripe_job *job, const stripe_entry *entry) {
+    size_t         chunkSize = entry->length < STREAM_CHUNK ? entry->length + 1 : STREAM_CHUNK;
+    unsigned char *chunk     = job->buffer ? NULL : malloc(chunkSize);
+    EVP_MD_CTX    *digest    = checksum_begin(&entry->header);
+    int            result    = digest && (job->buffer || chunk) ? 0 : -1;
+    if (digest && result != 0)
+        printerr("Memory allocation failed\n");
+
+    for (size_t done = 0; result == 0 && done < entry->length; done += STREAM_CHUNK) {
+        size_t         count  = entry->length - done < STREAM_CHUNK ? entry->length - done
+                                                                    : STREAM_CHUNK;
+        size_t         offset = entry->header.offset + done;
+        unsigned char *dst    = job->buffer ? job->buffer + offset : chunk;
+        read_payload(&entry->reader, entry->bmp, STRIPE_FRAME + done, dst, count);
+        if (EVP_DigestUpdate(digest, dst, count) != 1) {
+            printerr("Error computing the stripe checksum\n");
+            result = -1;
+        }
+        if (job->buffer || result != 0)
+            continue;
+
+        // File data sits between the size prefix and the extension
+        size_t begin = offset > UINT32_SIZE ? offset : UINT32_SIZE;
+        size_t end   = offset + count < UINT32_SIZE + job->fileSize ? offset + count
+                                                                    : UINT32_SIZE + job->fileSize;
+        if (begin >= end)
+            continue;
+        uint64_t span    = stats_begin();
+        ssize_t  written = pwrite(
+            job->fd, dst + begin - offset, end - begin, (off_t) (begin - UINT32_SIZE));
+        stats_count(STATS_BYTES_WRITTEN, end - begin);
+        stats_end(STATS_WRITE_OUTPUT, span);
+        if (written != (ssize_t) (end - begin)) {
+            printerr("Failed to write all data to output file\n");
+            result = -1;
+        }
+    }
+
+    uint32_t checksum;
+    if (digest && checksum_end(digest, &checksum) != 0)
+        result = -1;
+    else if (result == 0 && checksum != entry->header.checksum) {
+        printerr("Stripe checksum mismatch, the carrier is damaged\n");
+        result = -1;
+    }
+    free(chunk);
+    return result;
+}
+
+/* Decode the part of a stripe, on a thread of its own */
+static void part_task(size_t task, void *context) {
+    stripe_job *job   = context;
+    bool        quiet = printerr_quiet(true);
+    printerr_reset();
+    task_status(&job->entries[task], read_part(job, &job->entries[task]));
+    printerr_quiet(quiet);
+}
+
+/**
+ * @brief Output path: the output file name followed by the extension
+ *
+ * The output is truncated when opened while the carriers may still be read, so a path naming
+ * one of them is refused.
+ *
+ * @return The path, release it with free(), NULL on failure
+ */
+static char *output_path(const stripe_job *job, const char *outputFile, const char *extension) {
+    char *path = malloc(strlen(outputFile) + strlen(extension) + 1);
+    if (!path) {
+        printerr("Memory allocation failed\n");
+        return NULL;
+    }
+    strcpy(path, outputFile);
+    strcat(path, extension);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && is_carrier(job, &st)) {
+        printerr("Output file %s is one of the carriers\n", path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+/* Read the extension first, then have every stripe write its file data into the output */
+static int extract_plain(stripe_job *job, const char *outputFile, size_t total) {
+    unsigned char prefix[UINT32_SIZE];
+    char          extension[EXTENSION_MAX];
+    read_span(job, 0, prefix, UINT32_SIZE);
+    job->fileSize = get_be(prefix, UINT32_SIZE);
+
+    if (UINT32_SIZE + job->fileSize >= total) {
+        printerr("Size mismatch: read size too large\n");
+        return -1;
+    }
+    size_t length = total - UINT32_SIZE - job->fileSize;
+    if (length > EXTENSION_MAX) {
+        printerr("File extension is not null-terminated\n");
+        return -1;
+    }
+    read_span(job, UINT32_SIZE + job->fileSize, (unsigned char *) extension, length);
+    if (check_extension(extension, length) != 0)
+        return -1;
+
+    char *path = output_path(job, outputFile, extension);
+    if (!path)
+        return -1;
+    job->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (job->fd < 0 || ftruncate(job->fd, (off_t) job->fileSize) != 0) {
+        printerr("Failed to open output file %s\n", path);
+        if (job->fd >= 0)
+            remove(path);
+        free(path);
+        return -1;
+    }
+
+    parallel_tasks(job->count, part_task, job);
+    int result = report_failures(job);
+    if (close(job->fd) != 0 && result == 0) {
+        printerr("Failed to write all data to output file\n");
+        result = -1;
+    }
+    if (result != 0)
+        remove(path);
+    free(path);
+    return result;
+}
+
+/* Gather the ciphertext from every stripe, then decrypt it and write the output */
+static int extract_encrypted(stripe_job *job,
+                             const char *outputFile,
+                             size_t      total,
+                             const char *pass,
+                             encryption  a,
+                             mode        m) {
+    if (!(job->buffer = malloc(total))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    stats_alloc(total);
+    parallel_tasks(job->count, part_task, job);
+    if (report_failures(job) != 0)
+        return -1;
+    if (get_be(job->buffer, UINT32_SIZE) != total - UINT32_SIZE) {
+        printerr("Size mismatch: read size too large\n");
+        return -1;
+    }
+
+    size_t         plainSize;
+    unsigned char *plain = decrypt_data(
+        job->buffer + UINT32_SIZE, total - UINT32_SIZE, pass, a, m, &plainSize);
+    if (!plain) {
+        printerr("Error decrypting data\n");
+        return -1;
+    }
+
+    // Plaintext: size | data | extension
+    int    result   = -1;
+    size_t fileSize = plainSize < UINT32_SIZE ? 0 : get_be(plain, UINT32_SIZE);
+    char  *path     = NULL;
+    if (plainSize < UINT32_SIZE || UINT32_SIZE + fileSize >= plainSize)
+        printerr("Size mismatch: read size too large\n");
+    else if (check_extension((const char *) plain + UINT32_SIZE + fileSize,
+                             plainSize - UINT32_SIZE - fileSize) == 0 &&
+             (path = output_path(job, outputFile, (const char *) plain + UINT32_SIZE + fileSize)))
+        result = 0;
+
+    FILE *out = result == 0 ? fopen(path, "wb") : NULL;
+    if (result == 0 && !out) {
+        printerr("Failed to open output file %s\n", path);
+        result = -1;
+    }
+    if (out) {
+        uint64_t span = stats_begin();
+        if (fwrite(plain + UINT32_SIZE, 1, fileSize, out) != fileSize || fclose(out) != 0) {
+            printerr("Failed to write all data to output file\n");
+            remove(path);
+            result = -1;
+        }
+        stats_count(STATS_BYTES_WRITTEN, fileSize);
+        stats_end(STATS_WRITE_OUTPUT, span);
+    }
+
+    free(path);
+    free(plain);
+    return result;
+}
+
+/**
+ * @brief Reassemble a payload striped across several carriers and extract it into an output
+ * file, without printing the outcome or exiting on errors
+ *
+ * Every carrier is opened and has the rows of its stripe loaded on a thread of the shared pool,
+ * the carriers can be given in any order. The parts of a plain payload are then decoded
+ * concurrently and every one writes its file data at its own offset of the output. Encrypted
+ * payloads are gathered the same way into one buffer, they can only be decrypted as a whole.
+ *
+ * @param carriers Paths of the stego BMP files, every stripe of the payload once
+ * @param count Number of carriers
+ * @param outputFile Path of the output file, without the extension
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param pass Password to decrypt the data, NULL for plain payloads
+ * @param options Extraction options, as for extract_file
+ * @param dataSize Pointer to store the size of the whole payload
+ *
+ * @return 0 on success, -1 on failure (no output file is left behind)
+ */
+int stripe_extract_files(const char *const  *carriers,
+                         size_t              count,
+                         const char         *outputFile,
+                         steg                method,
+                         encryption          a,
+                         mode                m,
+                         const char         *pass,
+                         const steg_options *options,
+                         size_t             *dataSize) {
+    if (count == 0 || count > STRIPE_MAX) {
+        printerr("A payload can be striped across 1 to %d carriers\n", STRIPE_MAX);
+        return -1;
+    }
+
+    stripe_job job = {.count = count, .method = method, .options = options, .fd = -1};
+    if (!(job.entries = calloc(count, sizeof(stripe_entry)))) {
+        printerr("Memory allocation failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        job.entries[i].carrier = carriers[i];
+        stat(carriers[i], &job.entries[i].carrierStat);  // A missing carrier fails to open
+    }
+
+    *dataSize = 0;
+    parallel_tasks(count, open_task, &job);
+    int result = report_failures(&job);
+    if (result == 0)
+        result = check_stripes(&job);
+
+    if (result == 0) {
+        *dataSize = job.entries[0].header.total;
+        result    = pass ? extract_encrypted(&job, outputFile, *dataSize, pass, a, m)
+                         : extract_plain(&job, outputFile, *dataSize);
+    }
+    if (result != 0)
+        printerr("Error extracting data\n");
+
+    for (size_t i = 0; i < count; i++)
+        free_bmp(job.entries[i].bmp);
+    free(job.buffer);
+    free(job.entries);
+    return result;
+}
+
+/**
+ * @brief Embed a message striped across several carriers
+ *
+ * @param carriers Comma separated paths of the BMP files to embed the message into
+ * @param messageFile Path to the file containing the message to embed
+ * @param outputs Comma separated paths of the output BMP files, as many as carriers
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param pass Password to encrypt the data, NULL to embed it in plain
+ * @param options Embedding options, threads sets how many carriers are embedded at a time
+ */
+void stripe_embed(const char         *carriers,
+                  const char         *messageFile,
+                  const char         *outputs,
+                  steg                method,
+                  encryption          a,
+                  mode                m,
+                  const char         *pass,
+                  const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(1);
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
+        exit(1);
+
+    char        *carrierList = strdup(carriers);
+    char        *outputList  = strdup(outputs);
+    const char **carrierFiles = NULL, **outputFiles = NULL;
+    size_t       count = 0, outputCount = 0;
+    if (!carrierList || !outputList)
+        printerr("Memory allocation failed\n");
+    else if ((carrierFiles = split_list(carrierList, &count)) &&
+             (outputFiles = split_list(outputList, &outputCount)) && outputCount != count)
+        printerr("Expected %zu output files, %zu were given\n", count, outputCount);
+
+    size_t dataSize;
+    int    result = -1;
+    if (outputFiles && outputCount == count)
+        result = stripe_embed_files(carrierFiles,
+                                    outputFiles,
+                                    count,
+                                    messageFile,
+                                    method,
+                                    a,
+                                    m,
+                                    pass,
+                                    options,
+                                    &dataSize);
+    free(carrierFiles);
+    free(outputFiles);
+    free(carrierList);
+    if (result != 0) {
+        free(outputList);
+        exit(1);
+    }
+    key_cache_save();
+
+    char countStr[21], dataSizeStr[21];
+    snprintf(countStr, sizeof(countStr), "%zu", count);
+    snprintf(dataSizeStr, sizeof(dataSizeStr), "%zu", dataSize);
+    print_table("Successfully striped data across BMP files",
+                0xa6da95,
+                "Output files",
+                outputs,
+                "Stripes",
+                countStr,
+                "Stego Method",
+                steg_str[method],
+                "Size (bytes)",
+                dataSizeStr,
+                "Encryption Algorithm",
+                encryption_str[a],
+                "Enctryption Mode",
+                mode_str[m],
+                "Password",
+                pass,
+                NULL);
+    free(outputList);
+}
+
+/**
+ * @brief Extract a message striped across several carriers
+ *
+ * @param carriers Comma separated paths of the stego BMP files, in any order
+ * @param outputFile Path of the output file, without the extension
+ * @param method Steganography method to use
+ * @param a Encryption algorithm to use
+ * @param m Encryption mode to use
+ * @param pass Password to decrypt the data
+ * @param options Extraction options, threads sets how many carriers are read at a time
+ */
+void stripe_extract(const char         *carriers,
+                    const char         *outputFile,
+                    steg                method,
+                    encryption          a,
+                    mode                m,
+                    const char         *pass,
+                    const steg_options *options) {
+    if (options && steg_set_threads(options->threads) != 0)
+        exit(EXIT_FAILURE);
+    if (options && options->keyCache && key_cache_open(options->keyCache) != 0)
+        exit(EXIT_FAILURE);
+
+    char        *carrierList  = strdup(carriers);
+    const char **carrierFiles = NULL;
+    size_t       count        = 0;
+    if (!carrierList)
+        printerr("Memory allocation failed\n");
+    else
+        carrierFiles = split_list(carrierList, &count);
+
+    size_t dataSize;
+    int    result = -1;
+    if (carrierFiles)
+        result = stripe_extract_files(
+            carrierFiles, count, outputFile, method, a, m, pass, options, &dataSize);
+    free(carrierFiles);
+    free(carrierList);
+    if (result != 0)
+        exit(EXIT_FAILURE);
+    key_cache_save();
+
+    char countStr[21], dataSizeStr[21];
+    snprintf(countStr, sizeof(countStr), "%zu", count);
+    snprintf(dataSizeStr, sizeof(dataSizeStr), "%zu", dataSize);
+    print_table("Successfully extracted striped data from BMP files",
+                0xa6da95,
+                "Output file",
+                outputFile,
+                "Stripes",
+                countStr,
+                "Steganography method",
+                steg_str[method],
+                "Size (bytes)",
+                dataSizeStr,
+                "Encryption Algorithm",
+                encryption_str[a],
+                "Encryption Mode",
+                mode_str[m],
+                "Password",
+                pass ? pass : "None",
+                NULL);
+}
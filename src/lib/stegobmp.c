@@ -0,0 +1,438 @@
+#include "stegobmp.h"
+
+#include "embedding.h"
+#include "extraction.h"
+#include "quality.h"
+
+#define DEFAULT_EXTENSION ".txt"  // Extension stored when none is given
+
+// The public enumerations mirror the internal ones
+_Static_assert((int) STEGOBMP_LSB1 == LSB1 && (int) STEGOBMP_LSBI == LSBI, "steg values");
+_Static_assert((int) STEGOBMP_AES128 == AES128 && (int) STEGOBMP_3DES == DES3 &&
+                   (int) STEGOBMP_CHACHA20 == CHACHA20,
+               "cipher values");
+_Static_assert((int) STEGOBMP_ECB == ECB && (int) STEGOBMP_OFB == OFB &&
+                   (int) STEGOBMP_GCM == GCM && (int) STEGOBMP_POLY1305 == POLY1305,
+               "mode values");
+_Static_assert(STEGOBMP_EXTENSION_MAX == EXTENSION_MAX, "extension length");
+_Static_assert(STEGOBMP_HEADER_SIZE ==
+                   sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 3 * sizeof(uint32_t),
+               "header size");  // The channel masks of 32-bit files included
+_Static_assert((int) STEGOBMP_STAGE_WRITE_OUTPUT == STATS_WRITE_OUTPUT, "stage values");
+_Static_assert((int) STEGOBMP_STAGES == STATS_STAGES, "stage count");
+_Static_assert((int) STEGOBMP_KEYS_REUSED == STATS_KEYS_REUSED, "counter values");
+_Static_assert(sizeof(stegobmp_stats) == sizeof(stats_snapshot), "stats layout");
+_Static_assert(STEGOBMP_CHANNELS == QUALITY_CHANNELS, "channel count");
+_Static_assert(sizeof(stegobmp_quality) == sizeof(image_quality), "quality layout");
+
+struct stegobmp_ctx
+{
+    steg            method;
+    encryption      a;
+    mode            m;
+    char           *pass;  /* NULL for plain payloads */
+    bool            alpha; /* LSB1 and LSB4 use the 4th channel of 32-bit carriers too */
+    stegobmp_status status;
+    char            error[PRINTERR_MAX]; /* First error of the last call that failed */
+};
+
+static const char *status_str[] = {"Success",
+                                   "Invalid argument",
+                                   "Memory allocation failed",
+                                   "The carrier is not a supported BMP file",
+                                   "The payload does not fit in the carrier",
+                                   "The carrier holds no payload for this method",
+                                   "Encryption or decryption failed",
+                                   "Reading or writing a file descriptor failed"};
+
+/* Start a call: errors are recorded for the context instead of being printed */
+static bool call_begin(stegobmp_ctx *ctx) {
+    ctx->error[0] = '\0';
+    printerr_reset();
+    return printerr_quiet(true);
+}
+
+/* End a call: keep its outcome in the context and restore the error printing of the thread */
+static stegobmp_status call_end(stegobmp_ctx *ctx, stegobmp_status status, bool quiet) {
+    ctx->status = status;
+    if (status != STEGOBMP_OK)
+        snprintf(ctx->error, sizeof(ctx->error), "%s", printerr_first());
+    printerr_quiet(quiet);
+    return status;
+}
+
+/* Parse a BMP held in memory, its pixel plane points into the buffer */
+static stegobmp_status open_carrier(const stegobmp_ctx *ctx,
+                                    const uint8_t      *carrier,
+                                    size_t              carrierSize,
+                                    BMP_FILE          **bmp) {
+    *bmp = bmp_parse_from_memory(carrier, carrierSize, true);
+    if (*bmp)
+        bmp_use_alpha(*bmp, ctx->alpha && ctx->method != LSBI);
+    return *bmp ? STEGOBMP_OK : STEGOBMP_EFORMAT;
+}
+
+/* Whether two images match in size and channels, as compare_bmp requires */
+static bool same_layout(const BMP_FILE *first, const BMP_FILE *second) {
+    return bmp_width(first) == bmp_width(second) && bmp_height(first) == bmp_height(second) &&
+           first->channels == second->channels;
+}
+
+/**
+ * @brief Create a context
+ *
+ * @param method Steganography method used by the context
+ *
+ * @return The context, NULL for an invalid method or if it can not be allocated
+ */
+stegobmp_ctx *stegobmp_new(stegobmp_method method) {
+    if (method < STEGOBMP_LSB1 || method > STEGOBMP_LSBI)
+        return NULL;
+
+    stegobmp_ctx *ctx = calloc(1, sizeof(stegobmp_ctx));
+    if (ctx)
+        ctx->method = (steg) method;
+    return ctx;
+}
+
+/**
+ * @brief Free a context, its password is wiped
+ *
+ * @param ctx Context to free, may be NULL
+ */
+void stegobmp_destroy(stegobmp_ctx *ctx) {
+    if (!ctx)
+        return;
+    if (ctx->pass)
+        OPENSSL_cleanse(ctx->pass, strlen(ctx->pass));
+    free(ctx->pass);
+    free(ctx);
+}
+
+/**
+ * @brief Change the steganography method of a context
+ */
+stegobmp_status stegobmp_set_method(stegobmp_ctx *ctx, stegobmp_method method) {
+    if (!ctx || method < STEGOBMP_LSB1 || method > STEGOBMP_LSBI)
+        return STEGOBMP_EINVAL;
+    ctx->method = (steg) method;
+    return STEGOBMP_OK;
+}
+
+/**
+ * @brief Set the password encrypting the payloads of a context, with the same defaults as the
+ * command line
+ *
+ * @param ctx Context
+ * @param pass Password, copied, NULL to embed and extract plain payloads
+ * @param cipher Encryption algorithm, STEGOBMP_CIPHER_DEFAULT for AES128 (ChaCha20 with
+ * STEGOBMP_POLY1305)
+ * @param cipherMode Encryption mode, STEGOBMP_MODE_DEFAULT for CBC (Poly1305 with
+ * STEGOBMP_CHACHA20)
+ *
+ * @return STEGOBMP_OK, STEGOBMP_EINVAL (also for GCM with other than AES, or ChaCha20 with other
+ * than Poly1305) or STEGOBMP_ENOMEM
+ */
+stegobmp_status stegobmp_set_password(stegobmp_ctx   *ctx,
+                                      const char     *pass,
+                                      stegobmp_cipher cipher,
+                                      stegobmp_mode   cipherMode) {
+    if (!ctx || cipher < STEGOBMP_CIPHER_DEFAULT || cipher > STEGOBMP_CHACHA20 ||
+        cipherMode < STEGOBMP_MODE_DEFAULT || cipherMode > STEGOBMP_POLY1305)
+        return STEGOBMP_EINVAL;
+
+    encryption a = cipher ? (encryption) cipher : default_encryption((mode) cipherMode);
+    mode       m = cipherMode ? (mode) cipherMode : default_mode(a);
+    if (pass && !get_cipher(a, m))
+        return STEGOBMP_EINVAL;
+
+    char *copy = pass ? strdup(pass) : NULL;
+    if (pass && !copy)
+        return STEGOBMP_ENOMEM;
+
+    if (ctx->pass)
+        OPENSSL_cleanse(ctx->pass, strlen(ctx->pass));
+    free(ctx->pass);
+    ctx->pass = copy;
+    ctx->a    = pass ? a : ENC_NONE;
+    ctx->m    = pass ? m : MODE_NONE;
+    return STEGOBMP_OK;
+}
+
+/**
+ * @brief Choose whether LSB1 and LSB4 also hide payload bits in the alpha (or X) channel of
+ * 32-bit carriers, a third more room. Off by default, the extraction has to use the same setting.
+ * LSBI and 24-bit carriers are not affected.
+ *
+ * @return STEGOBMP_OK, or STEGOBMP_EINVAL without a context
+ */
+stegobmp_status stegobmp_set_alpha(stegobmp_ctx *ctx, int alpha) {
+    if (!ctx)
+        return STEGOBMP_EINVAL;
+    ctx->alpha = alpha != 0;
+    return STEGOBMP_OK;
+}
+
+/**
+ * @brief Set the number of threads sharing the work of each call, for the whole process
+ *
+ * May be called while other threads are inside stegobmp_embed or stegobmp_extract: calls in
+ * progress finish on the threads they started with.
+ *
+ * @param threads Number of threads, 0 for one per online CPU, 1 (the default) to stay single
+ * threaded
+ *
+ * @return STEGOBMP_OK, or STEGOBMP_ENOMEM if the threads could not be started
+ */
+stegobmp_status stegobmp_set_threads(size_t threads) {
+    bool quiet  = printerr_quiet(true);
+    int  result = steg_set_threads(threads);
+    printerr_quiet(quiet);
+    return result == 0 ? STEGOBMP_OK : STEGOBMP_ENOMEM;
+}
+
+/**
+ * @brief Embed a payload into a carrier, both held in memory
+ *
+ * @param ctx Context giving the method and the password
+ * @param carrier BMP file contents, left untouched: the result is a copy of it holding the
+ * payload
+ * @param carrierSize Size of the BMP file
+ * @param payload Payload to embed
+ * @param payloadSize Size of the payload
+ * @param extension Extension stored after the payload, starting with a dot (".txt" when NULL)
+ * @param stego Where to store the resulting BMP file, to be released with stegobmp_free
+ * @param stegoSize Where to store the size of the resulting BMP file
+ *
+ * @return STEGOBMP_OK on success, an error code otherwise (nothing is stored)
+ */
+stegobmp_status stegobmp_embed(stegobmp_ctx  *ctx,
+                               const uint8_t *carrier,
+                               size_t         carrierSize,
+                               const uint8_t *payload,
+                               size_t         payloadSize,
+                               const char    *extension,
+                               uint8_t      **stego,
+                               size_t        *stegoSize) {
+    if (!ctx || !carrier || (!payload && payloadSize) || !stego || !stegoSize)
+        return STEGOBMP_EINVAL;
+    if (!extension)
+        extension = DEFAULT_EXTENSION;
+    if (extension[0] != '.' || strlen(extension) >= STEGOBMP_EXTENSION_MAX)
+        return STEGOBMP_EINVAL;
+
+    uint8_t *output = malloc(carrierSize ? carrierSize : 1);
+    if (!output)
+        return STEGOBMP_ENOMEM;
+    memcpy(output, carrier, carrierSize);
+
+    // The output starts as a verbatim copy of the carrier and the payload is embedded in place
+    bool            quiet  = call_begin(ctx);
+    BMP_FILE       *bmp    = NULL;
+    stegobmp_status status = open_carrier(ctx, output, carrierSize, &bmp);
+    if (status != STEGOBMP_OK) {
+        free(output);
+        return call_end(ctx, status, quiet);
+    }
+
+    size_t dataSize;
+    if (embed_buffer(bmp,
+                     ctx->method,
+                     payload,
+                     payloadSize,
+                     extension,
+                     ctx->pass,
+                     ctx->a,
+                     ctx->m,
+                     &dataSize,
+                     NULL) != 0) {
+        // Tell a payload that does not fit from a cipher or allocation failure
+        size_t needed = payload_size(payloadSize, extension, ctx->pass, ctx->a, ctx->m);
+        if (payloadSize > UINT32_MAX || needed > embedding_capacity(bmp, ctx->method))
+            status = STEGOBMP_ECAPACITY;
+        else
+            status = ctx->pass ? STEGOBMP_ECRYPTO : STEGOBMP_ENOMEM;
+        free(output);
+    }
+    else {
+        *stego     = output;
+        *stegoSize = carrierSize;
+    }
+
+    free_bmp(bmp);
+    return call_end(ctx, status, quiet);
+}
+
+/**
+ * @brief Extract the payload hidden in a carrier held in memory
+ *
+ * Only the part of the carrier holding the payload is decoded, nothing else is read or copied.
+ *
+ * @param ctx Context giving the method and the password
+ * @param stego BMP file contents
+ * @param stegoSize Size of the BMP file
+ * @param payload Where to store the payload, to be released with stegobmp_free
+ * @param payloadSize Where to store the size of the payload
+ * @param extension Where to store the extension of the payload, null terminated
+ *
+ * @return STEGOBMP_OK on success, an error code otherwise (nothing is stored)
+ */
+stegobmp_status stegobmp_extract(stegobmp_ctx  *ctx,
+                                 const uint8_t *stego,
+                                 size_t         stegoSize,
+                                 uint8_t      **payload,
+                                 size_t        *payloadSize,
+                                 char           extension[STEGOBMP_EXTENSION_MAX]) {
+    if (!ctx || !stego || !payload || !payloadSize || !extension)
+        return STEGOBMP_EINVAL;
+
+    bool            quiet  = call_begin(ctx);
+    BMP_FILE       *bmp    = NULL;
+    stegobmp_status status = open_carrier(ctx, stego, stegoSize, &bmp);
+    if (status != STEGOBMP_OK)
+        return call_end(ctx, status, quiet);
+
+    lsb_reader reader;
+    size_t     dataSize;
+    if (steg_reader(bmp, ctx->method, &reader) != 0 || decode_size(bmp, &reader, &dataSize) != 0)
+        status = STEGOBMP_ENOTFOUND;
+    else if (extract_payload_memory(bmp,
+                                    &reader,
+                                    dataSize,
+                                    ctx->pass,
+                                    ctx->a,
+                                    ctx->m,
+                                    payload,
+                                    payloadSize,
+                                    extension) != 0)
+        status = ctx->pass ? STEGOBMP_ECRYPTO : STEGOBMP_ENOTFOUND;
+
+    free_bmp(bmp);
+    return call_end(ctx, status, quiet);
+}
+
+/**
+ * @brief Room a carrier leaves for a payload under the method and password of a context, known
+ * from its headers alone
+ *
+ * @param ctx Context giving the method and the password (whose cipher may pad the payload)
+ * @param header First bytes of the carrier, at least STEGOBMP_HEADER_SIZE
+ * @param headerSize Bytes held by header
+ * @param carrierSize Size of the whole carrier file
+ * @param capacity Where to store the largest payload size plus extension length (null
+ * terminator included) that fits
+ *
+ * @return STEGOBMP_OK on success, an error code otherwise (nothing is stored)
+ */
+stegobmp_status stegobmp_capacity(stegobmp_ctx  *ctx,
+                                  const uint8_t *header,
+                                  size_t         headerSize,
+                                  size_t         carrierSize,
+                                  size_t        *capacity) {
+    if (!ctx || !header || !capacity)
+        return STEGOBMP_EINVAL;
+
+    bool     quiet = call_begin(ctx);
+    BMP_FILE bmp;
+    if (bmp_parse_headers(header, headerSize, carrierSize, &bmp) != 0)
+        return call_end(ctx, STEGOBMP_EFORMAT, quiet);
+    bmp_use_alpha(&bmp, ctx->alpha && ctx->method != LSBI);
+
+    *capacity = payload_room(embedding_capacity(&bmp, ctx->method), ctx->pass, ctx->a, ctx->m);
+    return call_end(ctx, STEGOBMP_OK, quiet);
+}
+
+/**
+ * @brief Measure the distortion of a stego image against its cover, both held in memory: MSE,
+ * PSNR, SSIM and changed LSBs, overall and for each color channel
+ *
+ * @param ctx Context, its alpha setting (for LSB1 and LSB4) adds the alpha channel of 32-bit
+ * images
+ * @param cover Original BMP file contents
+ * @param coverSize Size of the original BMP file
+ * @param stego Stego BMP file contents, of the same size and channels as the cover
+ * @param stegoSize Size of the stego BMP file
+ * @param quality Where to store the measures
+ *
+ * @return STEGOBMP_OK on success, STEGOBMP_EINVAL if the images do not match, another error code
+ * otherwise (nothing is stored)
+ */
+stegobmp_status stegobmp_compare(stegobmp_ctx     *ctx,
+                                 const uint8_t    *cover,
+                                 size_t            coverSize,
+                                 const uint8_t    *stego,
+                                 size_t            stegoSize,
+                                 stegobmp_quality *quality) {
+    if (!ctx || !cover || !stego || !quality)
+        return STEGOBMP_EINVAL;
+
+    bool            quiet    = call_begin(ctx);
+    BMP_FILE       *coverBmp = NULL, *stegoBmp = NULL;
+    stegobmp_status status   = open_carrier(ctx, cover, coverSize, &coverBmp);
+    if (status == STEGOBMP_OK)
+        status = open_carrier(ctx, stego, stegoSize, &stegoBmp);
+
+    image_quality measures;
+    if (status == STEGOBMP_OK && compare_bmp(coverBmp, stegoBmp, &measures) != 0)  // Or no memory
+        status = same_layout(coverBmp, stegoBmp) ? STEGOBMP_ENOMEM : STEGOBMP_EINVAL;
+    if (status == STEGOBMP_OK)
+        memcpy(quality, &measures, sizeof(measures));
+
+    if (stegoBmp)
+        free_bmp(stegoBmp);
+    if (coverBmp)
+        free_bmp(coverBmp);
+    return call_end(ctx, status, quiet);
+}
+
+/**
+ * @brief Release a buffer returned by the library
+ */
+void stegobmp_free(void *buffer) {
+    free(buffer);
+}
+
+/**
+ * @brief Turn the timing of every stage and the counters on or off, for the whole process
+ *
+ * Disabled (the default), they cost a load and a branch per stage.
+ */
+void stegobmp_stats_enable(int enable) {
+    stats_enable(enable != 0);
+}
+
+/**
+ * @brief Clear the timings and counters recorded so far
+ */
+void stegobmp_stats_reset(void) {
+    stats_reset();
+}
+
+/**
+ * @brief Copy the timings (in nanoseconds) and counters recorded since the last reset
+ */
+void stegobmp_stats_get(stegobmp_stats *stats) {
+    stats_snapshot snapshot;
+    if (!stats)
+        return;
+    stats_get(&snapshot);
+    memcpy(stats, &snapshot, sizeof(snapshot));
+}
+
+/**
+ * @brief Description of a status code
+ */
+const char *stegobmp_strerror(stegobmp_status status) {
+    size_t index = (size_t) -(int) status;
+    return index < sizeof(status_str) / sizeof(*status_str) ? status_str[index] : "Unknown error";
+}
+
+/**
+ * @brief Description of the last failure of a context, the first error met by the call when
+ * there is one
+ */
+const char *stegobmp_last_error(const stegobmp_ctx *ctx) {
+    if (!ctx)
+        return stegobmp_strerror(STEGOBMP_EINVAL);
+    return ctx->error[0] ? ctx->error : stegobmp_strerror(ctx->status);
+}
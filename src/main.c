@@ -1,6 +1,26 @@
-#include "embedding.h"
-#include "extraction.h"
-#include "parse_args.h"
+#include "batch.h"
+#include "carrier_index.h"
+#include "crack.h"
+#include "detect.h"
+#include "quality.h"
+#include "serve.h"
+#include "stats.h"
+#include "steganalysis.h"
+#include "stripe.h"
+
+static const char *stats_file; /* Where the --stats summary goes, "-" for stdout */
+
+/* Print the --stats summary, also when the action exits on a failure */
+static void print_stats(void) {
+    stats_snapshot snapshot;
+    stats_get(&snapshot);
+
+    FILE *out = strcmp(stats_file, "-") == 0 ? stdout : fopen(stats_file, "w");
+    if (!out || stats_json(out, &snapshot) != 0)
+        printerr("Could not write stats to %s\n", stats_file);
+    if (out && out != stdout)
+        fclose(out);
+}
 
 int main(const int argc, const char* argv[]) {
     args args;
@@ -16,9 +36,23 @@ int main(const int argc, const char* argv[]) {
             - a
             - m
             - pass
+            - manifest
+            - results
+            - socket
+            - stats
+            - wordlist
+            - stego
+            - stripe
+            - options
     */
     parse_args(argc, argv, &args);
 
+    if (args.stats) {
+        stats_file = args.stats;
+        stats_enable(true);
+        atexit(print_stats);
+    }
+
     /**
      * @todo preguntar y saber todo el tema de que hacer con la extension y el directory de las
      * cosas porque el ejemplo muestra que le mandan "file.txt"
@@ -35,11 +69,61 @@ int main(const int argc, const char* argv[]) {
      *
      */
 
-    if (args.action == EMBED) {
-        embed(args.p, args.in, args.out, args.steg, args.a, args.m, args.pass);
+    char *carrier = NULL;
+    if (args.autoCarrier) {
+        carrier = auto_carrier(
+            args.options.carrierIndex, args.in, args.steg, args.pass, args.a, args.m);
+        if (!carrier)
+            return 1;
+        print_table("Carrier picked from the index", 0xa6da95, "Carrier", carrier, NULL);
+        args.p = carrier;
+    }
+
+    if (args.socket && args.action != SERVE) {
+        const char *message = args.action == EMBED ? args.in : NULL;
+        int         result  = serve_client(
+            args.socket, args.p, message, args.out, args.steg, args.a, args.m, args.pass);
+        free(carrier);
+        return result == 0 ? 0 : 1;
+    }
+
+    if (args.stripe && args.action == EMBED) {
+        stripe_embed(
+            args.p, args.in, args.out, args.steg, args.a, args.m, args.pass, &args.options);
+    }
+    else if (args.stripe && args.action == EXTRACT) {
+        stripe_extract(args.p, args.out, args.steg, args.a, args.m, args.pass, &args.options);
+    }
+    else if (args.action == EMBED) {
+        embed(args.p, args.in, args.out, args.steg, args.a, args.m, args.pass, &args.options);
+        free(carrier);
     }
     else if (args.action == EXTRACT) {
-        extract(args.p, args.out, args.steg, args.a, args.m, args.pass);
+        extract(args.p, args.out, args.steg, args.a, args.m, args.pass, &args.options);
+    }
+    else if (args.action == BATCH) {
+        return batch(args.manifest, args.results, &args.options) == 0 ? 0 : 1;
+    }
+    else if (args.action == INDEX) {
+        return carrier_index_build(args.p, args.options.carrierIndex, &args.options) == 0 ? 0 : 1;
+    }
+    else if (args.action == CAPACITY) {
+        return capacity(args.p, args.results, &args.options) == 0 ? 0 : 1;
+    }
+    else if (args.action == CRACK) {
+        crack(args.p, args.wordlist, args.steg, args.a, args.m, args.out, &args.options);
+    }
+    else if (args.action == DETECT) {
+        detect(args.p, &args.options);
+    }
+    else if (args.action == ANALYZE) {
+        return analyze(args.p, args.results, &args.options) == 0 ? 0 : 1;
+    }
+    else if (args.action == COMPARE) {
+        return compare(args.p, args.stego, args.results, &args.options) == 0 ? 0 : 1;
+    }
+    else if (args.action == SERVE) {
+        return serve(args.socket, &args.options) == 0 ? 0 : 1;
     }
 
     return 0;
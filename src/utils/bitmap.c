@@ -1,28 +1,233 @@
 #include "bitmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HEADERS_SIZE (sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
+#define MASKS_SIZE (3 * sizeof(uint32_t))  // Red, green and blue masks after the info header
+#define BMP_TILE_CHANNELS (512 * 3)        // Channels gathered at a time by bmp_visit_channels
+
 /**
- * @brief Read a BMP file and store it in a BMP_FILE structure
+ * @brief Allocate an aligned pixel plane of the given size
  *
- * @param filename Path to the BMP file
+ * Planes of at least one huge page are aligned to it and advised as huge page backed, which
+ * cuts the page faults taken while the rows are read in by a factor of 512.
  *
- * @return BMP_FILE structure containing the BMP file data
+ * @return Pointer to the plane or NULL on failure, release it with free()
  */
-BMP_FILE *read_bmp(const char *filename) {
-    FILE     *filePtr;  // File pointer
-    BMP_FILE *bmp;      // BMP file structure where the data will be stored
-    uint32_t  i;        // Loop counter
+static uint8_t *alloc_plane(size_t planeSize) {
+    void  *plane     = NULL;
+    size_t alignment = planeSize >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : BMP_PLANE_ALIGN;
+
+    if (posix_memalign(&plane, alignment, planeSize ? planeSize : 1) != 0)
+        return NULL;
+    stats_alloc(planeSize);
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE)
+        madvise(plane, planeSize & ~((size_t) HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+#endif
+    return plane;
+}
+
+/**
+ * @brief Check that the headers describe a BMP this tool can work with: 24-bit BGR or 32-bit BGRA
+ * (or BGRX) pixels, uncompressed, with a BITMAPINFOHEADER up to a BITMAPV5HEADER
+ *
+ * @param bmp BMP file structure holding the file and info headers
+ * @param extra Header bytes following the info header, where the channel masks are
+ * @param extraSize Bytes held by extra
+ *
+ * @return 0 if the format is supported, -1 otherwise
+ */
+static int check_headers(const BMP_FILE *bmp, const uint8_t *extra, size_t extraSize) {
+    const BITMAPINFOHEADER *info = &bmp->infoHeader;
+
+    // Verify that this is a BMP file by checking the magic number
+    if (bmp->fileHeader.bfType != BF_TYPE) {
+        printerr("Not a valid BMP file, magic number mismatch.\n");
+        return -1;
+    }
+
+    // BITMAPINFOHEADER, its V2 and V3 extensions (masks), BITMAPV4HEADER and BITMAPV5HEADER
+    if (info->biSize != 40 && info->biSize != 52 && info->biSize != 56 && info->biSize != 108 &&
+        info->biSize != 124) {
+        printerr("Unsupported BMP format: unknown info header size %u.\n", info->biSize);
+        return -1;
+    }
+
+    if (bmp->fileHeader.bfOffBits < sizeof(BITMAPFILEHEADER) + info->biSize) {
+        printerr("Not a valid BMP file, pixel data overlaps the headers.\n");
+        return -1;
+    }
+
+    if (info->biBitCount != 24 && info->biBitCount != 32) {
+        printerr("Unsupported BMP format: only 24-bit and 32-bit BMP files are supported.\n");
+        return -1;
+    }
+
+    // Masks are only allowed on 32-bit files, and only when they describe the BGRA layout
+    bool masked = info->biCompression == BI_BITFIELDS || info->biCompression == BI_ALPHABITFIELDS;
+    if (info->biCompression != BI_RGB && !(masked && info->biBitCount == 32)) {
+        printerr("BMP file is compressed, only uncompressed BMP files are supported.\n");
+        return -1;
+    }
+    if (masked) {
+        uint32_t masks[3];
+        if (extraSize < MASKS_SIZE) {
+            printerr("Reading BMP channel masks.\n");
+            return -1;
+        }
+        memcpy(masks, extra, MASKS_SIZE);
+        if (masks[0] != 0x00FF0000 || masks[1] != 0x0000FF00 || masks[2] != 0x000000FF) {
+            printerr("Unsupported BMP format: 32-bit files have to be stored as BGRA.\n");
+            return -1;
+        }
+    }
+
+    if (info->biWidth < 0 || info->biHeight == INT32_MIN) {
+        printerr("Not a valid BMP file, invalid dimensions.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Layout of the pixel plane described by checked headers, with the payload in B, G and R */
+static void set_layout(BMP_FILE *bmp) {
+    bmp->pixelSize = bmp->infoHeader.biBitCount / 8;
+    bmp->channels  = 3;
+    bmp->stride    = BMP_ROW_SIZE(bmp->infoHeader.biWidth, bmp->pixelSize);
+}
+
+/**
+ * @brief Choose whether the alpha (or X) channel of a 32-bit BMP carries payload too, 24-bit
+ * files are left as they are. The default is B, G and R only.
+ */
+void bmp_use_alpha(BMP_FILE *bmp, bool alpha) {
+    bmp->channels = alpha ? bmp->pixelSize : 3;
+}
+
+/* Gather the B, G and R channels of BGRX pixels into 3-byte ones, 4 bytes are stored for each
+ * pixel so the tile needs one spare byte */
+static void gather_bgr(const uint8_t *pixels, uint8_t *tile, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t pixel;
+        memcpy(&pixel, pixels + i * 4, sizeof(pixel));
+        memcpy(tile + i * 3, &pixel, sizeof(pixel));
+    }
+}
+
+/* Scatter 3-byte pixels back into BGRX ones, leaving the X channels as they are */
+static void scatter_bgr(uint8_t *pixels, const uint8_t *tile, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t pixel, bgr;
+        memcpy(&pixel, pixels + i * 4, sizeof(pixel));
+        memcpy(&bgr, tile + i * 3, sizeof(bgr));
+        pixel = (pixel & 0xFF000000) | (bgr & 0x00FFFFFF);
+        memcpy(pixels + i * 4, &pixel, sizeof(pixel));
+    }
+}
+
+/**
+ * @brief Hand the channels [k, end) of a row, counting only those carrying payload, to fn as
+ * runs of contiguous channels
+ *
+ * A row whose pixels carry payload in every channel is handed over as it is. The B, G and R
+ * channels of 32-bit pixels whose X channel carries nothing are gathered into a tile at a time
+ * instead, and when store is set the channels of [k, end) are scattered back: the other channels
+ * of the first and last pixels may belong to the band of another thread and are not written.
+ *
+ * @param bmp BMP file structure
+ * @param row Row, numbered bottom-up
+ * @param k First channel of the row
+ * @param end Channel after the last one
+ * @param store Whether fn modifies the channels
+ * @param fn Called with each run and the range of it to work on
+ * @param context Passed to fn
+ */
+void bmp_visit_channels(const BMP_FILE *bmp,
+                        size_t          row,
+                        size_t          k,
+                        size_t          end,
+                        bool            store,
+                        bmp_run_fn      fn,
+                        void           *context) {
+    uint8_t *pixels = bmp_row(bmp, row);
+    if (bmp->channels == bmp->pixelSize) {
+        fn(pixels, k, end, context);
+        return;
+    }
+
+    uint8_t tile[BMP_TILE_CHANNELS + 1];
+    for (size_t first = k - k % 3; first < end; first += BMP_TILE_CHANNELS) {
+        uint8_t *tilePixels = pixels + first / 3 * 4;
+        size_t   from       = k > first ? k - first : 0;
+        size_t   to         = end - first < BMP_TILE_CHANNELS ? end - first : BMP_TILE_CHANNELS;
+        size_t   count      = (to + 2) / 3;  // Pixels holding channels [0, to) of the tile
+
+        gather_bgr(tilePixels, tile, count);
+        fn(tile, from, to, context);
+        if (!store)
+            continue;
+
+        // Whole pixels go back at once, the channels of split ones one by one
+        size_t whole = (from + 2) / 3, wholeEnd = to / 3;
+        for (size_t c = from; c < to && c < whole * 3; c++)
+            tilePixels[c / 3 * 4 + c % 3] = tile[c];
+        if (whole < wholeEnd)
+            scatter_bgr(tilePixels + whole * 4, tile + whole * 3, wholeEnd - whole);
+        for (size_t c = wholeEnd > whole ? wholeEnd * 3 : whole * 3; c < to; c++)
+            tilePixels[c / 3 * 4 + c % 3] = tile[c];
+    }
+}
+
+/**
+ * @brief Build the name write_bmp uses for an output file, adding ".bmp" if not present
+ *
+ * @return The name to use, either filename itself or a new string the caller has to free
+ */
+char *bmp_output_filename(const char *filename) {
+    const char *extension = ".bmp";
+    char       *name;
+
+    if (strstr(filename, extension) != NULL)
+        return (char *) filename;
+
+    // Allocate space for the new filename with .bmp extension
+    name = malloc(strlen(filename) + strlen(extension) + 1);
+    if (name == NULL) {
+        printerr("Memory allocation for filename\n");
+        return NULL;
+    }
+    // Append ".bmp" to the filename
+    strcpy(name, filename);
+    strcat(name, extension);
+    return name;
+}
+
+/**
+ * @brief Read the headers of a BMP from a stream, pixel rows are loaded on demand with
+ * bmp_load_rows
+ *
+ * @param filePtr Stream positioned at the start of the BMP (a file, or a buffer opened with
+ * fmemopen), owned by the returned structure and closed on failure
+ *
+ * @return BMP_FILE structure with no rows loaded yet, release it with free_bmp
+ */
+BMP_FILE *open_bmp_stream(FILE *filePtr) {
+    BMP_FILE *bmp;  // BMP file structure where the data will be stored
+    uint64_t  span = stats_begin();
 
     // Allocate memory for BMP_FILE structure
     bmp = (BMP_FILE *) malloc(sizeof(BMP_FILE));
     if (!bmp) {
         printerr("Memory allocation for BMP_FILE failed\n");
-        return NULL;
-    }
-
-    // Open the file in binary mode
-    filePtr = fopen(filename, "rb");
-    if (filePtr == NULL) {
-        printerr("Opening BMP file\n");
-        free(bmp);
+        fclose(filePtr);
         return NULL;
     }
 
@@ -34,90 +239,228 @@ BMP_FILE *read_bmp(const char *filename) {
         return NULL;
     }
 
-    // Verify that this is a BMP file by checking the magic number
-    if (bmp->fileHeader.bfType != BF_TYPE) {
-        printerr("Not a valid BMP file, magic number mismatch.\n");
+    // Read the bitmap info header (DIB header)
+    if (fread(&bmp->infoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr) != 1) {
+        printerr("Reading BMP info header.\n");
         fclose(filePtr);
         free(bmp);
         return NULL;
     }
 
-    // Read the bitmap info header (DIB header)
-    if (fread(&bmp->infoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr) != 1) {
+    // Read the rest of the headers (V4/V5 fields, masks, palette) up to the pixel data
+    uint32_t offset  = bmp->fileHeader.bfOffBits;
+    bmp->extraSize   = offset > HEADERS_SIZE ? offset - HEADERS_SIZE : 0;
+    bmp->extraHeader = bmp->extraSize ? malloc(bmp->extraSize) : NULL;
+    size_t got       = bmp->extraHeader ? fread(bmp->extraHeader, 1, bmp->extraSize, filePtr) : 0;
+    if (got != bmp->extraSize) {
         printerr("Reading BMP info header.\n");
         fclose(filePtr);
+        free(bmp->extraHeader);
         free(bmp);
         return NULL;
     }
 
-    // Check if the BMP file is 24-bit (RGB format)
-    if (bmp->infoHeader.biBitCount != 24) {
-        printerr("Unsupported BMP format: only 24-bit BMP files are supported.\n");
+    if (check_headers(bmp, bmp->extraHeader, bmp->extraSize) != 0) {
         fclose(filePtr);
+        free(bmp->extraHeader);
         free(bmp);
         return NULL;
     }
 
-    if (bmp->infoHeader.biCompression != 0) {
-        printerr("BMP file is compressed, only uncompressed BMP files are supported.\n");
+    // Allocate the whole pixel plane at once, rows keep the padded layout they have on disk.
+    // Pages of rows that are never loaded are never touched.
+    set_layout(bmp);
+    size_t planeSize = bmp->stride * bmp_height(bmp);
+    bmp->data        = alloc_plane(planeSize);
+    bmp->map         = NULL;
+    bmp->mapSize     = 0;
+    bmp->borrowed    = false;
+    bmp->file        = filePtr;
+    bmp->rowsLoaded  = 0;
+    if (!bmp->data) {
+        printerr("Memory allocation for pixel plane failed\n");
         fclose(filePtr);
+        free(bmp->extraHeader);
         free(bmp);
         return NULL;
     }
 
-    // Allocate memory for a column of pixels
-    bmp->pixels = (PIXEL **) malloc(bmp->infoHeader.biHeight * sizeof(PIXEL *));
-    if (!bmp->pixels) {
-        printerr("Memory allocation for pixel rows failed\n");
-        fclose(filePtr);
-        free(bmp);
+    stats_count(STATS_BYTES_READ, HEADERS_SIZE + bmp->extraSize);
+    stats_end(STATS_READ_BMP, span);
+    return bmp;
+}
+
+/**
+ * @brief Open a BMP file reading only its headers, pixel rows are loaded on demand with
+ * bmp_load_rows
+ *
+ * @param filename Path to the BMP file
+ *
+ * @return BMP_FILE structure with no rows loaded yet, release it with free_bmp
+ */
+BMP_FILE *open_bmp(const char *filename) {
+    // Open the file in binary mode
+    FILE *filePtr = fopen(filename, "rb");
+    if (filePtr == NULL) {
+        printerr("Opening BMP file\n");
         return NULL;
     }
+    return open_bmp_stream(filePtr);
+}
 
-    // Allocate memory for each pixel row
-    for (i = 0; i < bmp->infoHeader.biHeight; i++) {
-        bmp->pixels[i] = (PIXEL *) malloc(bmp->infoHeader.biWidth * sizeof(PIXEL));
-        if (!bmp->pixels[i]) {
-            printerr("Memory allocation for pixel row %d failed\n", i);
-            for (uint32_t k = 0; k < i; k++)
-                free(bmp->pixels[k]);
-            free(bmp->pixels);
-            fclose(filePtr);
-            free(bmp);
-            return NULL;
-        }
+/* Padding bytes are not pixel data, clear those of the stored rows [first, last) so they are
+ * written back as zeros */
+static void clear_padding(BMP_FILE *bmp, size_t first, size_t last) {
+    size_t rowBytes = bmp_width(bmp) * bmp->pixelSize;
+    if (bmp->stride != rowBytes) {
+        for (size_t i = first; i < last; i++)
+            memset(bmp->data + i * bmp->stride + rowBytes, 0, bmp->stride - rowBytes);
     }
+}
 
-    // Move the file pointer to the start of the bitmap data
-    fseek(filePtr, bmp->fileHeader.bfOffBits, SEEK_SET);
-
-    // Read the pixel data from top to bottom
-    for (i = 0; i < bmp->infoHeader.biHeight; i++) {
-        if (fread(bmp->pixels[i], sizeof(PIXEL), bmp->infoHeader.biWidth, filePtr) !=
-            bmp->infoHeader.biWidth) {
-            printerr("Reading pixel data.\n");
-            for (uint32_t k = 0; k < i; k++)
-                free(bmp->pixels[k]);
-            free(bmp->pixels);
-            fclose(filePtr);
-            free(bmp);
-            return NULL;
-        }
-        // Skip padding bytes
-        // The number of bytes in a row must be a multiple of 4
-        // width *3 = number of bytes in a row
-        // number of bytes in row % 4 = remaining bytes
-        // 4 - remaining bytes = padding bytes
-        // padding bytes % 4 ensures that the padding bytes are not greater than 4
-        // example: width = 10 pixels = 30 bytes = 30 % 4 = 2 remaining bytes = 4 - 2 = 2 padding
-        // bytes padding bytes = 2 % 4 = 2 and fseek will skip 2 bytes
-        fseek(filePtr, (4 - (bmp->infoHeader.biWidth * 3) % 4) % 4, SEEK_CUR);
-    }
-
-    fclose(filePtr);
+/**
+ * @brief Make sure the first rows of the pixel plane are loaded
+ *
+ * @param bmp BMP file structure returned by open_bmp, read_bmp or map_bmp
+ * @param rows Number of rows (numbered bottom-up) that have to be available
+ *
+ * @return 0 on success, -1 on failure
+ */
+int bmp_load_rows(BMP_FILE *bmp, size_t rows) {
+    size_t height = bmp_height(bmp);
+    if (rows > height)
+        rows = height;
+    if (rows <= bmp->rowsLoaded)
+        return 0;
+
+    // The bottom rows of a top-down file are the last ones stored, read backwards from the end
+    size_t first = bmp_top_down(bmp) ? height - rows : bmp->rowsLoaded;  // First stored row
+    off_t  start = bmp->fileHeader.bfOffBits + (off_t) (first * bmp->stride);
+    if (bmp_top_down(bmp) && fseeko(bmp->file, start, SEEK_SET) != 0) {
+        printerr("Reading pixel data.\n");
+        return -1;
+    }
+
+    // Read the missing rows (pixels and padding) in a single call
+    uint64_t span  = stats_begin();
+    size_t   bytes = (rows - bmp->rowsLoaded) * bmp->stride;
+    if (fread(bmp->data + first * bmp->stride, 1, bytes, bmp->file) != bytes) {
+        printerr("Reading pixel data.\n");
+        return -1;
+    }
+    stats_count(STATS_BYTES_READ, bytes);
+    stats_end(STATS_READ_BMP, span);
+
+    clear_padding(bmp, first, first + rows - bmp->rowsLoaded);
+    bmp->rowsLoaded = rows;
+    if (rows == height) {
+        fclose(bmp->file);
+        bmp->file = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read a BMP file and store it in a BMP_FILE structure
+ *
+ * @param filename Path to the BMP file
+ *
+ * @return BMP_FILE structure containing the BMP file data
+ */
+BMP_FILE *read_bmp(const char *filename) {
+    BMP_FILE *bmp = open_bmp(filename);
+    if (!bmp)
+        return NULL;
+
+    if (bmp_load_rows(bmp, bmp_height(bmp)) != 0) {
+        free_bmp(bmp);
+        return NULL;
+    }
     return bmp;
 }
 
+/**
+ * @brief Write a BMP to a file descriptor with scatter output: the headers and the pixel plane
+ * (rows and their padding) go straight from the BMP_FILE structure, without an intermediate copy
+ *
+ * @param fd File descriptor to write to (a file, a pipe or a socket)
+ * @param bmp BMP file structure to write, rows not loaded yet are read first
+ *
+ * @return 0 on success, -1 on failure
+ */
+int bmp_writev(int fd, BMP_FILE *bmp) {
+    // Rows of a lazily opened file that were not needed yet have to be read before writing
+    if (bmp_load_rows(bmp, bmp_height(bmp)) != 0)
+        return -1;
+
+    size_t       planeSize = bmp->stride * bmp_height(bmp);
+    struct iovec parts[]   = {
+        {&bmp->fileHeader, sizeof(BITMAPFILEHEADER)},
+        {&bmp->infoHeader, sizeof(BITMAPINFOHEADER)},
+        {bmp->extraHeader, bmp->extraSize},
+        {bmp->data, planeSize},
+    };
+    struct iovec *part  = parts;
+    int           count = sizeof(parts) / sizeof(*parts);
+    uint64_t      span  = stats_begin();
+
+    while (count > 0) {
+        ssize_t written = writev(fd, part, count);
+        if (written < 0) {
+            printerr("Writing BMP file\n");
+            return -1;
+        }
+
+        // Skip what was written, a short write leaves the rest of the current part pending
+        while (count > 0 && (size_t) written >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            count--;
+        }
+        if (count > 0) {
+            part->iov_base = (uint8_t *) part->iov_base + written;
+            part->iov_len -= written;
+        }
+    }
+    stats_count(STATS_BYTES_WRITTEN, HEADERS_SIZE + bmp->extraSize + planeSize);
+    stats_end(STATS_WRITE_BMP, span);
+    return 0;
+}
+
+/**
+ * @brief Serialize a BMP into a new buffer holding the same bytes write_bmp writes to a file
+ *
+ * @param bmp BMP file structure to serialize, rows not loaded yet are read first
+ * @param buffer Where to store the buffer, to be released with free()
+ * @param size Where to store the size of the buffer
+ *
+ * @return 0 on success, -1 on failure
+ */
+int bmp_serialize_to_memory(BMP_FILE *bmp, uint8_t **buffer, size_t *size) {
+    if (bmp_load_rows(bmp, bmp_height(bmp)) != 0)
+        return -1;
+
+    uint64_t span      = stats_begin();
+    size_t   planeSize = bmp->stride * bmp_height(bmp);
+    size_t   total     = HEADERS_SIZE + bmp->extraSize + planeSize;
+    uint8_t *out       = malloc(total);
+    if (!out) {
+        printerr("Memory allocation for BMP buffer failed\n");
+        return -1;
+    }
+    stats_alloc(total);
+
+    memcpy(out, &bmp->fileHeader, sizeof(BITMAPFILEHEADER));
+    memcpy(out + sizeof(BITMAPFILEHEADER), &bmp->infoHeader, sizeof(BITMAPINFOHEADER));
+    if (bmp->extraSize)
+        memcpy(out + HEADERS_SIZE, bmp->extraHeader, bmp->extraSize);
+    memcpy(out + HEADERS_SIZE + bmp->extraSize, bmp->data, planeSize);
+    *buffer = out;
+    *size   = total;
+    stats_end(STATS_WRITE_BMP, span);
+    return 0;
+}
+
 /**
  * @brief Write a BMP file from a BMP_FILE structure
  *
@@ -129,90 +472,368 @@ BMP_FILE *read_bmp(const char *filename) {
 
 int write_bmp(const char *filename, BMP_FILE *bmp) {
     // Add ".bmp" extension if not present
-    const char *extension = ".bmp";
-    char       *output_filename;
+    char *output_filename = bmp_output_filename(filename);
+    if (output_filename == NULL)
+        return -1;
 
-    if (strstr(filename, extension) == NULL) {
-        // Allocate space for the new filename with .bmp extension
-        output_filename = malloc(strlen(filename) + strlen(extension) + 1);
-        if (output_filename == NULL) {
-            printerr("Memory allocation for filename\n");
-            return -1;
-        }
-        // Append ".bmp" to the filename
-        strcpy(output_filename, filename);
-        strcat(output_filename, extension);
-    }
-    else {
-        // Use the original filename if it already has the .bmp extension
-        output_filename = (char *) filename;
+    // Rows of a lazily opened file that were not needed yet have to be read before writing
+    if (bmp_load_rows(bmp, bmp_height(bmp)) != 0) {
+        if (output_filename != filename)
+            free(output_filename);
+        return -1;
     }
 
-    FILE *filePtr = fopen(output_filename, "wb");
-    if (filePtr == NULL) {
+    int fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         printerr("Opening BMP file\n");
         if (output_filename != filename)
             free(output_filename);  // Free if allocated
         return -1;
     }
 
-    // Write the file header
-    if (fwrite(&bmp->fileHeader, sizeof(BITMAPFILEHEADER), 1, filePtr) != 1) {
-        printerr("Writing BMP file header\n");
-        fclose(filePtr);
-        if (output_filename != filename)
-            free(output_filename);
+    /* Rows are stored with their padding already in place, headers and plane go out in one call */
+    int result = bmp_writev(fd, bmp);
+    if (close(fd) != 0 && result == 0) {
+        printerr("Writing pixel data\n");
+        result = -1;
+    }
+    if (output_filename != filename)
+        free(output_filename);  // Free allocated memory
+    return result;
+}
+
+/**
+ * @brief Parse the headers of a BMP without touching its pixels, to know its size and capacity
+ *
+ * @param buffer At least the first size bytes of the file
+ * @param size Bytes held by buffer
+ * @param fileSize Size of the whole file, which has to hold the pixel plane the headers describe
+ * @param bmp Where the headers and the layout are stored, it holds no pixel plane and no header
+ * bytes beyond the info header
+ *
+ * @return 0 on success, -1 if the headers do not describe a supported BMP of fileSize bytes
+ */
+int bmp_parse_headers(const uint8_t *buffer, size_t size, size_t fileSize, BMP_FILE *bmp) {
+    memset(bmp, 0, sizeof(BMP_FILE));
+    if (size < HEADERS_SIZE) {
+        printerr("Reading BMP file header.\n");
         return -1;
     }
 
-    // Write the info header
-    if (fwrite(&bmp->infoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr) != 1) {
-        printerr("Writing BMP info header\n");
-        fclose(filePtr);
-        if (output_filename != filename)
-            free(output_filename);
+    memcpy(&bmp->fileHeader, buffer, sizeof(BITMAPFILEHEADER));
+    memcpy(&bmp->infoHeader, buffer + sizeof(BITMAPFILEHEADER), sizeof(BITMAPINFOHEADER));
+    if (check_headers(bmp, buffer + HEADERS_SIZE, size - HEADERS_SIZE) != 0)
+        return -1;
+
+    set_layout(bmp);
+    size_t planeSize = bmp->stride * bmp_height(bmp);
+    if (bmp->fileHeader.bfOffBits > fileSize || fileSize - bmp->fileHeader.bfOffBits < planeSize) {
+        printerr("Reading pixel data.\n");
         return -1;
     }
+    return 0;
+}
 
-    /* Calculate padding per row (BMP rows must be a multiple of 4 bytes) */
-    uint32_t paddingSize = (4 - (bmp->infoHeader.biWidth * 3) % 4) % 4;
-    uint8_t  padding[3]  = {0, 0, 0};  // Padding bytes, up to 3 bytes of padding
+/**
+ * @brief Read and parse only the headers of a BMP file, see bmp_parse_headers
+ *
+ * A single pread of the headers (and the channel masks that may follow them) and an fstat for
+ * the file size, the pixels are never read.
+ *
+ * @return 0 on success, -1 if the file can not be read or is not a supported BMP
+ */
+int bmp_read_headers(const char *filename, BMP_FILE *bmp) {
+    uint8_t     headers[HEADERS_SIZE + MASKS_SIZE];
+    struct stat st;
 
-    /* Write the pixel data from top to bottom */
-    for (uint32_t i = 0; i < bmp->infoHeader.biHeight; i++) {
-        /* Write pixel data for the current row, but reverse the index */
-        if (fwrite(bmp->pixels[i], sizeof(PIXEL), bmp->infoHeader.biWidth, filePtr) !=
-            bmp->infoHeader.biWidth) {
-            printerr("Writing pixel data for row %d\n", i);
-            fclose(filePtr);
-            if (output_filename != filename)
-                free(output_filename);
-            return -1;
-        }
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printerr("Opening BMP file\n");
+        return -1;
+    }
+    ssize_t got = pread(fd, headers, sizeof(headers), 0);
+    int     ok  = got >= 0 && fstat(fd, &st) == 0;
+    close(fd);
+    if (!ok) {
+        printerr("Reading BMP file header.\n");
+        return -1;
+    }
+
+    stats_count(STATS_BYTES_READ, got);
+    return bmp_parse_headers(headers, got, st.st_size, bmp);
+}
+
+/**
+ * @brief Wrap a whole BMP file held in memory in a BMP_FILE structure whose pixel plane points
+ * into it
+ *
+ * @return BMP_FILE structure or NULL if the buffer is not a supported BMP
+ */
+static BMP_FILE *wrap_buffer(const uint8_t *buffer, size_t size) {
+    BMP_FILE *bmp = malloc(sizeof(BMP_FILE));
+    if (!bmp) {
+        printerr("Memory allocation for BMP_FILE failed\n");
+        return NULL;
+    }
+
+    if (bmp_parse_headers(buffer, size, size, bmp) != 0) {
+        free(bmp);
+        return NULL;
+    }
+
+    // Kept apart from the buffer so the header outlives it once the plane is copied
+    bmp->extraSize   = bmp->fileHeader.bfOffBits - HEADERS_SIZE;
+    bmp->extraHeader = bmp->extraSize ? malloc(bmp->extraSize) : NULL;
+    if (bmp->extraSize && !bmp->extraHeader) {
+        printerr("Memory allocation for BMP_FILE failed\n");
+        free(bmp);
+        return NULL;
+    }
+    if (bmp->extraSize)
+        memcpy(bmp->extraHeader, buffer + HEADERS_SIZE, bmp->extraSize);
+
+    bmp->data       = (uint8_t *) buffer + bmp->fileHeader.bfOffBits;
+    bmp->map        = NULL;
+    bmp->mapSize    = 0;
+    bmp->borrowed   = true;
+    bmp->file       = NULL;
+    bmp->rowsLoaded = bmp_height(bmp);  // Every row is already in memory
+    return bmp;
+}
+
+/**
+ * @brief Wrap a mapped BMP file in a BMP_FILE structure whose pixel plane points into the mapping
+ *
+ * @return BMP_FILE structure or NULL if the mapping is not a supported BMP, the mapping is
+ * released on failure
+ */
+static BMP_FILE *wrap_mapping(uint8_t *map, size_t mapSize) {
+    BMP_FILE *bmp = wrap_buffer(map, mapSize);
+    if (!bmp) {
+        munmap(map, mapSize);
+        return NULL;
+    }
+
+    bmp->map      = map;  // The mapping pages rows in by itself
+    bmp->mapSize  = mapSize;
+    bmp->borrowed = false;
+    return bmp;
+}
+
+/**
+ * @brief Parse a whole BMP file held in memory, such as one fetched from an object store
+ *
+ * @param buffer BMP file contents
+ * @param size Size of the buffer
+ * @param borrow false copies the pixel plane (padding cleared, like read_bmp), true makes the
+ * pixel plane point into buffer instead: nothing is copied, buffer has to outlive the BMP_FILE
+ * and the pixels modified through it are modified in buffer, which then already holds the
+ * output BMP (only borrow a read-only buffer to read from it)
+ *
+ * @return BMP_FILE structure, release it with free_bmp
+ */
+BMP_FILE *bmp_parse_from_memory(const uint8_t *buffer, size_t size, bool borrow) {
+    uint64_t  span = stats_begin();
+    BMP_FILE *bmp  = wrap_buffer(buffer, size);
+    if (!bmp || borrow) {
+        stats_end(STATS_READ_BMP, span);
+        return bmp;
+    }
 
-        /* Write padding bytes, if any */
-        if (paddingSize > 0) {
-            if (fwrite(padding, 1, paddingSize, filePtr) != paddingSize) {
-                printerr("Writing padding for row %d\n", i);
-                fclose(filePtr);
-                if (output_filename != filename)
-                    free(output_filename);
-                return -1;
+    size_t   planeSize = bmp->stride * bmp_height(bmp);
+    uint8_t *plane     = alloc_plane(planeSize);
+    if (!plane) {
+        printerr("Memory allocation for pixel plane failed\n");
+        free_bmp(bmp);
+        return NULL;
+    }
+    memcpy(plane, bmp->data, planeSize);
+    bmp->data     = plane;
+    bmp->borrowed = false;
+    clear_padding(bmp, 0, bmp_height(bmp));
+    stats_end(STATS_READ_BMP, span);
+    return bmp;
+}
+
+/**
+ * @brief Map a file into memory
+ *
+ * @return The mapping or NULL on failure, its length is stored in mapSize
+ */
+static uint8_t *map_file(const char *filename, int flags, int prot, int share, size_t *mapSize) {
+    int fd = open(filename, flags);
+    if (fd < 0) {
+        printerr("Opening BMP file\n");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printerr("Reading BMP file header.\n");
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, prot, share, fd, 0);
+    close(fd);  // The mapping keeps its own reference to the file
+    if (map == MAP_FAILED) {
+        printerr("Mapping BMP file\n");
+        return NULL;
+    }
+
+    *mapSize = st.st_size;
+    return map;
+}
+
+/**
+ * @brief Map a BMP file instead of reading it, pages are only loaded once a row is accessed
+ *
+ * @param filename Path to the BMP file
+ * @param writable 0 maps the file read-only, otherwise the mapping is private copy-on-write so
+ * the pixel plane can be modified (and saved with write_bmp) without altering the file
+ *
+ * @return BMP_FILE structure backed by the mapping, release it with free_bmp
+ */
+BMP_FILE *map_bmp(const char *filename, int writable) {
+    uint64_t span = stats_begin();
+    size_t   mapSize;
+    uint8_t *map = map_file(filename,
+                            O_RDONLY,
+                            writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                            MAP_PRIVATE,
+                            &mapSize);
+    if (!map)
+        return NULL;
+
+    BMP_FILE *bmp = wrap_mapping(map, mapSize);
+    stats_end(STATS_READ_BMP, span);
+    return bmp;
+}
+
+/**
+ * @brief Copy a file, letting the kernel move the data (or share extents) when it can
+ *
+ * The destination is only truncated once it is known not to be the source itself, so a copy
+ * onto its own path fails instead of emptying the file.
+ *
+ * @param created Set to whether the destination was created by this call
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int copy_file(const char *source, const char *destination, bool *created) {
+    *created = false;
+    int in   = open(source, O_RDONLY);
+    if (in < 0) {
+        printerr("Opening BMP file\n");
+        return -1;
+    }
+
+    int out = open(destination, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out >= 0)
+        *created = true;
+    else if (errno == EEXIST)
+        out = open(destination, O_WRONLY);
+    if (out < 0) {
+        printerr("Opening BMP file\n");
+        close(in);
+        return -1;
+    }
+
+    struct stat inStat, outStat;
+    if (fstat(in, &inStat) != 0 || fstat(out, &outStat) != 0) {
+        printerr("Reading BMP file attributes\n");
+        close(in);
+        close(out);
+        return -1;
+    }
+    if (inStat.st_dev == outStat.st_dev && inStat.st_ino == outStat.st_ino) {
+        printerr("The output file %s is the carrier, it cannot be mapped over itself\n",
+                 destination);
+        close(in);
+        close(out);
+        return -1;
+    }
+    if (!*created && ftruncate(out, 0) != 0) {
+        printerr("Truncating BMP file\n");
+        close(in);
+        close(out);
+        return -1;
+    }
+
+    char    buffer[1 << 16];
+    ssize_t copied;
+    int     kernelCopy = 1;
+    for (;;) {
+        if (kernelCopy) {
+            copied = copy_file_range(in, NULL, out, NULL, SIZE_MAX >> 2, 0);
+            if (copied < 0) {
+                // Not supported between these files, fall back to a plain copy
+                kernelCopy = 0;
+                continue;
             }
         }
+        else {
+            copied = read(in, buffer, sizeof(buffer));
+            if (copied > 0 && write(out, buffer, copied) != copied)
+                copied = -1;
+        }
+        if (copied <= 0)
+            break;
     }
 
-    fclose(filePtr);
-    if (output_filename != filename)
-        free(output_filename);  // Free allocated memory
+    close(in);
+    if (close(out) != 0 || copied < 0) {
+        printerr("Copying BMP file\n");
+        return -1;
+    }
     return 0;
 }
 
+/**
+ * @brief Create the output BMP as a copy of the carrier and map it shared, so the pixels modified
+ * through the returned BMP_FILE are written straight into the output file
+ *
+ * @param carrierFile Path to the carrier BMP file
+ * @param filename Path to the output BMP file, ".bmp" is added the same way write_bmp does
+ *
+ * @return BMP_FILE structure backed by the output file, release it with free_bmp
+ *
+ * @note Unlike read_bmp + write_bmp the carrier is copied verbatim, row padding included, and an
+ * output that is the carrier itself (same path or another link to it) is refused
+ */
+BMP_FILE *map_bmp_into(const char *carrierFile, const char *filename) {
+    char *outputFilename = bmp_output_filename(filename);
+    if (outputFilename == NULL)
+        return NULL;
+
+    BMP_FILE *bmp     = NULL;
+    bool      created = false;
+    uint64_t  span    = stats_begin();
+    if (copy_file(carrierFile, outputFilename, &created) == 0) {
+        size_t   mapSize;
+        uint8_t *map = map_file(
+            outputFilename, O_RDWR, PROT_READ | PROT_WRITE, MAP_SHARED, &mapSize);
+        if (map)
+            bmp = wrap_mapping(map, mapSize);
+        // Only remove a file this call created, never one that was already there
+        if (!bmp && created)
+            unlink(outputFilename);
+    }
+    stats_end(STATS_READ_BMP, span);
+
+    if (outputFilename != filename)
+        free(outputFilename);
+    return bmp;
+}
+
 /* Free the BMP */
 void free_bmp(BMP_FILE *bmp) {
-    for (uint32_t i = 0; i < bmp->infoHeader.biHeight; i++) {
-        free(bmp->pixels[i]);
-    }
-    free(bmp->pixels);
+    if (bmp->file)
+        fclose(bmp->file);
+    if (bmp->map)
+        munmap(bmp->map, bmp->mapSize);
+    else if (!bmp->borrowed)
+        free(bmp->data);
+    free(bmp->extraHeader);
     free(bmp);
 }
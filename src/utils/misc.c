@@ -76,12 +76,46 @@ void print_table(const char *header, int color, const char *firstAttribute, ...)
     va_end(args);  // Clean up the va_list
 }
 
+/**
+ * @brief Write a string as a JSON string, quotes included
+ */
+void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* First error printed by the current thread since printerr_reset, kept for batch reports */
+static _Thread_local char first_error[PRINTERR_MAX];
+/* The current thread only records errors, see printerr_quiet */
+static _Thread_local bool quiet_errors;
+
 void printerr(const char *format, ...) {
     va_list args;
 
     // Start processing the variable arguments
     va_start(args, format);
 
+    if (first_error[0] == '\0') {
+        va_list copy;
+        va_copy(copy, args);
+        vsnprintf(first_error, sizeof(first_error), format, copy);
+        va_end(copy);
+        first_error[strcspn(first_error, "\n")] = '\0';
+    }
+
+    if (quiet_errors) {
+        va_end(args);
+        return;
+    }
+
     // Print the "Error" message in red
     fprintf(stderr, "\033[0;31mError\033[0m: ");
 
@@ -90,4 +124,35 @@ void printerr(const char *format, ...) {
 
     // Clean up the variable arguments list
     va_end(args);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief First error printed by the calling thread since the last printerr_reset, without the
+ * trailing newline
+ *
+ * @return The message, empty if there was none
+ */
+const char *printerr_first(void) {
+    return first_error;
+}
+
+/**
+ * @brief Forget the errors printed so far by the calling thread
+ */
+void printerr_reset(void) {
+    first_error[0] = '\0';
+}
+
+/**
+ * @brief Keep the errors of the calling thread instead of printing them, printerr_first still
+ * returns the first one
+ *
+ * @param quiet true to stop printing, false to print again
+ *
+ * @return The previous setting, to restore it afterwards
+ */
+bool printerr_quiet(bool quiet) {
+    bool previous = quiet_errors;
+    quiet_errors  = quiet;
+    return previous;
+}
@@ -10,32 +10,167 @@ stegobmp --embed --in <file> --p <bitmapfile> --out <bitmapfile> --steg <LSB1 |
 --out <bitmapfile>: bmp output file with embedded information\n\
 --steg <LSB1 | LSB4 | LSBI>: steganography algorithm. \n\tOptions are: LSB (1bit), LSB (4 bits), LSB (Enhanced)\n\
 \nUsage for extraction:\n\t\
-stegobmp --extract --p <bitmapfile> --out <file> --steg <LSB1 | LSB4 | LSBI> --a <aes128 | aes192 | aes256 | 3des> --m <ecb | cfb | ofb | cbc> --pass <password>\n\
+stegobmp --extract --p <bitmapfile> --out <file> --steg <LSB1 | LSB4 | LSBI> --a <aes128 | aes192 | aes256 | 3des | chacha20> --m <ecb | cfb | ofb | cbc | gcm | poly1305> --pass <password>\n\
 \nExtraction command parameters:\n\
 --extract: option for extraction from bmp file\n\
 --p <bitmapfile>: bmp carrier file\n\
 --out <file>: file to be overwritten with output\n\
-\nOptional parameters:\n\
---a <aes128 | aes192 | aes256 | 3des>\n\
---m <ecb | cfb | ofb | cbc>\n\
---pass password: encryption password\n"
+\nUsage for batches:\n\t\
+stegobmp --batch <manifest> [--results <file>] [--threads <N>]\n\
+\nBatch command parameters:\n\
+--batch <manifest>: CSV (with a header line) or JSON Lines file, one job per line with\n\
+\tthe columns action, carrier, payload, output, method, cipher, mode and password\n\
+--results <file>: per job outcome and timings, CSV if the name ends in .csv, JSON Lines otherwise\n\
+\t(default <manifest>.results.jsonl)\n\
+\nUsage for the daemon:\n\t\
+stegobmp --serve <socket> [--threads <N>] [--key-cache <file>]\n\t\
+stegobmp --embed --connect <socket> --in <file> --p <bitmapfile> --out <bitmapfile> ...\n\t\
+stegobmp --extract --connect <socket> --p <bitmapfile> --out <file> ...\n\
+\nDaemon command parameters:\n\
+--serve <socket>: serves embed and extract requests on a Unix socket (mode 600) until SIGINT or\n\
+\tSIGTERM, each thread one connection at a time, keeping ciphers and derived keys across them\n\
+--connect <socket>: runs --embed or --extract through the daemon, the files are passed to it as\n\
+\tdescriptors and it writes the output directly\n"
+
+/* Split in parts, ISO C only guarantees string literals of 4095 characters */
+#define HELP_MSG_TOOLS \
+    "\nUsage for capacity queries:\n\t\
+stegobmp --capacity <bitmapfile | directory> [--results <file>] [--threads <N>]\n\
+\nCapacity command parameters:\n\
+--capacity <bitmapfile | directory>: reads only the headers of a carrier, or of every .bmp file\n\
+\tof a directory, and prints as JSON Lines the room each method leaves for a message and its\n\
+\textension, in plain and with each cipher and mode\n\
+--results <file>: write the JSON Lines to a file instead of stdout and print a summary\n\
+\nUsage for carrier indexes:\n\t\
+stegobmp --build-index <directory> --carrier-index <file> [--threads <N>]\n\t\
+stegobmp --embed --auto-carrier --carrier-index <file> --in <file> --out <bitmapfile> ...\n\
+\nCarrier index command parameters:\n\
+--build-index <directory>: records the size, capacity and SHA-256 of every .bmp file under the\n\
+\tdirectory in the index, carriers unchanged since the last build are not read again\n\
+--carrier-index <file>: binary carrier index, also used by batch jobs whose carrier is \"auto\"\n\
+--auto-carrier: embed into the smallest indexed carrier the payload fits in\n\
+\nUsage for striping:\n\t\
+stegobmp --embed --stripe --in <file> --p <bitmapfile,...> --out <bitmapfile,...> ...\n\t\
+stegobmp --extract --stripe --p <bitmapfile,...> --out <file> ...\n\
+\nStriping command parameters:\n\
+--stripe: splits the payload across the carriers listed in --p, in proportion to their\n\
+\tcapacity, one output per carrier. Every stripe is embedded and extracted on a thread of\n\
+\tits own (default one per carrier), the stego files can be given in any order\n\
+\nUsage for dictionary attacks:\n\t\
+stegobmp --crack <wordlist> --p <bitmapfile> [--out <file>] [--steg ...] [--a ...] [--m ...]\n\
+\nDictionary attack parameters:\n\
+--crack <wordlist>: tries every password of the wordlist (one per line) with every method,\n\
+\talgorithm and mode not fixed by --steg, --a and --m, on every CPU unless --threads is given.\n\
+\tWith --out the payload is extracted once the password is found\n\
+\nUsage for detection:\n\t\
+stegobmp --detect <bitmapfile> [--alpha]\n\
+\nDetection command parameters:\n\
+--detect <bitmapfile>: decodes the size prefix of every method at once and ranks the methods\n\
+\tby how plausible their payload is, telling whether it looks encrypted\n\
+\nUsage for steganalysis:\n\t\
+stegobmp --analyze <bitmapfile | directory> [--results <file>] [--alpha] [--threads <N>]\n\
+\nSteganalysis command parameters:\n\
+--analyze <bitmapfile | directory>: runs the chi-square attack, RS analysis and sample pair\n\
+\tanalysis over a carrier, or every .bmp file of a directory (one per CPU unless --threads\n\
+\tis given), and prints as JSON Lines the embedding rate estimated for each color channel\n\
+--results <file>: write the JSON Lines to a file instead of stdout and print a summary\n\
+\nUsage for image quality:\n\t\
+stegobmp --compare <cover bitmapfile> <stego bitmapfile> [--results <file>] [--alpha]\n\
+\nImage quality command parameters:\n\
+--compare <cover> <stego>: prints as a JSON line the MSE, PSNR and SSIM of the stego image\n\
+\tagainst its cover and how many LSBs changed, overall and for each color channel\n\
+--results <file>: write the JSON line to a file instead of stdout and print a summary\n"
+
+#define HELP_MSG_OPTIONS \
+    "\nOptional parameters:\n\
+--a <aes128 | aes192 | aes256 | 3des | chacha20>\n\
+--m <ecb | cfb | ofb | cbc | gcm | poly1305>: gcm (AES) and poly1305 (ChaCha20, its only mode)\n\
+\tstore a tag after the ciphertext, a wrong password or a corrupted carrier is rejected\n\
+\tbefore any output is written\n\
+--pass password: encryption password\n\
+--mmap: map the carrier instead of reading it, only the pages holding the payload are touched\n\
+--alpha: LSB1 and LSB4 also hide data in the alpha (or unused X) channel of 32-bit carriers,\n\
+\tthe same flag is needed to extract it\n\
+--threads <N>: threads sharing the work (default 1, 0 for one per CPU)\n\
+--key-cache <file>: keep the keys derived from passwords in a private file (mode 600) across runs\n\
+--stats[=<file>]: print the time spent in every stage and the bytes and channels touched as JSON\n\
+\t(default stdout)\n"
+
+#define MAX_THREADS 1024
 
 void print_help() {
-    printf("%s\n", HELP_MSG);
+    printf("%s%s%s\n", HELP_MSG, HELP_MSG_TOOLS, HELP_MSG_OPTIONS);
+}
+
+/* Index of a name within a table of names, case insensitive, the first entry ("None") excluded */
+static int find_name(const char *name, const char *const *names, int count) {
+    for (int i = 1; i < count; i++) {
+        if (strcasecmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Parse a steganography method name: LSB1, LSB4 or LSBI
+ *
+ * @return 0 on success, -1 if the name is not valid
+ */
+int parse_steg(const char *name, steg *method) {
+    int i = find_name(name, steg_str, sizeof(steg_str) / sizeof(*steg_str));
+    if (i < 0)
+        return -1;
+    *method = (steg) i;
+    return 0;
+}
+
+/**
+ * @brief Parse an encryption algorithm name: aes128, aes192, aes256, 3des or chacha20
+ *
+ * @return 0 on success, -1 if the name is not valid
+ */
+int parse_encryption(const char *name, encryption *a) {
+    int i = find_name(name, encryption_str, sizeof(encryption_str) / sizeof(*encryption_str));
+    if (i < 0)
+        return -1;
+    *a = (encryption) i;
+    return 0;
+}
+
+/**
+ * @brief Parse an encryption mode name: ecb, cfb, ofb, cbc, gcm or poly1305
+ *
+ * @return 0 on success, -1 if the name is not valid
+ */
+int parse_mode(const char *name, mode *m) {
+    int i = find_name(name, mode_str, sizeof(mode_str) / sizeof(*mode_str));
+    if (i < 0)
+        return -1;
+    *m = (mode) i;
+    return 0;
 }
 
 void parse_args(const int argc, const char *argv[], args *args) {
-    int option_index = 0;
-    int opt;
-
-    args->action = NONE;
-    args->in     = NULL;
-    args->p      = NULL;
-    args->out    = NULL;
-    args->steg   = STEG_NONE;
-    args->a      = ENC_NONE;
-    args->m      = MODE_NONE;
-    args->pass   = NULL;
+    int  option_index = 0;
+    int  opt;
+    bool threadsGiven = false;
+
+    args->action   = NONE;
+    args->in       = NULL;
+    args->p        = NULL;
+    args->out      = NULL;
+    args->steg     = STEG_NONE;
+    args->a        = ENC_NONE;
+    args->m        = MODE_NONE;
+    args->pass     = NULL;
+    args->manifest = NULL;
+    args->results  = NULL;
+    args->socket   = NULL;
+    args->stats    = NULL;
+    args->wordlist = NULL;
+    args->stego    = NULL;
+    memset(&args->options, 0, sizeof(args->options));
+    args->options.threads = 1;
 
     if (argc < 2) {
         print_help();
@@ -52,6 +187,24 @@ void parse_args(const int argc, const char *argv[], args *args) {
                                            {"a", required_argument, 0, 'a'},
                                            {"m", required_argument, 0, 'm'},
                                            {"pass", required_argument, 0, 'k'},
+                                           {"mmap", no_argument, 0, 'M'},
+                                           {"alpha", no_argument, 0, 'L'},
+                                           {"threads", required_argument, 0, 'T'},
+                                           {"key-cache", required_argument, 0, 'K'},
+                                           {"batch", required_argument, 0, 'B'},
+                                           {"results", required_argument, 0, 'R'},
+                                           {"serve", required_argument, 0, 'S'},
+                                           {"connect", required_argument, 0, 'C'},
+                                           {"stats", optional_argument, 0, 'Q'},
+                                           {"capacity", required_argument, 0, 'Y'},
+                                           {"carrier-index", required_argument, 0, 'I'},
+                                           {"build-index", required_argument, 0, 'D'},
+                                           {"auto-carrier", no_argument, 0, 'A'},
+                                           {"stripe", no_argument, 0, 'Z'},
+                                           {"crack", required_argument, 0, 'W'},
+                                           {"detect", required_argument, 0, 'G'},
+                                           {"analyze", required_argument, 0, 'N'},
+                                           {"compare", required_argument, 0, 'V'},
                                            {"help", no_argument, 0, 'h'},
                                            {0, 0, 0, 0}};
 
@@ -75,63 +228,100 @@ void parse_args(const int argc, const char *argv[], args *args) {
                 args->out = optarg;
                 break;
             case 's':  // Steganography method
-                if (strcasecmp(optarg, "LSB1") == 0) {
-                    args->steg = LSB1;
-                }
-                else if (strcasecmp(optarg, "LSB4") == 0) {
-                    args->steg = LSB4;
-                }
-                else if (strcasecmp(optarg, "LSBI") == 0) {
-                    args->steg = LSBI;
-                }
-                else {
+                if (parse_steg(optarg, &args->steg) != 0) {
                     printerr("Invalid steg value: %s\n", optarg);
                     printerr("- Valid options are: LSB1, LSB4, LSBI\n");
                     exit(1);
                 }
                 break;
             case 'a':  // Encryption algorithm
-
-                if (strcasecmp(optarg, "aes128") == 0) {
-                    args->a = AES128;
-                }
-                else if (strcasecmp(optarg, "aes192") == 0) {
-                    args->a = AES192;
-                }
-                else if (strcasecmp(optarg, "aes256") == 0) {
-                    args->a = AES256;
-                }
-                else if (strcasecmp(optarg, "3des") == 0) {
-                    args->a = DES3;
-                }
-                else {
+                if (parse_encryption(optarg, &args->a) != 0) {
                     printerr("\033[0;31mError\033[0m: Invalid encryption algorithm: %s\n", optarg);
-                    printerr("- Valid options are: aes128, aes192, aes256, 3des\n");
+                    printerr("- Valid options are: aes128, aes192, aes256, 3des, chacha20\n");
                     exit(1);
                 }
                 break;
             case 'm':  // Encryption mode
-                if (strcasecmp(optarg, "ecb") == 0) {
-                    args->m = ECB;
-                }
-                else if (strcasecmp(optarg, "cfb") == 0) {
-                    args->m = CFB;
-                }
-                else if (strcasecmp(optarg, "ofb") == 0) {
-                    args->m = OFB;
-                }
-                else if (strcasecmp(optarg, "cbc") == 0) {
-                    args->m = CBC;
-                }
-                else {
+                if (parse_mode(optarg, &args->m) != 0) {
                     printerr("\033[0;31mError\033[0m: Invalid encryption mode value: %s\n", optarg);
-                    printerr("- Valid options are: ecb, cfb, ofb, cbc\n");
+                    printerr("- Valid options are: ecb, cfb, ofb, cbc, gcm, poly1305\n");
                     exit(1);
                 }
                 break;
             case 'k':
                 args->pass = optarg;
                 break;
+            case 'M':  // Memory mapped carrier
+                args->options.mmap = true;
+                break;
+            case 'L':  // Payload in the 4th channel of 32-bit carriers too
+                args->options.alpha = true;
+                break;
+            case 'T': {  // Worker threads
+                char         *end;
+                unsigned long threads = strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || *optarg == '-' || threads > MAX_THREADS) {
+                    printerr("Invalid threads value: %s\n", optarg);
+                    printerr("- Valid options are: 0 (one per CPU) to %d\n", MAX_THREADS);
+                    exit(1);
+                }
+                args->options.threads = threads;
+                threadsGiven          = true;
+                break;
+            }
+            case 'K':  // Derived keys file
+                args->options.keyCache = optarg;
+                break;
+            case 'B':  // Batch manifest
+                args->action   = BATCH;
+                args->manifest = optarg;
+                break;
+            case 'R':  // Batch results file
+                args->results = optarg;
+                break;
+            case 'S':  // Daemon socket
+                args->action = SERVE;
+                args->socket = optarg;
+                break;
+            case 'C':  // Socket of the daemon running the action
+                args->socket = optarg;
+                break;
+            case 'Y':  // Carrier or directory of carriers to size up
+                args->action = CAPACITY;
+                args->p      = optarg;
+                break;
+            case 'I':  // Carrier index
+                args->options.carrierIndex = optarg;
+                break;
+            case 'D':  // Directory of carriers to index
+                args->action = INDEX;
+                args->p      = optarg;
+                break;
+            case 'A':  // Carrier picked from the index
+                args->autoCarrier = true;
+                break;
+            case 'Z':  // Payload split across several carriers
+                args->stripe = true;
+                break;
+            case 'W':  // Wordlist of a dictionary attack
+                args->action   = CRACK;
+                args->wordlist = optarg;
+                break;
+            case 'G':  // Carrier whose method is to be found
+                args->action = DETECT;
+                args->p      = optarg;
+                break;
+            case 'N':  // Carrier or directory of carriers to screen for payloads
+                args->action = ANALYZE;
+                args->p      = optarg;
+                break;
+            case 'V':  // Cover of the stego image to measure, which follows the options
+                args->action = COMPARE;
+                args->p      = optarg;
+                break;
+            case 'Q':  // Stage timings and counters
+                args->stats = optarg ? optarg : "-";
+                break;
             case 'h':
             case '?':
                 print_help();
@@ -142,6 +332,133 @@ void parse_args(const int argc, const char *argv[], args *args) {
         }
     }
 
+    // Every job of a batch brings its own files, method and password
+    if (args->action == BATCH) {
+        if (args->in || args->p || args->out || args->steg || args->pass || args->a || args->m) {
+            printerr("Batch jobs take their parameters from the manifest.\n");
+            print_help();
+            exit(1);
+        }
+        return;
+    }
+
+    if (args->autoCarrier && (args->action != EMBED || args->p || !args->options.carrierIndex)) {
+        printerr("--auto-carrier picks the carrier of --embed from --carrier-index, not --p.\n");
+        print_help();
+        exit(1);
+    }
+
+    // Indexing only reads carriers
+    if (args->action == INDEX) {
+        if (args->in || args->out || args->steg || args->pass || args->a || args->m ||
+            args->socket || args->options.mmap || args->options.alpha ||
+            !args->options.carrierIndex) {
+            printerr("--build-index takes a directory of carriers and --carrier-index.\n");
+            print_help();
+            exit(1);
+        }
+        return;
+    }
+
+    // Capacity queries only read carriers
+    if (args->action == CAPACITY) {
+        if (args->in || args->out || args->steg || args->pass || args->a || args->m ||
+            args->socket || args->options.mmap || args->options.alpha) {
+            printerr("--capacity only takes a carrier or a directory of carriers.\n");
+            print_help();
+            exit(1);
+        }
+        return;
+    }
+
+    // Dictionary attacks guess the password, and the method, algorithm and mode unless given
+    if (args->action == CRACK) {
+        if (!args->p || args->in || args->pass || args->socket || args->stripe ||
+            args->autoCarrier || (args->options.alpha && args->steg == LSBI)) {
+            printerr("--crack takes a wordlist and a carrier with --p.\n");
+            print_help();
+            exit(1);
+        }
+        if (!threadsGiven)
+            args->options.threads = 0;
+        return;
+    }
+
+    // Detection only reads the carrier, each method on a thread of its own unless told otherwise
+    if (args->action == DETECT) {
+        if (args->in || args->out || args->steg || args->pass || args->a || args->m ||
+            args->socket || args->stripe || args->autoCarrier) {
+            printerr("--detect only takes a carrier.\n");
+            print_help();
+            exit(1);
+        }
+        if (!threadsGiven)
+            args->options.threads = 3;
+        return;
+    }
+
+    // Steganalysis only reads carriers, one per CPU at a time unless told otherwise
+    if (args->action == ANALYZE) {
+        if (args->in || args->out || args->steg || args->pass || args->a || args->m ||
+            args->socket || args->options.mmap || args->stripe || args->autoCarrier) {
+            printerr("--analyze only takes a carrier or a directory of carriers.\n");
+            print_help();
+            exit(1);
+        }
+        if (!threadsGiven)
+            args->options.threads = 0;
+        return;
+    }
+
+    // Comparisons only read both images, split in bands across every CPU unless told otherwise
+    if (args->action == COMPARE) {
+        if (optind != argc - 1 || args->in || args->out || args->steg || args->pass || args->a ||
+            args->m || args->socket || args->options.mmap || args->stripe || args->autoCarrier) {
+            printerr("--compare takes a cover and a stego image.\n");
+            print_help();
+            exit(1);
+        }
+        args->stego = argv[optind];
+        if (!threadsGiven)
+            args->options.threads = 0;
+        return;
+    }
+
+    // Every request to the daemon brings its own files, method and password
+    if (args->action == SERVE) {
+        if (args->in || args->p || args->out || args->steg || args->pass || args->a || args->m ||
+            args->options.mmap || args->options.alpha) {
+            printerr("The daemon takes the parameters from each request.\n");
+            print_help();
+            exit(1);
+        }
+        return;
+    }
+    if (args->socket && args->action != EMBED && args->action != EXTRACT) {
+        printerr("--connect runs an embedding or an extraction through the daemon.\n");
+        print_help();
+        exit(1);
+    }
+    if (args->stripe && (args->socket || args->autoCarrier ||
+                         (args->action != EMBED && args->action != EXTRACT))) {
+        printerr("--stripe embeds into or extracts from the carriers listed in --p.\n");
+        print_help();
+        exit(1);
+    }
+    // One thread per carrier unless told otherwise
+    if (args->stripe && !threadsGiven && args->p) {
+        args->options.threads = 1;
+        for (const char *c = args->p; *c; c++)
+            args->options.threads += *c == ',';
+        if (args->options.threads > MAX_THREADS)
+            args->options.threads = MAX_THREADS;
+    }
+    if (args->options.alpha && (args->socket || args->steg == LSBI)) {
+        printerr("--alpha only applies to LSB1 and LSB4, and not through the daemon.\n");
+        print_help();
+        exit(1);
+    }
+
     if (args->pass != NULL) {
         // Caso 1: Se indica password pero no se indica modo ni algoritmo
         if (args->a == ENC_NONE && args->m == MODE_NONE) {
@@ -154,17 +471,26 @@ void parse_args(const int argc, const char *argv[], args *args) {
         }
         // Caso 2: Se indica algoritmo y password, pero no modo
         else if (args->a != ENC_NONE && args->m == MODE_NONE) {
-            args->m = CBC;
+            args->m = default_mode(args->a);
             printf(
                 "\033[0;33mWarning\033[0m: No encryption mode specified. Using default mode: "
-                "CBC\n");
+                "%s\n",
+                mode_str[args->m]);
         }
         // Caso 3: Se indica modo y password, pero no algoritmo
         else if (args->a == ENC_NONE && args->m != MODE_NONE) {
-            args->a = AES128;
+            args->a = default_encryption(args->m);
             printf(
                 "\033[0;33mWarning\033[0m: No encryption algorithm specified. Using default "
-                "algorithm: AES128\n");
+                "algorithm: %s\n",
+                encryption_str[args->a]);
+        }
+        // GCM solo con AES, Poly1305 solo con ChaCha20
+        if (!get_cipher(args->a, args->m)) {
+            printerr("%s does not support mode %s\n",
+                     encryption_str[args->a],
+                     mode_str[args->m]);
+            exit(1);
         }
     }
     else {
@@ -176,7 +502,7 @@ void parse_args(const int argc, const char *argv[], args *args) {
     }
 
     if (args->action == EMBED) {
-        if (!args->in || !args->p || !args->out || !args->steg) {
+        if (!args->in || (!args->p && !args->autoCarrier) || !args->out || !args->steg) {
             printerr("Missing required arguments for embedding.\n");
             print_help();
             exit(1);
@@ -190,7 +516,9 @@ void parse_args(const int argc, const char *argv[], args *args) {
         }
     }
     else {
-        printerr("No action specified. Use --embed or --extract.\n");
+        printerr(
+            "No action specified. Use --embed, --extract, --batch, --serve, --capacity, --crack, "
+            "--detect, --analyze or --compare.\n");
         print_help();
         exit(1);
     }
@@ -0,0 +1,85 @@
+#include "stats.h"
+
+#include <inttypes.h>
+
+atomic_bool stats_on = false;
+
+static atomic_uint_fast64_t stage_nanoseconds[STATS_STAGES];
+static atomic_uint_fast64_t stage_spans[STATS_STAGES];
+static atomic_uint_fast64_t counters[STATS_COUNTERS];
+
+/**
+ * @brief Turn the recording of spans and counters on or off, for the whole process
+ */
+void stats_enable(bool enable) {
+    atomic_store(&stats_on, enable);
+}
+
+/**
+ * @brief Clear every span and counter recorded so far
+ */
+void stats_reset(void) {
+    for (int stage = 0; stage < STATS_STAGES; stage++) {
+        atomic_store(&stage_nanoseconds[stage], 0);
+        atomic_store(&stage_spans[stage], 0);
+    }
+    for (int counter = 0; counter < STATS_COUNTERS; counter++)
+        atomic_store(&counters[counter], 0);
+}
+
+/**
+ * @brief Copy the spans and counters recorded so far
+ */
+void stats_get(stats_snapshot *snapshot) {
+    for (int stage = 0; stage < STATS_STAGES; stage++) {
+        snapshot->nanoseconds[stage] = atomic_load(&stage_nanoseconds[stage]);
+        snapshot->spans[stage]       = atomic_load(&stage_spans[stage]);
+    }
+    for (int counter = 0; counter < STATS_COUNTERS; counter++)
+        snapshot->counters[counter] = atomic_load(&counters[counter]);
+}
+
+/**
+ * @brief Write a snapshot as a JSON object: milliseconds and spans per stage, then the counters
+ *
+ * @return 0 on success, -1 if it could not be written
+ */
+int stats_json(FILE *out, const stats_snapshot *snapshot) {
+    fprintf(out, "{\"stages\": {");
+    for (int stage = 0; stage < STATS_STAGES; stage++) {
+        fprintf(out,
+                "%s\"%s\": {\"ms\": %.3f, \"spans\": %" PRIu64 "}",
+                stage ? ", " : "",
+                stats_stage_str[stage],
+                snapshot->nanoseconds[stage] / 1e6,
+                snapshot->spans[stage]);
+    }
+    fprintf(out, "}, \"counters\": {");
+    for (int counter = 0; counter < STATS_COUNTERS; counter++) {
+        fprintf(out,
+                "%s\"%s\": %" PRIu64,
+                counter ? ", " : "",
+                stats_counter_str[counter],
+                snapshot->counters[counter]);
+    }
+    fprintf(out, "}}\n");
+    return ferror(out) || fflush(out) != 0 ? -1 : 0;
+}
+
+/* Monotonic clock in nanoseconds */
+uint64_t stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/* Add the span started at start to a stage */
+void stats_record(stats_stage stage, uint64_t start) {
+    uint64_t elapsed = stats_clock() - start;
+    atomic_fetch_add_explicit(&stage_nanoseconds[stage], elapsed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stage_spans[stage], 1, memory_order_relaxed);
+}
+
+void stats_add(stats_counter counter, uint64_t amount) {
+    atomic_fetch_add_explicit(&counters[counter], amount, memory_order_relaxed);
+}
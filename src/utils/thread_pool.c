@@ -0,0 +1,288 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct thread_pool
+{
+    pthread_t      *workers;
+    size_t          threads;  // Workers + the thread calling thread_pool_run
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;  // New tasks or shutdown
+    pthread_cond_t  done;  // Last task of a run finished
+    thread_task     task;
+    void           *context;
+    size_t          tasks;     // Tasks of the current run, 0 when idle
+    size_t          next;      // Next task to hand out
+    size_t          finished;  // Tasks of the current run already done
+    bool            running;   // A run is in progress
+    bool            stop;
+    size_t          users;  // Runs using it as the shared pool, counted under shared_lock
+};
+
+/* Process-wide pool used by the embedding and extraction code, NULL when single threaded */
+static thread_pool    *shared_pool = NULL;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Take a reference to the shared pool, so it outlives a steg_set_threads call made from
+ * another thread while a run is in progress
+ *
+ * @return The shared pool, NULL when single threaded, give it back with release_shared
+ */
+static thread_pool *acquire_shared(void) {
+    pthread_mutex_lock(&shared_lock);
+    thread_pool *pool = shared_pool;
+    if (pool)
+        pool->users++;
+    pthread_mutex_unlock(&shared_lock);
+    return pool;
+}
+
+/* Give back a reference taken by acquire_shared, freeing the pool if it was replaced meanwhile */
+static void release_shared(thread_pool *pool) {
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&shared_lock);
+    bool retired = --pool->users == 0 && pool != shared_pool;
+    pthread_mutex_unlock(&shared_lock);
+    if (retired)
+        thread_pool_free(pool);
+}
+
+/* Run tasks of the current run until none is left, called with the lock held */
+static void work(thread_pool *pool) {
+    while (pool->next < pool->tasks) {
+        size_t task = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(task, pool->context);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->tasks)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *worker(void *arg) {
+    thread_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if (pool->next < pool->tasks)
+            work(pool);
+        else
+            pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * @brief Create a pool of threads
+ *
+ * @param threads Total number of threads working on each run, the caller of thread_pool_run
+ * included, so threads - 1 workers are started
+ *
+ * @return Pointer to the pool, NULL on failure
+ */
+thread_pool *thread_pool_create(size_t threads) {
+    thread_pool *pool = calloc(1, sizeof(thread_pool));
+    if (!pool)
+        return NULL;
+
+    pool->threads = threads ? threads : 1;
+    pool->workers = calloc(pool->threads, sizeof(pthread_t));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (size_t i = 1; i < pool->threads; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker, pool) != 0) {
+            pool->threads = i;
+            thread_pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+/**
+ * @brief Stop the workers and free the pool
+ *
+ * @param pool Pool to free, may be NULL
+ */
+void thread_pool_free(thread_pool *pool) {
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 1; i < pool->threads; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * @brief Number of threads working on each run
+ */
+size_t thread_pool_threads(const thread_pool *pool) {
+    return pool ? pool->threads : 1;
+}
+
+/**
+ * @brief Run task(0) ... task(tasks - 1) on the pool and wait for all of them
+ *
+ * The calling thread works on the tasks too. A run started while another one is in progress
+ * (from a task or from another thread) runs its tasks on the calling thread instead of waiting.
+ *
+ * @param pool Pool to run the tasks on, NULL to run them on the calling thread
+ * @param tasks Number of tasks
+ * @param task Function called once per task index
+ * @param context Passed to every call of task
+ */
+void thread_pool_run(thread_pool *pool, size_t tasks, thread_task task, void *context) {
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        if (!pool->running && tasks > 1) {
+            pool->running  = true;
+            pool->task     = task;
+            pool->context  = context;
+            pool->tasks    = tasks;
+            pool->next     = 0;
+            pool->finished = 0;
+            pthread_cond_broadcast(&pool->wake);
+
+            work(pool);
+            while (pool->finished < pool->tasks)
+                pthread_cond_wait(&pool->done, &pool->lock);
+
+            pool->tasks   = 0;
+            pool->next    = 0;
+            pool->running = false;
+            pthread_mutex_unlock(&pool->lock);
+            return;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for (size_t i = 0; i < tasks; i++)
+        task(i, context);
+}
+
+/**
+ * @brief Set the number of threads used by the embedding and extraction code
+ *
+ * Safe to call while other threads are running: runs already in progress keep the pool they
+ * started on, which is freed once the last of them is done, and later runs use the new one.
+ *
+ * @param threads Number of threads, 0 for one per online CPU, 1 to stay single threaded
+ *
+ * @return 0 on success, -1 if the threads could not be started
+ */
+int steg_set_threads(size_t threads) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads   = cpus > 0 ? (size_t) cpus : 1;
+    }
+
+    pthread_mutex_lock(&shared_lock);
+    int          result  = 0;
+    thread_pool *retired = NULL;
+    if (thread_pool_threads(shared_pool) != threads) {
+        if (shared_pool && shared_pool->users == 0)
+            retired = shared_pool;
+        shared_pool = threads > 1 ? thread_pool_create(threads) : NULL;
+        if (threads > 1 && !shared_pool) {
+            printerr("Could not start %zu threads\n", threads);
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&shared_lock);
+
+    thread_pool_free(retired);
+    return result;
+}
+
+/**
+ * @brief Number of threads used by the embedding and extraction code
+ */
+size_t steg_threads(void) {
+    pthread_mutex_lock(&shared_lock);
+    size_t threads = thread_pool_threads(shared_pool);
+    pthread_mutex_unlock(&shared_lock);
+    return threads;
+}
+
+/**
+ * @brief Run task(0) ... task(tasks - 1) on the shared pool and wait for all of them
+ *
+ * Bands started from within a task run on the thread of that task, so the threads are shared
+ * by the tasks instead of being split further.
+ */
+void parallel_tasks(size_t tasks, thread_task task, void *context) {
+    thread_pool *pool = acquire_shared();
+    thread_pool_run(pool, tasks, task, context);
+    release_shared(pool);
+}
+
+typedef struct
+{
+    size_t      total;
+    size_t      bandSize;
+    thread_band band;
+    void       *context;
+} bands_context;
+
+static void run_band(size_t task, void *context) {
+    bands_context *bands = context;
+    size_t         begin = task * bands->bandSize;
+    size_t         end   = begin + bands->bandSize < bands->total ? begin + bands->bandSize
+                                                                  : bands->total;
+    bands->band(begin, end, bands->context);
+}
+
+/**
+ * @brief Split [0, total) into one band per thread of the shared pool and process them
+ *
+ * Small ranges are not split: every band but the last one holds at least minBand units and a
+ * multiple of align units, so bands can be made to start on byte or pixel boundaries.
+ *
+ * @param total Size of the range
+ * @param minBand Smallest band worth handing to another thread
+ * @param align Every band but the last one holds a multiple of align units
+ * @param band Function called once per band
+ * @param context Passed to every call of band
+ */
+void parallel_bands(size_t total, size_t minBand, size_t align, thread_band band, void *context) {
+    thread_pool *pool    = acquire_shared();
+    size_t       threads = thread_pool_threads(pool);
+    size_t       bands   = minBand ? total / minBand : total;
+
+    if (bands > threads)
+        bands = threads;
+    if (bands <= 1) {
+        release_shared(pool);
+        band(0, total, context);
+        return;
+    }
+
+    size_t bandSize = (total + bands - 1) / bands;
+    if (align > 1)
+        bandSize = (bandSize + align - 1) / align * align;
+
+    bands_context bandsContext = {total, bandSize, band, context};
+    thread_pool_run(pool, (total + bandSize - 1) / bandSize, run_band, &bandsContext);
+    release_shared(pool);
+}